@@ -20,13 +20,16 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <linux/ctype.h>
 #include <linux/freezer.h>
+#include <linux/hash.h>
 #include <linux/irq_work.h>
 #include <linux/ipv6.h>
 #include <linux/kthread.h>
 #include <linux/tcp.h>
 #include <linux/topology.h>
 #include <linux/nodemask.h>
+#include <linux/vmalloc.h>
 
 #undef DEBUG
 #if DBG_CACHE > 0
@@ -278,6 +281,40 @@ static DEFINE_PER_CPU(char[RESP_BUF_LEN], g_c_buf);
 
 static TfwStr g_crlf = { .data = S_CRLF, .len = SLEN(S_CRLF) };
 
+/*
+ * Link headers of the last cached responses, which are used to build
+ * 103 (Early Hints) responses on cache misses. The table is direct-mapped
+ * by the cache key, so a newer resource simply evicts an older one with
+ * the same bucket. Hints are advisory, thus rare mismatches caused by
+ * the key collisions are harmless.
+ */
+#define TFW_CACHE_HINTS_BITS	12
+/* Make a bucket fit 512 bytes on production builds. */
+#define TFW_CACHE_HINTS_LEN	496
+
+/**
+ * @lock	- protects the bucket;
+ * @key		- cache key of the response the links were taken from;
+ * @len		- length of @links, zero for an empty bucket;
+ * @links	- comma separated preload links from response Link headers;
+ */
+typedef struct {
+	spinlock_t	lock;
+	unsigned long	key;
+	unsigned int	len;
+	char		links[TFW_CACHE_HINTS_LEN];
+} TfwCacheHints;
+
+/*
+ * The hints table is allocated only if "early_hints auto" is configured for
+ * any location, and it's never freed on reconfiguration, so readers just
+ * check the pointer.
+ */
+static TfwCacheHints *c_hints;
+static bool c_hints_cfg;
+/* Scratch buffer to filter Link headers out of the bucket lock. */
+static DEFINE_PER_CPU(char[TFW_CACHE_HINTS_LEN], c_hints_buf);
+
 /*
  * Iterate over request URI and Host header to process request key.
  * uri_path and host are not expected to be empty, because we check
@@ -2531,6 +2568,287 @@ tfw_cache_decrease_stat(TdbRec *rec)
 	TFW_DEC_STAT_BH(cache.objects);
 }
 
+static TfwCacheHints *
+tfw_cache_hints_bucket(unsigned long key)
+{
+	TfwCacheHints *hints = smp_load_acquire(&c_hints);
+
+	if (!hints)
+		return NULL;
+
+	return &hints[hash_long(key, TFW_CACHE_HINTS_BITS)];
+}
+
+/**
+ * Check that relation types in @p..@end contain one which lets a client
+ * start fetching or connecting before the final response is received.
+ */
+static bool
+tfw_cache_hints_rel_type(const char *p, const char *end)
+{
+	static const TfwStr rels[] = {
+		TFW_STR_STRING("preload"),
+		TFW_STR_STRING("modulepreload"),
+		TFW_STR_STRING("preconnect"),
+	};
+	const char *t;
+	int i;
+
+	while (p < end) {
+		for (t = p; p < end && !isspace(*p); ++p)
+			;
+		for (i = 0; i < ARRAY_SIZE(rels); ++i)
+			if (p - t == rels[i].len
+			    && !strncasecmp(t, rels[i].data, rels[i].len))
+				return true;
+		while (p < end && isspace(*p))
+			++p;
+	}
+
+	return false;
+}
+
+/**
+ * Check the first rel parameter of a single link-value @p..@end
+ * (RFC 8288 3): '<' URI-Reference '>' *( OWS ";" OWS link-param ).
+ */
+static bool
+tfw_cache_hints_rel(const char *p, const char *end)
+{
+	const char *n, *v, *v_end;
+
+	if (!(p = memchr(p, '>', end - p)))
+		return false;
+
+	for (++p; p < end; ) {
+		if (*p++ != ';')
+			continue;
+		while (p < end && isspace(*p))
+			++p;
+		for (n = p; p < end && *p != '=' && *p != ';' && !isspace(*p);
+		     ++p)
+			;
+		if (p - n != SLEN("rel") || strncasecmp(n, "rel", SLEN("rel")))
+			n = NULL;
+		while (p < end && isspace(*p))
+			++p;
+		if (p == end || *p != '=')
+			continue;
+		for (++p; p < end && isspace(*p); ++p)
+			;
+		if (p < end && *p == '"') {
+			for (v = ++p; p < end && *p != '"'; ++p)
+				if (*p == '\\')
+					++p;
+			v_end = p = min(p, end);
+			++p;
+		} else {
+			for (v = p; p < end && *p != ';' && !isspace(*p); ++p)
+				;
+			v_end = p;
+		}
+		/* Occurrences after the first one must be ignored. */
+		if (n)
+			return tfw_cache_hints_rel_type(v, v_end);
+	}
+
+	return false;
+}
+
+/**
+ * Finish a link-value written to @out at @vstart..@len: trim trailing
+ * whitespace and drop it with the preceding separator at @start if the
+ * link is useless as an early hint. Return the new length of @out.
+ */
+static unsigned int
+tfw_cache_hints_link_end(const char *out, unsigned int start,
+			 unsigned int vstart, unsigned int len)
+{
+	while (len > vstart && isspace(out[len - 1]))
+		--len;
+	if (len > vstart && tfw_cache_hints_rel(out + vstart, out + len))
+		return len;
+
+	return start;
+}
+
+/**
+ * Append the link-values from Link header value @val, which are useful as
+ * early hints, to @out at @len separated by comma. Return the new length
+ * of @out, or -E2BIG if the links don't fit TFW_CACHE_HINTS_LEN bytes.
+ */
+static int
+tfw_cache_hints_copy_val(const TfwStr *val, char *out, unsigned int len)
+{
+	unsigned int start = len, vstart = len;
+	bool quote = false, esc = false, uri = false;
+	const TfwStr *c, *end;
+	const char *p;
+
+	TFW_STR_FOR_EACH_CHUNK(c, val, end) {
+		for (p = c->data; p < c->data + c->len; ++p) {
+			/* Commas are allowed in URIs and quoted strings. */
+			if (*p == ',' && !quote && !uri) {
+				len = tfw_cache_hints_link_end(out, start,
+							       vstart, len);
+				start = vstart = len;
+				continue;
+			}
+			if (len == vstart) {
+				if (isspace(*p))
+					continue;
+				if (len) {
+					if (len + 2 > TFW_CACHE_HINTS_LEN)
+						return -E2BIG;
+					memcpy_fast(out + len, ", ", 2);
+					vstart = len += 2;
+				}
+			}
+			if (len == TFW_CACHE_HINTS_LEN)
+				return -E2BIG;
+			out[len++] = *p;
+
+			if (esc) {
+				esc = false;
+			} else if (quote) {
+				esc = *p == '\\';
+				quote = *p != '"';
+			} else if (*p == '"') {
+				quote = true;
+			} else if (*p == '<') {
+				uri = true;
+			} else if (*p == '>') {
+				uri = false;
+			}
+		}
+	}
+
+	return tfw_cache_hints_link_end(out, start, vstart, len);
+}
+
+/**
+ * Walk through Link headers of @resp and copy the link-values with
+ * preload, modulepreload or preconnect relation types to @out of
+ * TFW_CACHE_HINTS_LEN bytes. Other links, e.g. canonical or alternate
+ * ones, are useless before the final response and just waste bytes of
+ * 103 responses. Return the total length, or zero if there are no such
+ * links or they don't fit @out.
+ */
+static unsigned int
+tfw_cache_hints_copy(TfwHttpResp *resp, char *out)
+{
+	static const TfwStr s_link = TFW_STR_STRING("link:");
+	TfwStr *field, *end, *dup, *dup_end;
+	int len = 0;
+
+	FOR_EACH_HDR_FIELD_RAW(field, end, resp) {
+		TFW_STR_FOR_EACH_DUP(dup, field, dup_end) {
+			TfwStr name = {}, val = {};
+
+			if (tfw_stricmpspn(dup, &s_link, ':'))
+				break;
+			tfw_http_hdr_split(dup, &name, &val, true);
+			len = tfw_cache_hints_copy_val(&val, out, len);
+			if (len < 0)
+				return 0;
+		}
+	}
+
+	return len;
+}
+
+/**
+ * Remember preload links of the response stored in the cache. A response
+ * without such links, or with too long ones, clears the hints for the
+ * resource: it's better to send no hints than a part of them.
+ */
+static void
+tfw_cache_hints_update(TfwHttpResp *resp, unsigned long key)
+{
+	char *buf = *this_cpu_ptr(&c_hints_buf);
+	TfwCacheHints *h;
+	unsigned int len;
+
+	if (!(h = tfw_cache_hints_bucket(key)))
+		return;
+
+	len = tfw_cache_hints_copy(resp, buf);
+
+	spin_lock(&h->lock);
+	if (len) {
+		h->key = key;
+		h->len = len;
+		memcpy_fast(h->links, buf, len);
+	} else if (h->key == key) {
+		h->len = 0;
+	}
+	spin_unlock(&h->lock);
+}
+
+/**
+ * Get Link headers of the last cached response for @req. The links are
+ * copied to @req pool, so they stay valid after the bucket update.
+ */
+bool
+tfw_cache_get_early_hints(TfwHttpReq *req, TfwStr *links)
+{
+	unsigned long key;
+	TfwCacheHints *h;
+	char *p = NULL;
+
+	if (!READ_ONCE(c_hints))
+		return false;
+
+	key = tfw_http_req_key_calc(req);
+	h = tfw_cache_hints_bucket(key);
+
+	spin_lock(&h->lock);
+	if (h->key == key && h->len
+	    && (p = tfw_pool_alloc(req->pool, h->len)))
+	{
+		memcpy_fast(p, h->links, h->len);
+		links->data = p;
+		links->len = h->len;
+	}
+	spin_unlock(&h->lock);
+
+	return !!p;
+}
+
+/**
+ * Called on configuration parsing if any location uses Link headers of
+ * cached responses as early hints.
+ */
+void
+tfw_cache_hints_enable(void)
+{
+	c_hints_cfg = true;
+}
+
+/*
+ * Allocate the hints table if it's required by the configuration. The table
+ * may be allocated on live reconfiguration, when the cache is in use, so
+ * publish it only after initialization.
+ */
+static int
+tfw_cache_hints_init(void)
+{
+	TfwCacheHints *hints;
+	int i;
+
+	if (!c_hints_cfg || c_hints)
+		return 0;
+
+	hints = vzalloc(sizeof(TfwCacheHints) << TFW_CACHE_HINTS_BITS);
+	if (!hints)
+		return -ENOMEM;
+	for (i = 0; i < (1 << TFW_CACHE_HINTS_BITS); i++)
+		spin_lock_init(&hints[i].lock);
+	smp_store_release(&c_hints, hints);
+
+	return 0;
+}
+
 static void
 __cache_add_node(TDB *db, TfwHttpResp *resp, unsigned long key)
 {
@@ -2625,6 +2943,7 @@ tfw_cache_add(TfwHttpResp *resp, tfw_http_cache_cb_t action)
 		for_each_node_with_cpus(nid)
 			__cache_add_node(get_db_for_node(nid), resp, key);
 	}
+	tfw_cache_hints_update(resp, key);
 
 	/*
 	 * Cache population is synchronous now. Don't forget to set
@@ -2746,30 +3065,14 @@ tfw_cache_purge_method(TfwHttpReq *req)
  * Add page from cache into response.
  */
 static int
-tfw_cache_add_body_page(TfwMsgIter *it, char *p, int sz, bool h2,
-			bool last_frag)
+tfw_cache_add_body_page(TfwMsgIter *it, char *p, int sz)
 {
-	int off;
-	struct page *page;
-
-	if (h2) {
-		char *new_p;
-		if (!(page = alloc_page(GFP_ATOMIC))) {
-			return -ENOMEM;
-		}
-		new_p = page_address(page);
-		off = 0;
-		memcpy_fast(new_p, p, sz);
-	}
-	else {
-		off = ((unsigned long)p & ~PAGE_MASK);
-		page = virt_to_page(p);
-	}
+	int off = (unsigned long)p & ~PAGE_MASK;
+	struct page *page = virt_to_page(p);
 
 	++it->frag;
 	skb_fill_page_desc(it->skb, it->frag, page, off, sz);
-	if (!h2)
-		skb_frag_ref(it->skb, it->frag);
+	skb_frag_ref(it->skb, it->frag);
 	ss_skb_adjust_data_len(it->skb, sz);
 
 	return 0;
@@ -2779,44 +3082,31 @@ tfw_cache_add_body_page(TfwMsgIter *it, char *p, int sz, bool h2,
  * Build the message body as paged fragments of skb.
  * See do_tcp_sendpages() as reference.
  *
- * Different strategies are used to avoid extra data copying depending on
- * client connection type:
- * - for http connections - pages are reused in skbs and SKBTX_SHARED_FRAG is
- * set to avoid any data copies.
- * - for https connections - pages are reused in skbs and SKBTX_SHARED_FRAG is
- * set, but in-place crypto operations are not allowed, so data copy happens
- * right before data is pushed into network.
- * - for h2 connections - every response has unique frame header, so need to
- * copy on constructing response body from cache. SKBTX_SHARED_FRAG is left
- * unset to allow in-place crypto operations.
- *
- * Since we can't encrypt shared data in-place we always copy it, so we need
- * reserve some space in cached pages to avoid extra skb fragmentation. Since
- * body fragments are stored in cache by pages with at least cache record
- * header preceding, which is bigger than h2 frame header, it's always possible
- * to fit body fragment and h2 header into a single page. So there is no need
- * to actually reserve any space for h2 frame header.
+ * The cached pages are referenced by the skbs with SKBTX_SHARED_FRAG set for
+ * all the client connection types, so the body is never copied:
+ * - for http connections the pages go to the network as is;
+ * - for https connections in-place crypto operations aren't allowed on the
+ *   shared pages, so the encryption writes the ciphertext into new pages,
+ *   see ss_skb_to_sgvec_with_new_pages();
+ * - for h2 connections DATA frame headers are inserted into the body as new
+ *   fragments, see __split_pgfrag_add(), so the cached pages are never
+ *   written, and the frames are encrypted as for https.
  */
 static int
 tfw_cache_build_resp_body(TDB *db, TdbVRec *trec, TfwMsgIter *it, char *p,
-			  unsigned long body_sz, bool h2)
+			  unsigned long body_sz)
 {
 	int r;
-	bool sh_frag = h2 ? false : true;
 
 	if (WARN_ON_ONCE(!it->skb_head))
 		return -EINVAL;
 	/*
-	 * If all skbs/frags are used up (see @tfw_http_msg_expand_data()),
-	 * create new skb with empty frags to reference the cached body;
-	 * otherwise, use next empty frag in current skb.
+	 * Create new skb with empty frags to reference the cached body: the
+	 * shared fragments flag is per skb.
 	 */
-	if (!it->skb || it->frag + 1 >= MAX_SKB_FRAGS || sh_frag) {
-		if  ((r = tfw_msg_iter_append_skb(it)))
-			return r;
-		if (sh_frag)
-			skb_shinfo(it->skb)->tx_flags |= SKBTX_SHARED_FRAG;
-	}
+	if ((r = tfw_msg_iter_append_skb(it)))
+		return r;
+	skb_shinfo(it->skb)->tx_flags |= SKBTX_SHARED_FRAG;
 
 	while (1) {
 		int off, f_size;
@@ -2826,8 +3116,7 @@ tfw_cache_build_resp_body(TDB *db, TdbVRec *trec, TfwMsgIter *it, char *p,
 		if (f_size) {
 			f_size = min(body_sz, (unsigned long)f_size);
 			body_sz -= f_size;
-			r = tfw_cache_add_body_page(it, p, f_size, h2,
-						    !body_sz);
+			r = tfw_cache_add_body_page(it, p, f_size);
 			if (r)
 				return r;
 		}
@@ -2841,10 +3130,10 @@ tfw_cache_build_resp_body(TDB *db, TdbVRec *trec, TfwMsgIter *it, char *p,
 			return -EINVAL;
 		p = trec->data;
 
-		if (it->frag + 1 == MAX_SKB_FRAGS
-		    && (r = tfw_msg_iter_append_skb(it)))
-		{
-			return r;
+		if (it->frag + 1 == MAX_SKB_FRAGS) {
+			if ((r = tfw_msg_iter_append_skb(it)))
+				return r;
+			skb_shinfo(it->skb)->tx_flags |= SKBTX_SHARED_FRAG;
 		}
 	}
 
@@ -3052,8 +3341,7 @@ write_body:
 	/* Fill skb with body from cache for HTTP/2 or HTTP/1.1 response. */
 	BUG_ON(p != TDB_PTR(db->hdr, ce->body));
 	if (ce->body_len && req->method != TFW_HTTP_METH_HEAD) {
-		if (tfw_cache_build_resp_body(db, trec, it, p, ce->body_len,
-					      TFW_MSG_H2(req)))
+		if (tfw_cache_build_resp_body(db, trec, it, p, ce->body_len))
 			goto free;
 	}
 	resp->content_length = ce->body_len;
@@ -3491,10 +3779,12 @@ tfw_wq_tasklet(unsigned long data)
 {
 	TfwWorkTasklet *ct = (TfwWorkTasklet *)data;
 	TfwRBQueue *wq = &ct->wq;
-	TfwCWork cw;
+	TfwCWork cw[8];
+	int i, n;
 
-	while (!tfw_wq_pop(wq, &cw))
-		tfw_cache_do_action(cw.msg, cw.action);
+	while ((n = tfw_wq_pop_batch(wq, cw, ARRAY_SIZE(cw), NULL)))
+		for (i = 0; i < n; ++i)
+			tfw_cache_do_action(cw[i].msg, cw[i].action);
 
 	TFW_WQ_IPI_SYNC(tfw_wq_size, wq);
 
@@ -3553,6 +3843,14 @@ tfw_cache_wq_clear(int cpu)
 	tfw_wq_destroy(&ct->wq);
 }
 
+static int
+tfw_cache_cfgstart(void)
+{
+	c_hints_cfg = false;
+
+	return 0;
+}
+
 static int
 tfw_cache_start(void)
 {
@@ -3561,10 +3859,10 @@ tfw_cache_start(void)
 	if (WARN_ON_ONCE(cache_cfg.cache == TFW_CACHE_UNDEFINED))
 		return -EINVAL;
 
-	if (tfw_runstate_is_reconfig())
-		return 0;
 	if (!cache_cfg.cache)
 		return 0;
+	if (tfw_runstate_is_reconfig())
+		return tfw_cache_hints_init();
 
 	if ((r = tfw_init_node_cpus()))
 		goto node_cpus_alloc_err;
@@ -3578,6 +3876,10 @@ tfw_cache_start(void)
 		}
 		c_nodes[i].db->hdr->before_free = tfw_cache_decrease_stat;
 	}
+
+	if ((r = tfw_cache_hints_init()))
+		goto close_db;
+
 #if 0
 	cache_mgr_thr = kthread_run(tfw_cache_mgr, NULL, "tfw_cache_mgr");
 	if (IS_ERR(cache_mgr_thr)) {
@@ -3619,6 +3921,8 @@ free_tasklet:
 	for_each_online_cpu(i)
 		tfw_cache_wq_clear(i);
 close_db:
+	vfree(c_hints);
+	c_hints = NULL;
 	for_each_node_with_cpus(i)
 		tdb_close(c_nodes[i].db);
 
@@ -3650,6 +3954,8 @@ tfw_cache_stop(void)
 		kfree(per_cpu(ce_dbg_buf, i));
 #endif
 
+	vfree(c_hints);
+	c_hints = NULL;
 	for_each_node_with_cpus(i)
 		tdb_close(c_nodes[i].db);
 
@@ -3805,6 +4111,7 @@ static TfwCfgSpec tfw_cache_specs[] = {
 
 TfwMod tfw_cache_mod = {
 	.name 	= "cache",
+	.cfgstart = tfw_cache_cfgstart,
 	.start	= tfw_cache_start,
 	.stop	= tfw_cache_stop,
 	.specs	= tfw_cache_specs,
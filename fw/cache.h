@@ -27,6 +27,8 @@ int tfw_cache_process(TfwHttpMsg *msg, tfw_http_cache_cb_t action);
 bool tfw_cache_is_enabled_or_not_configured(void);
 TfwHttpResp *tfw_cache_build_resp_stale(TfwHttpReq *req);
 void tfw_cache_put_entry(int node, void *ce);
+bool tfw_cache_get_early_hints(TfwHttpReq *req, TfwStr *links);
+void tfw_cache_hints_enable(void);
 
 extern unsigned int cache_default_ttl;
 
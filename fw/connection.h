@@ -139,6 +139,10 @@ typedef struct tfw_conn_t {
  * as by threads that process responses. In the latter case that may
  * not lead to sending a response. Thus a separate @ret_qlock is used
  * for sending responses to decrease the time @seq_qlock is taken for.
+ * Only one thread, the owner elected with @ret_cnt, sends responses for
+ * a client connection at any given moment. Other threads only mark their
+ * responses as ready and leave the sending to the owner, so they never
+ * spin on @ret_qlock.
  *
  * Unless serviced from cache, each request is forwarded to a server
  * over specific server connection. It's put on server connection's
@@ -167,6 +171,9 @@ typedef struct tfw_conn_t {
  * @seq_queue	- queue of client's messages in the order they came;
  * @seq_qlock	- lock for accessing @seq_queue;
  * @ret_qlock	- lock for serializing sets of responses;
+ * @ret_cnt	- number of ready responses which the sending owner must
+ *		  take care of, the owner is the thread which increments it
+ *		  from zero;
  * @timer_lock	- lock for serializing of deleting/modifing keep-alive timer;
  * @js_histoty	- history of client js challenge misses. High 48 bits are
  *		  timestamp, low 16 bits are count of misses;
@@ -177,6 +184,7 @@ typedef struct {
 	struct list_head	seq_queue;
 	spinlock_t		seq_qlock;
 	spinlock_t		ret_qlock;
+	atomic_t		ret_cnt;
 	spinlock_t		timer_lock;
 	u64			js_histoty[FRANG_FREQ];
 } TfwCliConn;
@@ -268,10 +276,15 @@ enum {
 
 /**
  * TLS hardened connection.
+ *
+ * @drs_sent	- application data bytes sent in small TLS records since the
+ *		  connection start or the last idle period, see
+ *		  tfw_tls_encrypt();
  */
 typedef struct {
 	TfwCliConn	cli_conn;
 	TlsCtx		tls;
+	unsigned int	drs_sent;
 } TfwTlsConn;
 
 #define tfw_tls_context(conn)	((TlsCtx *)(&((TfwTlsConn *)conn)->tls))
@@ -156,6 +156,7 @@ bool allow_empty_body_content_type;
 #define S_HTTPS			"https://"
 
 #define S_100			"HTTP/1.1 100 Continue"
+#define S_103			"HTTP/1.1 103 Early Hints"
 #define S_200			"HTTP/1.1 200 OK"
 #define S_301			"HTTP/1.1 301 Moved Permanently"
 #define S_302			"HTTP/1.1 302 Found"
@@ -183,6 +184,7 @@ bool allow_empty_body_content_type;
 #define S_F_ETAG		"etag: "
 #define S_F_RETRY_AFTER		"retry-after: "
 #define S_F_SERVER		"server: "
+#define S_F_LINK		"link: "
 
 
 #define S_V_DATE		"Sun, 06 Nov 1994 08:49:37 GMT"
@@ -1294,11 +1296,9 @@ tfw_h1_send_err_resp(TfwHttpReq *req, int status)
  *
  * However, at this time requests may always be re-sent in case of
  * a connection failure. There's no option to prohibit re-sending.
- * Thus, request's SKB can't be passed to the network layer until
- * certain changes are implemented. For now there's no choice but
- * make a copy of request's SKBs in SS layer.
- *
- * TODO: Making a copy of each SKB _IS BAD_. See issues #391 and #488.
+ * Thus, request's SKBs are kept and SS layer passes to the network layer
+ * their twins referencing the same pages, see ss_skb_share(). The data
+ * is copied only if it lives in kmalloc()'ed skb heads (issues #391, #488).
  */
 static inline void
 tfw_http_req_init_ss_flags(TfwSrvConn *srv_conn, TfwHttpReq *req)
@@ -4484,19 +4484,80 @@ __tfw_http_ws_connection_put(TfwCliConn *cli_conn)
 }
 
 /*
- * Mark @resp as ready to transmit. Then, starting with the first request
- * in @seq_queue, pick consecutive requests that have response ready to
- * transmit. Move those requests to the list of returned responses
- * @ret_queue. Sequentially send responses from @ret_queue to the client.
+ * Starting with the first request in @seq_queue, pick consecutive requests
+ * that have response ready to transmit. Move those requests to the list of
+ * returned responses @ret_queue. Sequentially send responses from
+ * @ret_queue to the client.
+ *
+ * Called by the sending owner of the client connection only, see
+ * tfw_http_resp_fwd(), so @ret_qlock is contended only by the rare
+ * out-of-order senders like 103 Early Hints.
+ */
+static void
+tfw_http_resp_fwd_ready(TfwCliConn *cli_conn)
+{
+	TfwHttpReq *req, *tmp;
+	struct list_head *seq_queue = &cli_conn->seq_queue;
+	struct list_head *req_retent = NULL;
+	LIST_HEAD(ret_queue);
+
+	spin_lock_bh(&cli_conn->seq_qlock);
+	list_for_each_entry(req, seq_queue, msg.seq_list) {
+		if (!req->resp
+		    || !test_bit(TFW_HTTP_B_RESP_READY, req->resp->flags))
+		{
+			break;
+		}
+		req_retent = &req->msg.seq_list;
+	}
+	if (!req_retent) {
+		spin_unlock_bh(&cli_conn->seq_qlock);
+		return;
+	}
+	__list_cut_position(&ret_queue, seq_queue, req_retent);
+
+	spin_lock_bh(&cli_conn->ret_qlock);
+	spin_unlock_bh(&cli_conn->seq_qlock);
+
+	__tfw_http_resp_fwd(cli_conn, &ret_queue);
+
+	/* Zap request/responses that were not sent due to an error. */
+	list_for_each_entry_safe(req, tmp, &ret_queue, msg.seq_list) {
+		T_DBG2("%s: Forwarding error: conn=[%p] resp=[%p]\n",
+		       __func__, cli_conn, req->resp);
+		BUG_ON(!req->resp);
+		list_del_init(&req->msg.seq_list);
+		if (!test_bit(TFW_HTTP_B_CONTINUE_RESP, req->resp->flags))
+			tfw_http_resp_pair_free(req);
+		else
+			tfw_http_msg_free(req->pair);
+		TFW_INC_STAT_BH(serv.msgs_otherr);
+	}
+
+	spin_unlock_bh(&cli_conn->ret_qlock);
+}
+
+/*
+ * Mark @resp as ready to transmit and send all the ready responses in
+ * the order of requests.
+ *
+ * The function may be called concurrently on different CPUs, all going
+ * for the same client connection, e.g. when responses to pipelined
+ * requests come from different servers. Instead of competing for the
+ * sending lock, only one thread becomes the owner of the connection
+ * sending: the one which increments @ret_cnt from zero. Other threads
+ * just mark their responses as ready, account them in @ret_cnt and
+ * leave. The owner keeps sending the in-order prefix of @seq_queue until
+ * it consumes all the accounted responses, so a response marked ready
+ * after the owner scanned @seq_queue is never lost: the owner observes
+ * the increased @ret_cnt and retries the scan.
  */
 void
 tfw_http_resp_fwd(TfwHttpResp *resp)
 {
 	TfwHttpReq *req = resp->req;
 	TfwCliConn *cli_conn = (TfwCliConn *)req->conn;
-	struct list_head *seq_queue = &cli_conn->seq_queue;
-	struct list_head *req_retent = NULL;
-	LIST_HEAD(ret_queue);
+	int n;
 
 	T_DBG2("%s: req=[%p], resp=[%p]\n", __func__, req, resp);
 	WARN_ON_ONCE(req->resp != resp);
@@ -4511,9 +4572,12 @@ tfw_http_resp_fwd(TfwHttpResp *resp)
 	 * Doing ss_close() on client connection's socket is safe
 	 * as long as @req that holds a reference to the connection is
 	 * not freed.
+	 *
+	 * The response is marked as ready under the lock to synchronize
+	 * with tfw_http_conn_cli_drop(), which frees ready responses.
 	 */
 	spin_lock_bh(&cli_conn->seq_qlock);
-	if (unlikely(list_empty(seq_queue))) {
+	if (unlikely(list_empty(&cli_conn->seq_queue))) {
 		BUG_ON(!list_empty(&req->msg.seq_list));
 		spin_unlock_bh(&cli_conn->seq_qlock);
 		T_DBG2("%s: The client was disconnected, drop resp and req: "
@@ -4531,73 +4595,24 @@ tfw_http_resp_fwd(TfwHttpResp *resp)
 	}
 	BUG_ON(list_empty(&req->msg.seq_list));
 	set_bit(TFW_HTTP_B_RESP_READY, resp->flags);
-	/* Move consecutive requests with @req->resp to @ret_queue. */
-	list_for_each_entry(req, seq_queue, msg.seq_list) {
-		if (!req->resp
-		    || !test_bit(TFW_HTTP_B_RESP_READY, req->resp->flags))
-		{
-			break;
-		}
-		req_retent = &req->msg.seq_list;
-	}
-	if (!req_retent) {
-		spin_unlock_bh(&cli_conn->seq_qlock);
-		return;
-	}
-	__list_cut_position(&ret_queue, seq_queue, req_retent);
-
 	/*
-	 * The function may be called concurrently on different CPUs,
-	 * all going for the same client connection. In some threads
-	 * a response is paired with a request, but the first response
-	 * in the queue is not ready yet, so it can't be sent out. When
-	 * there're responses to send, sending must be in correct order
-	 * which is controlled by the lock. To avoid delays in progress
-	 * of other threads during responses sending, unlock the seq_queue
-	 * lock and use different lock @ret_qlock for sending.
-	 *
-	 * A client may close the connection at any time. A connection
-	 * is destroyed when the last reference goes, so the argument
-	 * to spin_unlock() may get invalid. Hold the connection until
-	 * sending is done.
-	 *
-	 * TODO: There's a lock contention here as multiple threads/CPUs
-	 * go for the same client connection's queue. Perhaps there's a
-	 * better way of doing this that is more effective. Please see
-	 * the TODO comment above and to the function tfw_http_popreq().
-	 * Also, please see the issue #687.
-	 *
-	 * TODO #687: this is the only place where req_qlock is used. Instead
-	 * of competing for the lock from different softirqs, just process
-	 * the next available response, set a flag for current softirq
-	 * processing ret_queue and make the current softirq retry from
-	 * determination of req_retent.
+	 * A client may close the connection at any time and the request
+	 * may be freed by the owner or on the connection drop as soon as
+	 * we release the lock. Hold the connection while we use it.
 	 */
-	tfw_connection_get((TfwConn *)(cli_conn));
-	spin_lock_bh(&cli_conn->ret_qlock);
+	tfw_connection_get((TfwConn *)cli_conn);
 	spin_unlock_bh(&cli_conn->seq_qlock);
 
-	__tfw_http_resp_fwd(cli_conn, &ret_queue);
-
-	/* Zap request/responses that were not sent due to an error. */
-	if (!list_empty(&ret_queue)) {
-		TfwHttpReq *tmp;
-		list_for_each_entry_safe(req, tmp, &ret_queue, msg.seq_list) {
-			T_DBG2("%s: Forwarding error: conn=[%p] resp=[%p]\n",
-			       __func__, cli_conn, req->resp);
-			BUG_ON(!req->resp);
-			list_del_init(&req->msg.seq_list);
-			if (!test_bit(TFW_HTTP_B_CONTINUE_RESP,
-				     req->resp->flags))
-				tfw_http_resp_pair_free(req);
-			else
-				tfw_http_msg_free(req->pair);
-			TFW_INC_STAT_BH(serv.msgs_otherr);
-		}
-	}
+	/* The owner is sending now and will send our response as well. */
+	if (atomic_inc_return(&cli_conn->ret_cnt) > 1)
+		goto out;
 
-	spin_unlock_bh(&cli_conn->ret_qlock);
-	tfw_connection_put((TfwConn *)(cli_conn));
+	do {
+		n = atomic_read(&cli_conn->ret_cnt);
+		tfw_http_resp_fwd_ready(cli_conn);
+	} while (atomic_sub_return(n, &cli_conn->ret_cnt));
+out:
+	tfw_connection_put((TfwConn *)cli_conn);
 }
 
 int
@@ -5727,6 +5742,101 @@ tfw_h2_resp_adjust_fwd(TfwHttpResp *resp)
 	}
 }
 
+/*
+ * Send 103 (Early Hints) response to HTTP/1.1 client. Unlike HTTP/2, there
+ * are no streams, so the interim response can be sent only if it doesn't
+ * break the order of responses: the request must be the first one in
+ * @seq_queue, i.e. all the responses for the previous requests are already
+ * sent or are being sent under @ret_qlock.
+ */
+static void
+tfw_h1_send_early_hints(TfwHttpReq *req, const TfwStr *links)
+{
+	int r;
+	TfwMsgIter it;
+	TfwMsg msg = {};
+	TfwHttpReq *head;
+	TfwCliConn *cli_conn = (TfwCliConn *)req->conn;
+	TfwStr data = {
+		.chunks = (TfwStr []){
+			{ .data = S_103 S_CRLF S_F_LINK,
+			  .len = SLEN(S_103 S_CRLF S_F_LINK) },
+			{ .data = links->data, .len = links->len },
+			{ .data = S_CRLFCRLF, .len = SLEN(S_CRLFCRLF) }
+		},
+		.len = SLEN(S_103 S_CRLF S_F_LINK) + links->len
+		       + SLEN(S_CRLFCRLF),
+		.nchunks = 3
+	};
+
+	/* RFC 9110 15.2: 1xx responses can't be sent to HTTP/1.0 clients. */
+	if (req->version != TFW_HTTP_VER_11)
+		return;
+
+	msg.len = data.len;
+	if (tfw_msg_iter_setup(&it, &msg.skb_head, msg.len, 0)
+	    || tfw_msg_write(&it, &data))
+		goto err;
+
+	spin_lock_bh(&cli_conn->seq_qlock);
+	head = list_first_entry_or_null(&cli_conn->seq_queue, TfwHttpReq,
+					msg.seq_list);
+	if (head != req || req->resp) {
+		spin_unlock_bh(&cli_conn->seq_qlock);
+		goto err;
+	}
+	tfw_connection_get((TfwConn *)cli_conn);
+	spin_lock_bh(&cli_conn->ret_qlock);
+	spin_unlock_bh(&cli_conn->seq_qlock);
+
+	r = tfw_cli_conn_send(cli_conn, &msg);
+
+	spin_unlock_bh(&cli_conn->ret_qlock);
+	tfw_connection_put((TfwConn *)cli_conn);
+	if (!r)
+		return;
+err:
+	ss_skb_queue_purge(&msg.skb_head);
+}
+
+/*
+ * Send 103 (Early Hints) response for the request missed in the cache, so
+ * the client can start fetching the linked resources during the request
+ * forwarding to the upstream. The links are taken from the location
+ * configuration or, if the location allows that, from the last cached
+ * response for the resource. The hints are advisory, so all the errors
+ * are silently ignored.
+ */
+static void
+tfw_http_send_early_hints(TfwHttpReq *req)
+{
+	unsigned int id;
+	TfwEarlyHints *eh;
+	TfwStr links = {};
+
+	if (req->method != TFW_HTTP_METH_GET || !req->vhost)
+		return;
+	if (!(eh = tfw_vhost_get_early_hints(req->location, req->vhost)))
+		return;
+	if (!eh->auto_hints || !tfw_cache_get_early_hints(req, &links)) {
+		if (!eh->len)
+			return;
+		links.data = eh->links;
+		links.len = eh->len;
+	}
+
+	if (!TFW_MSG_H2(req)) {
+		tfw_h1_send_early_hints(req, &links);
+		return;
+	}
+
+	if (!(id = tfw_h2_req_stream_id(req)))
+		return;
+	if (tfw_h2_send_early_hints(tfw_h2_context_unsafe(req->conn), id,
+				    &links))
+		T_DBG("Cannot send early hints for stream %u\n", id);
+}
+
 /**
  * Depending on results of processing of a request, either send the request
  * to an appropriate server, or return the cached response. If none of that
@@ -5780,6 +5890,8 @@ tfw_http_req_cache_cb(TfwHttpMsg *msg)
 	/* Account current request in APM health monitoring statistics */
 	tfw_http_hm_srv_update((TfwServer *)srv_conn->peer, req);
 
+	tfw_http_send_early_hints(req);
+
 	/* Forward request to the server. */
 	tfw_http_req_fwd_resched(srv_conn, req, &eq);
 	tfw_http_req_zap_error(&eq);
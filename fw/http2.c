@@ -41,10 +41,11 @@ static void
 tfw_h2_apply_wnd_sz_change(TfwH2Ctx *ctx, long int delta)
 {
 	TfwH2Conn *conn = container_of(ctx, TfwH2Conn, h2);
-	TfwStream *stream, *next;
+	TfwStream *stream;
+	unsigned int i;
 
 	/*
-	 * Order is no matter, use default funtion from the Linux kernel.
+	 * Order is no matter, just walk over the streams storage.
 	 * According to RFC 9113 6.9.2
 	 * When the value of SETTINGS_INITIAL_WINDOW_SIZE changes, a receiver
 	 * MUST adjust the size of all stream flow-control windows that it
@@ -52,8 +53,7 @@ tfw_h2_apply_wnd_sz_change(TfwH2Ctx *ctx, long int delta)
 	 * A change to SETTINGS_INITIAL_WINDOW_SIZE can cause the available
 	 * space in a flow-control window to become negative.
 	 */
-	rbtree_postorder_for_each_entry_safe(stream, next,
-					     &ctx->sched.streams, node) {
+	tfw_h2_stream_map_for_each(&ctx->sched.streams, stream, i) {
 		TfwStreamState state = tfw_h2_get_stream_state(stream);
 		if (state == HTTP2_STREAM_OPENED ||
 		    state == HTTP2_STREAM_REM_HALF_CLOSED) {
@@ -243,6 +243,7 @@ void
 tfw_h2_context_clear(TfwH2Ctx *ctx)
 {
 	WARN_ON_ONCE(ctx->streams_num);
+	tfw_h2_stream_map_free(&ctx->sched.streams);
 	/*
 	 * Free POSTPONED SKBs. This is necessary when h2 context has
 	 * postponed frames and connection closing initiated.
@@ -294,7 +295,8 @@ tfw_h2_remove_idle_streams(TfwH2Ctx *ctx, unsigned int id)
 void
 tfw_h2_conn_streams_cleanup(TfwH2Ctx *ctx)
 {
-	TfwStream *cur, *next;
+	TfwStream *cur;
+	unsigned int i;
 	TfwH2Conn *conn = container_of(ctx, TfwH2Conn, h2);
 	TfwStreamSched *sched = &ctx->sched;
 
@@ -304,19 +306,19 @@ tfw_h2_conn_streams_cleanup(TfwH2Ctx *ctx)
 
 	tfw_h2_remove_idle_streams(ctx, UINT_MAX);
 
-        rbtree_postorder_for_each_entry_safe(cur, next, &sched->streams, node) {
+	tfw_h2_stream_map_for_each(&sched->streams, cur, i) {
 		tfw_h2_stream_purge_all_and_free_response(cur);
 		tfw_h2_stream_unlink_lock(ctx, cur);
 
-		/* The streams tree is about to be destroyed and
-		 * we don't want to trigger rebalancing.
+		/* The streams storage is about to be destroyed, so we
+		 * don't remove the streams from it one by one.
 		 * No further actions regarding streams dependencies/prio
 		 * is required at this stage.
 		 */
 		tfw_h2_delete_stream(cur);
 		--ctx->streams_num;
 	}
-	sched->streams = RB_ROOT;
+	tfw_h2_stream_map_free(&sched->streams);
 }
 
 void
@@ -352,20 +354,48 @@ tfw_h2_current_stream_send_rst(TfwH2Ctx *ctx, int err_code)
 	return tfw_h2_send_rst_stream(ctx, stream_id, err_code);
 }
 
+/*
+ * Fully closed stream without any pending data can be freed right away,
+ * its ID is enough to process frames, which the peer may still send for it.
+ */
+static inline bool
+tfw_h2_closed_stream_can_free(TfwH2Ctx *ctx, TfwStream *stream)
+{
+	return tfw_h2_stream_is_closed(stream) && stream != ctx->error
+		&& !stream->xmit.skb_head && !stream->xmit.resp;
+}
+
 /*
  * Clean the queue of closed streams if its size has exceeded a certain
- * value.
+ * value. Fully closed streams are freed regardless of the queue size, IDs
+ * of all the freed streams are kept in @ctx->closed_ids.
  */
 void
 tfw_h2_closed_streams_shrink(TfwH2Ctx *ctx)
 {
-	TfwStream *cur;
+	TfwStream *cur, *tmp;
 	unsigned int max_streams = ctx->lsettings.max_streams;
 	TfwStreamQueue *closed_streams = &ctx->closed_streams;
+	LIST_HEAD(freed);
 
 	T_DBG3("%s: ctx [%p] closed streams num %lu\n", __func__, ctx,
 	       closed_streams->num);
 
+	spin_lock(&ctx->lock);
+	list_for_each_entry_safe(cur, tmp, &closed_streams->list, hcl_node) {
+		if (!tfw_h2_closed_stream_can_free(ctx, cur))
+			continue;
+		tfw_h2_stream_unlink_nolock(ctx, cur);
+		list_add_tail(&cur->hcl_node, &freed);
+	}
+	spin_unlock(&ctx->lock);
+
+	list_for_each_entry_safe(cur, tmp, &freed, hcl_node) {
+		list_del_init(&cur->hcl_node);
+		tfw_h2_stream_id_add_closed(&ctx->closed_ids, cur->id);
+		tfw_h2_stream_clean(ctx, cur);
+	}
+
 	while (1) {
 		spin_lock(&ctx->lock);
 
@@ -385,6 +415,7 @@ tfw_h2_closed_streams_shrink(TfwH2Ctx *ctx)
 
 		T_DBG3("%s: ctx [%p] cur stream [%p]\n", __func__, ctx, cur);
 
+		tfw_h2_stream_id_add_closed(&ctx->closed_ids, cur->id);
 		tfw_h2_stream_clean(ctx, cur);
 	}
 }
@@ -62,6 +62,7 @@ typedef struct {
  *                        HTTP2_STREAM_REM_CLOSED state), which are waiting
  *                        for removal;
  * @idle_streams        - queue of idle streams (in HTTP2_STREAM_IDLE) state;
+ * @closed_ids          - IDs of closed streams, which are already freed;
  * @loc_wnd             - connection's current flow controlled window;
  * @rem_wnd             - remote peer current flow controlled window;
  * @hpack               - HPACK context, used in processing of
@@ -116,6 +117,7 @@ typedef struct tfw_h2_ctx_t {
         TfwStreamSched  sched;
         TfwStreamQueue  closed_streams;
         TfwStreamQueue  idle_streams;
+        TfwStreamIdRanges closed_ids;
         long int        loc_wnd;
         long int        rem_wnd;
         TfwHPack        hpack;
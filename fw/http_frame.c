@@ -259,10 +259,43 @@ tfw_h2_on_send_dflt(void *conn, struct sk_buff **skb_head)
 	return 0;
 }
 
+/*
+ * 103 (Early Hints) response is advisory, so drop it if it can't be sent
+ * right before the final response: the stream is already closed or its
+ * final response is being sent. Also drop the hints if the dynamic table
+ * size update is pending - it must be placed at the beginning of the next
+ * header block (RFC 7541 4.2), which will be the final response one.
+ */
+static int
+tfw_h2_on_send_early_hints(void *conn, struct sk_buff **skb_head)
+{
+	TfwH2Ctx *ctx = tfw_h2_context_unsafe((TfwConn *)conn);
+	unsigned int stream_id = TFW_SKB_CB(*skb_head)->stream_id;
+	TfwStreamState state;
+	TfwStream *stream;
+
+	stream = tfw_h2_find_not_closed_stream(ctx, stream_id, false);
+	if (!stream || stream->xmit.resp || stream->xmit.skb_head
+	    || ctx->hpack.enc_tbl.wnd_changed)
+		return -EPIPE;
+	state = tfw_h2_get_stream_state(stream);
+	if (state != HTTP2_STREAM_OPENED
+	    && state != HTTP2_STREAM_REM_HALF_CLOSED)
+		return -EPIPE;
+
+	if (ctx->cur_send_headers) {
+		ss_skb_queue_splice(&ctx->cur_send_headers->xmit.postponed,
+				    skb_head);
+	}
+
+	return 0;
+}
+
 /**
  * Prepare and send HTTP/2 frame to the client; @hdr must contain
  * the valid data to fill in the frame's header; @data may carry
- * additional data as frame's payload.
+ * additional data as frame's payload. @on_send overrides the default
+ * callback for the frame type if it's not NULL.
  *
  * NOTE: Caller must leave first chunk of @data unoccupied - to
  * provide the place for frame's header which will be packed and
@@ -270,7 +303,7 @@ tfw_h2_on_send_dflt(void *conn, struct sk_buff **skb_head)
  */
 static int
 __tfw_h2_send_frame(TfwH2Ctx *ctx, TfwFrameHdr *hdr, TfwStr *data,
-		    TfwCloseType type)
+		    TfwCloseType type, on_send_cb_t on_send)
 {
 	int r;
 	TfwMsgIter it;
@@ -308,7 +341,10 @@ __tfw_h2_send_frame(TfwH2Ctx *ctx, TfwFrameHdr *hdr, TfwStr *data,
 		break;
 	}
 
-	if (hdr->type == HTTP2_GOAWAY) {
+	if (on_send) {
+		TFW_SKB_CB(msg.skb_head)->on_send = on_send;
+		TFW_SKB_CB(msg.skb_head)->stream_id = hdr->stream_id;
+	} else if (hdr->type == HTTP2_GOAWAY) {
 		TFW_SKB_CB(msg.skb_head)->on_send = tfw_h2_on_send_goaway;
 	} else if (hdr->type == HTTP2_RST_STREAM) {
 		TFW_SKB_CB(msg.skb_head)->on_send = tfw_h2_on_send_rst_stream;
@@ -343,19 +379,19 @@ err:
 static inline int
 tfw_h2_send_frame(TfwH2Ctx *ctx, TfwFrameHdr *hdr, TfwStr *data)
 {
-	return __tfw_h2_send_frame(ctx, hdr, data, 0);
+	return __tfw_h2_send_frame(ctx, hdr, data, 0, NULL);
 }
 
 static inline int
 tfw_h2_send_frame_shutdown(TfwH2Ctx *ctx, TfwFrameHdr *hdr, TfwStr *data)
 {
-	return __tfw_h2_send_frame(ctx, hdr, data, TFW_FRAME_SHUTDOWN);
+	return __tfw_h2_send_frame(ctx, hdr, data, TFW_FRAME_SHUTDOWN, NULL);
 }
 
 static inline int
 tfw_h2_send_frame_close(TfwH2Ctx *ctx, TfwFrameHdr *hdr, TfwStr *data)
 {
-	return __tfw_h2_send_frame(ctx, hdr, data, TFW_FRAME_CLOSE);
+	return __tfw_h2_send_frame(ctx, hdr, data, TFW_FRAME_CLOSE, NULL);
 }
 
 static inline int
@@ -541,6 +577,50 @@ tfw_h2_send_rst_stream(TfwH2Ctx *ctx, unsigned int id, TfwH2Err err_code)
 	return tfw_h2_send_frame(ctx, &hdr, &data);
 }
 
+/**
+ * Send 103 (Early Hints) response with the only Link header containing
+ * @links on the stream @id. Only HEADERS frame without END_STREAM flag is
+ * sent, the final response follows it on the same stream. The header block
+ * doesn't touch the HPACK dynamic table: the ':status' and 'link' headers
+ * are encoded as literals without indexing with statically indexed names
+ * (RFC 7541 6.2.2).
+ */
+int
+tfw_h2_send_early_hints(TfwH2Ctx *ctx, unsigned int id, const TfwStr *links)
+{
+	static const char s_status[] = "\x08\x03" "103";
+	static const char s_link[] = "\x0f\x1e";
+	TfwHPackInt vlen;
+	TfwStr data = {
+		.chunks = (TfwStr []){
+			{},
+			{ .data = (char *)s_status, .len = SLEN(s_status) },
+			{ .data = (char *)s_link, .len = SLEN(s_link) },
+			{ .data = vlen.buf },
+			{ .data = links->data, .len = links->len }
+		},
+		.nchunks = 5
+	};
+	TfwFrameHdr hdr = {
+		.stream_id = id,
+		.type = HTTP2_HEADERS,
+		.flags = HTTP2_F_END_HEADERS
+	};
+
+	if (WARN_ON_ONCE(!TFW_STR_PLAIN(links)))
+		return -EINVAL;
+
+	write_int(links->len, 0x7F, 0, &vlen);
+	__TFW_STR_CH(&data, 3)->len = vlen.sz;
+	data.len = SLEN(s_status) + SLEN(s_link) + vlen.sz + links->len;
+	if (data.len > ctx->rsettings.max_frame_sz)
+		return -E2BIG;
+	hdr.length = data.len;
+
+	return __tfw_h2_send_frame(ctx, &hdr, &data, 0,
+				   tfw_h2_on_send_early_hints);
+}
+
 static inline void
 tfw_h2_conn_terminate(TfwH2Ctx *ctx, TfwH2Err err_code)
 {
@@ -873,19 +953,29 @@ tfw_h2_first_settings_verify(TfwH2Ctx *ctx)
 	return 0;
 }
 
-static inline int
+/*
+ * Verify ID of a new stream and return the HTTP/2 error code for the
+ * connection termination if the ID is invalid.
+ */
+static inline TfwH2Err
 tfw_h2_current_stream_id_verify(TfwH2Ctx *ctx)
 {
 	TfwFrameHdr *hdr = &ctx->hdr;
 
 	if (ctx->cur_stream)
-		return 0;
+		return HTTP2_ECODE_NO_ERROR;
 	/*
 	 * If stream ID is not greater than last processed ID, there may be
 	 * two reasons for that:
-	 * 1. Stream has been created, processed, closed and removed by now;
+	 * 1. Stream has been created, processed, closed and removed by now,
+	 *    so its ID is in @ctx->closed_ids. Receiving a frame after the
+	 *    stream was closed is a connection error of type STREAM_CLOSED
+	 *    (RFC 9113 section 5.1);
 	 * 2. Stream was never created and has been moved from idle to closed
-	 *    without processing (see RFC 7540 section 5.1.1 for details).
+	 *    without processing (see RFC 9113 section 5.1.1 for details), so
+	 *    the ID is unexpected and this is a PROTOCOL_ERROR. Skipped IDs
+	 *    merged into a range of closed IDs get the first, more lenient,
+	 *    error code.
 	 *
 	 * NOTE: in cases of sending RST_STREAM frame or END_STREAM flag, stream
 	 * can be switched into special closed states: HTTP2_STREAM_LOC_CLOSED
@@ -900,10 +990,16 @@ tfw_h2_current_stream_id_verify(TfwH2Ctx *ctx)
 	 * queue @TfwStreamQueue.
 	 */
 	if (ctx->lstream_id >= hdr->stream_id) {
-		T_DBG("Invalid ID of new stream: %u stream is"
-		      " closed and removed, %u last initiated\n",
-		      hdr->stream_id, ctx->lstream_id);
-		return -EINVAL;
+		if (tfw_h2_stream_id_is_closed(&ctx->closed_ids,
+					       hdr->stream_id))
+		{
+			T_DBG("Invalid ID of new stream: %u stream is closed"
+			      " and removed\n", hdr->stream_id);
+			return HTTP2_ECODE_CLOSED;
+		}
+		T_DBG("Invalid ID of new stream: %u stream was skipped, %u"
+		      " last initiated\n", hdr->stream_id, ctx->lstream_id);
+		return HTTP2_ECODE_PROTO;
 	}
 	/*
 	 * Streams initiated by client must use odd-numbered
@@ -912,10 +1008,10 @@ tfw_h2_current_stream_id_verify(TfwH2Ctx *ctx)
 	if (!(hdr->stream_id & 0x1)) {
 		T_DBG("Invalid ID of new stream: initiated by"
 		      " server\n");
-		return -EINVAL;
+		return HTTP2_ECODE_PROTO;
 	}
 
-	return 0;
+	return HTTP2_ECODE_NO_ERROR;
 }
 
 static inline int
@@ -1097,10 +1193,8 @@ do {									\
 		ctx->cur_stream =
 			tfw_h2_find_not_closed_stream(ctx, hdr->stream_id,
 						      true);
-		if (tfw_h2_current_stream_id_verify(ctx)) {
-			err_code = HTTP2_ECODE_PROTO;
+		if ((err_code = tfw_h2_current_stream_id_verify(ctx)))
 			goto conn_term;
-		}
 
 		tfw_h2_remove_idle_streams(ctx, hdr->stream_id);
 
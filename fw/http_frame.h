@@ -158,6 +158,8 @@ typedef struct tfw_conn_t TfwConn;
 int tfw_h2_frame_process(TfwConn *c, struct sk_buff *skb,
 			 struct sk_buff **next);
 int tfw_h2_send_rst_stream(TfwH2Ctx *ctx, unsigned int id, TfwH2Err err_code);
+int tfw_h2_send_early_hints(TfwH2Ctx *ctx, unsigned int id,
+			    const TfwStr *links);
 int tfw_h2_send_goaway(TfwH2Ctx *ctx, TfwH2Err err_code, bool attack);
 int tfw_h2_make_frames(struct sock *sk, TfwH2Ctx *ctx, unsigned long smd_wnd,
 		       bool *data_is_available);
@@ -1601,40 +1601,6 @@ __tfw_http_msg_move_body(TfwHttpResp *resp, struct sk_buff *nskb)
 	return 0;
 }
 
-/*
- * Move linear data to paged fragment before inserting data into skb.
- * We must do it, because we want to insert new data "before" linear.
- * For instance: We want to insert headers. Linear data contains part
- * of the body, if we insert headers without moving linear part,
- * headers will be inserted after the body or between the body chunks.
- */
-int
-tfw_http_msg_linear_transform(TfwMsgIter *it)
-{
-	/*
-	 * There is no sense to move linear part if next skb has linear
-	 * part as well and current skb has max frags.
-	 */
-	if (skb_shinfo(it->skb)->nr_frags == MAX_SKB_FRAGS
-	    && skb_headlen(it->skb->next))
-	{
-		struct sk_buff *nskb = ss_skb_alloc(0);
-
-		if (!nskb)
-			return -ENOMEM;
-
-		skb_shinfo(nskb)->tx_flags = skb_shinfo(it->skb)->tx_flags;
-		ss_skb_insert_before(&it->skb_head, it->skb, nskb);
-		it->skb = nskb;
-		it->frag = -1;
-
-		return 0;
-	} else {
-		return ss_skb_linear_transform(it->skb_head, it->skb,
-					       it->skb->data);
-	}
-}
-
 /*
  * Expand message by @str increasing size of current paged fragment or add
  * new paged fragment using @pool if room in current pool's chunk is not enough.
@@ -1655,10 +1621,9 @@ __tfw_http_msg_expand_from_pool(TfwHttpResp *resp, const TfwStr *str,
 
 	BUG_ON(it->skb->len > SS_SKB_MAX_DATA_LEN);
 
-	if (skb_headlen(it->skb)) {
-		if (unlikely((r = tfw_http_msg_linear_transform(it))))
-			return r;
-	}
+	/* Headers are written to paged fragments in front of the body. */
+	if (WARN_ON_ONCE(skb_headlen(it->skb)))
+		return -EINVAL;
 
 	TFW_STR_FOR_EACH_CHUNK(c, str, end) {
 		rlen = c->len;
@@ -1796,20 +1761,21 @@ __tfw_h2_msg_shrink_frag(struct sk_buff *skb, int frag_idx, const char *nbegin)
  * Delete SKBs and paged fragments related to @resp that contains response
  * headers. SKBs and fragments will be "unlinked" and placed to @cleanup.
  * At this point we can't free SKBs, because data that they contain used
- * as source for message trasformation.
+ * as source for message trasformation. If the response has a body, then
+ * an empty skb for the new headers is inserted in front of it.
  */
 int
 tfw_h2_msg_cutoff_headers(TfwHttpResp *resp, TfwHttpRespCleanup* cleanup)
 {
-	int i, r = 0;
+	int i;
 	char *begin, *end;
+	struct sk_buff *skb;
 	TfwMsgIter *it = &resp->mit.iter;
 	char* body = TFW_STR_CHUNK(&resp->body, 0)->data;
 	TfwStr *crlf = TFW_STR_LAST(&resp->crlf);
 	char *off = body ? body : crlf->data + (crlf->len - 1);
 
 	do {
-		struct sk_buff *skb;
 		struct skb_shared_info *si = skb_shinfo(it->skb);
 
 		if (skb_headlen(it->skb)) {
@@ -1817,14 +1783,21 @@ tfw_h2_msg_cutoff_headers(TfwHttpResp *resp, TfwHttpRespCleanup* cleanup)
 			end = begin + skb_headlen(it->skb);
 
 			if (ss_skb_is_within_fragment(begin, off, end)) {
-				it->frag = -1;
-				/* We would end up here if the start of the body or
-				 * the end of CRLF lies within the linear data area
-				 * of the current @it->skb
+				/*
+				 * We would end up here if the start of the
+				 * body or the end of CRLF lies within the
+				 * linear data area of the current @it->skb.
+				 * Just pull the headers out of the linear
+				 * data, so the body stays in place. The
+				 * headers data is still there and can be used
+				 * for the transformation.
 				 */
-				r = ss_skb_linear_transform(it->skb_head,
-							    it->skb, body);
-				break;
+				if (body)
+					__skb_pull(it->skb, off - begin);
+				else
+					ss_skb_put(it->skb, -(end - begin));
+				it->skb->tail_lock = 1;
+				goto end;
 			} else {
 				ss_skb_put(it->skb, -skb_headlen(it->skb));
 				it->skb->tail_lock = 1;
@@ -1874,7 +1847,7 @@ tfw_h2_msg_cutoff_headers(TfwHttpResp *resp, TfwHttpRespCleanup* cleanup)
 
 end:
 	/* Pointer to data or CRLF not found in skbs. */
-	BUG_ON(!r && (!it->skb_head || !it->skb));
+	BUG_ON(!it->skb_head || !it->skb);
 
 	it->skb_head = it->skb;
 	resp->msg.skb_head = it->skb;
@@ -1882,7 +1855,23 @@ end:
 	/* Start from zero fragment */
 	it->frag = -1;
 
-	return r;
+	if (!body)
+		return 0;
+
+	/*
+	 * Write the new headers into a separate skb in front of the body,
+	 * so the body fragments are never shifted or moved to next skbs to
+	 * make room for the headers and the transformation cost depends on
+	 * the headers size only. The skbs are split at the end of HEADERS
+	 * frame on transmission anyway.
+	 */
+	if (!(skb = ss_skb_alloc(0)))
+		return -ENOMEM;
+	skb_shinfo(skb)->tx_flags = skb_shinfo(it->skb)->tx_flags;
+	ss_skb_insert_before(&resp->msg.skb_head, it->skb, skb);
+	it->skb_head = it->skb = skb;
+
+	return 0;
 }
 
 /**
@@ -52,6 +52,9 @@ typedef struct {
 	unsigned int		seq;
 } TfwRatioSrvDesc;
 
+/* Per-CPU start index for the search of CPU-local connections. */
+static DEFINE_PER_CPU(unsigned int, tfw_sched_ratio_local_idx);
+
 /**
  * Individual server data for scheduler.
  *
@@ -810,9 +813,46 @@ retry:
 	goto retry;
 }
 
+/**
+ * Find an idle connection which socket is served by the current CPU, see
+ * sk_incoming_cpu. ss_send() on such a connection transmits the request
+ * on the same CPU, without the remote CPU work queue and IPI. Connections
+ * with queued requests aren't preferred: pipelining all the requests of
+ * a CPU on its few local connections costs more than a cross-CPU send.
+ *
+ * TCP sockets are SLAB_TYPESAFE_BY_RCU, so @sk of a connection being closed
+ * can be read under the RCU lock, and the liveness is checked at the end.
+ */
+static inline TfwSrvConn *
+__sched_srv_local(TfwRatioSrvDesc *srvdesc)
+{
+	size_t ci, n = srvdesc->conn_n;
+	int cpu = smp_processor_id();
+	unsigned int idx = this_cpu_inc_return(tfw_sched_ratio_local_idx);
+
+	for (ci = 0; ci < n; ++ci) {
+		TfwSrvConn *srv_conn = srvdesc->conn[(idx + ci) % n];
+		struct sock *sk = READ_ONCE(srv_conn->sk);
+
+		if (!sk || READ_ONCE(sk->sk_incoming_cpu) != cpu
+		    || READ_ONCE(srv_conn->qsize))
+			continue;
+		if (unlikely(tfw_srv_conn_restricted(srv_conn)
+			     || tfw_srv_conn_unscheduled(srv_conn)
+			     || tfw_srv_conn_busy(srv_conn)
+			     || tfw_srv_conn_hasnip(srv_conn)))
+			continue;
+		if (likely(tfw_srv_conn_get_if_live(srv_conn)))
+			return srv_conn;
+	}
+
+	return NULL;
+}
+
 /*
  * Find an available connection to the server described by @srvdesc.
- * Consider the following restrictions:
+ * Idle connections local to the current CPU are tried first. Otherwise,
+ * consider the following restrictions:
  * 1. connection is not in recovery mode.
  * 2. connection's queue is not be full.
  * 3. connection doesn't have active non-idempotent requests.
@@ -824,10 +864,15 @@ static inline TfwSrvConn *
 __sched_srv(TfwRatioSrvDesc *srvdesc, int skipnip, int *nipconn)
 {
 	size_t ci;
+	TfwSrvConn *srv_conn;
+
+	if (skipnip && (srv_conn = __sched_srv_local(srvdesc)))
+		return srv_conn;
 
 	for (ci = 0; ci < srvdesc->conn_n; ++ci) {
 		unsigned long idxval = atomic64_inc_return(&srvdesc->counter);
-		TfwSrvConn *srv_conn = srvdesc->conn[idxval % srvdesc->conn_n];
+
+		srv_conn = srvdesc->conn[idxval % srvdesc->conn_n];
 
 		if (unlikely(tfw_srv_conn_restricted(srv_conn)
 			     || tfw_srv_conn_unscheduled(srv_conn)
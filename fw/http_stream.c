@@ -17,6 +17,7 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <linux/hash.h>
 #include <linux/slab.h>
 
 #undef DEBUG
@@ -29,6 +30,8 @@
 #include "http.h"
 
 #define HTTP2_DEF_WEIGHT	16
+/* Initial size of the open addressing part of the streams storage. */
+#define TFW_H2_STREAM_MAP_MIN_ORDER	5
 
 static struct kmem_cache *stream_cache;
 
@@ -67,6 +70,110 @@ tfw_h2_stream_purge_all(TfwStream *stream)
 	stream->xmit.h_len = stream->xmit.b_len = 0;
 }
 
+static inline bool
+tfw_h2_stream_map_is_inline(unsigned int id)
+{
+	return (id & 1) && (id >> 1) < TFW_H2_STREAM_MAP_INLINE;
+}
+
+static TfwStreamMapSlot *
+tfw_h2_stream_map_lookup(TfwStreamMap *map, unsigned int id)
+{
+	unsigned int i, mask;
+
+	if (!map->tbl)
+		return NULL;
+
+	/*
+	 * The table is never filled by more than 3/4, so there is always
+	 * an empty slot terminating the probe sequence.
+	 */
+	mask = TFW_H2_STREAM_MAP_TBL_SZ(map) - 1;
+	i = hash_32(id, map->tbl_order);
+	for ( ; map->tbl[i].id; i = (i + 1) & mask)
+		if (map->tbl[i].id == id)
+			return &map->tbl[i];
+
+	return NULL;
+}
+
+static void
+__tfw_h2_stream_map_tbl_put(TfwStreamMapSlot *tbl, unsigned int order,
+			    unsigned int id, TfwStream *stream)
+{
+	unsigned int mask = (1U << order) - 1, i = hash_32(id, order);
+
+	while (tbl[i].id)
+		i = (i + 1) & mask;
+	tbl[i].id = id;
+	tbl[i].stream = stream;
+}
+
+static int
+tfw_h2_stream_map_grow(TfwStreamMap *map)
+{
+	TfwStreamMapSlot *tbl;
+	unsigned int i, order = map->tbl ? map->tbl_order + 1
+					 : TFW_H2_STREAM_MAP_MIN_ORDER;
+
+	tbl = kcalloc(1U << order, sizeof(*tbl), GFP_ATOMIC);
+	if (unlikely(!tbl))
+		return -ENOMEM;
+
+	for (i = 0; i < TFW_H2_STREAM_MAP_TBL_SZ(map); ++i)
+		if (map->tbl[i].id)
+			__tfw_h2_stream_map_tbl_put(tbl, order, map->tbl[i].id,
+						    map->tbl[i].stream);
+	kfree(map->tbl);
+	map->tbl = tbl;
+	map->tbl_order = order;
+
+	return 0;
+}
+
+/*
+ * Remove the stream from the storage. Deletion from the hash table shifts
+ * following entries of the probe sequence backward, so we don't need
+ * tombstones and lookups never walk over deleted slots.
+ */
+static void
+tfw_h2_stream_map_remove(TfwStreamMap *map, TfwStream *stream)
+{
+	TfwStreamMapSlot *slot;
+	unsigned int i, j, h, mask;
+
+	if (tfw_h2_stream_map_is_inline(stream->id)) {
+		WARN_ON_ONCE(map->inl[stream->id >> 1] != stream);
+		map->inl[stream->id >> 1] = NULL;
+		return;
+	}
+
+	slot = tfw_h2_stream_map_lookup(map, stream->id);
+	if (WARN_ON_ONCE(!slot || slot->stream != stream))
+		return;
+
+	mask = TFW_H2_STREAM_MAP_TBL_SZ(map) - 1;
+	i = slot - map->tbl;
+	for (j = (i + 1) & mask; map->tbl[j].id; j = (j + 1) & mask) {
+		h = hash_32(map->tbl[j].id, map->tbl_order);
+		/* Move the entry if the hole is on its probe path. */
+		if (((j - h) & mask) >= ((j - i) & mask)) {
+			map->tbl[i] = map->tbl[j];
+			i = j;
+		}
+	}
+	map->tbl[i].id = 0;
+	map->tbl[i].stream = NULL;
+	--map->tbl_cnt;
+}
+
+void
+tfw_h2_stream_map_free(TfwStreamMap *map)
+{
+	kfree(map->tbl);
+	bzero_fast(map, sizeof(*map));
+}
+
 static void
 tfw_h2_stop_stream(TfwStreamSched *sched, TfwStream *stream)
 {
@@ -81,14 +188,13 @@ tfw_h2_stop_stream(TfwStreamSched *sched, TfwStream *stream)
 	tfw_h2_stream_purge_all_and_free_response(stream);
 
 	tfw_h2_conn_reset_stream_on_close(ctx, stream);
-	rb_erase(&stream->node, &sched->streams);
+	tfw_h2_stream_map_remove(&sched->streams, stream);
 }
 
 static inline void
 tfw_h2_init_stream(TfwStream *stream, unsigned int id, unsigned short weight,
 		   long int loc_wnd, long int rem_wnd)
 {
-	RB_CLEAR_NODE(&stream->node);
 	bzero_fast(&stream->sched_node, sizeof(stream->sched_node));
 	stream->sched_state = HTTP2_STREAM_SCHED_STATE_UNKNOWN;
 	tfw_h2_init_stream_sched_entry(&stream->sched);
@@ -106,22 +212,15 @@ tfw_h2_add_stream(TfwStreamSched *sched, unsigned int id, unsigned short weight,
 		  long int loc_wnd, long int rem_wnd)
 {
 	TfwStream *new_stream;
-	struct rb_node **new = &sched->streams.rb_node;
-	struct rb_node *parent = NULL;
+	TfwStreamMap *map = &sched->streams;
+	bool inl = tfw_h2_stream_map_is_inline(id);
 
-	while (*new) {
-		TfwStream *stream = rb_entry(*new, TfwStream, node);
+	if (WARN_ON_ONCE(tfw_h2_find_stream(sched, id)))
+		return NULL;
 
-		parent = *new;
-		if (id < stream->id) {
-			new = &parent->rb_left;
-		} else if (id > stream->id) {
-			new = &parent->rb_right;
-		} else {
-			WARN_ON_ONCE(1);
-			return NULL;
-		}
-	}
+	if (!inl && (map->tbl_cnt + 1) * 4 > TFW_H2_STREAM_MAP_TBL_SZ(map) * 3
+	    && tfw_h2_stream_map_grow(map))
+		return NULL;
 
 	new_stream = kmem_cache_alloc(stream_cache, GFP_ATOMIC | __GFP_ZERO);
 	if (unlikely(!new_stream))
@@ -129,8 +228,13 @@ tfw_h2_add_stream(TfwStreamSched *sched, unsigned int id, unsigned short weight,
 
 	tfw_h2_init_stream(new_stream, id, weight, loc_wnd, rem_wnd);
 
-	rb_link_node(&new_stream->node, parent, new);
-	rb_insert_color(&new_stream->node, &sched->streams);
+	if (inl) {
+		map->inl[id >> 1] = new_stream;
+	} else {
+		__tfw_h2_stream_map_tbl_put(map->tbl, map->tbl_order, id,
+					    new_stream);
+		++map->tbl_cnt;
+	}
 
 	return new_stream;
 }
@@ -787,20 +891,15 @@ finish:
 TfwStream *
 tfw_h2_find_stream(TfwStreamSched *sched, unsigned int id)
 {
-	struct rb_node *node = sched->streams.rb_node;
+	TfwStreamMap *map = &sched->streams;
+	TfwStreamMapSlot *slot;
 
-	while (node) {
-		TfwStream *stream = rb_entry(node, TfwStream, node);
+	if (tfw_h2_stream_map_is_inline(id))
+		return map->inl[id >> 1];
 
-		if (id < stream->id)
-			node = node->rb_left;
-		else if (id > stream->id)
-			node = node->rb_right;
-		else
-			return stream;
-	}
+	slot = tfw_h2_stream_map_lookup(map, id);
 
-	return NULL;
+	return slot ? slot->stream : NULL;
 }
 
 void
@@ -810,6 +909,65 @@ tfw_h2_delete_stream(TfwStream *stream)
 	kmem_cache_free(stream_cache, stream);
 }
 
+/*
+ * Remember that the stream with @id is closed and its object is freed.
+ */
+void
+tfw_h2_stream_id_add_closed(TfwStreamIdRanges *ranges, unsigned int id)
+{
+	TfwStreamIdRange *r = ranges->r;
+	unsigned int i, k, gap, min_gap;
+
+retry:
+	/* Find the first range which isn't far below @id. */
+	for (i = 0; i < ranges->num && r[i].hi + 2 < id; ++i)
+		;
+
+	if (i < ranges->num && r[i].lo <= id + 2) {
+		r[i].lo = min(r[i].lo, id);
+		r[i].hi = max(r[i].hi, id);
+		/* Coalesce with the next range if they touch now. */
+		if (i + 1 < ranges->num && r[i + 1].lo <= r[i].hi + 2) {
+			r[i].hi = r[i + 1].hi;
+			memmove(&r[i + 1], &r[i + 2],
+				(ranges->num - i - 2) * sizeof(*r));
+			--ranges->num;
+		}
+		return;
+	}
+
+	if (ranges->num == TFW_H2_CLOSED_RANGES) {
+		/* Merge the two closest ranges to get a free one. */
+		for (k = 0, i = 1, min_gap = UINT_MAX; i < ranges->num; ++i) {
+			gap = r[i].lo - r[i - 1].hi;
+			if (gap < min_gap) {
+				min_gap = gap;
+				k = i;
+			}
+		}
+		r[k - 1].hi = r[k].hi;
+		memmove(&r[k], &r[k + 1], (ranges->num - k - 1) * sizeof(*r));
+		--ranges->num;
+		goto retry;
+	}
+
+	memmove(&r[i + 1], &r[i], (ranges->num - i) * sizeof(*r));
+	r[i].lo = r[i].hi = id;
+	++ranges->num;
+}
+
+bool
+tfw_h2_stream_id_is_closed(TfwStreamIdRanges *ranges, unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < ranges->num; ++i)
+		if (ranges->r[i].lo <= id && id <= ranges->r[i].hi)
+			return true;
+
+	return false;
+}
+
 int
 tfw_h2_stream_init_for_xmit(TfwHttpResp *resp, TfwStreamXmitState state,
 			    unsigned long h_len, unsigned long b_len)
@@ -151,6 +151,37 @@ typedef struct {
 	unsigned long		num;
 } TfwStreamQueue;
 
+/**
+ * Number of ranges in @TfwStreamIdRanges.
+ */
+#define TFW_H2_CLOSED_RANGES		4
+
+/**
+ * Range [@lo, @hi] of client stream IDs.
+ */
+typedef struct {
+	unsigned int		lo;
+	unsigned int		hi;
+} TfwStreamIdRange;
+
+/**
+ * Compact tracking of the stream IDs, which were closed and whose stream
+ * objects have been already freed. Used to choose the error code for
+ * a HEADERS frame on such a stream: STREAM_CLOSED for a processed stream
+ * and PROTOCOL_ERROR for a skipped one. Adjacent IDs are coalesced into
+ * ranges, and if we run out of ranges, the two closest ones are merged: all
+ * the client IDs below the last processed one, which are not opened, are
+ * closed anyway (RFC 9113 5.1.1) and the connection is terminated in both
+ * the cases, so such an approximation only changes the error code.
+ *
+ * @r		- ranges sorted by IDs;
+ * @num		- number of used ranges;
+ */
+typedef struct {
+	TfwStreamIdRange	r[TFW_H2_CLOSED_RANGES];
+	unsigned int		num;
+} TfwStreamIdRanges;
+
 typedef enum {
 	HTTP2_STREAM_SCHED_STATE_UNKNOWN,
 	HTTP2_STREAM_SCHED_STATE_BLOCKED,
@@ -160,7 +191,6 @@ typedef enum {
 /**
  * Representation of HTTP/2 stream entity.
  *
- * @node	- entry in per-connection storage of streams (red-black tree);
  * @sched_node	- entry in per-connection priority storage of active streams;
  * sched_state	- state of stream in the per-connection scheduler;
  * @sched	- scheduler for child streams;
@@ -177,7 +207,6 @@ typedef enum {
  * @xmit	- last http2 response info, used in `xmit` callbacks;
  */
 struct tfw_http_stream_t {
-	struct rb_node		node;
 	struct eb64_node	sched_node;
 	TfwStreamSchedState	sched_state;
 	TfwStreamSchedEntry	sched;
@@ -207,7 +236,10 @@ TfwStreamFsmRes tfw_h2_stream_fsm(TfwH2Ctx *ctx, TfwStream *stream,
 				  unsigned char type, unsigned char flags,
 				  bool send, TfwH2Err *err);
 TfwStream *tfw_h2_find_stream(TfwStreamSched *sched, unsigned int id);
+void tfw_h2_stream_map_free(TfwStreamMap *map);
 void tfw_h2_delete_stream(TfwStream *stream);
+void tfw_h2_stream_id_add_closed(TfwStreamIdRanges *ranges, unsigned int id);
+bool tfw_h2_stream_id_is_closed(TfwStreamIdRanges *ranges, unsigned int id);
 int tfw_h2_stream_init_for_xmit(TfwHttpResp *resp, TfwStreamXmitState state,
 				unsigned long h_len, unsigned long b_len);
 void tfw_h2_stream_add_closed(TfwH2Ctx *ctx, TfwStream *stream);
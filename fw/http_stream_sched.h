@@ -20,10 +20,10 @@
 #ifndef __HTTP_STREAM_SCHED__
 #define __HTTP_STREAM_SCHED__
 
-#include <linux/rbtree.h>
 #include <linux/list.h>
 
 #include "lib/eb64tree.h"
+#include "lib/str.h"
 #include "http_types.h"
 
 /**
@@ -41,16 +41,68 @@ typedef struct tfw_stream_sched_entry_t {
 	struct eb_root			blocked;
 } TfwStreamSchedEntry;
 
+/**
+ * Number of streams with small odd IDs (1, 3, ..., 2 * N - 1) stored in the
+ * inline part of @TfwStreamMap. Most of connections never go beyond this.
+ */
+#define TFW_H2_STREAM_MAP_INLINE	16
+
+/**
+ * Slot of the open addressing part of @TfwStreamMap.
+ *
+ * @id		- stream ID, zero for an empty slot;
+ * @stream	- the stream;
+ */
+typedef struct {
+	unsigned int		id;
+	TfwStream		*stream;
+} TfwStreamMapSlot;
+
+/**
+ * Per-connection storage of streams. Client initiated streams with the first
+ * @TFW_H2_STREAM_MAP_INLINE odd IDs are stored right in @inl array indexed
+ * by the stream ID, the rest of streams live in the dense open addressing
+ * hash table @tbl with linear probing. The table is allocated on first use
+ * and grows twice when it's filled by 3/4.
+ *
+ * @inl		- directly indexed streams with small IDs;
+ * @tbl		- hash table for the rest of the streams;
+ * @tbl_order	- log2 of the hash table size or zero if it's not allocated;
+ * @tbl_cnt	- number of streams in @tbl;
+ */
+typedef struct {
+	TfwStream		*inl[TFW_H2_STREAM_MAP_INLINE];
+	TfwStreamMapSlot	*tbl;
+	unsigned int		tbl_order;
+	unsigned int		tbl_cnt;
+} TfwStreamMap;
+
+#define TFW_H2_STREAM_MAP_TBL_SZ(m)	((m)->tbl ? 1U << (m)->tbl_order : 0)
+
+/**
+ * Iterate over all the streams in the map @m. @i is an unsigned int cursor.
+ * Streams must not be added to or removed from the map during iteration.
+ */
+#define tfw_h2_stream_map_for_each(m, s, i)				\
+	for ((i) = 0;							\
+	     (i) < TFW_H2_STREAM_MAP_INLINE + TFW_H2_STREAM_MAP_TBL_SZ(m);\
+	     ++(i))							\
+		if (!((s) = (i) < TFW_H2_STREAM_MAP_INLINE		\
+			    ? (m)->inl[i]				\
+			    : (m)->tbl[(i) - TFW_H2_STREAM_MAP_INLINE].stream))\
+			;						\
+		else
+
 /**
  * Scheduler for stream's processing distribution based on dependency/priority
  * values.
  *
- * @streams		- root red-black tree entry for per-connection streams storage;
+ * @streams		- per-connection streams storage;
  * @root		- root scheduler of per-connection priority tree;
  * @blocked_streams	- count of blocked streams;
  */
 typedef struct tfw_stream_sched_t {
-	struct rb_root		streams;
+	TfwStreamMap		streams;
 	TfwStreamSchedEntry	root;
 	long int		blocked_streams;
 } TfwStreamSched;
@@ -88,7 +140,7 @@ tfw_h2_init_stream_sched_entry(TfwStreamSchedEntry *entry)
 static inline void
 tfw_h2_init_stream_sched(TfwStreamSched *sched)
 {
-	sched->streams = RB_ROOT;
+	bzero_fast(&sched->streams, sizeof(sched->streams));
 	tfw_h2_init_stream_sched_entry(&sched->root);
 }
 
@@ -500,6 +500,7 @@ tfw_init(void)
 
 	/* The order of initialization is highly important. */
 	DO_INIT(pool);
+	DO_INIT(ss_skb);
 	DO_INIT(cfg);
 	DO_INIT(access_log);
 	DO_INIT(apm);
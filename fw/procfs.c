@@ -23,6 +23,7 @@
 #include "apm.h"
 #include "server.h"
 #include "procfs.h"
+#include "tls.h"
 
 /*
  * Common Tempesta statistics.
@@ -89,6 +90,8 @@ tfw_perfstat_collect(TfwPerfStat *stat)
 		SADD(serv.rx_bytes);
 		SADD(serv.tls_hs_successful);
 		SADD(serv.tls_hs_failed);
+		SADD(serv.tls_sess_cache_hits);
+		SADD(serv.tls_sess_cache_misses);
 
 		/*
 		 * Health statistics (differs from health monitor statistics):
@@ -114,6 +117,7 @@ tfw_perfstat_seq_show(struct seq_file *seq, void *off)
 
 	int i;
 	TfwPerfStat stat = {0};
+	TlsMpoolStat tls_mp;
 	u64 serv_conn_active, serv_conn_sched;
 	SsStat *ss_stat = kmalloc(sizeof(SsStat) * num_online_cpus(),
 				  GFP_KERNEL);
@@ -199,6 +203,15 @@ tfw_perfstat_seq_show(struct seq_file *seq, void *off)
 	SPRN("Server RX bytes\t\t\t\t", serv.rx_bytes);
 	SPRN("Server successful TLS handshakes\t", serv.tls_hs_successful);
 	SPRN("Server failed TLS handshakes\t\t", serv.tls_hs_failed);
+	SPRN("Server TLS session cache hits\t\t", serv.tls_sess_cache_hits);
+	SPRN("Server TLS session cache misses\t\t",
+	     serv.tls_sess_cache_misses);
+
+	/* TLS handshake crypto memory. */
+	ttls_mpool_stat(&tls_mp);
+	SPRNE("TLS handshake crypto contexts\t\t", (u64)tls_mp.hs_ctx);
+	SPRNE("TLS handshake crypto memory\t\t", (u64)tls_mp.hs_mem);
+	SPRNE("TLS handshake crypto profile size\t", (u64)tls_mp.hs_profile);
 
 	if (stat.hm) {
 		seq_printf(seq, "Tempesta health statistics:\n");
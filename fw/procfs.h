@@ -61,12 +61,16 @@ typedef struct {
 /*
  * @tls_hs_successul	- The number of successfull TLS handshakes.
  * @tls_hs_failed	- The number of failed TLS handshakes.
+ * @tls_sess_cache_hits	- Sessions resumed from the TLS session cache.
+ * @tls_sess_cache_misses	- Session IDs not found in TLS session cache.
  */
 typedef struct {
 	TFW_STAT_COMMON;
 	u64	conn_restricted;
 	u64	tls_hs_successful;
 	u64	tls_hs_failed;
+	u64	tls_sess_cache_hits;
+	u64	tls_sess_cache_misses;
 } TfwSrvStat;
 
 /*
@@ -48,16 +48,16 @@ typedef struct {
 } SsWork;
 
 /**
- * Backlog for synchronous close operations. Uses turnstile to keep order with
- * ring-buffer work queue. The work queue tail is used as a ticket for the
- * turnstile. The backlog is used in slow path if the-ring buffer work queue
- * is full.
+ * Backlog for synchronous close operations and for send operations on bursts.
+ * Uses turnstile to keep order with ring-buffer work queue. The work queue
+ * tail is used as a ticket for the turnstile. The backlog is used in slow path
+ * if the-ring buffer work queue is full.
  *
  * @head	- head of backlog queue;
  * @lock	- synchronization for the backlog (MPSC);
  * @turn	- last pop()'ed node ticket value, used to decide where to pop()
  * 		  a next item from without locking;
- * @size	- current backlog queue size, just for statistics;
+ * @size	- current backlog queue size, limits the sends in the backlog;
  */
 typedef struct {
 	struct list_head	head;
@@ -285,45 +285,47 @@ ss_wq_push(SsWork *sw, int cpu)
 	return r;
 }
 
+/**
+ * Fetch up to @n works to @sw. The works are taken from the work queue by
+ * batches with a single update of the queue tail, but never beyond the
+ * turn of the backlog.
+ *
+ * @turn stores @wq->head value of a next item to insert (the position was
+ * unavailable when we tried it), so if we fetched i'th item last time, then
+ * now we should fetch (i + 1)'th item from the backlog. While there are many
+ * producers, they have different head views and they can put the items to
+ * the backlog with wrong order. Thus, we should fetch all the items with
+ * small enough tickets. If some of them are still being written, then
+ * nothing is fetched and the next softirq retries.
+ *
+ * Return the number of fetched works.
+ */
 static int
-ss_wq_pop(TfwRBQueue *wq, SsWork *sw, long *ticket)
+ss_wq_pop(TfwRBQueue *wq, SsWork *sw, int n, long *ticket)
 {
 	SsCloseBacklog *cb = this_cpu_ptr(&close_backlog);
+	SsCblNode *cn = NULL;
+	int r;
 
-	/*
-	 * Since backlog is used for closing only, items from the work queue
-	 * are fetched first.
-	 */
-	if (!*ticket && !tfw_wq_pop_ticket(wq, sw, ticket))
-		return 0;
+	r = tfw_wq_pop_turn(wq, sw, n, READ_ONCE(cb->turn), ticket);
+	if (r >= 0)
+		return r;
 
-	/*
-	 * @turn stores @wq->head value of a next item to insert (the position
-	 * was unavailable when we tried it), so if we fetched i'th item last
-	 * time, then now we should fetch (i + 1)'th item from the backlog.
-	 * While there are many producers, they have different head views and
-	 * they can put the items to the backlog with wrong order. Thus, we
-	 * should fetch all the items with small enough tickets.
-	 */
-	if (*ticket + 1 >= cb->turn) {
-		SsCblNode *cn = NULL;
-
-		spin_lock(&cb->lock);
-		if (!list_empty(&cb->head)) {
-			cn = list_first_entry(&cb->head, SsCblNode, list);
-			list_del(&cn->list);
-			ss_turnstile_update_turn(cb);
-			cb->size--;
-		}
-		spin_unlock(&cb->lock);
-		if (cn) {
-			memcpy_fast(sw, &cn->sw, sizeof(*sw));
-			kmem_cache_free(ss_cbacklog_cache, cn);
-			return 0;
-		}
+	spin_lock(&cb->lock);
+	if (!list_empty(&cb->head)) {
+		cn = list_first_entry(&cb->head, SsCblNode, list);
+		list_del(&cn->list);
+		ss_turnstile_update_turn(cb);
+		cb->size--;
 	}
+	spin_unlock(&cb->lock);
+	if (!cn)
+		return 0;
+
+	memcpy_fast(sw, &cn->sw, sizeof(*sw));
+	kmem_cache_free(ss_cbacklog_cache, cn);
 
-	return tfw_wq_pop_ticket(wq, sw, ticket);
+	return 1;
 }
 
 static size_t
@@ -519,6 +521,7 @@ int
 ss_send(struct sock *sk, struct sk_buff **skb_head, int flags)
 {
 	int cpu, r = 0;
+	long ticket;
 	struct sk_buff *skb, *twin_skb;
 	SsWork sw = {
 		.sk	= sk,
@@ -549,14 +552,17 @@ ss_send(struct sock *sk, struct sk_buff **skb_head, int flags)
 
 	/*
 	 * Remove the skbs from Tempesta lists if we won't use them,
-	 * or copy them if they're going to be used by Tempesta during
-	 * and after the transmission.
+	 * or make their twins referencing the same data if the skbs are
+	 * going to be used by Tempesta during and after the transmission.
 	 */
 	if (flags & SS_F_KEEP_SKB) {
 		skb = *skb_head;
 		do {
-			/* tcp_transmit_skb() will clone the skb. */
-			twin_skb = pskb_copy_for_clone(skb, GFP_ATOMIC);
+			/*
+			 * tcp_transmit_skb() will clone the skb, so the twin
+			 * must not share the skb data with the kept skb.
+			 */
+			twin_skb = ss_skb_share(skb);
 			if (!twin_skb) {
 				T_WARN("Unable to copy an egress SKB.\n");
 				r = -ENOMEM;
@@ -582,7 +588,15 @@ ss_send(struct sock *sk, struct sk_buff **skb_head, int flags)
 	 * leakage, so we never use synchronous sending.
 	 */
 	sock_hold(sk);
-	if (ss_wq_push(&sw, cpu)) {
+	if ((ticket = ss_wq_push(&sw, cpu))) {
+		/*
+		 * Spill a burst overflowing the work queue to the backlog,
+		 * but limit it by the work queue size to not consume too much
+		 * memory if the CPU just can't cope with the load.
+		 */
+		if (READ_ONCE(per_cpu(close_backlog, cpu).size) < __wq_size
+		    && !ss_turnstile_push(ticket, &sw, cpu))
+			return 0;
 		T_DBG2("Cannot schedule socket %p for transmission"
 		       " (queue size %d)\n", sk,
 		       tfw_wq_size(&per_cpu(si_wq, cpu)));
@@ -1509,121 +1523,134 @@ ss_is_closed_force(SsWork *sw)
 	return (sw->action == SS_CLOSE) && (sw->flags & __SS_F_FORCE);
 }
 
+/* Number of works fetched from the work queue at once. */
+#define SS_TX_BATCH		16
+
 static void
-ss_tx_action(void)
+ss_tx_do_work(SsWork *sw)
 {
-	SsWork sw;
-	int budget;
+	struct sock *sk = sw->sk;
 	struct sk_buff *skb;
-	TfwRBQueue *wq = this_cpu_ptr(&si_wq);
-	long ticket = 0;
 
+	bh_lock_sock(sk);
 	/*
-	 * @budget limits the loop to prevent live lock on constantly arriving
-	 * new items. We use some small integer as a lower bound to catch just
-	 * arriving items.
+	 * We can call ss_tx_action() for DEAD or shutdowned sock
+	 * in two cases:
+	 * - Parallel requests, one of which failed with error.
+	 *   All responses to other requests which were sent after
+	 *   error response should be dropped, because socket is
+	 *   already closed.
+	 * - We close and drop connection immediately with __SS_F_FORCE
+	 *   flag, because Tempesta FW is shutdowning.
 	 */
-	budget = max(10UL, ss_wq_local_size(wq));
-	while ((!ss_active() || budget--) && !ss_wq_pop(wq, &sw, &ticket)) {
-		struct sock *sk = sw.sk;
+	if (sock_flag(sk, SOCK_DEAD)) {
+		if (sk->sk_user_data
+		    && (SS_CONN_TYPE(sk) & Conn_Closing)
+		    && ss_is_closed_force(sw))
+			ss_conn_drop_guard_exit(sk);
+		/* We've closed the socket on earlier job. */
+		bh_unlock_sock(sk);
+		goto dead_sock;
+	} else if (sk->sk_user_data
+		   && (SS_CONN_TYPE(sk) & Conn_Shutdown)) {
+		if (ss_is_closed_force(sw))
+			ss_linkerror(sk, SS_F_ABORT);
+		bh_unlock_sock(sk);
+		goto dead_sock;
+	}
 
-		bh_lock_sock(sk);
+	switch (sw->action) {
+	case SS_SEND:
 		/*
-		 * We can call ss_tx_action() for DEAD or shutdowned sock
-		 * in two cases:
-		 * - Parallel requests, one of which failed with error.
-		 *   All responses to other requests which were sent after
-		 *   error response should be dropped, because socket is
-		 *   already closed.
-		 * - We close and drop connection immediately with __SS_F_FORCE
-		 *   flag, because Tempesta FW is shutdowning.
+		 * Don't make TSQ spin on the lock while we're working
+		 * with the socket.
+		 *
+		 * Socket is locked and this synchronizes possible
+		 * socket closing with tcp_tasklet_func(): we must
+		 * clear the TSQ deffered flag with
+		 * sk->sk_lock.owned = 1.
+		 *
+		 * Set sk->sk_lock.owned = 0 if no closing is required,
+		 * otherwise ss_do_close() does this.
 		 */
-		if (sock_flag(sk, SOCK_DEAD)) {
-			if (sk->sk_user_data
-			    && (SS_CONN_TYPE(sk) & Conn_Closing)
-			    && ss_is_closed_force(&sw))
-				ss_conn_drop_guard_exit(sk);
-			/* We've closed the socket on earlier job. */
-			bh_unlock_sock(sk);
-			goto dead_sock;
-		} else if (sk->sk_user_data
-			   && (SS_CONN_TYPE(sk) & Conn_Shutdown)) {
-			if (ss_is_closed_force(&sw))
-				ss_linkerror(sk, SS_F_ABORT);
-			bh_unlock_sock(sk);
-			goto dead_sock;
-		}
+		sk->sk_lock.owned = 1;
 
-		switch (sw.action) {
-		case SS_SEND:
-			/*
-			 * Don't make TSQ spin on the lock while we're working
-			 * with the socket.
-			 *
-			 * Socket is locked and this synchronizes possible
-			 * socket closing with tcp_tasklet_func(): we must
-			 * clear the TSQ deffered flag with
-			 * sk->sk_lock.owned = 1.
-			 *
-			 * Set sk->sk_lock.owned = 0 if no closing is required,
-			 * otherwise ss_do_close() does this.
-			 */
-			sk->sk_lock.owned = 1;
-
-			ss_do_send(sk, &sw.skb_head, sw.flags);
-			switch(sw.flags & SS_F_CLOSE_FORCE) {
-			case SS_F_CLOSE_FORCE:
-				/* paired with bh_lock_sock() */
-				__sk_close_locked(sk, sw.flags);
-				break;
-			case SS_F_CONN_CLOSE:
-				ss_do_shutdown(sk);
-				fallthrough;
-			default:
-				sk->sk_lock.owned = 0;
-				bh_unlock_sock(sk);
-				break;
-			case __SS_F_FORCE:
-				BUG();
-			}
-
-			break;
-		case SS_CLOSE:
-			/*
-			 * We were asked to close the socket. If current state
-			 * is either ESTABLISHED or SYN_SENT, we initiate the
-			 * closing process. If for some reason other side sent
-			 * us FIN, we are at CLOSE_WAIT, so the socket closing
-			 * is in progress, but still need to cleanup on our
-			 * side. If we send shutdown we can also be in two
-			 * states TCP_FIN_WAIT1 or TCP_CLOSING if client didn't
-			 * send ACK to our FIN or we still have data to sent.
-			 * If we get here while the socket in any other
-			 * state, resources were either already freed or were
-			 * never allocated.
-			 */
-			if (!((1 << sk->sk_state)
-			      & (TCPF_ESTABLISHED | TCPF_SYN_SENT
-				 | TCPF_CLOSE_WAIT)))
-			{
-				T_DBG2("[%d]: %s: Socket inactive: sk %p\n",
-				       smp_processor_id(), __func__, sk);
-				bh_unlock_sock(sk);
-				break;
-			}
+		ss_do_send(sk, &sw->skb_head, sw->flags);
+		switch(sw->flags & SS_F_CLOSE_FORCE) {
+		case SS_F_CLOSE_FORCE:
 			/* paired with bh_lock_sock() */
-			__sk_close_locked(sk, sw.flags);
+			__sk_close_locked(sk, sw->flags);
 			break;
+		case SS_F_CONN_CLOSE:
+			ss_do_shutdown(sk);
+			fallthrough;
 		default:
+			sk->sk_lock.owned = 0;
+			bh_unlock_sock(sk);
+			break;
+		case __SS_F_FORCE:
 			BUG();
 		}
+
+		break;
+	case SS_CLOSE:
+		/*
+		 * We were asked to close the socket. If current state
+		 * is either ESTABLISHED or SYN_SENT, we initiate the
+		 * closing process. If for some reason other side sent
+		 * us FIN, we are at CLOSE_WAIT, so the socket closing
+		 * is in progress, but still need to cleanup on our
+		 * side. If we send shutdown we can also be in two
+		 * states TCP_FIN_WAIT1 or TCP_CLOSING if client didn't
+		 * send ACK to our FIN or we still have data to sent.
+		 * If we get here while the socket in any other
+		 * state, resources were either already freed or were
+		 * never allocated.
+		 */
+		if (!((1 << sk->sk_state)
+		      & (TCPF_ESTABLISHED | TCPF_SYN_SENT
+			 | TCPF_CLOSE_WAIT)))
+		{
+			T_DBG2("[%d]: %s: Socket inactive: sk %p\n",
+			       smp_processor_id(), __func__, sk);
+			bh_unlock_sock(sk);
+			break;
+		}
+		/* paired with bh_lock_sock() */
+		__sk_close_locked(sk, sw->flags);
+		break;
+	default:
+		BUG();
+	}
 dead_sock:
-		sock_put(sk); /* paired with push() calls */
-		if (sw.skb_head)
-			ss_skb_destroy_opaque_data(sw.skb_head);
+	sock_put(sk); /* paired with push() calls */
+	if (sw->skb_head)
+		ss_skb_destroy_opaque_data(sw->skb_head);
 
-		while ((skb = ss_skb_dequeue(&sw.skb_head)))
-			kfree_skb(skb);
+	while ((skb = ss_skb_dequeue(&sw->skb_head)))
+		kfree_skb(skb);
+}
+
+static void
+ss_tx_action(void)
+{
+	SsWork sws[SS_TX_BATCH];
+	int i, n, budget;
+	TfwRBQueue *wq = this_cpu_ptr(&si_wq);
+	long ticket = 0;
+
+	/*
+	 * @budget limits the loop to prevent live lock on constantly arriving
+	 * new items. We use some small integer as a lower bound to catch just
+	 * arriving items.
+	 */
+	budget = max(10UL, ss_wq_local_size(wq));
+	while ((!ss_active() || budget > 0)
+	       && (n = ss_wq_pop(wq, sws, SS_TX_BATCH, &ticket)))
+	{
+		for (i = 0; i < n; ++i)
+			ss_tx_do_work(&sws[i]);
+		budget -= n;
 	}
 
 	/*
@@ -1790,8 +1817,9 @@ ss_synchronize(void)
  * http/1 request would generally take much more space, so the queue would
  * not overflow.
  *
- * TODO: since iface MTU and net.core.dev_weight can be changed in runtime,
- * we might need to support dynamic queue resize without reloading the Tempesta
+ * Since iface MTU and net.core.dev_weight can be changed in runtime, the size
+ * is estimated again and the queues are resized on each Tempesta start, see
+ * ss_wq_resize(). Bursts overflowing the queue go to the bounded backlog.
  */
 static unsigned int
 ss_estimate_pcpu_wq_size(void)
@@ -1830,6 +1858,32 @@ ss_estimate_pcpu_wq_size(void)
  * stages such as closing listening sockets, closing client sockets and
  * finally closing server sockets.
  */
+/**
+ * Resize the work queues to the current network settings. Tempesta is stopped,
+ * so there are no producers and all the queues are drained by
+ * ss_synchronize(). A queue keeps its current size if it can't be resized.
+ */
+static void
+ss_wq_resize(void)
+{
+	int cpu;
+	unsigned int qsz;
+
+	qsz = max_t(unsigned int, TFW_DFLT_QSZ, ss_estimate_pcpu_wq_size());
+	if (qsz == __wq_size)
+		return;
+
+	for_each_online_cpu(cpu) {
+		TfwRBQueue *wq = &per_cpu(si_wq, cpu);
+
+		if (ss_wq_size(cpu)
+		    || tfw_wq_resize(wq, qsz, cpu_to_node(cpu)))
+			T_WARN_NL("Cannot resize work queue for CPU #%d to %u"
+				  " items\n", cpu, qsz);
+	}
+	__wq_size = qsz;
+}
+
 void
 ss_start(void)
 {
@@ -1839,6 +1893,7 @@ ss_start(void)
 	 */
 	if (tfw_runstate_is_reconfig())
 		return;
+	ss_wq_resize();
 	WRITE_ONCE(__ss_active, true);
 }
 
@@ -1862,8 +1917,7 @@ tfw_sync_socket_wq_init(int cpu)
 	TfwRBQueue *wq = &per_cpu(si_wq, cpu);
 	int r;
 
-	r = tfw_wq_init(wq, max_t(unsigned int, TFW_DFLT_QSZ, __wq_size),
-			cpu_to_node(cpu));
+	r = tfw_wq_init(wq, __wq_size, cpu_to_node(cpu));
 	if (unlikely(r))
 		return r;
 	init_irq_work(&per_cpu(ipi_work, cpu), ss_ipi);
@@ -1887,7 +1941,8 @@ tfw_sync_socket_init(void)
 					      sizeof(SsCblNode), 0, 0, NULL);
 	if (!ss_cbacklog_cache)
 		return -ENOMEM;
-	__wq_size = ss_estimate_pcpu_wq_size();
+	__wq_size = max_t(unsigned int, TFW_DFLT_QSZ,
+			  ss_estimate_pcpu_wq_size());
 	for_each_online_cpu(cpu) {
 		SsCloseBacklog *cb = &per_cpu(close_backlog, cpu);
 
@@ -103,6 +103,7 @@ tfw_cli_conn_alloc(int type)
 	INIT_LIST_HEAD(&cli_conn->seq_queue);
 	spin_lock_init(&cli_conn->seq_qlock);
 	spin_lock_init(&cli_conn->ret_qlock);
+	atomic_set(&cli_conn->ret_cnt, 0);
 	spin_lock_init(&cli_conn->timer_lock);
 	bzero_fast(cli_conn->js_histoty, sizeof(cli_conn->js_histoty));
 #ifdef CONFIG_LOCKDEP
@@ -38,6 +38,37 @@
 #include "procfs.h"
 #include "ss_skb.h"
 
+#define SS_PG_POOL_SZ		64
+/* Number of pooled pages probed for reuse on an allocation. */
+#define SS_PG_POOL_PROBE	4
+
+/**
+ * Per-CPU pool of pages for locally generated messages.
+ *
+ * Error responses, redirects, JS challenges and cache hits are built in
+ * freshly allocated pages, which are freed by the network stack when the
+ * data is transmitted. Under DDoS we generate millions of such messages
+ * per second, so the page allocator becomes a bottleneck. The pool keeps
+ * a reference to each of its pages, so a page isn't returned to the page
+ * allocator when the stack is done with it and its reference counter
+ * drops back to one. Such page can be reused for a next message without
+ * any allocation. Pages are allocated on the local NUMA node.
+ *
+ * @lock	- synchronizes the pool with the shrinker only;
+ * @n		- number of pages in the pool;
+ * @cur		- next slot to probe for a free page;
+ * @pages	- the pooled pages;
+ */
+typedef struct {
+	spinlock_t	lock;
+	unsigned int	n;
+	unsigned int	cur;
+	struct page	*pages[SS_PG_POOL_SZ];
+} SsPagePool;
+
+static DEFINE_PER_CPU(SsPagePool, ss_pg_pool);
+static atomic_t ss_pg_pool_n = ATOMIC_INIT(0);
+
 /**
  * Get @skb's source address and port as a string, e.g. "127.0.0.1", "::1".
  *
@@ -63,6 +94,93 @@ ss_skb_fmt_src_addr(const struct sk_buff *skb, char *out_buf)
 	return tfw_addr_fmt(&addr, TFW_NO_PORT, out_buf);
 }
 
+/**
+ * Get a page from the per-CPU pool. Probe several pooled pages and take the
+ * first of them released by the network stack. If there is no such page,
+ * then allocate a new one and put it into the pool if there is room.
+ */
+static struct page *
+ss_skb_page_alloc(void)
+{
+	int i;
+	struct page *page;
+	SsPagePool *pp;
+
+	local_bh_disable();
+	pp = this_cpu_ptr(&ss_pg_pool);
+	spin_lock(&pp->lock);
+
+	for (i = 0; i < min_t(int, pp->n, SS_PG_POOL_PROBE); ++i) {
+		page = pp->pages[pp->cur];
+		if (++pp->cur >= pp->n)
+			pp->cur = 0;
+		/* Only the pool holds the page, nobody can get it. */
+		if (page_ref_count(page) == 1) {
+			get_page(page);
+			goto out;
+		}
+	}
+
+	page = alloc_pages_node(numa_mem_id(), GFP_ATOMIC, 0);
+	if (page && pp->n < SS_PG_POOL_SZ) {
+		get_page(page);
+		pp->pages[pp->n++] = page;
+		atomic_inc(&ss_pg_pool_n);
+	}
+out:
+	spin_unlock(&pp->lock);
+	local_bh_enable();
+
+	return page;
+}
+
+/*
+ * Release the pool references to the pages. The pages still being
+ * transmitted are freed by the network stack.
+ */
+static unsigned long
+ss_skb_page_pool_drain(SsPagePool *pp)
+{
+	unsigned long n;
+
+	spin_lock_bh(&pp->lock);
+	n = pp->n;
+	while (pp->n)
+		put_page(pp->pages[--pp->n]);
+	pp->cur = 0;
+	spin_unlock_bh(&pp->lock);
+	atomic_sub(n, &ss_pg_pool_n);
+
+	return n;
+}
+
+static unsigned long
+ss_skb_pool_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+	return atomic_read(&ss_pg_pool_n) ? : SHRINK_EMPTY;
+}
+
+static unsigned long
+ss_skb_pool_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+	int cpu;
+	unsigned long freed = 0;
+
+	for_each_possible_cpu(cpu) {
+		if (freed >= sc->nr_to_scan)
+			break;
+		freed += ss_skb_page_pool_drain(&per_cpu(ss_pg_pool, cpu));
+	}
+
+	return freed;
+}
+
+static struct shrinker ss_skb_pool_shrinker = {
+	.count_objects	= ss_skb_pool_count,
+	.scan_objects	= ss_skb_pool_scan,
+	.seeks		= DEFAULT_SEEKS,
+};
+
 /**
  * Allocate a new skb that can hold @len bytes of data.
  *
@@ -89,7 +207,7 @@ ss_skb_alloc_pages(size_t len)
 		return NULL;
 
 	for (i = 0; i < nr_frags; ++i) {
-		struct page *page = alloc_page(GFP_ATOMIC);
+		struct page *page = ss_skb_page_alloc();
 		if (!page) {
 			kfree_skb(skb);
 			return NULL;
@@ -1332,6 +1450,58 @@ ss_skb_split(struct sk_buff *skb, int len)
 	return buff;
 }
 
+/**
+ * Make a twin of @skb for transmission while @skb itself is kept by Tempesta,
+ * e.g. to re-send a request on a server connection failure.
+ *
+ * The twin is a small skb with room for the protocol headers only, which
+ * references the linear data and the fragments of @skb by its own fragments,
+ * so the payload isn't copied. Tempesta doesn't modify a message after it's
+ * sent, and the fragments are marked as shared, so TLS encrypts them into
+ * new pages and doesn't spoil the kept data.
+ *
+ * Fall back to a copy of the linear data if it isn't in a page fragment, or
+ * if there is no room for it in the fragments array.
+ */
+struct sk_buff *
+ss_skb_share(struct sk_buff *skb)
+{
+	int i, n = 0;
+	unsigned int headlen = skb_headlen(skb);
+	struct skb_shared_info *si = skb_shinfo(skb);
+	struct sk_buff *nskb;
+
+	if ((headlen && !skb->head_frag)
+	    || si->nr_frags + !!headlen > MAX_SKB_FRAGS
+	    || skb_has_frag_list(skb) || skb_zcopy(skb))
+		return pskb_copy_for_clone(skb, GFP_ATOMIC);
+
+	if (!(nskb = ss_skb_alloc(0)))
+		return NULL;
+
+	if (headlen) {
+		struct page *page = virt_to_head_page(skb->data);
+		unsigned int off = skb->data - (u8 *)page_address(page);
+
+		get_page(page);
+		skb_fill_page_desc(nskb, n++, page, off, headlen);
+	}
+	for (i = 0; i < si->nr_frags; ++i, ++n) {
+		skb_shinfo(nskb)->frags[n] = si->frags[i];
+		__skb_frag_ref(&si->frags[i]);
+	}
+	skb_shinfo(nskb)->nr_frags = n;
+	skb_shinfo(nskb)->tx_flags |= SKBTX_SHARED_FRAG;
+	ss_skb_adjust_data_len(nskb, skb->len);
+
+	/* Copy the same fields as pskb_copy_for_clone() does for us. */
+	memcpy(nskb->cb, skb->cb, sizeof(skb->cb));
+	nskb->mark = skb->mark;
+	skb_set_tfw_tls_type(nskb, skb_tfw_tls_type(skb));
+
+	return nskb;
+}
+
 /**
  * Tempesta FW forwards skbs with application and transport payload as is,
  * so initialize such skbs such that TCP/IP stack won't stumble on dirty
@@ -1683,29 +1853,23 @@ ss_skb_add_frag(struct sk_buff *skb_head, struct sk_buff **skb, char* addr,
 	return 0;
 }
 
-/* Using @split_point transform the remaining linear portion of original @skb
- * to the first fragment of the same SKB. Existing fragments of @skb
- * would moved to next SKB if necessary inside __split_linear_data().
- */
-int
-ss_skb_linear_transform(struct sk_buff *skb_head, struct sk_buff *skb,
-			unsigned char *split_point)
+int __init
+tfw_ss_skb_init(void)
 {
-	int fpos, r;
-	TfwStr _;
+	int cpu;
 
-	if (!split_point) {
-		/* Usage of linear portion of SKB is not expected */
-		ss_skb_put(skb, -skb_headlen(skb));
-		skb->tail_lock = 1;
-	} else {
-		unsigned int off = split_point - skb->data;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu(ss_pg_pool, cpu).lock);
 
-		r = __split_linear_data(skb_head, skb, split_point, 0, &_, &fpos);
-		if (unlikely(r))
-			return r;
-		ss_skb_put(skb, -off);
-	}
-	return 0;
+	return register_shrinker(&ss_skb_pool_shrinker);
 }
 
+void
+tfw_ss_skb_exit(void)
+{
+	int cpu;
+
+	unregister_shrinker(&ss_skb_pool_shrinker);
+	for_each_possible_cpu(cpu)
+		ss_skb_page_pool_drain(&per_cpu(ss_pg_pool, cpu));
+}
@@ -104,6 +104,8 @@ TEST_SUITE(mmap_buffer);
 
 extern int tfw_pool_init(void);
 extern void tfw_pool_exit(void);
+extern int tfw_ss_skb_init(void);
+extern void tfw_ss_skb_exit(void);
 
 int
 test_run_all(void)
@@ -112,6 +114,8 @@ test_run_all(void)
 
 	r = tfw_pool_init();
 	BUG_ON(r != 0);
+	r = tfw_ss_skb_init();
+	BUG_ON(r != 0);
 
 	test_fail_counter = 0;
 
@@ -164,6 +168,7 @@ test_run_all(void)
 
 	kernel_fpu_end();
 
+	tfw_ss_skb_exit();
 	tfw_pool_exit();
 
 	return test_fail_counter;
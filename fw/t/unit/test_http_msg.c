@@ -84,146 +84,246 @@ TEST(http_msg, hdr_in_array)
 	EXPECT_NOT_NULL(tfw_http_msg_find_hdr(&dup_hdr, hdrs));
 }
 
+/*
+ * Fill @skb with @nr_frags paged fragments referencing the same page
+ * with @data.
+ */
+static int
+__test_skb_fill_frags(struct sk_buff *skb, TfwStr *data,
+		      unsigned short nr_frags)
+{
+	struct page *page;
+	int i;
+
+	if (!(page = alloc_page(GFP_ATOMIC)))
+		return -ENOMEM;
+	memcpy(page_address(page), data->data, data->len);
+
+	for (i = 0; i < nr_frags; ++i) {
+		skb_fill_page_desc(skb, i, page, 0, data->len);
+		get_page(page);
+		ss_skb_adjust_data_len(skb, data->len);
+	}
+	put_page(page);
+
+	return 0;
+}
+
+/*
+ * Allocate a response with a single skb containing @head_data in linear
+ * data and @nr_frags paged fragments with @paged_data. The body starts at
+ * @body_off of the linear data.
+ */
 static TfwHttpResp *
 __test_resp_alloc(TfwStr *head_data, TfwStr *paged_data,
-		  unsigned short nr_frags)
+		  unsigned short nr_frags, unsigned int body_off)
 {
 	TfwMsgIter *it;
 	TfwHttpResp *hmresp;
 	struct sk_buff *skb;
-	struct page *page;
-	char *addr;
-	int i;
 
 	hmresp = (TfwHttpResp *)__tfw_http_msg_alloc(Conn_HttpSrv, true);
 	BUG_ON(!hmresp);
 
 	skb = ss_skb_alloc(head_data->len);
 	if (!skb)
-		return NULL;
+		goto err;
 
 	skb->next = skb->prev = skb;
+	hmresp->msg.skb_head = skb;
 	it = &hmresp->mit.iter;
 	it->skb = it->skb_head = skb;
 	it->frag = -1;
 
 	skb_put_data(skb, head_data->data, head_data->len);
+	if (__test_skb_fill_frags(skb, paged_data, nr_frags))
+		goto err;
 
-	if (nr_frags == 0)
-		return hmresp;
+	hmresp->body.data = skb->data + body_off;
+	hmresp->body.len = head_data->len - body_off
+			   + paged_data->len * nr_frags;
+	hmresp->body.skb = skb;
 
-	page = alloc_page(GFP_ATOMIC);
-	if (!page) {
-		kfree_skb(skb);
-		return NULL;
-	}
+	return hmresp;
+err:
+	tfw_http_msg_free((TfwHttpMsg *)hmresp);
+	return NULL;
+}
 
-	addr = page_address(page);
-	memcpy(addr, paged_data->data, paged_data->len);
+/*
+ * Insert an empty skb for new headers in front of the body as
+ * @tfw_h2_msg_cutoff_headers() does.
+ */
+static int
+__test_resp_hdrs_skb(TfwHttpResp *resp)
+{
+	TfwMsgIter *it = &resp->mit.iter;
+	struct sk_buff *skb = ss_skb_alloc(0);
 
-	for (i = 0; i < nr_frags; ++i) {
-		skb_fill_page_desc(skb, i, page, 0, paged_data->len);
-		ss_skb_adjust_data_len(skb, paged_data->len);
-	}
+	if (!skb)
+		return -ENOMEM;
 
-	return hmresp;
+	ss_skb_insert_before(&resp->msg.skb_head, it->skb, skb);
+	it->skb_head = it->skb = skb;
+	it->frag = -1;
+
+	return 0;
+}
+
+#define EXPECT_FRAGS_EQ_STR(skb, data)					\
+do {									\
+	int i;								\
+									\
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)	{		\
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];		\
+		char* addr = skb_frag_address(frag);			\
+		unsigned int fragsz = skb_frag_size(frag);		\
+									\
+		EXPECT_ZERO(memcmp(addr, data, fragsz));		\
+	}								\
+} while (0)
+
+/*
+ * Headers are pulled out of the linear data, the body stays in place, and
+ * an empty skb for the new headers is inserted in front of the body.
+ */
+TEST(http_msg, cutoff_headers)
+{
+#define S_HDRS	"HTTP/1.1 200 OK\r\ncontent-length: 31\r\n\r\n"
+	TfwStr head = TFW_STR_STRING(S_HDRS "linear_body");
+	TfwStr pgd = TFW_STR_STRING("paged_body");
+	TfwHttpResp *resp = __test_resp_alloc(&head, &pgd, 2, SLEN(S_HDRS));
+	TfwHttpRespCleanup cleanup = {};
+	struct sk_buff *skb;
+	TfwMsgIter *it;
+	char *body;
+
+	EXPECT_NOT_NULL(resp);
+	if (!resp)
+		return;
+
+	it = &resp->mit.iter;
+	skb = it->skb;
+	body = resp->body.data;
+	resp->crlf.data = body - 2;
+	resp->crlf.len = 2;
+
+	EXPECT_ZERO(tfw_h2_msg_cutoff_headers(resp, &cleanup));
+
+	/* The headers skb is empty and goes before the body. */
+	EXPECT_EQ(it->skb, resp->msg.skb_head);
+	EXPECT_EQ(it->skb_head, resp->msg.skb_head);
+	EXPECT_EQ(it->frag, -1);
+	EXPECT_ZERO(it->skb->len);
+	EXPECT_EQ(it->skb->next, skb);
+	EXPECT_EQ(skb->next, it->skb);
+
+	/* The body isn't shifted. */
+	EXPECT_EQ(skb->data, body);
+	EXPECT_EQ(skb_headlen(skb), SLEN("linear_body"));
+	EXPECT_ZERO(memcmp(skb->data, "linear_body", skb_headlen(skb)));
+	EXPECT_EQ(skb_shinfo(skb)->nr_frags, 2);
+	EXPECT_FRAGS_EQ_STR(skb, pgd.data);
+	EXPECT_EQ(resp->body.skb, skb);
+
+	/* Nothing to free: the headers data is still in the body skb. */
+	EXPECT_NULL(cleanup.skb_head);
+	EXPECT_ZERO(cleanup.pages_sz);
+
+	tfw_http_msg_free((TfwHttpMsg *)resp);
+#undef S_HDRS
 }
 
 /*
- * Tests correctness of using SKBs with linear data during allocating memory
- * using @tfw_http_msg_expand_from_pool().
+ * New headers are written by @tfw_http_msg_expand_from_pool() to paged
+ * fragments of the headers skb and the body skb isn't touched.
  */
 TEST(http_msg, expand_from_pool)
 {
-	static TfwStr frags[] = {
-		TFW_STR_STRING("headers"),
-		TFW_STR_STRING("linear_body"),
-		TFW_STR_STRING("paged_body")
-	};
-	TfwStr *hdr = &frags[0], *head = &frags[1], *pgd = &frags[2];
-	TfwHttpResp *resp = __test_resp_alloc(head, pgd, 1);
+	TfwStr head = TFW_STR_STRING("linear_body");
+	TfwStr pgd = TFW_STR_STRING("paged_body");
+	TfwStr hdr = TFW_STR_STRING("headers");
+	TfwHttpResp *resp = __test_resp_alloc(&head, &pgd, 1, 0);
+	struct sk_buff *skb;
 	TfwMsgIter *it;
-	int i;
 
 	EXPECT_NOT_NULL(resp);
 	if (!resp)
 		return;
 
 	it = &resp->mit.iter;
+	skb = it->skb;
 
-	EXPECT_FALSE(it->skb->data_len == head->len + hdr->len + pgd->len);
-	tfw_http_msg_expand_from_pool(resp, hdr);
-	/* Linear part MUST be moved to paged fragments */
+	EXPECT_ZERO(__test_resp_hdrs_skb(resp));
+	EXPECT_ZERO(tfw_http_msg_expand_from_pool(resp, &hdr));
+
+	EXPECT_EQ(it->skb, resp->msg.skb_head);
 	EXPECT_TRUE(!skb_headlen(it->skb));
+	EXPECT_EQ(it->skb->len, hdr.len);
+	EXPECT_FRAGS_EQ_STR(it->skb, hdr.data);
 
-	for (i = 0; i < ARRAY_SIZE(frags); i++) {
-		skb_frag_t *frag = &skb_shinfo(it->skb)->frags[i];
-		char* addr = skb_frag_address(frag);
-		unsigned int fragsz = skb_frag_size(frag);
+	/* The body skb is intact. */
+	EXPECT_EQ(it->skb->next, skb);
+	EXPECT_EQ(resp->body.skb, skb);
+	EXPECT_EQ(skb->len, head.len + pgd.len);
+	EXPECT_ZERO(memcmp(skb->data, head.data, skb_headlen(skb)));
+	EXPECT_EQ(skb_shinfo(skb)->nr_frags, 1);
+	EXPECT_FRAGS_EQ_STR(skb, pgd.data);
 
-		EXPECT_ZERO(memcmp(addr, frags[i].data, fragsz));
-	}
 	tfw_http_msg_free((TfwHttpMsg *)resp);
 }
 
 /*
- * Tests correctness of using SKBs with linear data and maximum fragments
- * during allocating memory using @tfw_http_msg_expand_from_pool().
+ * If the headers skb has maximum fragments, then a new skb for the rest of
+ * the headers is inserted by @tfw_http_msg_expand_from_pool() between the
+ * headers and the body, and the body fragments aren't moved.
  */
 TEST(http_msg, expand_from_pool_max_frags)
 {
 	TfwStr head = TFW_STR_STRING("linear_body");
 	TfwStr pgd = TFW_STR_STRING("paged_body");
 	TfwStr hdr = TFW_STR_STRING("headers");
-	TfwHttpResp *resp = __test_resp_alloc(&head, &pgd, MAX_SKB_FRAGS);
-	unsigned int skbsz = head.len + hdr.len + (pgd.len + MAX_SKB_FRAGS);
-	struct sk_buff *skb, *next;
+	TfwHttpResp *resp = __test_resp_alloc(&head, &pgd, MAX_SKB_FRAGS, 0);
+	struct sk_buff *skb, *hskb;
 	TfwMsgIter *it;
 
-#define EXPECT_FRAGS_EQ_STR(skb, data)					\
-do {									\
-	int i;								\
-									\
-	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)	{		\
-		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];		\
-		char* addr = skb_frag_address(frag);			\
-		unsigned int fragsz = skb_frag_size(frag);		\
-									\
-		EXPECT_ZERO(memcmp(addr, data, fragsz));		\
-	}								\
-} while (0)
-
 	EXPECT_NOT_NULL(resp);
 	if (!resp)
 		return;
 
 	it = &resp->mit.iter;
-
-	EXPECT_FALSE(it->skb->data_len == skbsz);
-	tfw_http_msg_expand_from_pool(resp, &hdr);
 	skb = it->skb;
-	next = it->skb->next;
 
-	/* Expected new skb without linear data. */
-	EXPECT_TRUE(!skb_headlen(skb));
+	EXPECT_ZERO(__test_resp_hdrs_skb(resp));
+	hskb = it->skb;
+	EXPECT_ZERO(__test_skb_fill_frags(hskb, &hdr, MAX_SKB_FRAGS));
+	it->frag = MAX_SKB_FRAGS - 1;
 
-	/* Current SKB must contain only one frag with "headers" */
-	EXPECT_FRAGS_EQ_STR(skb, hdr.data);
+	EXPECT_ZERO(tfw_http_msg_expand_from_pool(resp, &hdr));
+
+	/* The rest of the headers is in a new skb without linear data. */
+	EXPECT_EQ(hskb, resp->msg.skb_head);
+	EXPECT_EQ(hskb->next, it->skb);
+	EXPECT_TRUE(!skb_headlen(it->skb));
+	EXPECT_EQ(skb_shinfo(it->skb)->nr_frags, 1);
+	EXPECT_FRAGS_EQ_STR(it->skb, hdr.data);
+
+	/* The body skb is intact. */
+	EXPECT_EQ(it->skb->next, skb);
+	EXPECT_EQ(resp->body.skb, skb);
+	EXPECT_ZERO(memcmp(skb->data, head.data, skb_headlen(skb)));
+	EXPECT_EQ(skb_shinfo(skb)->nr_frags, MAX_SKB_FRAGS);
+	EXPECT_FRAGS_EQ_STR(skb, pgd.data);
 
-	/*
-	 * Next SKB must contain "linear_body" in linear data
-	 * and "paged_body" in each paged fragment.
-	 */
-	EXPECT_ZERO(memcmp(next->data, head.data, skb_headlen(next)));
-	EXPECT_FRAGS_EQ_STR(next, pgd.data);
 	tfw_http_msg_free((TfwHttpMsg *)resp);
+}
 
 #undef EXPECT_FRAGS_EQ_STR
-}
 
 TEST_SUITE(http_msg)
 {
 	TEST_RUN(http_msg, hdr_in_array);
+	TEST_RUN(http_msg, cutoff_headers);
 	TEST_RUN(http_msg, expand_from_pool);
 	TEST_RUN(http_msg, expand_from_pool_max_frags);
 }
@@ -65,6 +65,8 @@ typedef struct {
 
 static atomic_t active_prods;
 static atomic_t active_cons;
+/* Number of items pop()'ed by a consumer at once. */
+static int cons_batch = 1;
 
 static void
 tfw_test_wq_suite_setup(void)
@@ -111,14 +113,17 @@ static int
 tfw_test_wq_work_cons(void *data)
 {
 	while (atomic_read(&active_prods) || tfw_wq_size(wq)) {
-		TfwTestWork wq_item;
+		TfwTestWork wq_items[16];
+		int i, n;
 
 		schedule();
-		if (tfw_wq_pop(wq, &wq_item))
-			continue;
+		n = tfw_wq_pop_batch(wq, wq_items, cons_batch, NULL);
+		EXPECT_LE(n, cons_batch);
 
-		EXPECT_EQ(*wq_item.work, X_MISSED);
-		*wq_item.work = X_DONE;
+		for (i = 0; i < n; ++i) {
+			EXPECT_EQ(*wq_items[i].work, X_MISSED);
+			*wq_items[i].work = X_DONE;
+		}
 	}
 	atomic_dec(&active_cons);
 
@@ -308,6 +313,77 @@ TEST(wq, many_prod_one_con)
 	tfw_test_wq_test(n, 1);
 }
 
+TEST(wq, many_prod_one_con_batch)
+{
+	size_t n = num_online_cpus() < 32
+		? JOB_N * num_online_cpus()
+		: num_online_cpus();
+
+	cons_batch = 16;
+	tfw_test_wq_test(n, 1);
+	cons_batch = 1;
+}
+
+TEST(wq, resize)
+{
+	EXPECT_ZERO(tfw_wq_resize(wq, TFW_DFLT_QSZ * 2,
+				  cpu_to_node(smp_processor_id())));
+	EXPECT_EQ(wq->qsize, TFW_DFLT_QSZ * 2);
+	EXPECT_ZERO(tfw_wq_resize(wq, TFW_DFLT_QSZ,
+				  cpu_to_node(smp_processor_id())));
+	tfw_test_wq_test(1, 1);
+}
+
+/*
+ * A work spilled to a backlog on a full queue gets the queue head as its
+ * turnstile ticket, so all the works pushed before it must be fetched first,
+ * even if a producer is still writing one of them, and the works pushed after
+ * it must wait for the backlog.
+ */
+TEST(wq, pop_turn)
+{
+	int x[4] = { 0, 1, 2, 3 };
+	long head, turn, ticket;
+	atomic64_t *head_local;
+	TfwTestWork w[16];
+
+	w[0].work = &x[0];
+	EXPECT_ZERO(__tfw_wq_push(wq, &w[0]));
+	w[0].work = &x[1];
+	EXPECT_ZERO(__tfw_wq_push(wq, &w[0]));
+
+	/* A producer acquired the next position, but hasn't written it yet. */
+	local_bh_disable();
+	head_local = this_cpu_ptr(wq->heads);
+	head = atomic64_read(&wq->head);
+	atomic64_set(head_local, head);
+	atomic64_inc(&wq->head);
+	local_bh_enable();
+
+	/* The next work is spilled to the backlog. */
+	turn = atomic64_read(&wq->head);
+
+	EXPECT_EQ(tfw_wq_pop_turn(wq, w, 16, turn, &ticket), 2);
+	EXPECT_EQ(*w[0].work, 0);
+	EXPECT_EQ(*w[1].work, 1);
+	/* The backlog must wait for the acquired position. */
+	EXPECT_ZERO(tfw_wq_pop_turn(wq, w, 16, turn, &ticket));
+
+	w[0].work = &x[2];
+	memcpy(&wq->array[head & (wq->qsize - 1)], &w[0], WQ_ITEM_SZ);
+	atomic64_set(head_local, LONG_MAX);
+	w[0].work = &x[3];
+	EXPECT_ZERO(__tfw_wq_push(wq, &w[0]));
+
+	EXPECT_EQ(tfw_wq_pop_turn(wq, w, 16, turn, &ticket), 1);
+	EXPECT_EQ(*w[0].work, 2);
+	EXPECT_EQ(tfw_wq_pop_turn(wq, w, 16, turn, &ticket), -ENOENT);
+
+	/* The backlog is empty now. */
+	EXPECT_EQ(tfw_wq_pop_turn(wq, w, 16, LONG_MAX, &ticket), 1);
+	EXPECT_EQ(*w[0].work, 3);
+}
+
 TEST_SUITE(wq)
 {
 	TEST_SETUP(tfw_test_wq_suite_setup);
@@ -316,4 +392,7 @@ TEST_SUITE(wq)
 	/* The queue is MPSC queue, multiple consumers are not allowed. */
 	TEST_RUN(wq, one_prod_one_con);
 	TEST_RUN(wq, many_prod_one_con);
+	TEST_RUN(wq, many_prod_one_con_batch);
+	TEST_RUN(wq, resize);
+	TEST_RUN(wq, pop_turn);
 }
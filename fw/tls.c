@@ -24,6 +24,10 @@
 #define DEBUG DBG_TLS
 #endif
 
+#include <linux/kthread.h>
+#include <linux/vmalloc.h>
+#include <asm/fpu/api.h>
+
 #include "cfg.h"
 #include "connection.h"
 #include "client.h"
@@ -36,8 +40,10 @@
 #include "msg.h"
 #include "procfs.h"
 #include "tls.h"
+#include "tls_conf.h"
 #include "vhost.h"
 #include "tcp.h"
+#include "work_queue.h"
 
 /* Common tls configuration for all vhosts. */
 static TlsCfg tfw_tls_cfg;
@@ -205,12 +211,68 @@ next_msg:
 	return r;
 }
 
+/*
+ * Dynamic TLS record sizing. A receiver can't decrypt a record until all the
+ * TCP segments of the record arrive, so a large record delays the first
+ * bytes of a response, e.g. HTML head or HTTP/2 HEADERS, by one or more RTT
+ * while the congestion window is small. Send records fitting one segment at
+ * the connection start and after an idle period, which restarts the
+ * congestion window, and switch to records as large as TCP allows after
+ * TFW_TLS_DRS_BYTES to minimize the TLS overhead for bulk transfers.
+ */
+#define TFW_TLS_DRS_BYTES	(1 << 20)
+#define TFW_TLS_DRS_IDLE	HZ
+
+static unsigned int
+tfw_tls_record_limit(struct sock *sk, TfwTlsConn *conn, unsigned int mss_now,
+		     unsigned int overhead, unsigned int limit)
+{
+	/*
+	 * tcp_mtu_probe() passes the probe size as both @mss_now and @limit,
+	 * don't cut the probe.
+	 */
+	if (limit == mss_now || mss_now <= overhead)
+		return limit;
+
+	if (tcp_jiffies32 - tcp_sk(sk)->lsndtime > TFW_TLS_DRS_IDLE)
+		conn->drs_sent = 0;
+	if (conn->drs_sent >= TFW_TLS_DRS_BYTES)
+		return limit;
+
+	return min(limit, mss_now - overhead);
+}
+
+/**
+ * Cut @len bytes from the head of @skb to be encrypted as a separate TLS
+ * record and insert the rest into the socket write queue right after @skb.
+ */
+static int
+tfw_tls_skb_split(struct sock *sk, struct sk_buff *skb, unsigned int len,
+		  unsigned int mss_now)
+{
+	struct sk_buff *nskb;
+	unsigned int t_sz = skb->truesize;
+
+	if (!(nskb = ss_skb_split(skb, len)))
+		return -ENOMEM;
+
+	skb_copy_tfw_cb(nskb, skb);
+	/* tfw_tcp_setup_new_skb() moves FIN, if any, to @nskb. */
+	TCP_SKB_CB(skb)->end_seq = TCP_SKB_CB(skb)->seq + skb->len;
+	tfw_tcp_setup_new_skb(sk, skb, nskb, mss_now);
+	ss_add_overhead(sk, skb->truesize + nskb->truesize - t_sz);
+
+	return 0;
+}
+
 /**
  * The callback is called by tcp_write_xmit() if @skb must be encrypted by TLS.
  * @skb is current head of the TCP send queue. @limit defines how much data
  * can be sent right now with knowledge of current congestion and the receiver's
  * advertised window. Limit can be larger than skb->len and in this case we
  * can add the next skb in the send queue to the current encrypted TLS record.
+ * The limit is further reduced by the dynamic record sizing, so @skb can be
+ * split to fit the record.
  *
  * We extend the skbs on TCP transmission (when CWND is calculated), so we
  * also adjust TCP sequence numbers in the socket. See skb_entail().
@@ -227,7 +289,7 @@ tfw_tls_encrypt(struct sock *sk, struct sk_buff *skb, unsigned int mss_now,
 #define MAX_SEG_N	64
 
 	int r = -ENOMEM;
-	unsigned int head_sz, len, frags, t_sz, out_frags, next_nents;
+	unsigned int head_sz, len, frags, t_sz, out_frags, next_nents, aad_pre;
 	unsigned char type;
 	struct sk_buff *next = skb, *skb_tail = skb;
 	struct tcp_skb_cb *tcb = TCP_SKB_CB(skb);
@@ -242,8 +304,9 @@ tfw_tls_encrypt(struct sock *sk, struct sk_buff *skb, unsigned int mss_now,
 	struct scatterlist sg[AUTO_SEGS_N], out_sg[AUTO_SEGS_N];
 	struct page **pages = NULL, **pages_end, **p;
 	struct page *auto_pages[AUTO_SEGS_N];
+	TfwTlsConn *conn = sk->sk_user_data;
 
-	tls = tfw_tls_context(sk->sk_user_data);
+	tls = &conn->tls;
 	io = &tls->io_out;
 	xfrm = &tls->xfrm;
 
@@ -260,7 +323,6 @@ tfw_tls_encrypt(struct sock *sk, struct sk_buff *skb, unsigned int mss_now,
 		     != tcb->end_seq);
 
 	head_sz = ttls_payload_off(xfrm);
-	len = skb->len;
 	type = skb_tfw_tls_type(skb);
 	/* Checked early before call this function. */
 	if ((WARN_ON_ONCE(!type))) {
@@ -268,6 +330,15 @@ tfw_tls_encrypt(struct sock *sk, struct sk_buff *skb, unsigned int mss_now,
 		goto out;
 	}
 
+	limit = tfw_tls_record_limit(sk, conn, mss_now, head_sz + TTLS_TAG_LEN,
+				     limit);
+	/* Just send a larger record if we can't split the skb. */
+	if (skb->len > limit && !tfw_tls_skb_split(sk, skb, limit, mss_now)) {
+		sgt.nents = skb_shinfo(skb)->nr_frags + !!skb_headlen(skb);
+		out_sgt.nents = sgt.nents;
+	}
+	len = skb->len;
+
 	/* TLS header is always allocated from the skb headroom. */
 	tcb->end_seq += head_sz;
 
@@ -457,6 +528,24 @@ tfw_tls_encrypt(struct sock *sk, struct sk_buff *skb, unsigned int mss_now,
 	}
 	WARN_ON_ONCE(sgt.nents != frags);
 
+	/*
+	 * If there is no explicit IV, then the AAD sequence number doesn't
+	 * fit the record head. Borrow the bytes just before the record header
+	 * from the skb headroom: they're overwritten by TCP/IP headers later.
+	 */
+	if ((aad_pre = ttls_aad_prefix_len(xfrm))) {
+		if (WARN_ON_ONCE(skb_headroom(skb) < aad_pre
+				 || sg_virt(sgt.sgl) != skb->data))
+		{
+			r = -EINVAL;
+			goto free_pages;
+		}
+		sg_set_buf(sgt.sgl, skb->data - aad_pre,
+			   sgt.sgl->length + aad_pre);
+		sg_set_buf(out_sgt.sgl, skb->data - aad_pre,
+			   out_sgt.sgl->length + aad_pre);
+	}
+
 	spin_lock(&tls->lock);
 
 	/* Set IO context under the lock before encryption. */
@@ -467,6 +556,9 @@ tfw_tls_encrypt(struct sock *sk, struct sk_buff *skb, unsigned int mss_now,
 
 	spin_unlock(&tls->lock);
 
+	if (!r && conn->drs_sent < TFW_TLS_DRS_BYTES)
+		conn->drs_sent += len - head_sz - TTLS_TAG_LEN;
+
 free_pages:
 	for (p = pages; p < pages_end; ++p)
 		put_page(*p);
@@ -677,6 +769,7 @@ tfw_tls_conn_init(TfwConn *c)
 	BUG_ON(!(c->proto.type & TFW_FSM_HTTPS));
 
 	tls = tfw_tls_context(c);
+	((TfwTlsConn *)c)->drs_sent = 0;
 	if ((r = ttls_ctx_init(tls, &tfw_tls_cfg))) {
 		T_ERR("TLS (%pK) setup failed (%x)\n", tls, -r);
 		return -EINVAL;
@@ -842,48 +935,13 @@ tfw_tls_get_if_configured(TfwVhost *vhost)
 			  T_WARN("client %s requested " fmt, addr_str,	\
 				 ## __VA_ARGS__))
 
-static int
-fw_tls_apply_sni_wildcard(BasicStr *name)
-{
-	int n;
-	char *p = strnchr(name->data, name->len, '.');
-	if (!p)
-		return -ENOENT;
-	n = name->data + name->len - p;
-
-	/* The resulting name must be lower than a top level domain. */
-	if (n < 2)
-		return -ENOENT;
-
-	/*
-	 * Store leading dot to match against chopped wildcard (see
-	 * tfw_tls_add_cn()) and do not confuse the name with a CN.
-	 */
-	name->data = p;
-	name->len = n;
-
-	return 0;
-}
-
+/**
+ * Resolve the lower case server name into a vhost by exact or wildcard SANs.
+ */
 TfwVhost*
 tfw_tls_find_vhost_by_name(BasicStr *srv_name)
 {
-	TfwVhost *vhost;
-
-	/* Look for non-wildcard name */
-	vhost = tfw_vhost_lookup_sni(srv_name);
-	if (vhost)
-		return vhost;
-
-	/*
-	 * Try wildcard SANs if the SNI requests 2nd-level or
-	 * lower domain.
-	 */
-	if (!vhost && !fw_tls_apply_sni_wildcard(srv_name)
-	    && (vhost = tfw_vhost_lookup_sni(srv_name)))
-		return vhost;
-
-	return NULL;
+	return tfw_vhost_lookup_sni(srv_name);
 }
 
 /**
@@ -960,6 +1018,273 @@ tfw_tls_sni(TlsCtx *ctx, const unsigned char *data, size_t len)
 	return 0;
 }
 
+static unsigned long
+ttls_cli_id(TlsCtx *tls, unsigned long hash)
+{
+	TfwCliConn *cli_conn = &container_of(tls, TfwTlsConn, tls)->cli_conn;
+
+	return hash_calc_update((const char *)&cli_conn->peer->addr.sin6_addr,
+				sizeof(cli_conn->peer->addr.sin6_addr), hash);
+}
+
+/*
+ * ------------------------------------------------------------------------
+ *	Session cache.
+ * ------------------------------------------------------------------------
+ */
+/*
+ * Server-side cache of TLS sessions identified by session IDs (RFC 5246
+ * 7.4.1.2) for clients which don't support session tickets. The cache is
+ * shared by all CPUs. The entries keep master secrets, so the cache lives in
+ * memory only and the secrets are wiped as soon as an entry is evicted.
+ *
+ * The number of entries is fixed on start. Like the client LRU list in
+ * client.c, new sessions are added to the head of the list of used entries
+ * and the last one is evicted if there are no free entries. All the sessions
+ * have the same lifetime, so the list is also (almost) ordered by expiration
+ * time and expired entries are evicted from the tail on each insertion.
+ *
+ * To not serialize handshakes of all the CPUs on one lock, the hash table is
+ * split into lock stripes by the lowest bits of the bucket index. Each stripe
+ * has its own share of the entries and its own used and free lists, so the
+ * eviction order is kept per stripe. Session IDs are random, so the stripes
+ * are loaded evenly.
+ */
+static struct {
+	unsigned int	tbl_size;
+	unsigned int	lifetime;
+} sess_cache_cfg __read_mostly;
+
+/**
+ * TLS session cache entry.
+ *
+ * @hlist		- the hash table bucket list;
+ * @list		- the used or free entries list;
+ * @start		- the session start time, seconds since the Epoch;
+ * @cli_hash		- client and server name the session is bound to,
+ *			  see ttls_cli_id();
+ * @etm			- Encrypt-then-MAC is negotiated for the session;
+ * @ciphersuite		- negotiated ciphersuite;
+ * @id			- session ID;
+ * @master		- the master secret;
+ */
+typedef struct {
+	struct hlist_node	hlist;
+	struct list_head	list;
+	long			start;
+	unsigned long		cli_hash;
+	int			etm;
+	unsigned short		ciphersuite;
+	unsigned char		id[TTLS_SESS_ID_LEN];
+	unsigned char		master[TTLS_SESS_SECRET_LEN];
+} TfwTlsSessEntry;
+
+/* Maximum number of the session cache lock stripes, a power of 2. */
+#define TFW_TLS_SESS_STRIPES	64
+
+/**
+ * TLS session cache lock stripe.
+ *
+ * @used	- used entries of the stripe, the most recent first;
+ * @free	- free entries of the stripe;
+ * @lock	- protects the lists and the hash buckets of the stripe;
+ */
+typedef struct {
+	struct list_head	used;
+	struct list_head	free;
+	spinlock_t		lock;
+} ____cacheline_aligned_in_smp TfwTlsSessStripe;
+
+/**
+ * TLS session cache.
+ *
+ * @ents	- all the entries;
+ * @htbl	- hash table of used entries by session ID;
+ * @n		- number of entries;
+ * @hmask	- hash table mask, the table size is a power of 2;
+ * @smask	- lock stripes mask, the bucket index bits choosing a stripe;
+ * @stripes	- lock stripes;
+ */
+static struct {
+	TfwTlsSessEntry		*ents;
+	struct hlist_head	*htbl;
+	unsigned int		n;
+	unsigned int		hmask;
+	unsigned int		smask;
+	TfwTlsSessStripe	stripes[TFW_TLS_SESS_STRIPES];
+} sess_cache;
+
+static inline unsigned long
+tfw_tls_sess_cache_key(const unsigned char *id)
+{
+	unsigned long key = hash_calc((const char *)id, TTLS_SESS_ID_LEN);
+
+	return key & sess_cache.hmask;
+}
+
+static inline TfwTlsSessStripe *
+tfw_tls_sess_cache_stripe(unsigned long key)
+{
+	return &sess_cache.stripes[key & sess_cache.smask];
+}
+
+static inline bool
+tfw_tls_sess_cache_expired(const TfwTlsSessEntry *e, long now)
+{
+	return e->start + sess_cache_cfg.lifetime < now;
+}
+
+static void
+tfw_tls_sess_cache_evict(TfwTlsSessStripe *st, TfwTlsSessEntry *e)
+{
+	hlist_del(&e->hlist);
+	list_move(&e->list, &st->free);
+	memzero_explicit(e->master, TTLS_SESS_SECRET_LEN);
+}
+
+/**
+ * Store a new full handshake session. Sessions with client certificates
+ * aren't cached since the certificate chain can not be restored.
+ */
+static void
+tfw_tls_sess_cache_put(TlsCtx *tls)
+{
+	TlsSess *sess = &tls->sess;
+	TfwTlsSessEntry *e, *tmp;
+	TfwTlsSessStripe *st;
+	unsigned long key;
+	long now = ktime_get_real_seconds();
+
+	if (!sess_cache.ents || sess->id_len != TTLS_SESS_ID_LEN
+	    || sess->peer_cert)
+		return;
+
+	key = tfw_tls_sess_cache_key(sess->id);
+	st = tfw_tls_sess_cache_stripe(key);
+
+	spin_lock(&st->lock);
+
+	list_for_each_entry_safe_reverse(e, tmp, &st->used, list) {
+		if (!tfw_tls_sess_cache_expired(e, now))
+			break;
+		tfw_tls_sess_cache_evict(st, e);
+	}
+	if (list_empty(&st->free)) {
+		e = list_last_entry(&st->used, TfwTlsSessEntry, list);
+		tfw_tls_sess_cache_evict(st, e);
+	}
+
+	e = list_first_entry(&st->free, TfwTlsSessEntry, list);
+	e->start = sess->start;
+	e->cli_hash = ttls_cli_id(tls, tls->sni_hash);
+	e->etm = sess->etm;
+	e->ciphersuite = sess->ciphersuite;
+	memcpy_fast(e->id, sess->id, TTLS_SESS_ID_LEN);
+	memcpy_fast(e->master, sess->master, TTLS_SESS_SECRET_LEN);
+	hlist_add_head(&e->hlist, &sess_cache.htbl[key]);
+	list_move(&e->list, &st->used);
+
+	spin_unlock(&st->lock);
+}
+
+/**
+ * Called by the TLS library on ClientHello with a session ID and without a
+ * valid session ticket. Restore the session if it's found in the cache, is
+ * still alive and belongs to the same client and server name, like for
+ * session tickets. The client session ID and JA5t fingerprint are kept.
+ * An expired entry is evicted on lookup.
+ */
+static bool
+tfw_tls_sess_cache_get(TlsCtx *tls)
+{
+	TlsSess *sess = &tls->sess;
+	TfwTlsSessEntry *e;
+	TfwTlsSessStripe *st;
+	unsigned long cli_hash, key;
+	long now = ktime_get_real_seconds();
+	bool hit = false;
+
+	if (!sess_cache.ents)
+		return false;
+
+	cli_hash = ttls_cli_id(tls, tls->sni_hash);
+	key = tfw_tls_sess_cache_key(sess->id);
+	st = tfw_tls_sess_cache_stripe(key);
+
+	spin_lock(&st->lock);
+	hlist_for_each_entry(e, &sess_cache.htbl[key], hlist) {
+		if (memcmp_fast(e->id, sess->id, TTLS_SESS_ID_LEN))
+			continue;
+		if (tfw_tls_sess_cache_expired(e, now)) {
+			tfw_tls_sess_cache_evict(st, e);
+		} else if (e->cli_hash == cli_hash) {
+			sess->start = e->start;
+			sess->etm = e->etm;
+			sess->ciphersuite = e->ciphersuite;
+			memcpy_fast(sess->master, e->master,
+				    TTLS_SESS_SECRET_LEN);
+			hit = true;
+		}
+		break;
+	}
+	spin_unlock(&st->lock);
+
+	if (hit)
+		TFW_INC_STAT_BH(serv.tls_sess_cache_hits);
+	else
+		TFW_INC_STAT_BH(serv.tls_sess_cache_misses);
+
+	return hit;
+}
+
+static int
+tfw_tls_sess_cache_start(void)
+{
+	unsigned int i, n, hsz;
+
+	if (!sess_cache_cfg.lifetime)
+		return 0;
+
+	n = sess_cache_cfg.tbl_size
+	    / (sizeof(TfwTlsSessEntry) + sizeof(struct hlist_head));
+	hsz = rounddown_pow_of_two(n);
+	if (!(sess_cache.ents = vzalloc(n * sizeof(TfwTlsSessEntry))))
+		return -ENOMEM;
+	if (!(sess_cache.htbl = vzalloc(hsz * sizeof(struct hlist_head)))) {
+		vfree(sess_cache.ents);
+		sess_cache.ents = NULL;
+		return -ENOMEM;
+	}
+	sess_cache.n = n;
+	sess_cache.hmask = hsz - 1;
+	sess_cache.smask = min_t(unsigned int, hsz, TFW_TLS_SESS_STRIPES) - 1;
+	for (i = 0; i <= sess_cache.smask; i++) {
+		TfwTlsSessStripe *st = &sess_cache.stripes[i];
+
+		spin_lock_init(&st->lock);
+		INIT_LIST_HEAD(&st->used);
+		INIT_LIST_HEAD(&st->free);
+	}
+	for (i = 0; i < n; i++)
+		list_add(&sess_cache.ents[i].list,
+			 &sess_cache.stripes[i & sess_cache.smask].free);
+
+	return 0;
+}
+
+static void
+tfw_tls_sess_cache_stop(void)
+{
+	if (!sess_cache.ents)
+		return;
+
+	kvfree_sensitive(sess_cache.ents,
+			 sess_cache.n * sizeof(TfwTlsSessEntry));
+	sess_cache.ents = NULL;
+	vfree(sess_cache.htbl);
+	sess_cache.htbl = NULL;
+}
+
 static inline int
 tfw_tls_over(TlsCtx *tls, int state)
 {
@@ -970,6 +1295,8 @@ tfw_tls_over(TlsCtx *tls, int state)
 	if (state == TTLS_HS_CB_FINISHED_NEW
 	    || state == TTLS_HS_CB_FINISHED_RESUMED)
 		TFW_INC_STAT_BH(serv.tls_hs_successful);
+	if (state == TTLS_HS_CB_FINISHED_NEW)
+		tfw_tls_sess_cache_put(tls);
 
 	if (TFW_FSM_TYPE(sk_proto) == TFW_FSM_H2 &&
 	    ((r = tfw_h2_context_init(tfw_h2_context_unsafe(conn))))) {
@@ -980,15 +1307,6 @@ tfw_tls_over(TlsCtx *tls, int state)
 	return frang_tls_handler(tls, state);
 }
 
-static unsigned long
-ttls_cli_id(TlsCtx *tls, unsigned long hash)
-{
-	TfwCliConn *cli_conn = &container_of(tls, TfwTlsConn, tls)->cli_conn;
-
-	return hash_calc_update((const char *)&cli_conn->peer->addr.sin6_addr,
-				sizeof(cli_conn->peer->addr.sin6_addr), hash);
-}
-
 bool
 tfw_tls_alpn_match(const TlsCtx *tls, const ttls_alpn_proto *alpn)
 {
@@ -1031,6 +1349,230 @@ tfw_ja5t_limit_rec(TlsJa5t fingerprint)
 	return rate > limit;
 }
 
+/*
+ * ------------------------------------------------------------------------
+ *	Handshake offloading.
+ * ------------------------------------------------------------------------
+ */
+/*
+ * Per-CPU bound of deferred handshakes. A queued handshake waits for all the
+ * previous ones, so keep the queue short enough to not exceed client
+ * handshake timeouts with slow RSA keys. If the queue is full, then the
+ * handshake is just processed in softirq.
+ */
+#define TFW_TLS_HS_QSZ		512
+
+/**
+ * A handshake waiting for the server flight.
+ * @conn	- client connection, the reference is held while the work is
+ *		  queued;
+ */
+typedef struct {
+	TfwConn		*conn;
+	unsigned long	__unused[3];
+} TfwTlsHsWork;
+
+/**
+ * Per-CPU handshake worker.
+ * @thr		- kernel thread bound to the CPU;
+ * @wq		- queue of deferred handshakes;
+ */
+typedef struct {
+	struct task_struct	*thr;
+	TfwRBQueue		wq;
+} TfwTlsHsWorker;
+
+static bool tfw_tls_hs_offload;
+static DEFINE_PER_CPU(TfwTlsHsWorker, tls_hs_worker);
+
+/**
+ * Called by the TLS library in softirq after ClientHello of a full handshake
+ * to move the asymmetric cryptography of the server flight to the worker
+ * thread of current CPU. Softirqs for established connections don't wait
+ * for the signing and ephemeral key generation then.
+ *
+ * The worker of the same CPU is used since the socket is processed by the CPU
+ * and the per-CPU handshake state, e.g. MPI pools statistics, is kept local.
+ */
+static bool
+tfw_tls_hs_defer(TlsCtx *tls)
+{
+	TfwTlsHsWorker *w = this_cpu_ptr(&tls_hs_worker);
+	TfwTlsHsWork hw = {
+		.conn = (TfwConn *)container_of(tls, TfwTlsConn, tls)
+	};
+	struct task_struct *thr = READ_ONCE(w->thr);
+
+	if (!thr)
+		return false;
+
+	tfw_connection_get(hw.conn);
+	if (__tfw_wq_push(&w->wq, &hw)) {
+		/* The caller holds a reference, so it's not the last one. */
+		tfw_connection_put(hw.conn);
+		T_DBG2("TLS handshake queue is full on CPU%d\n",
+		       smp_processor_id());
+		return false;
+	}
+	wake_up_process(thr);
+
+	return true;
+}
+
+/**
+ * Compute, write and send the deferred server flight of one handshake.
+ *
+ * The ServerKeyExchange signature and the ephemeral key generation (see
+ * tls/t/benchmark.c for the costs) run with softirqs enabled: the worker has
+ * its own FPU section, which softirqs save and restore if they interrupt it,
+ * and the TLS library uses the process context per-CPU MPI pool for it, see
+ * ttls_handshake_prepare(). Only preemption is disabled for the computations.
+ *
+ * Writing and sending the flight holds @tls->lock, which is taken by softirq
+ * without disabling BH, and uses the FPU, so softirqs of the CPU are delayed
+ * just for the flight copying to the socket. Connection closing and the
+ * statistics don't need the FPU, so they're done out of the window.
+ */
+static void
+tfw_tls_hs_resume(TfwConn *conn)
+{
+	int r = 0;
+	TlsCtx *tls = tfw_tls_context(conn);
+
+	/* Don't waste CPU on connections closed while the work was queued. */
+	if (unlikely(!ss_sock_live(conn->sk)))
+		goto out;
+
+	kernel_fpu_begin_task();
+	r = ttls_handshake_prepare(tls);
+	kernel_fpu_end_task();
+
+	if (likely(!r)) {
+		kernel_fpu_begin();
+		local_bh_disable();
+
+		spin_lock(&tls->lock);
+		if (likely(ss_sock_live(conn->sk)))
+			r = ttls_handshake_resume(tls);
+		spin_unlock(&tls->lock);
+
+		local_bh_enable();
+		kernel_fpu_end();
+	}
+out:
+	local_bh_disable();
+	if (unlikely(r)) {
+		T_DBG("TLS deferred handshake failed (%d) on conn=%pK\n",
+		      r, conn);
+		TFW_INC_STAT_BH(serv.tls_hs_failed);
+		tfw_connection_close(conn, true);
+	}
+	tfw_connection_put(conn);
+	local_bh_enable();
+}
+
+/**
+ * The worker runs with the lowest priority: softirqs of established
+ * connections preempt it anyway and ksoftirqd, if softirqs are punted to it,
+ * takes precedence. Softirqs are disabled only to write and send a server
+ * flight, see tfw_tls_hs_resume(), and the queue length bounds how long a
+ * handshake waits for its flight.
+ */
+static int
+tfw_tls_hs_thread(void *data)
+{
+	TfwTlsHsWorker *w = data;
+	TfwTlsHsWork hw;
+
+	set_user_nice(current, MAX_NICE);
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!tfw_wq_size(&w->wq)) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		while (!tfw_wq_pop(&w->wq, &hw)) {
+			tfw_tls_hs_resume(hw.conn);
+			cond_resched();
+		}
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static void
+tfw_tls_hs_worker_stop(int cpu)
+{
+	TfwTlsHsWorker *w = per_cpu_ptr(&tls_hs_worker, cpu);
+	struct task_struct *thr = w->thr;
+	TfwTlsHsWork hw;
+
+	if (!thr)
+		return;
+	WRITE_ONCE(w->thr, NULL);
+	kthread_stop(thr);
+
+	/* All the connections are closed, just release them. */
+	local_bh_disable();
+	while (!tfw_wq_pop(&w->wq, &hw))
+		tfw_connection_put(hw.conn);
+	local_bh_enable();
+
+	tfw_wq_destroy(&w->wq);
+}
+
+static int
+tfw_tls_hs_worker_start(int cpu)
+{
+	int r;
+	struct task_struct *thr;
+	TfwTlsHsWorker *w = per_cpu_ptr(&tls_hs_worker, cpu);
+
+	if ((r = tfw_wq_init(&w->wq, TFW_TLS_HS_QSZ, cpu_to_node(cpu))))
+		return r;
+
+	thr = kthread_create_on_cpu(tfw_tls_hs_thread, w, cpu, "tfw_tls_hs/%u");
+	if (IS_ERR(thr)) {
+		tfw_wq_destroy(&w->wq);
+		return PTR_ERR(thr);
+	}
+	wake_up_process(thr);
+	WRITE_ONCE(w->thr, thr);
+
+	return 0;
+}
+
+static void
+tfw_tls_hs_workers_stop(void)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu)
+		tfw_tls_hs_worker_stop(cpu);
+}
+
+static int
+tfw_tls_hs_workers_start(void)
+{
+	int cpu, r;
+
+	TFW_WQ_CHECKSZ(TfwTlsHsWork);
+	for_each_online_cpu(cpu) {
+		if ((r = tfw_tls_hs_worker_start(cpu))) {
+			T_ERR_NL("TLS: can't start handshake worker for"
+				 " CPU #%d (%d)\n", cpu, r);
+			tfw_tls_hs_workers_stop();
+			return r;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * ------------------------------------------------------------------------
  *	TLS library configuration.
@@ -1174,12 +1716,14 @@ tfw_tls_cfgend(void)
 		return -EINVAL;
 	}
 
-	return 0;
+	/* Serialize the static handshake data once for all the handshakes. */
+	return ttls_config_hs_prepare(&tfw_tls_cfg);
 }
 
 static int
 tfw_tls_start(void)
 {
+	int r;
 	u64 storage_size = tls_get_ja5_storage_size();
 
 	tfw_tls_allow_any_sni = allow_any_sni_reconfig;
@@ -1187,7 +1731,28 @@ tfw_tls_start(void)
 	if (storage_size && !ja5t_init_filter(storage_size))
 		return -ENOMEM;
 
-	return 0;
+	tfw_tls_tickets_start();
+
+	if (tfw_runstate_is_reconfig())
+		return 0;
+
+	if ((r = tfw_tls_sess_cache_start()))
+		return r;
+	if (tfw_tls_hs_offload && (r = tfw_tls_hs_workers_start()))
+		tfw_tls_sess_cache_stop();
+
+	return r;
+}
+
+static void
+tfw_tls_stop(void)
+{
+	if (tfw_runstate_is_reconfig())
+		return;
+
+	tfw_tls_tickets_stop();
+	tfw_tls_hs_workers_stop();
+	tfw_tls_sess_cache_stop();
 }
 
 bool
@@ -1211,6 +1776,35 @@ static TfwCfgSpec tfw_tls_specs[] = {
 		.allow_repeat = false,
 		.allow_reconfig = true,
 	},
+	{
+		.name = "tls_hs_offload",
+		.deflt = "false",
+		.handler = tfw_cfg_set_bool,
+		.dest = &tfw_tls_hs_offload,
+		.allow_none = true,
+		.allow_repeat = false,
+	},
+	{
+		.name = "tls_sess_cache_lifetime",
+		.deflt = "0",
+		.handler = tfw_cfg_set_int,
+		.dest = &sess_cache_cfg.lifetime,
+		.spec_ext = &(TfwCfgSpecInt) {
+			.range = { 0, 86400 },
+		},
+		.allow_none = true,
+		.allow_repeat = false,
+	},
+	{
+		.name = "tls_sess_cache_tbl_size",
+		.deflt = "16M",
+		.handler = tfw_cfg_set_mem,
+		.dest = &sess_cache_cfg.tbl_size,
+		.spec_ext = &(TfwCfgSpecMem) {
+			.multiple_of = "4K",
+			.range = { "4K", "1G" },
+		}
+	},
 	{ 0 }
 };
 
@@ -1219,6 +1813,7 @@ TfwMod tfw_tls_mod = {
 	.cfgend		= tfw_tls_cfgend,
 	.cfgstart	= tfw_tls_cfgstart,
 	.start		= tfw_tls_start,
+	.stop		= tfw_tls_stop,
 	.specs		= tfw_tls_specs,
 };
 
@@ -1239,7 +1834,8 @@ tfw_tls_init(void)
 
 	ttls_register_callbacks(tfw_tls_send, tfw_tls_sni, tfw_tls_over,
 				ttls_cli_id, tfw_tls_alpn_match,
-				tfw_ja5t_limit_conn, tfw_ja5t_limit_rec);
+				tfw_ja5t_limit_conn, tfw_ja5t_limit_rec,
+				tfw_tls_hs_defer, tfw_tls_sess_cache_get);
 
 	if ((r = tfw_h2_init()))
 		goto err_h2;
@@ -1,7 +1,7 @@
 /**
  *		Tempesta FW
  *
- * Copyright (C) 2019-2024 Tempesta Technologies, Inc.
+ * Copyright (C) 2019-2026 Tempesta Technologies, Inc.
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -17,6 +17,11 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <linux/hashtable.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <crypto/sha.h>
+
 #include "tls_conf.h"
 #include "tls.h"
 #include "vhost.h"
@@ -26,11 +31,66 @@
 #define TFW_TLS_CFG_F_CKEY	2U
 
 #define TLS_CONF_CERT_NUM	8
+#define TLS_CERTS_HASH_BITS	10
+/* How often the ticket keys files are checked for updates. */
+#define TLS_TICKET_FILE_POLL	(10 * HZ)
 
+/**
+ * Certificate chain with its private key. The pair is parsed once by a worker
+ * and is shared by all the configurations using the same certificate and key
+ * files, so unchanged certificates aren't parsed again on reconfiguration.
+ *
+ * @hlist	- entry in the certificates cache;
+ * @refcnt	- number of the configured certificates referencing the entry;
+ * @crt_err	- certificate parsing error;
+ * @key_err	- private key parsing error;
+ * @digest	- SHA-256 of the certificate and the key files contents;
+ * @work	- the parsing work;
+ * @crt_data	- certificate file contents, freed after the parsing;
+ * @key_data	- private key file contents, freed after the parsing;
+ * @crt_size	- size of @crt_data;
+ * @key_size	- size of @key_data;
+ * @crt		- the parsed certificate chain;
+ * @key		- the parsed private key.
+ */
+typedef struct {
+	struct hlist_node	hlist;
+	unsigned int		refcnt;
+	int			crt_err;
+	int			key_err;
+	unsigned char		digest[SHA256_DIGEST_SIZE];
+	struct work_struct	work;
+	void			*crt_data;
+	void			*key_data;
+	size_t			crt_size;
+	size_t			key_size;
+	TlsX509Crt		crt;
+	TlsPkCtx		key;
+} TfwTlsCert;
+
+/**
+ * Certificate configured for a vhost.
+ *
+ * @cert	- the parsed certificate and key, NULL until the key directive;
+ * @vhost	- the vhost owning the certificate;
+ * @list	- entry in the list of certificates waiting for the parsing;
+ * @crt_path	- certificate file path for the configuration messages;
+ * @crt_data	- certificate file contents until the key directive;
+ * @crt_size	- size of @crt_data;
+ * @ocsp_data	- stapled OCSP response file contents until the parsing;
+ * @ocsp_size	- size of @ocsp_data;
+ * @conf_stage	- configuration directives seen for the certificate.
+ */
 typedef struct {
-	TlsX509Crt	crt;
-	TlsPkCtx	key;
-	unsigned int	conf_stage;
+	TfwTlsCert		*cert;
+	TfwVhost		*vhost;
+	struct list_head	list;
+	char			*crt_path;
+	void			*crt_data;
+	size_t			crt_size;
+	void			*ocsp_data;
+	size_t			ocsp_size;
+	unsigned int		conf_stage;
 } TlsCertConf;
 
 typedef struct {
@@ -39,11 +99,281 @@ typedef struct {
 	unsigned int	init_done:1;
 } TlsConfEntry;
 
+/*
+ * Parsed certificates of the current and the new configurations. The cache
+ * is accessed in process context on configuration, but a vhost of the old
+ * configuration can be freed from softirq.
+ */
+static DEFINE_HASHTABLE(tfw_tls_certs, TLS_CERTS_HASH_BITS);
+static DEFINE_SPINLOCK(tfw_tls_certs_lock);
+/*
+ * Certificates of the new configuration, which are being parsed by the
+ * workers. Accessed from the configuration process context only.
+ */
+static LIST_HEAD(tfw_tls_certs_pending);
+
+/**
+ * Ticket keys file written by an external key rotation service.
+ *
+ * @list	- entry in the list of the ticket keys files;
+ * @path	- the file path;
+ * @keys	- the keys shared by all the vhosts configured with the file;
+ * @digest	- SHA-256 of the loaded file contents;
+ * @used	- the file is used by the configuration being loaded.
+ */
+typedef struct {
+	struct list_head	list;
+	char			*path;
+	TlsTicketKeys		*keys;
+	unsigned char		digest[SHA256_DIGEST_SIZE];
+	bool			used;
+} TfwTlsTicketFile;
+
+/*
+ * Ticket keys files of the current and the new configurations. The files are
+ * re-read periodically and on each configuration reload, so the keys rotated
+ * by the service are picked up without a restart.
+ */
+static LIST_HEAD(tfw_tls_ticket_files);
+static DEFINE_MUTEX(tfw_tls_ticket_files_lock);
+static void tfw_tls_ticket_files_poll(struct work_struct *work);
+static DECLARE_DELAYED_WORK(tfw_tls_ticket_files_work,
+			    tfw_tls_ticket_files_poll);
+
 size_t tfw_tls_vhost_priv_data_sz(void)
 {
 	return sizeof(TlsConfEntry);
 }
 
+static void
+tfw_tls_cert_parse(struct work_struct *work)
+{
+	TfwTlsCert *c = container_of(work, TfwTlsCert, work);
+
+	c->crt_err = ttls_x509_crt_parse(&c->crt, c->crt_data, c->crt_size);
+	if (!c->crt_err)
+		c->key_err = ttls_pk_parse_key(&c->key, c->key_data,
+					       c->key_size);
+
+	kfree(c->crt_data);
+	kfree(c->key_data);
+	c->crt_data = c->key_data = NULL;
+}
+
+/**
+ * Find a certificate with the same certificate and key files contents or
+ * create a new one and schedule its parsing. Thousands of vhosts certificates
+ * are parsed in parallel by the unbound workers, the configuration waits for
+ * them in tfw_tls_cert_cfg_flush().
+ *
+ * The function takes ownership of @crt_data and @key_data.
+ */
+static TfwTlsCert *
+tfw_tls_cert_get(void *crt_data, size_t crt_size, void *key_data,
+		 size_t key_size)
+{
+	unsigned long key;
+	struct sha256_state sctx;
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	TfwTlsCert *c;
+
+	sha256_init(&sctx);
+	sha256_update(&sctx, crt_data, crt_size);
+	sha256_update(&sctx, key_data, key_size);
+	sha256_final(&sctx, digest);
+	key = *(unsigned long *)digest;
+
+	spin_lock_bh(&tfw_tls_certs_lock);
+	hash_for_each_possible(tfw_tls_certs, c, hlist, key) {
+		if (!memcmp(c->digest, digest, sizeof(digest))) {
+			c->refcnt++;
+			spin_unlock_bh(&tfw_tls_certs_lock);
+			kfree(crt_data);
+			kfree(key_data);
+			return c;
+		}
+	}
+	spin_unlock_bh(&tfw_tls_certs_lock);
+
+	if (!(c = kzalloc(sizeof(*c), GFP_KERNEL))) {
+		kfree(crt_data);
+		kfree(key_data);
+		return NULL;
+	}
+	c->refcnt = 1;
+	memcpy(c->digest, digest, sizeof(digest));
+	c->crt_data = crt_data;
+	c->crt_size = crt_size;
+	c->key_data = key_data;
+	c->key_size = key_size;
+	ttls_x509_crt_init(&c->crt);
+	ttls_pk_init(&c->key);
+	INIT_WORK(&c->work, tfw_tls_cert_parse);
+
+	/*
+	 * The configuration is serialized, so nobody could add the same
+	 * certificate while the lock was released.
+	 */
+	spin_lock_bh(&tfw_tls_certs_lock);
+	hash_add(tfw_tls_certs, &c->hlist, key);
+	spin_unlock_bh(&tfw_tls_certs_lock);
+
+	queue_work(system_unbound_wq, &c->work);
+
+	return c;
+}
+
+static void
+tfw_tls_cert_put(TfwTlsCert *c)
+{
+	spin_lock_bh(&tfw_tls_certs_lock);
+	if (--c->refcnt) {
+		spin_unlock_bh(&tfw_tls_certs_lock);
+		return;
+	}
+	hash_del(&c->hlist);
+	spin_unlock_bh(&tfw_tls_certs_lock);
+
+	ttls_x509_crt_free(&c->crt);
+	ttls_pk_free(&c->key);
+	kfree(c);
+}
+
+/**
+ * (Re)load the ticket keys file @tf if its contents changed.
+ */
+static int
+tfw_tls_ticket_file_load(TfwTlsTicketFile *tf)
+{
+	void *data;
+	size_t size;
+	struct sha256_state sctx;
+	unsigned char digest[SHA256_DIGEST_SIZE];
+	TlsTicketKeys *keys;
+
+	if (!(data = tfw_cfg_read_file(tf->path, &size)))
+		return -ENOENT;
+	/* Skip the trailing '\0' added by tfw_cfg_read_file(). */
+	size--;
+
+	sha256_init(&sctx);
+	sha256_update(&sctx, data, size);
+	sha256_final(&sctx, digest);
+	if (tf->keys && !memcmp(tf->digest, digest, sizeof(digest))) {
+		kfree(data);
+		return 0;
+	}
+
+	keys = ttls_tickets_keys_load(tf->keys, data, size);
+	memzero_explicit(data, size);
+	kfree(data);
+	if (IS_ERR(keys))
+		return PTR_ERR(keys);
+
+	T_LOG_NL("TLS: ticket keys loaded from '%s'\n", tf->path);
+	tf->keys = keys;
+	memcpy(tf->digest, digest, sizeof(digest));
+
+	return 0;
+}
+
+static void
+tfw_tls_ticket_file_free(TfwTlsTicketFile *tf)
+{
+	list_del(&tf->list);
+	ttls_tickets_keys_put(tf->keys);
+	kfree(tf->path);
+	kfree(tf);
+}
+
+static void
+tfw_tls_ticket_files_poll(struct work_struct *work)
+{
+	TfwTlsTicketFile *tf;
+
+	mutex_lock(&tfw_tls_ticket_files_lock);
+	/* Keep the current keys if the file is broken or is being replaced. */
+	list_for_each_entry(tf, &tfw_tls_ticket_files, list)
+		tfw_tls_ticket_file_load(tf);
+	if (!list_empty(&tfw_tls_ticket_files))
+		schedule_delayed_work(&tfw_tls_ticket_files_work,
+				      TLS_TICKET_FILE_POLL);
+	mutex_unlock(&tfw_tls_ticket_files_lock);
+}
+
+/**
+ * Get the ticket keys from the file @path. The file is read on each
+ * configuration, so the keys shared with the current configuration are
+ * updated immediately.
+ */
+static TlsTicketKeys *
+tfw_tls_ticket_file_get(const char *path)
+{
+	TfwTlsTicketFile *tf;
+	TlsTicketKeys *keys = NULL;
+
+	mutex_lock(&tfw_tls_ticket_files_lock);
+
+	list_for_each_entry(tf, &tfw_tls_ticket_files, list)
+		if (!strcmp(tf->path, path))
+			goto load;
+
+	if (!(tf = kzalloc(sizeof(*tf), GFP_KERNEL)))
+		goto out;
+	if (!(tf->path = kstrdup(path, GFP_KERNEL))) {
+		kfree(tf);
+		goto out;
+	}
+	list_add_tail(&tf->list, &tfw_tls_ticket_files);
+load:
+	if (!tfw_tls_ticket_file_load(tf)) {
+		tf->used = true;
+		keys = tf->keys;
+	} else if (!tf->keys) {
+		tfw_tls_ticket_file_free(tf);
+	}
+out:
+	mutex_unlock(&tfw_tls_ticket_files_lock);
+
+	return keys;
+}
+
+/**
+ * Drop the ticket keys files which aren't used by the new configuration and
+ * start polling the files for updates. The vhosts of the previous
+ * configuration keep their references to the keys.
+ */
+void
+tfw_tls_tickets_start(void)
+{
+	TfwTlsTicketFile *tf, *tmp;
+
+	mutex_lock(&tfw_tls_ticket_files_lock);
+	list_for_each_entry_safe(tf, tmp, &tfw_tls_ticket_files, list) {
+		if (!tf->used)
+			tfw_tls_ticket_file_free(tf);
+		else
+			tf->used = false;
+	}
+	if (!list_empty(&tfw_tls_ticket_files))
+		mod_delayed_work(system_wq, &tfw_tls_ticket_files_work,
+				 TLS_TICKET_FILE_POLL);
+	mutex_unlock(&tfw_tls_ticket_files_lock);
+}
+
+void
+tfw_tls_tickets_stop(void)
+{
+	TfwTlsTicketFile *tf, *tmp;
+
+	cancel_delayed_work_sync(&tfw_tls_ticket_files_work);
+
+	mutex_lock(&tfw_tls_ticket_files_lock);
+	list_for_each_entry_safe(tf, tmp, &tfw_tls_ticket_files, list)
+		tfw_tls_ticket_file_free(tf);
+	mutex_unlock(&tfw_tls_ticket_files_lock);
+}
+
 static int
 tfw_tls_peer_tls_init(TfwVhost *vhost)
 {
@@ -167,16 +497,14 @@ tfw_tls_add_cn(const ttls_x509_buf *sname, void *a_vhost)
 }
 
 /**
- * Handle 'tls_certificate <path>' config entry.
+ * Handle 'tls_certificate <path>' config entry. The certificate is parsed
+ * together with the private key, see tfw_tls_set_cert_key().
  */
 int
 tfw_tls_set_cert(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 {
 	int r;
-	unsigned char *crt_data;
-	size_t crt_size;
 	TlsCertConf *conf;
-	uint32_t flags;
 
 	BUG_ON(!vhost->tls_cfg.priv);
 	if ((r = tfw_tls_peer_tls_init(vhost)))
@@ -187,64 +515,16 @@ tfw_tls_set_cert(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 	if (tfw_cfg_check_single_val(ce))
 		return -EINVAL;
 
-	crt_data = tfw_cfg_read_file(ce->vals[0], &crt_size);
-	if (!crt_data) {
+	conf->vhost = vhost;
+	if (!(conf->crt_path = kstrdup(ce->vals[0], GFP_KERNEL)))
+		return -ENOMEM;
+	conf->crt_data = tfw_cfg_read_file(ce->vals[0], &conf->crt_size);
+	if (!conf->crt_data) {
 		T_ERR_NL("%s: Can't read certificate file '%s'\n",
 			 ce->name, ce->vals[0]);
 		return -EINVAL;
 	}
 
-	ttls_x509_crt_init(&conf->crt);
-	r = ttls_x509_crt_parse(&conf->crt, crt_data, crt_size);
-	if (r) {
-		T_ERR_NL("%s: Invalid certificate specified, err=%x\n",
-			 cs->name, -r);
-		goto err;
-	}
-
-	/* Do simple check, because we don't have private key at this moment. */
-	if ((flags = ttls_x509_check_cert_validity(&conf->crt))) {
-		if (flags & TTLS_X509_BADCERT_EXPIRED)
-			T_WARN("The certificate '%s' has expired! Please renew\n"
-			       "the certificate to maintain functionality.",
-			       ce->vals[0]);
-
-		if (flags & TTLS_X509_BADCERT_FUTURE)
-			T_WARN("The certificate %s is not yet valid. Please\n"
-			       "ensure the correct certificate is in use.",
-			       ce->vals[0]);
-	}
-
-	if (ttls_x509_process_san(&conf->crt, tfw_tls_add_cn, vhost)) {
-		/* None of the SANs match the vhost. */
-		T_WARN("Vhost %s doesn't have certificate with matching SAN/CN.\n"
-		       "    Maybe that's fine, but it's worth checking the\n"
-		       "    config - if there is no relations between the\n"
-		       "    names, then host name confusion attack is possible.\n",
-		       vhost->name.data);
-	}
-
-err:
-	kfree(crt_data);
-
-	return r;
-}
-
-int
-tfw_tls_cert_cfg_finish_cert(TfwVhost *vhost)
-{
-	TlsConfEntry *conf_entry = vhost->tls_cfg.priv;
-	TlsCertConf *conf = &conf_entry->certs[conf_entry->certs_num];
-	int r;
-
-	r = ttls_conf_own_cert(&vhost->tls_cfg, &conf->crt, &conf->key,
-			       conf->crt.next, NULL);
-	if (r) {
-		T_ERR_NL("TLS: can't set own certificate (%x)\n", r);
-		return -EINVAL;
-	}
-	conf_entry->certs_num++;
-
 	return 0;
 }
 
@@ -261,19 +541,17 @@ tfw_tls_cert_cfg_finish_cert(TfwVhost *vhost)
 int
 tfw_tls_set_cert_key(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 {
-	int r;
 	void *key_data;
 	size_t key_size;
+	TlsConfEntry *conf_entry = vhost->tls_cfg.priv;
 	TlsCertConf *conf;
 
-	BUG_ON(!vhost->tls_cfg.priv);
+	BUG_ON(!conf_entry);
 	if (tfw_cfg_check_single_val(ce))
 		return -EINVAL;
 	if (!(conf = tfw_tls_get_cert_conf(vhost, TFW_TLS_CFG_F_CKEY)))
 		return -EINVAL;
 
-	ttls_pk_init(&conf->key);
-
 	key_data = tfw_cfg_read_file(ce->vals[0], &key_size);
 	if (!key_data) {
 		T_ERR_NL("%s: Can't read certificate file '%s'\n",
@@ -281,16 +559,150 @@ tfw_tls_set_cert_key(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 		return -EINVAL;
 	}
 
-	r = ttls_pk_parse_key(&conf->key, key_data, key_size);
-	/* The key is copied, so free the paged data. */
-	kfree(key_data);
+	conf->cert = tfw_tls_cert_get(conf->crt_data, conf->crt_size,
+				      key_data, key_size);
+	conf->crt_data = NULL;
+	if (!conf->cert)
+		return -ENOMEM;
+	list_add_tail(&conf->list, &tfw_tls_certs_pending);
+	conf_entry->certs_num++;
+
+	return 0;
+}
+
+/**
+ * Handle 'tls_certificate_ocsp <path>' config entry: staple the OCSP response
+ * from the file to the last configured certificate. The file is written by an
+ * external tool and is re-read on each configuration reload. The response is
+ * verified against the certificate, so it's loaded after the parsing.
+ */
+int
+tfw_tls_set_cert_ocsp(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
+{
+	TlsConfEntry *conf_entry = vhost->tls_cfg.priv;
+	TlsCertConf *conf;
+
+	BUG_ON(!conf_entry);
+	if (tfw_cfg_check_single_val(ce))
+		return -EINVAL;
+	if (!conf_entry->certs_num
+	    || (conf_entry->certs_num < TLS_CONF_CERT_NUM
+		&& conf_entry->certs[conf_entry->certs_num].conf_stage))
+	{
+		T_ERR_NL("%s: the directive must follow 'tls_certificate' and"
+			 " 'tls_certificate_key' directives.\n", cs->name);
+		return -EINVAL;
+	}
+	conf = &conf_entry->certs[conf_entry->certs_num - 1];
+	if (conf->ocsp_data) {
+		T_ERR_NL("%s: the directive was found twice for the same"
+			 " certificate.\n", cs->name);
+		return -EINVAL;
+	}
+
+	conf->ocsp_data = tfw_cfg_read_file(ce->vals[0], &conf->ocsp_size);
+	if (!conf->ocsp_data) {
+		T_ERR_NL("%s: Can't read OCSP response file '%s'\n",
+			 ce->name, ce->vals[0]);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * Add the parsed certificate to the vhost: check the certificate, add its
+ * SANs to the SNI mapping and staple the OCSP response.
+ */
+static int
+tfw_tls_cert_cfg_finish_cert(TlsCertConf *conf)
+{
+	int r;
+	uint32_t flags;
+	TfwTlsCert *c = conf->cert;
+	TfwVhost *vhost = conf->vhost;
+
+	if (c->crt_err) {
+		T_ERR_NL("tls_certificate: Invalid certificate specified in"
+			 " '%s', err=%x\n", conf->crt_path, -c->crt_err);
+		return -EINVAL;
+	}
+	if (c->key_err) {
+		T_ERR_NL("tls_certificate_key: Invalid private key specified"
+			 " for '%s' (%x)\n", conf->crt_path, -c->key_err);
+		return -EINVAL;
+	}
+
+	/* Do simple check, the certificate can be reused from a long ago. */
+	if ((flags = ttls_x509_check_cert_validity(&c->crt))) {
+		if (flags & TTLS_X509_BADCERT_EXPIRED)
+			T_WARN("The certificate '%s' has expired! Please renew\n"
+			       "the certificate to maintain functionality.",
+			       conf->crt_path);
+
+		if (flags & TTLS_X509_BADCERT_FUTURE)
+			T_WARN("The certificate %s is not yet valid. Please\n"
+			       "ensure the correct certificate is in use.",
+			       conf->crt_path);
+	}
+
+	if (ttls_x509_process_san(&c->crt, tfw_tls_add_cn, vhost)) {
+		/* None of the SANs match the vhost. */
+		T_WARN("Vhost %s doesn't have certificate with matching SAN/CN.\n"
+		       "    Maybe that's fine, but it's worth checking the\n"
+		       "    config - if there is no relations between the\n"
+		       "    names, then host name confusion attack is possible.\n",
+		       vhost->name.data);
+	}
+
+	r = ttls_conf_own_cert(&vhost->tls_cfg, &c->crt, &c->key, c->crt.next,
+			       NULL);
 	if (r) {
-		T_ERR_NL("%s: Invalid private key specified (%x)\n",
-			 cs->name, -r);
+		T_ERR_NL("TLS: can't set own certificate (%x)\n", r);
 		return -EINVAL;
 	}
 
-	return tfw_tls_cert_cfg_finish_cert(vhost);
+	if (conf->ocsp_data) {
+		TlsKeyCert *key_cert = vhost->tls_cfg.key_cert;
+
+		/* The certificate is the last one in the list. */
+		while (key_cert->next)
+			key_cert = key_cert->next;
+		r = ttls_key_cert_ocsp_load(key_cert, conf->ocsp_data,
+					    conf->ocsp_size);
+		kfree(conf->ocsp_data);
+		conf->ocsp_data = NULL;
+		if (r) {
+			T_ERR_NL("tls_certificate_ocsp: Invalid OCSP response"
+				 " for '%s' (%x)\n", conf->crt_path, -r);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Wait for all the certificates of the new configuration to be parsed and
+ * add them to their vhosts in the configuration order.
+ */
+int
+tfw_tls_cert_cfg_flush(void)
+{
+	int r;
+	TlsCertConf *conf, *tmp;
+
+	list_for_each_entry_safe(conf, tmp, &tfw_tls_certs_pending, list) {
+		flush_work(&conf->cert->work);
+		list_del_init(&conf->list);
+		r = tfw_tls_cert_cfg_finish_cert(conf);
+		kfree(conf->crt_path);
+		conf->crt_path = NULL;
+		if (r)
+			return r;
+	}
+
+	return 0;
 }
 
 int
@@ -317,17 +729,17 @@ tfw_tls_cert_cfg_finish(TfwVhost *vhost)
 static void
 tfw_tls_cleanup_tls_cert(TlsCertConf *conf)
 {
-	if (!(conf->conf_stage & TFW_TLS_CFG_F_CERT))
-		return;
-	ttls_x509_crt_free(&conf->crt);
-}
-
-static void
-tfw_tls_cleanup_tls_ckey(TlsCertConf *conf)
-{
-	if (!(conf->conf_stage & TFW_TLS_CFG_F_CKEY))
+	kfree(conf->crt_path);
+	kfree(conf->crt_data);
+	kfree(conf->ocsp_data);
+	if (!conf->cert)
 		return;
-	ttls_pk_free(&conf->key);
+	/* The configuration failed before the certificates were parsed. */
+	if (!list_empty(&conf->list)) {
+		list_del(&conf->list);
+		flush_work(&conf->cert->work);
+	}
+	tfw_tls_cert_put(conf->cert);
 }
 
 void
@@ -337,12 +749,8 @@ tfw_tls_cert_clean(TfwVhost *vhost)
 	int i;
 
 	ttls_key_cert_free(vhost->tls_cfg.key_cert);
-	for (i = 0; i < TLS_CONF_CERT_NUM; i++) {
-		TlsCertConf *cconf = &conf->certs[i];
-
-		tfw_tls_cleanup_tls_cert(cconf);
-		tfw_tls_cleanup_tls_ckey(cconf);
-	}
+	for (i = 0; i < TLS_CONF_CERT_NUM; i++)
+		tfw_tls_cleanup_tls_cert(&conf->certs[i]);
 	ttls_config_peer_free(&vhost->tls_cfg);
 }
 
@@ -350,13 +758,14 @@ int
 tfw_tls_set_tickets(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 {
 	bool enabled = true;
-	const char *secret = NULL;
+	const char *secret = NULL, *key_file = NULL;
 	size_t secret_len = 0;
 	unsigned long lifetime = 0;
 	TfwCfgEntry ce_tmp;
 	const char *key, *val;
+	TlsTicketKeys *keys = NULL;
 	int i, r;
-	bool was_secret = false, was_lifetime=false;
+	bool was_secret = false, was_lifetime=false, was_key_file = false;
 
 	if ((r = tfw_tls_peer_tls_init(vhost)))
 		return r;
@@ -401,6 +810,11 @@ tfw_tls_set_tickets(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 						  "recommended value is %d\n",
 						  cs->name,
 						  TTLS_DEFAULT_TICKET_LIFETIME);
+			} else if (!strcasecmp(key, "key_file")) {
+				TFW_CFG_CHECK_VAL_DUP(key, was_key_file, {
+					return -EINVAL;
+				})
+				key_file = val;
 			} else {
 				T_ERR_NL("%s: unsupported argument: '%s=%s'.\n",
 					 cs->name, key, val);
@@ -409,6 +823,20 @@ tfw_tls_set_tickets(TfwVhost *vhost, TfwCfgSpec *cs, TfwCfgEntry *ce)
 		}
 	}
 
+	if (enabled && key_file) {
+		if (secret) {
+			T_ERR_NL("%s: 'secret' and 'key_file' can't be used"
+				 " together.\n", cs->name);
+			return -EINVAL;
+		}
+		if (!(keys = tfw_tls_ticket_file_get(key_file))) {
+			T_ERR_NL("%s: can't load ticket keys from '%s'\n",
+				 cs->name, key_file);
+			return -EINVAL;
+		}
+	}
+
 	return ttls_conf_tickets(&vhost->tls_cfg, enabled, lifetime, secret,
-				 secret_len, vhost->name.data, vhost->name.len);
+				 secret_len, vhost->name.data, vhost->name.len,
+				 keys);
 }
@@ -42,15 +42,30 @@
 #include "tls_conf.h"
 #include "lib/log.h"
 
-/*
- * The hash table entry for mapping @sni to @vhost for SAN certificates handling.
+/**
+ * A node of the reversed labels trie mapping SAN/CN names to virtual hosts.
+ * A name is inserted by its labels from right to left, e.g. "www.a.org" is
+ * the path "org" -> "a" -> "www", so exact names and wildcards share their
+ * common suffixes and a server name is resolved in a single pass over its
+ * labels.
+ *
+ * @vhost	- virtual host for the exact name ending at the node;
+ * @wc_vhost	- virtual host for the "*." wildcard of the name;
+ * @child	- child nodes sorted by their labels;
+ * @n_child	- number of the child nodes;
+ * @cap	- size of @child array;
+ * @len	- length of @label;
+ * @label	- the label in lower case.
  */
-typedef struct {
-	struct hlist_node	hlist;
+typedef struct tfw_sni_node_t {
 	TfwVhost		*vhost;
-	size_t			sni_len;
-	char			sni[0];
-} TfwSVHMap;
+	TfwVhost		*wc_vhost;
+	struct tfw_sni_node_t	**child;
+	unsigned int		n_child;
+	unsigned int		cap;
+	unsigned int		len;
+	char			label[0];
+} TfwSniNode;
 
 #define TFW_VH_HBITS	10
 /**
@@ -62,13 +77,13 @@ typedef struct {
  * @expl_dflt	- Flag to indicate explicit configuration of default
  *		  virtual host.
  * @vh_hash	- Hash table with configured virtual hosts.
- * @sni_vh_map	- Hash table mapping SNI to virtual hosts.
+ * @sni_root	- Root of the trie mapping SNI to virtual hosts.
  */
 typedef struct {
 	TfwVhost	*vhost_dflt;
 	bool		expl_dflt;
 	DECLARE_HASHTABLE(vh_hash, TFW_VH_HBITS);
-	DECLARE_HASHTABLE(sni_vh_map, TFW_VH_HBITS);
+	TfwSniNode	*sni_root;
 } TfwVhostList;
 
 /* Mappings for match operators. */
@@ -424,6 +439,28 @@ tfw_vhost_get_cache_use_stale(TfwLocation *loc, TfwVhost *vhost)
 	return loc->cache_use_stale;
 }
 
+/**
+ * Find early hints setting according to the current location.
+ *
+ * @loc		- request URI location;
+ * @vhost	- virtual host for the request;
+ */
+TfwEarlyHints *
+tfw_vhost_get_early_hints(TfwLocation *loc, TfwVhost *vhost)
+{
+	TfwVhost *vh_dflt = vhost->vhost_dflt;
+
+	/* TODO #862: req->location must be the full set of options. */
+	if (!loc || !loc->early_hints)
+		loc = vhost->loc_dflt;
+	if (!loc || !loc->early_hints)
+		loc = vh_dflt ? vh_dflt->loc_dflt : NULL;
+	if (!loc || !loc->early_hints)
+		return NULL;
+
+	return loc->early_hints;
+}
+
 /*
  * ------------------------------------------------------------------------
  *	Configuration processing.
@@ -493,32 +530,88 @@ tfw_vhost_lookup_reconfig(const char *name)
 				  tfw_vhost_name_match);
 }
 
+static int
+tfw_sni_label_cmp(const TfwSniNode *node, const char *label, unsigned int len)
+{
+	unsigned int i, n = min(node->len, len);
+
+	for (i = 0; i < n; ++i) {
+		int c = (unsigned char)node->label[i]
+			- (unsigned char)tolower(label[i]);
+		if (c)
+			return c;
+	}
+
+	return (int)node->len - (int)len;
+}
+
+/**
+ * Binary search of the child of @node with the label. If there is no such
+ * child, @pos is set to the position to insert it.
+ */
+static TfwSniNode *
+tfw_sni_node_find(const TfwSniNode *node, const char *label, unsigned int len,
+		  unsigned int *pos)
+{
+	unsigned int l = 0, r = node->n_child;
+
+	while (l < r) {
+		unsigned int m = (l + r) / 2;
+		int c = tfw_sni_label_cmp(node->child[m], label, len);
+
+		if (!c)
+			return node->child[m];
+		if (c < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+	if (pos)
+		*pos = l;
+
+	return NULL;
+}
+
 /**
- * Lookup vhost by an SNI wildcard. It is a caller responsibility to
+ * Lookup vhost by a server name, exact SAN/CN names have priority over
+ * wildcards. @name must be in lower case. It is a caller responsibility to
  * release the vhost reference after use.
  */
 TfwVhost *
 tfw_vhost_lookup_sni(const BasicStr *name)
 {
-	TfwSVHMap *svhm;
+	const char *p, *s = name->data, *end = name->data + name->len;
+	TfwVhost *vhost = NULL;
 	TfwVhostList *vhlist;
-	unsigned long key = basic_hash_str(name);
+	TfwSniNode *node;
 
 	rcu_read_lock_bh();
 	vhlist = rcu_dereference_bh(tfw_vhosts);
 	BUG_ON(!vhlist);
 
-	hash_for_each_possible(vhlist->sni_vh_map, svhm, hlist, key) {
-		if (svhm->sni_len != name->len
-		    || tfw_cstricmp(name->data, svhm->sni, svhm->sni_len))
-			continue;
-		tfw_vhost_get(svhm->vhost);
-		rcu_read_unlock_bh();
-		return svhm->vhost;
+	for (node = vhlist->sni_root; node; end = p - 1) {
+		/* The rightmost label of the remaining name. */
+		for (p = end; p > s && p[-1] != '.'; --p)
+			;
+		if (p == s) {
+			/*
+			 * By RFC 2818 3.1, a wildcard matches only the single
+			 * leftmost label, e.g. *.a.com matches foo.a.com, but
+			 * not bar.foo.a.com.
+			 */
+			vhost = node->wc_vhost;
+			node = tfw_sni_node_find(node, p, end - p, NULL);
+			if (node && node->vhost)
+				vhost = node->vhost;
+			break;
+		}
+		node = tfw_sni_node_find(node, p, end - p, NULL);
 	}
+	if (vhost)
+		tfw_vhost_get(vhost);
 	rcu_read_unlock_bh();
 
-	return NULL;
+	return vhost;
 }
 
 /**
@@ -1052,6 +1145,95 @@ tfw_cfgop_out_cache_use_stale(TfwCfgSpec *cs, TfwCfgEntry *ce)
 	return tfw_cfgop_cache_use_stale(cs, ce, vh_dflt->loc_dflt);
 }
 
+/*
+ * Parse the early_hints directive:
+ *
+ *	early_hints [auto] ["<link>" ...];
+ *
+ * All the configured links are joined into single Link header value.
+ * The "auto" keyword allows to use Link headers of the last cached
+ * response for the same resource if the resource is missed in cache.
+ */
+static int
+tfw_cfgop_early_hints(TfwCfgSpec *cs, TfwCfgEntry *ce, TfwLocation *loc)
+{
+	TfwEarlyHints *cfg;
+	size_t i, len = 0;
+	bool auto_hints = false;
+	char *p;
+
+	TFW_CFG_CHECK_NO_ATTRS(cs, ce);
+	TFW_CFG_CHECK_VAL_N(>=, 1, cs, ce);
+
+	for (i = 0; i < ce->val_n; i++) {
+		const char *v = ce->vals[i];
+
+		if (!strcasecmp(v, "auto")) {
+			if (auto_hints) {
+				T_ERR_NL("%s: duplicated 'auto' argument.\n",
+					 cs->name);
+				return -EINVAL;
+			}
+			auto_hints = true;
+			continue;
+		}
+		if (v[0] != '<' || strpbrk(v, "\r\n")) {
+			T_ERR_NL("%s: invalid link '%s', the link must start"
+				 " with '<' and must not contain CR or LF.\n",
+				 cs->name, v);
+			return -EINVAL;
+		}
+		len += (len ? SLEN(", ") : 0) + strlen(v);
+	}
+	if (len > PAGE_SIZE) {
+		T_ERR_NL("%s: too long list of links (%zu bytes).\n",
+			 cs->name, len);
+		return -EINVAL;
+	}
+
+	if (!(cfg = kzalloc(sizeof(TfwEarlyHints) + len, GFP_KERNEL)))
+		return -ENOMEM;
+	cfg->auto_hints = auto_hints;
+	cfg->len = len;
+
+	for (i = 0, p = cfg->links; i < ce->val_n; i++) {
+		size_t vlen = strlen(ce->vals[i]);
+
+		if (!strcasecmp(ce->vals[i], "auto"))
+			continue;
+		if (p != cfg->links) {
+			memcpy(p, ", ", SLEN(", "));
+			p += SLEN(", ");
+		}
+		memcpy(p, ce->vals[i], vlen);
+		p += vlen;
+	}
+	loc->early_hints = cfg;
+	if (auto_hints)
+		tfw_cache_hints_enable();
+
+	return 0;
+}
+
+static int
+tfw_cfgop_loc_early_hints(TfwCfgSpec *cs, TfwCfgEntry *ce)
+{
+	return tfw_cfgop_early_hints(cs, ce, tfwcfg_this_location);
+}
+
+static int
+tfw_cfgop_in_early_hints(TfwCfgSpec *cs, TfwCfgEntry *ce)
+{
+	return tfw_cfgop_early_hints(cs, ce, tfw_vhost_entry->loc_dflt);
+}
+
+static int
+tfw_cfgop_out_early_hints(TfwCfgSpec *cs, TfwCfgEntry *ce)
+{
+	TfwVhost *vh_dflt = tfw_vhosts_reconfig->vhost_dflt;
+	return tfw_cfgop_early_hints(cs, ce, vh_dflt->loc_dflt);
+}
+
 /*
  * Find a cache policy directive entry.
  */
@@ -1653,7 +1835,8 @@ tfw_location_del(TfwLocation *loc)
 
 	/*
 	 * Free loc->arg and loc->frang_cfg, loc->capo,
-	 * loc->nipdef, loc->cache_use_stale and loc->capo_hdr_del.
+	 * loc->nipdef, loc->cache_use_stale, loc->early_hints and
+	 * loc->capo_hdr_del.
 	 */
 	for (i = 0; i < loc->capo_sz; ++i) {
 		BUG_ON(!loc->capo[i]);
@@ -1670,6 +1853,7 @@ tfw_location_del(TfwLocation *loc)
 	kfree(loc->arg);
 	kfree(loc->frang_cfg);
 	kfree(loc->cache_use_stale);
+	kfree(loc->early_hints);
 
 	tfw_sg_put(loc->main_sg);
 	tfw_sg_put(loc->backup_sg);
@@ -1997,30 +2181,108 @@ tfw_vhost_add(TfwVhost *vhost)
 	}
 }
 
+static TfwSniNode *
+tfw_sni_node_alloc(const char *label, unsigned int len)
+{
+	unsigned int i;
+	TfwSniNode *node;
+
+	if (!(node = kzalloc(sizeof(*node) + len, GFP_KERNEL)))
+		return NULL;
+	node->len = len;
+	for (i = 0; i < len; ++i)
+		node->label[i] = tolower(label[i]);
+
+	return node;
+}
+
+static TfwSniNode *
+tfw_sni_node_add(TfwSniNode *node, const char *label, unsigned int len,
+		 unsigned int pos)
+{
+	TfwSniNode *child;
+
+	if (node->n_child == node->cap) {
+		unsigned int cap = node->cap ? node->cap * 2 : 4;
+		TfwSniNode **ch;
+
+		ch = krealloc(node->child, cap * sizeof(*ch), GFP_KERNEL);
+		if (!ch)
+			return NULL;
+		node->child = ch;
+		node->cap = cap;
+	}
+	if (!(child = tfw_sni_node_alloc(label, len)))
+		return NULL;
+
+	memmove(&node->child[pos + 1], &node->child[pos],
+		(node->n_child - pos) * sizeof(*node->child));
+	node->child[pos] = child;
+	node->n_child++;
+
+	return child;
+}
+
+static void
+tfw_sni_node_free(TfwSniNode *node)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->n_child; ++i)
+		tfw_sni_node_free(node->child[i]);
+	if (node->vhost)
+		tfw_vhost_put(node->vhost);
+	if (node->wc_vhost)
+		tfw_vhost_put(node->wc_vhost);
+	kfree(node->child);
+	kfree(node);
+	tfw_srv_loop_sched_rcu();
+}
+
 /**
+ * Map SAN/CN @cn to @vhost. @cn starting with a dot is a chopped wildcard,
+ * e.g. ".a.org" for "*.a.org", see tfw_tls_add_cn().
+ *
  * Called on (re-)configuration time in process context.
  */
 void
 tfw_vhost_add_sni_map(const BasicStr *cn, TfwVhost *vhost)
 {
-	unsigned long key = basic_hash_str(cn);
-	TfwSVHMap *svhm;
-	int n = sizeof(*svhm) + cn->len;
+	bool wc = cn->len && cn->data[0] == '.';
+	const char *p, *s = cn->data + wc, *end = cn->data + cn->len;
+	unsigned int pos;
+	TfwSniNode *node, *next;
+	TfwVhost **dst;
 
-	if (!(svhm = kmalloc(n, GFP_KERNEL))) {
-		T_WARN("Cannot allocate mapping for SAN/CN %.*s -> %.*s\n",
-		       (int)cn->len, cn->data,
-		       (int)vhost->name.len, vhost->name.data);
-		return;
+	if (!(node = tfw_vhosts_reconfig->sni_root)) {
+		if (!(node = tfw_sni_node_alloc(NULL, 0)))
+			goto err;
+		tfw_vhosts_reconfig->sni_root = node;
 	}
 
-	svhm->vhost = vhost;
-	INIT_HLIST_NODE(&svhm->hlist);
-	svhm->sni_len = cn->len;
-	memcpy(svhm->sni, cn->data, cn->len);
+	for ( ; ; end = p - 1) {
+		for (p = end; p > s && p[-1] != '.'; --p)
+			;
+		next = tfw_sni_node_find(node, p, end - p, &pos);
+		if (!next && !(next = tfw_sni_node_add(node, p, end - p, pos)))
+			goto err;
+		node = next;
+		if (p == s)
+			break;
+	}
 
-	hash_add(tfw_vhosts_reconfig->sni_vh_map, &svhm->hlist, key);
+	/* SAN/CN collisions happen on the same certificate only. */
+	dst = wc ? &node->wc_vhost : &node->vhost;
+	if (*dst)
+		tfw_vhost_put(*dst);
+	*dst = vhost;
 	tfw_vhost_get(vhost);
+
+	return;
+err:
+	T_WARN("Cannot allocate mapping for SAN/CN %.*s -> %.*s\n",
+	       (int)cn->len, cn->data,
+	       (int)vhost->name.len, vhost->name.data);
 }
 
 static const TfwCfgEnum frang_http_methods_enum[] = {
@@ -2496,6 +2758,24 @@ tfw_cfgop_in_tls_certificate_key(TfwCfgSpec *cs, TfwCfgEntry *ce)
 	return tfw_tls_set_cert_key(tfw_vhost_entry, cs, ce);
 }
 
+static int
+tfw_cfgop_out_tls_certificate_ocsp(TfwCfgSpec *cs, TfwCfgEntry *ce)
+{
+	if (tfw_vhosts_reconfig->expl_dflt) {
+		T_ERR_NL("%s: global level certificates are to be configured "
+			 "outside of explicit '%s' vhost.\n",
+			 cs->name, TFW_VH_DFT_NAME);
+		return -EINVAL;
+	}
+	return tfw_tls_set_cert_ocsp(tfw_vhosts_reconfig->vhost_dflt, cs, ce);
+}
+
+static int
+tfw_cfgop_in_tls_certificate_ocsp(TfwCfgSpec *cs, TfwCfgEntry *ce)
+{
+	return tfw_tls_set_cert_ocsp(tfw_vhost_entry, cs, ce);
+}
+
 static int
 tfw_cfgop_out_tls_tickets(TfwCfgSpec *cs, TfwCfgEntry *ce)
 {
@@ -2584,7 +2864,7 @@ tfw_vhost_cfgstart(void)
 
 	tfw_vhosts_reconfig->expl_dflt = false;
 	hash_init(tfw_vhosts_reconfig->vh_hash);
-	hash_init(tfw_vhosts_reconfig->sni_vh_map);
+	tfw_vhosts_reconfig->sni_root = NULL;
 	tfw_frang_clean(&tfw_frang_vhost_reconfig);
 	tfw_frang_global_clean(&tfw_frang_glob_reconfig);
 	tfw_spec_init_frang_default(tfw_global_frang_specs);
@@ -2638,6 +2918,10 @@ tfw_vhost_cfgend(void)
 		goto err;
 
 check_vhost:
+	/* All the vhosts are configured, wait for their certificates. */
+	if ((r = tfw_tls_cert_cfg_flush()))
+		goto err;
+
 	if (tfw_global.cache_purge
 	    && !tfw_cache_is_enabled_or_not_configured())
 	{
@@ -2741,7 +3025,6 @@ static void
 tfw_cfgop_vhosts_list_free(TfwVhostList *vhosts)
 {
 	TfwVhost *vhost;
-	TfwSVHMap *svhm;
 	struct hlist_node *tmp;
 	int i;
 	if (!vhosts)
@@ -2754,12 +3037,8 @@ tfw_cfgop_vhosts_list_free(TfwVhostList *vhosts)
 		tfw_srv_loop_sched_rcu();
 	}
 
-	hash_for_each_safe(vhosts->sni_vh_map, i, tmp, svhm, hlist) {
-		hash_del(&svhm->hlist);
-		tfw_vhost_put(svhm->vhost);
-		kfree(svhm);
-		tfw_srv_loop_sched_rcu();
-	}
+	if (vhosts->sni_root)
+		tfw_sni_node_free(vhosts->sni_root);
 
 	set_bit(TFW_VHOST_B_REMOVED, &vhosts->vhost_dflt->flags);
 	tfw_vhost_put(vhosts->vhost_dflt);
@@ -3490,6 +3769,14 @@ static TfwCfgSpec tfw_vhost_location_specs[] = {
 		.allow_repeat = false,
 		.allow_reconfig = true,
 	},
+	{
+		.name = "early_hints",
+		.deflt = NULL,
+		.handler = tfw_cfgop_loc_early_hints,
+		.allow_none = true,
+		.allow_repeat = false,
+		.allow_reconfig = true,
+	},
 	{ 0 }
 };
 
@@ -3598,6 +3885,14 @@ static TfwCfgSpec tfw_vhost_internal_specs[] = {
 		.allow_repeat = true,
 		.allow_reconfig = true,
 	},
+	{
+		.name = "tls_certificate_ocsp",
+		.deflt = NULL,
+		.handler = tfw_cfgop_in_tls_certificate_ocsp,
+		.allow_none = true,
+		.allow_repeat = true,
+		.allow_reconfig = true,
+	},
 	{
 		.name = "tls_tickets",
 		.deflt = "",
@@ -3656,6 +3951,14 @@ static TfwCfgSpec tfw_vhost_internal_specs[] = {
 		.allow_repeat = false,
 		.allow_reconfig = true,
 	},
+	{
+		.name = "early_hints",
+		.deflt = NULL,
+		.handler = tfw_cfgop_in_early_hints,
+		.allow_none = true,
+		.allow_repeat = false,
+		.allow_reconfig = true,
+	},
 	{ 0 }
 };
 
@@ -3780,6 +4083,14 @@ static TfwCfgSpec tfw_vhost_specs[] = {
 		.allow_repeat = true,
 		.allow_reconfig = true,
 	},
+	{
+		.name = "tls_certificate_ocsp",
+		.deflt = NULL,
+		.handler = tfw_cfgop_out_tls_certificate_ocsp,
+		.allow_none = true,
+		.allow_repeat = true,
+		.allow_reconfig = true,
+	},
 	{
 		.name = "tls_tickets",
 		.deflt = "",
@@ -3853,6 +4164,14 @@ static TfwCfgSpec tfw_vhost_specs[] = {
 		.allow_repeat = false,
 		.allow_reconfig = true,
 	},
+	{
+		.name = "early_hints",
+		.deflt = NULL,
+		.handler = tfw_cfgop_out_early_hints,
+		.allow_none = true,
+		.allow_repeat = false,
+		.allow_reconfig = true,
+	},
 	{ 0 }
 };
 
@@ -136,6 +136,20 @@ typedef struct {
 	bool		on_timeout;
 } TfwCacheUseStale;
 
+/**
+ * early_hints directive setting.
+ *
+ * @auto_hints	- Whether Link headers of the last cached response for the
+ *		  same resource should be used as hints;
+ * @len		- Length of @links, zero if no links are configured;
+ * @links	- Configured Link header value for 103 (Early Hints) response;
+ */
+typedef struct {
+	bool		auto_hints;
+	unsigned int	len;
+	char		links[];
+} TfwEarlyHints;
+
 /**
  * Group of policies by specific location.
  *
@@ -153,6 +167,7 @@ typedef struct {
  * @main_sg	- Main server group to which requests must be proxied.
  * @backup_sg	- Backup server group.
  * @hdrs_pool	- Pointer to parent vhost's pool (for mod. headers allocation).
+ * @early_hints	- Links to send in 103 (Early Hints) response on cache miss.
  * @mod_hdrs	- Modification of request/response headers before forwarding.
  */
 typedef struct {
@@ -171,6 +186,7 @@ typedef struct {
 	TfwSrvGroup		*backup_sg;
 	TfwPool			*hdrs_pool;
 	TfwCacheUseStale	*cache_use_stale;
+	TfwEarlyHints		*early_hints;
 	TfwHdrMods		mod_hdrs[TFW_VHOST_HDRMOD_NUM];
 	unsigned int		validate_post_req:1;
 } TfwLocation;
@@ -314,5 +330,6 @@ unsigned int tfw_vhost_get_cc_ignore(TfwLocation *loc,
 				     TfwVhost *vhost);
 TfwCacheUseStale *tfw_vhost_get_cache_use_stale(TfwLocation *loc,
 						TfwVhost *vhost);
+TfwEarlyHints *tfw_vhost_get_early_hints(TfwLocation *loc, TfwVhost *vhost);
 
 #endif /* __TFW_VHOST_H__ */
@@ -21,6 +21,7 @@
  * this program; if not, write to the Free Software Foundation, Inc., 59
  * Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#include <linux/log2.h>
 #include <linux/percpu.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
@@ -133,15 +134,21 @@ full_out:
 }
 
 /**
+ * Pop up to @n items to @buf with a single update of the queue tail: the
+ * consumer drains all the available items at once.
+ *
  * Sets tail value to be compared with current turnstile ticket, so
- * @ticket is the identifier of currently successfully pop()'ed item or an item
+ * @ticket is the identifier of the last successfully pop()'ed item or an item
  * to be pop()'ed next time.
+ *
+ * Return the number of pop()'ed items.
  */
 int
-tfw_wq_pop_ticket(TfwRBQueue *q, void *buf, long *ticket)
+tfw_wq_pop_batch(TfwRBQueue *q, void *buf, int n, long *ticket)
 {
-	int cpu, r = -EBUSY;
+	int cpu, r = 0;
 	long tail;
+	size_t i, n1;
 
 	local_bh_disable();
 
@@ -174,18 +181,70 @@ tfw_wq_pop_ticket(TfwRBQueue *q, void *buf, long *ticket)
 			goto out;
 	}
 
-	memcpy(buf, &q->array[tail & (q->qsize - 1)], WQ_ITEM_SZ);
+	/* All the items before @last_head are completely written. */
+	r = min_t(long, n, q->last_head - tail);
+	i = tail & (q->qsize - 1);
+	n1 = min_t(size_t, r, q->qsize - i);
+	memcpy(buf, &q->array[i], n1 * WQ_ITEM_SZ);
+	if (unlikely(r > n1))
+		memcpy((char *)buf + n1 * WQ_ITEM_SZ, q->array,
+		       (r - n1) * WQ_ITEM_SZ);
 	mb();
 
 	/*
 	 * Since only one CPU writes @tail, then use faster atomic write
 	 * instead of increment.
 	 */
-	atomic64_set(&q->tail, tail + 1);
-	r = 0;
+	atomic64_set(&q->tail, tail + r);
 out:
 	local_bh_enable();
 	if (ticket)
-		*ticket = tail;
+		*ticket = r ? tail + r - 1 : tail;
 	return r;
 }
+
+/**
+ * Turnstile pop: fetch up to @n items from @q which precede an item with
+ * ticket @turn kept in a backlog. The ticket is the queue head at the time
+ * the item was spilled to the backlog, so all the items before it must be
+ * fetched first, even if their producers are still writing them.
+ *
+ * Return the number of fetched items, which is zero if the preceding items
+ * aren't written yet, or -ENOENT if the backlog item is the next one.
+ */
+int
+tfw_wq_pop_turn(TfwRBQueue *q, void *buf, int n, long turn, long *ticket)
+{
+	long tail = atomic64_read(&q->tail);
+
+	if (tail >= turn)
+		return -ENOENT;
+
+	return tfw_wq_pop_batch(q, buf, min_t(long, n, turn - tail), ticket);
+}
+
+/**
+ * Resize the empty queue @q to @qsize items, which must be a power of 2.
+ * The caller must guarantee that there are no concurrent producers and the
+ * consumer. The queue positions aren't reset, so the turnstile tickets stay
+ * valid.
+ */
+int
+tfw_wq_resize(TfwRBQueue *q, size_t qsize, int node)
+{
+	__WqItem *array;
+
+	if (qsize == q->qsize)
+		return 0;
+	if (WARN_ON_ONCE(tfw_wq_size(q) || !is_power_of_2(qsize)))
+		return -EINVAL;
+
+	array = kvmalloc_node(qsize * WQ_ITEM_SZ, GFP_KERNEL, node);
+	if (!array)
+		return -ENOMEM;
+	kvfree(q->array);
+	q->array = array;
+	q->qsize = qsize;
+
+	return 0;
+}
@@ -61,7 +61,9 @@ do {								\
 int tfw_wq_init(TfwRBQueue *wq, size_t qsize, int node);
 void tfw_wq_destroy(TfwRBQueue *wq);
 long __tfw_wq_push(TfwRBQueue *wq, void *ptr);
-int tfw_wq_pop_ticket(TfwRBQueue *wq, void *buf, long *ticket);
+int tfw_wq_pop_batch(TfwRBQueue *q, void *buf, int n, long *ticket);
+int tfw_wq_pop_turn(TfwRBQueue *q, void *buf, int n, long turn, long *ticket);
+int tfw_wq_resize(TfwRBQueue *q, size_t qsize, int node);
 
 static inline int
 tfw_wq_size(TfwRBQueue *q)
@@ -101,6 +103,12 @@ tfw_wq_push(TfwRBQueue *q, void *ptr, int cpu, struct irq_work *work,
 	return 0;
 }
 
+static inline int
+tfw_wq_pop_ticket(TfwRBQueue *wq, void *buf, long *ticket)
+{
+	return tfw_wq_pop_batch(wq, buf, 1, ticket) ? 0 : -EBUSY;
+}
+
 static inline int
 tfw_wq_pop(TfwRBQueue *wq, void *buf)
 {
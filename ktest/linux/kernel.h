@@ -90,11 +90,19 @@ struct module { /* dummy strut */ };
 #define request_module(...)
 
 #define __init
+#define __ro_after_init
 
 struct list_head {
 	struct list_head *next, *prev;
 };
 
+static inline void
+memzero_explicit(void *s, size_t count)
+{
+	memset(s, 0, count);
+	__asm__ __volatile__("" : : "r"(s) : "memory");
+}
+
 static inline int
 get_random_bytes_arch(void *buf, int nbytes)
 {
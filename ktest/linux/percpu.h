@@ -30,6 +30,8 @@
 
 #define __get_cpu_var(var)		var
 #define this_cpu_read(var)		var
+#define this_cpu_inc(var)		(++(var))
+#define this_cpu_dec(var)		(--(var))
 #define alloc_percpu(t)			calloc(NR_CPUS, sizeof(t))
 #define __alloc_percpu(s, a)		calloc(NR_CPUS, (s))
 #define free_percpu(p)			free(p)
@@ -30,4 +30,7 @@
 #define preempt_disable()
 #define preempt_enable()
 
+/* All the tested code runs as softirq. */
+#define in_serving_softirq()	1
+
 #endif /* __PREEMPT_H__ */
@@ -57,6 +57,7 @@
 #define TTLS_ASN1_OCTET_STRING				0x04
 #define TTLS_ASN1_NULL					0x05
 #define TTLS_ASN1_OID					0x06
+#define TTLS_ASN1_ENUMERATED				0x0A
 #define TTLS_ASN1_UTF8_STRING				0x0C
 #define TTLS_ASN1_SEQUENCE				0x10
 #define TTLS_ASN1_SET					0x11
@@ -41,8 +41,11 @@
 #include "mpool.h"
 #include "tls_internal.h"
 
-/* Maximum sliding window size in bits used for modular exponentiation. */
-#define MPI_W_SZ		6
+/*
+ * Maximum window size in bits used for modular exponentiation. The window
+ * table for RSA-4096 without CRT takes 16KB of the MPI stack pool.
+ */
+#define MPI_W_SZ		5
 
 void
 ttls_mpi_precompute_RR(TlsMpi *X, const TlsMpi *N)
@@ -491,6 +494,29 @@ ttls_mpi_write_binary(const TlsMpi *X, unsigned char *buf, size_t buflen)
 	return 0;
 }
 
+/**
+ * Export X into unsigned binary data, little endian, as used by RFC 7748 for
+ * Curve25519 coordinates. Always fills the whole buffer, which will end with
+ * zeros if the number is smaller.
+ */
+int
+ttls_mpi_write_binary_le(const TlsMpi *X, unsigned char *buf, size_t buflen)
+{
+	size_t i, l;
+
+	if (buflen < ttls_mpi_size(X))
+		return -ENOSPC;
+
+	for (i = 0; i < buflen; ++i) {
+		l = i / CIL;
+		buf[i] = l < X->used
+			 ? (unsigned char)(MPI_P(X)[l] >> (i % CIL) * 8)
+			 : 0;
+	}
+
+	return 0;
+}
+
 /**
  * Fill X with @size bytes of random.
  *
@@ -746,65 +772,15 @@ ttls_mpi_sub_int(TlsMpi *X, const TlsMpi *A, long b)
 	}
 }
 
-#define MULADDC_INIT							\
-	asm(	"xorq	%%r8, %%r8	\n\t"
-
-#define MULADDC_CORE							\
-		"movq	(%%rsi), %%rax	\n\t"				\
-		"mulq	%%rbx		\n\t"				\
-		"addq	$8, %%rsi	\n\t"				\
-		"addq	%%rcx, %%rax	\n\t"				\
-		"movq	%%r8, %%rcx	\n\t"				\
-		"adcq	$0, %%rdx	\n\t"				\
-		"nop			\n\t"				\
-		"addq	%%rax, (%%rdi)	\n\t"				\
-		"adcq	%%rdx, %%rcx	\n\t"				\
-		"addq	$8, %%rdi	\n\t"
-
-#define MULADDC_STOP							\
-		: "+c" (c), "+D" (d), "+S" (s)				\
-		: "b" (b)						\
-		: "rax", "rdx", "r8"					\
-	);
-
 static void
 __mpi_mul(size_t n, const unsigned long *s, unsigned long *d, unsigned long b)
 {
-	unsigned long c = 0;
-
-	for ( ; n >= 16; n -= 16) {
-		MULADDC_INIT
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_STOP
-	}
-	for ( ; n >= 8; n -= 8) {
-		MULADDC_INIT
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_CORE MULADDC_CORE
-		MULADDC_STOP
-	}
-	for ( ; n > 0; n--) {
-		MULADDC_INIT
-		MULADDC_CORE
-		MULADDC_STOP
-	}
+	unsigned long c = mpi_mul_add_x86_64(d, s, n, b);
 
-	do {
+	for (d += n; c; d++) {
 		*d += c;
 		c = *d < c;
-		d++;
-	} while (c);
+	}
 }
 
 /**
@@ -1116,68 +1092,144 @@ __mpi_montg_init(unsigned long *mm, const TlsMpi *N)
 }
 
 /**
- * Montgomery multiplication: A = A * B * R^-1 mod N  (HAC 14.36).
- *
- * TODO #1335: this is used for modular exponentiation only, so repalce it with
- * an adequate assembly implementation for the RSA handshakes.
+ * The final subtraction of Montgomery multiplication: X = D mod N, where @D
+ * is @n + 1 limbs and D < 2 * N. Both the results are always computed and
+ * the right one is selected by a mask, so there are no data dependent
+ * branches or memory accesses.
  */
-static int
-__mpi_montmul(TlsMpi *A, const TlsMpi *B, const TlsMpi *N, unsigned long mm,
-	      TlsMpi *T)
+static void
+__mpi_mont_final(unsigned long *x, const unsigned long *d,
+		 const unsigned long *N, size_t n)
 {
-	size_t i, n, m;
-	unsigned long u0, u1, *d;
+	size_t i;
+	unsigned long t, m, b = 0;
 
-	BUG_ON(T->limbs < N->used + 1);
-	bzero_fast(MPI_P(T), T->limbs * CIL);
+	for (i = 0; i < n; i++) {
+		t = d[i] - N[i];
+		m = d[i] < N[i];
+		x[i] = t - b;
+		b = m | (t < b);
+	}
+	/* Keep D if D < N, i.e. the subtraction borrowed from the top limb. */
+	m = (b & ~d[n]) - 1;
+	for (i = 0; i < n; i++)
+		x[i] = (x[i] & m) | (d[i] & ~m);
+}
 
-	d = MPI_P(T);
-	n = N->used;
-	m = (B->used < n) ? B->used : n;
+/**
+ * Montgomery multiplication of @n limbs operands: X = A * B * R^-1 mod N
+ * (HAC 14.36). @T is a scratch area of 2 * n + 1 limbs, @X may be the same
+ * as @A or @B.
+ */
+static void
+__mpi_mont_mul(unsigned long *x, const unsigned long *a, const unsigned long *b,
+	       const unsigned long *N, size_t n, unsigned long mm,
+	       unsigned long *t)
+{
+	size_t i;
+	unsigned long c, *d = t;
+
+	bzero_fast(t, (2 * n + 1) * CIL);
+
+	for (i = 0; i < n; i++, d++) {
+		/* T = (T + a[i] * B + u * N) / 2^BIL */
+		c = mpi_mul_add_x86_64(d, b, n, a[i]);
+		d[n] += c;
+		d[n + 1] += d[n] < c;
+		c = mpi_mul_add_x86_64(d, N, n, d[0] * mm);
+		d[n] += c;
+		d[n + 1] += d[n] < c;
+	}
 
-	for (i = 0; i < n; i++) {
-		/* T = (T + u0*B + u1*N) / 2^BIL */
-		u0 = MPI_P(A)[i];
-		u1 = (d[0] + u0 * MPI_P(B)[0]) * mm;
+	__mpi_mont_final(x, d, N, n);
+}
 
-		__mpi_mul(m, MPI_P(B), d, u0);
-		__mpi_mul(n, MPI_P(N), d, u1);
+/**
+ * Montgomery squaring: X = A^2 * R^-1 mod N. The cross products A[i] * A[j],
+ * i < j, are computed only once, so the squaring costs about 3/4 of
+ * the multiplication. The product is reduced with separate Montgomery
+ * reduction (HAC 14.32).
+ */
+static void
+__mpi_mont_sqr(unsigned long *x, const unsigned long *a,
+	       const unsigned long *N, size_t n, unsigned long mm,
+	       unsigned long *t)
+{
+	size_t i;
+	unsigned long c, s, carry = 0;
 
-		*d++ = u0;
-		d[n + 1] = 0;
-	}
-	mpi_fixup_used(T, T->limbs);
+	bzero_fast(t, (2 * n + 1) * CIL);
 
-	memcpy_fast(MPI_P(A), d, (n + 1) * CIL);
-	mpi_fixup_used(A, n + 1);
+	for (i = 0; i + 1 < n; i++)
+		t[i + n] = mpi_mul_add_x86_64(t + 2 * i + 1, a + i + 1,
+					      n - i - 1, a[i]);
+	mpi_sqr_diag_x86_64(t, a, n);
 
-	if (ttls_mpi_cmp_abs(A, N) >= 0) {
-		mpi_sub_x86_64(MPI_P(A), MPI_P(N), MPI_P(A), N->used, A->used);
-		mpi_fixup_used(A, A->used);
-	} else {
-		/* Prevent timing attacks. */
-		mpi_sub_x86_64(MPI_P(T), MPI_P(A), MPI_P(T), A->used, T->used);
-		mpi_fixup_used(T, T->used);
+	/*
+	 * The carry of each reduction step is deferred to the next one,
+	 * so it's never propagated further than one limb.
+	 */
+	for (i = 0; i < n; i++) {
+		c = mpi_mul_add_x86_64(t + i, N, n, t[i] * mm);
+		s = t[i + n] + c;
+		c = s < c;
+		t[i + n] = s + carry;
+		carry = c + (t[i + n] < carry);
 	}
+	t[2 * n] = carry;
 
-	return 0;
+	__mpi_mont_final(x, t + n, N, n);
 }
 
 /**
- * Montgomery reduction: A = A * R^-1 mod N
+ * Copy @X to @n limbs @d padding it with zeros.
  */
-static int
-__mpi_montred(TlsMpi *A, const TlsMpi *N, unsigned long mm, TlsMpi *T)
+static void
+__mpi_to_limbs(unsigned long *d, const TlsMpi *X, size_t n)
 {
-	DECLARE_MPI_AUTO_INITLIMBS(U, 1, { 1 });
-	U.s = 1;
+	BUG_ON(X->used > n);
+	memcpy_fast(d, MPI_P(X), X->used * CIL);
+	bzero_fast(d + X->used, (n - X->used) * CIL);
+}
 
-	return __mpi_montmul(A, &U, N, mm, T);
+/**
+ * Read @w bits of @E starting from bit @pos.
+ */
+static unsigned long
+__mpi_get_window(const TlsMpi *E, size_t pos, size_t w)
+{
+	size_t l = pos / BIL, off = pos % BIL;
+	unsigned long v = MPI_P(E)[l] >> off;
+
+	if (off + w > BIL && l + 1 < E->used)
+		v |= MPI_P(E)[l + 1] << (BIL - off);
+
+	return v & ((1UL << w) - 1);
+}
+
+/**
+ * Constant-time table lookup: read all the @wn entries of @n limbs from @W
+ * and keep only the @idx'th one in @d, so the memory access pattern doesn't
+ * depend on the exponent bits.
+ */
+static void
+__mpi_select(unsigned long *d, const unsigned long *W, size_t wn, size_t n,
+	     unsigned long idx)
+{
+	size_t i, j;
+	unsigned long m;
+
+	bzero_fast(d, n * CIL);
+	for (i = 0; i < wn; i++, W += n) {
+		m = 0UL - (((i ^ idx) - 1) >> (BIL - 1));
+		for (j = 0; j < n; j++)
+			d[j] |= W[j] & m;
+	}
 }
 
 /**
- * Sliding-window exponentiation with Montgomery reduction: X = A^E mod N
- * See HAC 14.85 and [2] chapter 7.2.2.
+ * Fixed-window exponentiation with Montgomery reduction: X = A^E mod N
+ * See HAC 14.82 and [2] chapter 7.2.1.
  *
  * @X	- destination MPI;
  * @A	- left-hand MPI
@@ -1188,6 +1240,11 @@ __mpi_montred(TlsMpi *A, const TlsMpi *N, unsigned long mm, TlsMpi *T)
  * @RR is used to avoid re-computing R * R mod N across multiple calls,
  * which speeds up things a bit.
  *
+ * The function is used for RSA private keys and DHE secrets, so the sequence
+ * of squarings and multiplications is the same for all exponents of the same
+ * length and the window table is read in constant time. All the operands are
+ * processed as @N->used limbs arrays with the MULX/ADX assembly kernels.
+ *
  * TODO #1335: couple the Montgomery multiplication with Karatsuba's one:
  * RSA operates with large numbers, so Karatsuba with fallback to 256-bit
  * schoolbook should be beneficial.
@@ -1196,33 +1253,36 @@ int
 ttls_mpi_exp_mod(TlsMpi *X, const TlsMpi *A, const TlsMpi *E, const TlsMpi *N,
 		 TlsMpi *RR)
 {
-	int ret = -ENOMEM, neg;
-	size_t i, j, nblimbs, bufsize = 0, nbits = 0, wbits = 0, wsize;
-	unsigned long ei, mm, state = 0;
-	TlsMpi T, Apos, *W;
+	int neg;
+	size_t i, k, n, nw, ebits, wsize, wn;
+	unsigned long mm, *W, *x, *w, *t;
+	TlsMpi Apos;
 
-	BUILD_BUG_ON(MPI_W_SZ < 6);
 	if (ttls_mpi_cmp_int(N, 0) <= 0 || !(MPI_P(N)[0] & 1))
 		return -EINVAL;
 	if (ttls_mpi_cmp_int(E, 0) < 0)
 		return -EINVAL;
 
-	/* Init temps and window size. */
-	j = N->used + 1;
-	if (WARN_ON_ONCE(X->limbs < j))
+	n = N->used;
+	if (WARN_ON_ONCE(X->limbs < n + 1))
 		return -ENOMEM;
 	__mpi_montg_init(&mm, N);
-	ttls_mpi_alloca_init(&T, j * 2);
-	W = ttls_mpool_alloc_stack(sizeof(TlsMpi) * (1 << MPI_W_SZ));
-	bzero_fast(W, sizeof(TlsMpi) * (1 << MPI_W_SZ));
-	ttls_mpi_alloc(&W[1], j);
-
-	i = ttls_mpi_bitlen(E);
-	wsize = (i > 671) ? 6
-		: (i > 239) ? 5
-		  : (i >  79) ? 4
-		    : (i >  23) ? 3
-		      : 1;
+
+	/* The window sizes are the same as in OpenSSL for constant-time. */
+	ebits = ttls_mpi_bitlen(E);
+	wsize = (ebits > 306) ? MPI_W_SZ
+		: (ebits >  89) ? 4
+		  : (ebits >  22) ? 3
+		    : 1;
+	wn = 1 << wsize;
+
+	/* The window table, X, the current window value and the scratch. */
+	W = ttls_mpool_alloc_stack(CIL * n * (wn + 4) + CIL);
+	if (!W)
+		return -ENOMEM;
+	x = W + wn * n;
+	w = x + n;
+	t = w + n;
 
 	/* Compensate for negative A (and correct at the end). */
 	neg = (A->s == -1);
@@ -1239,100 +1299,66 @@ ttls_mpi_exp_mod(TlsMpi *X, const TlsMpi *A, const TlsMpi *E, const TlsMpi *N,
 	BUG_ON(!RR);
 	if (unlikely(ttls_mpi_empty(RR)))
 		ttls_mpi_precompute_RR(RR, N);
+	__mpi_to_limbs(x, RR, n);
 
 	/* W[1] = A * R^2 * R^-1 mod N = A * R mod N */
 	if (ttls_mpi_cmp_mpi(A, N) >= 0)
-		ttls_mpi_mod_mpi(&W[1], A, N);
-	else
-		ttls_mpi_copy(&W[1], A);
-
-	TTLS_MPI_CHK(__mpi_montmul(&W[1], RR, N, mm, &T));
-
-	/* X = R^2 * R^-1 mod N = R mod N */
-	ttls_mpi_copy(X, RR);
-	TTLS_MPI_CHK(__mpi_montred(X, N, mm, &T));
-
-	if (wsize > 1) {
-		/* W[1 << (wsize - 1)] = W[1] ^ (wsize - 1) */
-		j =  1 << (wsize - 1);
-
-		ttls_mpi_alloc(&W[j], N->used + 1);
-		ttls_mpi_copy(&W[j], &W[1]);
-
-		for (i = 0; i < wsize - 1; i++)
-			TTLS_MPI_CHK(__mpi_montmul(&W[j], &W[j], N, mm, &T));
-
-		/* W[i] = W[i - 1] * W[1] */
-		for (i = j + 1; i < (1 << wsize); i++) {
-			ttls_mpi_alloc(&W[i], N->used + 1);
-			ttls_mpi_copy(&W[i], &W[i - 1]);
-			TTLS_MPI_CHK(__mpi_montmul(&W[i], &W[1], N, mm, &T));
-		}
-	}
-
-	nblimbs = E->used;
-	while (1) {
-		if (!bufsize) {
-			if (!nblimbs)
-				break;
-			nblimbs--;
-			bufsize = sizeof(unsigned long) << 3;
-		}
-
-		bufsize--;
-
-		ei = (MPI_P(E)[nblimbs] >> bufsize) & 1;
-
-		/* Skip leading 0s. */
-		if (!ei && !state)
-			continue;
-
-		if (!ei && state == 1) {
-			/* Out of window, square X. */
-			TTLS_MPI_CHK(__mpi_montmul(X, X, N, mm, &T));
-			continue;
-		}
-
-		/* Add ei to current window. */
-		state = 2;
-
-		nbits++;
-		wbits |= (ei << (wsize - nbits));
-
-		if (nbits == wsize) {
-			/* X = X^wsize R^-1 mod N . */
-			for (i = 0; i < wsize; i++)
-				TTLS_MPI_CHK(__mpi_montmul(X, X, N, mm, &T));
-
-			/* X = X * W[wbits] R^-1 mod N. */
-			TTLS_MPI_CHK(__mpi_montmul(X, &W[wbits], N, mm, &T));
-
-			state--;
-			nbits = 0;
-			wbits = 0;
-		}
+		ttls_mpi_mod_mpi(X, A, N);
+	else if (X != A)
+		ttls_mpi_copy(X, A);
+	__mpi_to_limbs(w, X, n);
+	__mpi_mont_mul(W + n, w, x, MPI_P(N), n, mm, t);
+
+	/* W[0] = R^2 * R^-1 mod N = R mod N */
+	bzero_fast(w, n * CIL);
+	w[0] = 1;
+	__mpi_mont_mul(W, x, w, MPI_P(N), n, mm, t);
+
+	/* W[i] = W[1] ^ i */
+	for (i = 2; i < wn; i++) {
+		if (i & 1)
+			__mpi_mont_mul(W + i * n, W + (i - 1) * n, W + n,
+				       MPI_P(N), n, mm, t);
+		else
+			__mpi_mont_sqr(W + i * n, W + i / 2 * n, MPI_P(N), n,
+				       mm, t);
 	}
 
-	/* Process the remaining bits. */
-	for (i = 0; i < nbits; i++) {
-		TTLS_MPI_CHK(__mpi_montmul(X, X, N, mm, &T));
-
-		wbits <<= 1;
-		if (wbits & (1 << wsize))
-			TTLS_MPI_CHK(__mpi_montmul(X, &W[1], N, mm, &T));
+	/*
+	 * Process the exponent from the most significant window. The leading
+	 * window is just loaded to X, each of the rest costs @wsize squarings
+	 * and one multiplication, even for zero windows.
+	 */
+	nw = (ebits + wsize - 1) / wsize;
+	k = nw ? nw - 1 : 0;
+	__mpi_select(x, W, wn, n, nw ? __mpi_get_window(E, k * wsize, wsize)
+				      : 0);
+	while (k--) {
+		unsigned long idx = __mpi_get_window(E, k * wsize, wsize);
+
+		for (i = 0; i < wsize; i++)
+			__mpi_mont_sqr(x, x, MPI_P(N), n, mm, t);
+		__mpi_select(w, W, wn, n, idx);
+		__mpi_mont_mul(x, x, w, MPI_P(N), n, mm, t);
 	}
 
 	/* X = A^E * R * R^-1 mod N = A^E mod N. */
-	TTLS_MPI_CHK(__mpi_montred(X, N, mm, &T));
+	bzero_fast(w, n * CIL);
+	w[0] = 1;
+	__mpi_mont_mul(x, x, w, MPI_P(N), n, mm, t);
+
+	memcpy_fast(MPI_P(X), x, n * CIL);
+	mpi_fixup_used(X, n);
+	X->s = 1;
 
 	if (neg && E->used && (MPI_P(E)[0] & 1)) {
 		X->s = -1;
 		ttls_mpi_add_mpi(X, N, X);
 	}
 
-cleanup:
 	ttls_mpi_pool_cleanup_ctx((unsigned long)W, false);
-	return ret;
+
+	return 0;
 }
 
 /**
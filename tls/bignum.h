@@ -25,6 +25,7 @@
 #ifndef TTLS_BIGNUM_H
 #define TTLS_BIGNUM_H
 
+#include <linux/preempt.h>
 #include <linux/random.h>
 
 #include "bignum_asm.h"
@@ -64,6 +65,20 @@ do {									\
 #define BITS_TO_LIMBS(n)	(((n) + BIL - 1) >> BSHIFT)
 #define CHARS_TO_LIMBS(n)	(((n) + CIL - 1) >> LSHIFT)
 
+/*
+ * Per-CPU scratch data for PK computations has an instance for softirq and an
+ * instance for process context, i.e. for configuration and for the handshake
+ * workers, which do PK computations with softirqs enabled, see
+ * ttls_handshake_prepare(). Process context users must disable preemption.
+ */
+#define TTLS_CPU_CTX_N		2
+
+static inline int
+ttls_cpu_ctx(void)
+{
+	return !in_serving_softirq();
+}
+
 /**
  * MPI structure.
  *
@@ -176,6 +191,8 @@ size_t ttls_mpi_size(const TlsMpi *X);
 
 void ttls_mpi_read_binary(TlsMpi *X, const unsigned char *buf, size_t buflen);
 int ttls_mpi_write_binary(const TlsMpi *X, unsigned char *buf, size_t buflen);
+int ttls_mpi_write_binary_le(const TlsMpi *X, unsigned char *buf,
+			     size_t buflen);
 void ttls_mpi_fill_random(TlsMpi *X, size_t size);
 
 int ttls_mpi_safe_cond_swap(TlsMpi *X, TlsMpi *Y, unsigned char swap);
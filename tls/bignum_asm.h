@@ -60,6 +60,9 @@ void mpi_mul_x86_64_4(unsigned long *x, const unsigned long *a,
 		      const unsigned long *b);
 void mpi_mul_int_x86_64_4(unsigned long *x, const unsigned long *a, long b);
 void mpi_sqr_x86_64_4(unsigned long *x, const unsigned long *a);
+unsigned long mpi_mul_add_x86_64(unsigned long *d, const unsigned long *s,
+				 size_t n, unsigned long b);
+void mpi_sqr_diag_x86_64(unsigned long *x, const unsigned long *a, size_t n);
 
 void mpi_mul_mod_p256_x86_64_4(unsigned long *x, const unsigned long *a,
 			       const unsigned long *b);
@@ -72,5 +75,8 @@ void mpi_mul_mont_mod_p256_x86_64(unsigned long *x, const unsigned long *a,
 void mpi_sqr_mont_mod_p256_x86_64(unsigned long *x, const unsigned long *a);
 void mpi_from_mont_p256_x86_64(unsigned long *x);
 
+void ecp256_gather_avx2(void *r, const void *t, unsigned long idx,
+			unsigned long n);
+
 #endif /* __BIGNUM_ASM_H__ */
 
@@ -88,6 +88,21 @@ static TlsCiphersuite ciphersuite_definitions[] = {
 	  TTLS_CIPHER_AES_128_CCM, TTLS_MD_SHA256,
 	  TTLS_KEY_EXCHANGE_DHE_RSA,
 	  0, { &cs_mp_dhe.mp, NULL } },
+	{ TTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+	  "TLS-ECDHE-ECDSA-WITH-CHACHA20-POLY1305-SHA256",
+	  TTLS_CIPHER_CHACHA20_POLY1305, TTLS_MD_SHA256,
+	  TTLS_KEY_EXCHANGE_ECDHE_ECDSA,
+	  0, { &cs_mp_ecdhe_secp256.mp, &cs_mp_ecdhe_curve25519.mp } },
+	{ TTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+	  "TLS-ECDHE-RSA-WITH-CHACHA20-POLY1305-SHA256",
+	  TTLS_CIPHER_CHACHA20_POLY1305, TTLS_MD_SHA256,
+	  TTLS_KEY_EXCHANGE_ECDHE_RSA,
+	  0, { &cs_mp_ecdhe_secp256.mp, &cs_mp_ecdhe_curve25519.mp } },
+	{ TTLS_TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+	  "TLS-DHE-RSA-WITH-CHACHA20-POLY1305-SHA256",
+	  TTLS_CIPHER_CHACHA20_POLY1305, TTLS_MD_SHA256,
+	  TTLS_KEY_EXCHANGE_DHE_RSA,
+	  0, { &cs_mp_dhe.mp, NULL } },
 	{ 0, "", TTLS_CIPHER_NONE, TTLS_MD_NONE, TTLS_KEY_EXCHANGE_NONE,
 	  0, { NULL, NULL } }
 };
@@ -108,6 +123,7 @@ ttls_ciphersuite_addr_mp(void *addr)
 	unsigned long x = (unsigned long)addr;
 
 	__CS_ADDR_MP(ecdhe_secp256, x);
+	__CS_ADDR_MP(ecdhe_curve25519, x);
 	__CS_ADDR_MP(dhe, x);
 
 	return NULL;
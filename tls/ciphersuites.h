@@ -41,6 +41,9 @@
 #define TTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384	0xC030
 #define TTLS_TLS_DHE_RSA_WITH_AES_128_CCM		0xC09E
 #define TTLS_TLS_DHE_RSA_WITH_AES_256_CCM		0xC09F
+#define TTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256	0xCCA8
+#define TTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256	0xCCA9
+#define TTLS_TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256	0xCCAA
 
 /*
  * Reminder: update ttls_premaster_secret when adding a new key exchange.
@@ -77,6 +80,12 @@ ttls_pk_type_t ttls_get_ciphersuite_sig_pk_alg(const TlsCiphersuite *info);
 ttls_pk_type_t ttls_get_ciphersuite_sig_alg(const TlsCiphersuite *info);
 int ttls_ciphersuite_uses_ec(const TlsCiphersuite *info);
 
+static inline bool
+ttls_ciphersuite_is_chacha(const TlsCiphersuite *info)
+{
+	return info->cipher == TTLS_CIPHER_CHACHA20_POLY1305;
+}
+
 static inline int
 ttls_ciphersuite_cert_req_allowed(const TlsCiphersuite *info)
 {
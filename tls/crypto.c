@@ -126,6 +126,19 @@ static TlsCipherInfo aes_256_ccm_info = {
 	16,
 };
 
+/*
+ * RFC 7905: the whole 12-byte nonce is derived from the key block and the
+ * record sequence number, so there is no explicit part of IV on the wire.
+ */
+static TlsCipherInfo chacha20_poly1305_info = {
+	TTLS_CIPHER_CHACHA20_POLY1305,
+	TTLS_MODE_CHACHAPOLY,
+	32,
+	"CHACHA20-POLY1305",
+	"rfc7539(chacha20,poly1305)",
+	12,
+};
+
 static TlsCipherDef ttls_ciphers[] = {
 	{ TTLS_CIPHER_AES_128_GCM,	&aes_128_gcm_info },
 	{ TTLS_CIPHER_AES_192_GCM,	&aes_192_gcm_info },
@@ -133,6 +146,7 @@ static TlsCipherDef ttls_ciphers[] = {
 	{ TTLS_CIPHER_AES_128_CCM,	&aes_128_ccm_info },
 	{ TTLS_CIPHER_AES_192_CCM,	&aes_192_ccm_info },
 	{ TTLS_CIPHER_AES_256_CCM,	&aes_256_ccm_info },
+	{ TTLS_CIPHER_CHACHA20_POLY1305, &chacha20_poly1305_info },
 	{ TTLS_CIPHER_NONE,		NULL }
 };
 
@@ -429,6 +443,14 @@ ttls_crypto_modinit(void)
 	};
 	char **inst_set;
 
+	/*
+	 * rfc7539 template is built on top of the best chacha20 and poly1305
+	 * implementations registered at the moment of the first allocation,
+	 * so load the SIMD ones first if they're built as modules.
+	 */
+	request_module("crypto-chacha20-simd");
+	request_module("crypto-poly1305-simd");
+
 	for (c = ttls_ciphers; c->info; c++) {
 		name = c->info->drv_name;
 		if ((r = ttls_ciphermod_preload(name)))
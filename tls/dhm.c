@@ -110,43 +110,92 @@ static const unsigned char ttls_dhm_rfc3526_modp_2048_p[] = {
 
 static const unsigned char ttls_dhm_rfc3526_modp_2048_g[] = { 0x02 };
 
+#define DHM_2048_LEN		sizeof(ttls_dhm_rfc3526_modp_2048_p)
+#define DHM_2048_LIMBS		(DHM_2048_LEN / CIL)
+#define DHM_2048_PARAMS_LEN	(2 + DHM_2048_LEN + 2			\
+				 + sizeof(ttls_dhm_rfc3526_modp_2048_g))
+
 /*
- * Set DHM prime modulus and generator defined in NSA Suite B (257 bytes).
+ * The only DHM group which we use. All the constant data, including R^2 mod P
+ * for Montgomery multiplication and the ServerKeyExchange encoding of P and G,
+ * is computed once on the module initialization and is referenced by pointer
+ * from all the handshake contexts, so the per-handshake memory profiles keep
+ * only the mutable data.
+ *
+ * The MPIs reference their limbs by short offsets, so the limbs are placed in
+ * the same structure.
+ */
+static struct {
+	TlsDHMGroup	grp;
+	TlsMpi		P;
+	unsigned long	p[DHM_2048_LIMBS];
+	TlsMpi		G;
+	unsigned long	g[1];
+	TlsMpi		RP;
+	unsigned long	rp[DHM_2048_LIMBS * 2 + 2];
+	unsigned char	params[DHM_2048_PARAMS_LEN];
+} ttls_dhm_2048 __ro_after_init ____cacheline_aligned;
+
+static void
+ttls_dhm_init_mpi(TlsMpi *X, unsigned long *p, size_t limbs)
+{
+	X->s = 1;
+	X->used = 0;
+	X->limbs = limbs;
+	X->_off = (unsigned char *)p - (unsigned char *)X;
+}
+
+/**
+ * Initialize the shared DHM group. Must be called in the same context as
+ * the MPI profiles initialization since the R^2 mod P computation uses the
+ * temporary MPI pool.
  */
 void
-ttls_dhm_load(TlsDHMCtx *ctx)
+ttls_dhm_init(void)
 {
-	ttls_mpi_read_binary(&ctx->P, ttls_dhm_rfc3526_modp_2048_p,
+	TlsDHMGroup *grp = &ttls_dhm_2048.grp;
+	unsigned char *p = ttls_dhm_2048.params;
+
+	ttls_dhm_init_mpi(&ttls_dhm_2048.P, ttls_dhm_2048.p,
+			  ARRAY_SIZE(ttls_dhm_2048.p));
+	ttls_dhm_init_mpi(&ttls_dhm_2048.G, ttls_dhm_2048.g,
+			  ARRAY_SIZE(ttls_dhm_2048.g));
+	ttls_dhm_init_mpi(&ttls_dhm_2048.RP, ttls_dhm_2048.rp,
+			  ARRAY_SIZE(ttls_dhm_2048.rp));
+
+	ttls_mpi_read_binary(&ttls_dhm_2048.P, ttls_dhm_rfc3526_modp_2048_p,
 			     sizeof(ttls_dhm_rfc3526_modp_2048_p));
-	ttls_mpi_read_binary(&ctx->G, ttls_dhm_rfc3526_modp_2048_g,
+	ttls_mpi_read_binary(&ttls_dhm_2048.G, ttls_dhm_rfc3526_modp_2048_g,
 			     sizeof(ttls_dhm_rfc3526_modp_2048_g));
-	ctx->len = ttls_mpi_size(&ctx->P);
-	ttls_mpi_alloc(&ctx->GX, ctx->P.used + 1);
-	ttls_mpi_alloc(&ctx->K, ctx->P.used + 1);
+	ttls_mpi_precompute_RR(&ttls_dhm_2048.RP, &ttls_dhm_2048.P);
+
+	*p++ = (unsigned char)(sizeof(ttls_dhm_rfc3526_modp_2048_p) >> 8);
+	*p++ = (unsigned char)sizeof(ttls_dhm_rfc3526_modp_2048_p);
+	memcpy(p, ttls_dhm_rfc3526_modp_2048_p,
+	       sizeof(ttls_dhm_rfc3526_modp_2048_p));
+	p += sizeof(ttls_dhm_rfc3526_modp_2048_p);
+	*p++ = 0;
+	*p++ = (unsigned char)sizeof(ttls_dhm_rfc3526_modp_2048_g);
+	memcpy(p, ttls_dhm_rfc3526_modp_2048_g,
+	       sizeof(ttls_dhm_rfc3526_modp_2048_g));
+
+	grp->len = ttls_mpi_size(&ttls_dhm_2048.P);
+	grp->plen = sizeof(ttls_dhm_2048.params);
+	grp->P = &ttls_dhm_2048.P;
+	grp->G = &ttls_dhm_2048.G;
+	grp->RP = &ttls_dhm_2048.RP;
+	grp->params = ttls_dhm_2048.params;
 }
 
 /*
- * helper to validate the TlsMpi size and import it
+ * Set DHM prime modulus and generator defined in NSA Suite B (257 bytes).
  */
-static int
-dhm_read_bignum(TlsMpi *X, unsigned char **p, const unsigned char *end)
+void
+ttls_dhm_load(TlsDHMCtx *ctx)
 {
-	int n;
-
-	if (end - *p < 2)
-		return TTLS_ERR_DHM_BAD_INPUT_DATA;
-
-	n = ((*p)[0] << 8) | (*p)[1];
-	(*p) += 2;
-
-	if ((int)(end - *p) < n)
-		return TTLS_ERR_DHM_BAD_INPUT_DATA;
-
-	ttls_mpi_read_binary(X, *p, n);
-
-	(*p) += n;
-
-	return 0;
+	ctx->grp = &ttls_dhm_2048.grp;
+	ttls_mpi_alloc(&ctx->GX, ctx->grp->P->used + 1);
+	ttls_mpi_alloc(&ctx->K, ctx->grp->P->used + 1);
 }
 
 /**
@@ -175,25 +224,14 @@ dhm_check_range(const TlsMpi *param, const TlsMpi *P)
 }
 
 /*
- * Parse the ServerKeyExchange parameters
+ * R^2 mod P is precomputed for the shared group, so ttls_mpi_exp_mod() never
+ * writes it.
  */
-int ttls_dhm_read_params(TlsDHMCtx *ctx,
-		 unsigned char **p,
-		 const unsigned char *end)
+static int
+dhm_exp_mod(TlsMpi *X, const TlsMpi *A, const TlsMpi *E,
+	    const TlsDHMGroup *grp)
 {
-	int ret;
-
-	if ((ret = dhm_read_bignum(&ctx->P,  p, end)) != 0 ||
-		(ret = dhm_read_bignum(&ctx->G,  p, end)) != 0 ||
-		(ret = dhm_read_bignum(&ctx->GY, p, end)) != 0)
-		return ret;
-
-	if ((ret = dhm_check_range(&ctx->GY, &ctx->P)) != 0)
-		return ret;
-
-	ctx->len = ttls_mpi_size(&ctx->P);
-
-	return 0;
+	return ttls_mpi_exp_mod(X, A, E, grp->P, (TlsMpi *)grp->RP);
 }
 
 /*
@@ -208,54 +246,40 @@ ttls_dhm_make_params(TlsDHMCtx *ctx, int x_size, unsigned char *output,
 		     size_t *olen)
 {
 	int r = -EINVAL, count = 0;
-	size_t n1, n2, n3;
+	size_t n;
 	unsigned char *p;
 
-	if (WARN_ON_ONCE(!ttls_mpi_cmp_int(&ctx->P, 0)))
-		return -EINVAL;
-
 	/* Generate X as large as possible (< P). */
 	do {
 		ttls_mpi_fill_random(&ctx->X, x_size);
 
-		while (ttls_mpi_cmp_mpi(&ctx->X, &ctx->P) >= 0)
+		while (ttls_mpi_cmp_mpi(&ctx->X, ctx->grp->P) >= 0)
 			ttls_mpi_shift_r(&ctx->X, 1);
 
 		if (count++ > 10) {
 			T_WARN("DHM random failed\n");
 			goto err;
 		}
-	} while (dhm_check_range(&ctx->X, &ctx->P));
+	} while (dhm_check_range(&ctx->X, ctx->grp->P));
 
 	/* Calculate GX = G^X mod P. */
-	r = ttls_mpi_exp_mod(&ctx->GX, &ctx->G, &ctx->X, &ctx->P, &ctx->RP);
+	r = dhm_exp_mod(&ctx->GX, ctx->grp->G, &ctx->X, ctx->grp);
 	if (r)
 		goto err;
-	if ((r = dhm_check_range(&ctx->GX, &ctx->P)))
+	if ((r = dhm_check_range(&ctx->GX, ctx->grp->P)))
 		goto err;
 
-	/* Export P, G, GX. */
-#define DHM_MPI_EXPORT(X, n)						\
-	if ((r = ttls_mpi_write_binary(X, p + 2, n)))			\
-		goto err;						\
-	*p++ = (unsigned char)(n >> 8);					\
-	*p++ = (unsigned char)n;					\
+	/* Export P and G encoded on the group initialization and GX. */
+	n = ttls_mpi_size(&ctx->GX);
+	memcpy_fast(output, ctx->grp->params, ctx->grp->plen);
+	p = output + ctx->grp->plen;
+	if ((r = ttls_mpi_write_binary(&ctx->GX, p + 2, n)))
+		goto err;
+	*p++ = (unsigned char)(n >> 8);
+	*p++ = (unsigned char)n;
 	p += n;
 
-	n1 = ttls_mpi_size(&ctx->P);
-	n2 = ttls_mpi_size(&ctx->G);
-	n3 = ttls_mpi_size(&ctx->GX);
-
-	p = output;
-	DHM_MPI_EXPORT(&ctx->P, n1);
-	DHM_MPI_EXPORT(&ctx->G, n2);
-	DHM_MPI_EXPORT(&ctx->GX, n3);
-
 	*olen = p - output;
-
-	ctx->len = n1;
-
-#undef DHM_MPI_EXPORT
 err:
 	if (r)
 		T_WARN("Making of the DHM parameters failed, %d\n", r);
@@ -268,7 +292,7 @@ err:
 int
 ttls_dhm_read_public(TlsDHMCtx *ctx, const unsigned char *input, size_t ilen)
 {
-	if (!ctx || ilen < 1 || ilen > ctx->len)
+	if (!ctx || ilen < 1 || ilen > ctx->grp->len)
 		return -EINVAL;
 
 	ttls_mpi_read_binary(&ctx->GY, input, ilen);
@@ -284,10 +308,10 @@ int ttls_dhm_make_public(TlsDHMCtx *ctx, int x_size,
 {
 	int ret, count = 0;
 
-	if (ctx == NULL || olen < 1 || olen > ctx->len)
+	if (ctx == NULL || olen < 1 || olen > ctx->grp->len)
 		return(TTLS_ERR_DHM_BAD_INPUT_DATA);
 
-	if (ttls_mpi_cmp_int(&ctx->P, 0) == 0)
+	if (ttls_mpi_cmp_int(ctx->grp->P, 0) == 0)
 		return(TTLS_ERR_DHM_BAD_INPUT_DATA);
 
 	/*
@@ -296,18 +320,17 @@ int ttls_dhm_make_public(TlsDHMCtx *ctx, int x_size,
 	do {
 		ttls_mpi_fill_random(&ctx->X, x_size);
 
-		while (ttls_mpi_cmp_mpi(&ctx->X, &ctx->P) >= 0)
+		while (ttls_mpi_cmp_mpi(&ctx->X, ctx->grp->P) >= 0)
 			ttls_mpi_shift_r(&ctx->X, 1);
 
 		if (count++ > 10)
 			return(TTLS_ERR_DHM_MAKE_PUBLIC_FAILED);
 	}
-	while (dhm_check_range(&ctx->X, &ctx->P) != 0);
+	while (dhm_check_range(&ctx->X, ctx->grp->P) != 0);
 
-	TTLS_MPI_CHK(ttls_mpi_exp_mod(&ctx->GX, &ctx->G, &ctx->X,
-			  &ctx->P , &ctx->RP));
+	TTLS_MPI_CHK(dhm_exp_mod(&ctx->GX, ctx->grp->G, &ctx->X, ctx->grp));
 
-	if ((ret = dhm_check_range(&ctx->GX, &ctx->P)) != 0)
+	if ((ret = dhm_check_range(&ctx->GX, ctx->grp->P)) != 0)
 		return ret;
 
 	TTLS_MPI_CHK(ttls_mpi_write_binary(&ctx->GX, output, olen));
@@ -347,10 +370,10 @@ static int dhm_update_blinding(TlsDHMCtx *ctx)
 	 */
 	if (ttls_mpi_cmp_int(&ctx->Vi, 1)) {
 		ttls_mpi_mul_mpi(&ctx->Vi, &ctx->Vi, &ctx->Vi);
-		ttls_mpi_mod_mpi(&ctx->Vi, &ctx->Vi, &ctx->P);
+		ttls_mpi_mod_mpi(&ctx->Vi, &ctx->Vi, ctx->grp->P);
 
 		ttls_mpi_mul_mpi(&ctx->Vf, &ctx->Vf, &ctx->Vf);
-		ttls_mpi_mod_mpi(&ctx->Vf, &ctx->Vf, &ctx->P);
+		ttls_mpi_mod_mpi(&ctx->Vf, &ctx->Vf, ctx->grp->P);
 
 		return 0;
 	}
@@ -362,9 +385,9 @@ static int dhm_update_blinding(TlsDHMCtx *ctx)
 	/* Vi = random(2, P-1) */
 	count = 0;
 	do {
-		ttls_mpi_fill_random(&ctx->Vi, ttls_mpi_size(&ctx->P));
+		ttls_mpi_fill_random(&ctx->Vi, ttls_mpi_size(ctx->grp->P));
 
-		while (ttls_mpi_cmp_mpi(&ctx->Vi, &ctx->P) >= 0)
+		while (ttls_mpi_cmp_mpi(&ctx->Vi, ctx->grp->P) >= 0)
 			ttls_mpi_shift_r(&ctx->Vi, 1);
 
 		if (count++ > 10)
@@ -373,8 +396,8 @@ static int dhm_update_blinding(TlsDHMCtx *ctx)
 	while (ttls_mpi_cmp_int(&ctx->Vi, 1) <= 0);
 
 	/* Vf = Vi^-X mod P */
-	ttls_mpi_inv_mod(&ctx->Vf, &ctx->Vi, &ctx->P);
-	TTLS_MPI_CHK(ttls_mpi_exp_mod(&ctx->Vf, &ctx->Vf, &ctx->X, &ctx->P, &ctx->RP));
+	ttls_mpi_inv_mod(&ctx->Vf, &ctx->Vi, ctx->grp->P);
+	TTLS_MPI_CHK(dhm_exp_mod(&ctx->Vf, &ctx->Vf, &ctx->X, ctx->grp));
 
 cleanup:
 	return ret;
@@ -390,10 +413,10 @@ ttls_dhm_calc_secret(TlsDHMCtx *ctx, unsigned char *output, size_t output_size,
 	int r;
 	TlsMpi *GYb;
 
-	if (unlikely(!ctx || output_size < ctx->len))
+	if (unlikely(!ctx || output_size < ctx->grp->len))
 		return -EINVAL;
 
-	if ((r = dhm_check_range(&ctx->GY, &ctx->P)))
+	if ((r = dhm_check_range(&ctx->GY, ctx->grp->P)))
 		return r;
 
 	/* Blind peer's value */
@@ -401,14 +424,14 @@ ttls_dhm_calc_secret(TlsDHMCtx *ctx, unsigned char *output, size_t output_size,
 
 	GYb = ttls_mpi_alloc_stack_init(ctx->GY.used + ctx->Vi.used);
 	ttls_mpi_mul_mpi(GYb, &ctx->GY, &ctx->Vi);
-	ttls_mpi_mod_mpi(GYb, GYb, &ctx->P);
+	ttls_mpi_mod_mpi(GYb, GYb, ctx->grp->P);
 
 	/* Do modular exponentiation */
-	MPI_CHK(ttls_mpi_exp_mod(&ctx->K, GYb, &ctx->X, &ctx->P, &ctx->RP));
+	MPI_CHK(dhm_exp_mod(&ctx->K, GYb, &ctx->X, ctx->grp));
 
 	/* Unblind secret value */
 	ttls_mpi_mul_mpi(&ctx->K, &ctx->K, &ctx->Vf);
-	ttls_mpi_mod_mpi(&ctx->K, &ctx->K, &ctx->P);
+	ttls_mpi_mod_mpi(&ctx->K, &ctx->K, ctx->grp->P);
 
 	*olen = ttls_mpi_size(&ctx->K);
 
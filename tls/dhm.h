@@ -64,54 +64,47 @@
 #define TTLS_ERR_DHM_MAKE_PUBLIC_FAILED				-0x3280  /**< Making of the public value failed. */
 
 /**
- * The DHM context structure.
+ * Read-only DHM group data shared by all the handshakes.
  *
  * @len		- The size of P in bytes;
+ * @plen	- The size of @params in bytes;
  * @P		- The prime modulus;
  * @G		- The generator;
+ * @RP		- The precomputed value R^2 mod P;
+ * @params	- P and G encoded for ServerKeyExchange, RFC 5246 7.4.3.
+ */
+typedef struct {
+	size_t			len;
+	size_t			plen;
+	const TlsMpi		*P;
+	const TlsMpi		*G;
+	const TlsMpi		*RP;
+	const unsigned char	*params;
+} TlsDHMGroup;
+
+/**
+ * The DHM context structure.
+ *
+ * @grp		- The group parameters;
  * @X		- Our secret value;
  * @GX		- Our public key = G^X mod P;
  * @GY		- The public key of the peer = G^Y mod P;
  * @K		- The shared secret = G^(XY) mod P;
- * @RP		- The cached value = R^2 mod P;
  * @Vi		- The blinding value;
  * @Vf		- The unblinding value;
  * @pX		- The previous X.
  */
 typedef struct {
-	size_t	len;
-	TlsMpi	P;
-	TlsMpi	G;
-	TlsMpi	X;
-	TlsMpi	GX;
-	TlsMpi	GY;
-	TlsMpi	K;
-	TlsMpi	RP;
-	TlsMpi	Vi;
-	TlsMpi	Vf;
-	TlsMpi	pX;
+	const TlsDHMGroup	*grp;
+	TlsMpi			X;
+	TlsMpi			GX;
+	TlsMpi			GY;
+	TlsMpi			K;
+	TlsMpi			Vi;
+	TlsMpi			Vf;
+	TlsMpi			pX;
 } TlsDHMCtx;
 
-/**
- * \brief		  This function parses the ServerKeyExchange parameters.
- *
- * \param ctx	  The DHM context.
- * \param p		On input, *p must be the start of the input buffer.
- *				 On output, *p is updated to point to the end of the data
- *				 that has been read. On success, this is the first byte
- *				 past the end of the ServerKeyExchange parameters.
- *				 On error, this is the point at which an error has been
- *				 detected, which is usually not useful except to debug
- *				 failures.
- * \param end	  The end of the input buffer.
- *
- * \return		 \c 0 on success, or an \c TTLS_ERR_DHM_XXX error code
- *				 on failure.
- */
-int ttls_dhm_read_params(TlsDHMCtx *ctx,
-		 unsigned char **p,
-		 const unsigned char *end);
-
 int ttls_dhm_make_params(TlsDHMCtx *ctx, int x_size, unsigned char *output,
 			 size_t *olen);
 
@@ -136,11 +129,11 @@ int ttls_dhm_read_public(TlsDHMCtx *ctx,
  * \param x_size   The private value size in Bytes.
  * \param output   The destination buffer.
  * \param olen	 The length of the destination buffer. Must be at least
-				   equal to ctx->len (the size of \c P).
+				   equal to ctx->grp->len (the size of \c P).
  *
  * \note		   The destination buffer will always be fully written
  *				 so as to contain a big-endian presentation of G^X mod P.
- *				 If it is larger than ctx->len, it will accordingly be
+ *				 If it is larger than the size of P, it will accordingly be
  *				 padded with zero-bytes in the beginning.
  *
  * \return		 \c 0 on success, or an \c TTLS_ERR_DHM_XXX error code
@@ -153,5 +146,6 @@ int ttls_dhm_calc_secret(TlsDHMCtx *ctx,
 		 unsigned char *output, size_t output_size, size_t *olen);
 
 void ttls_dhm_load(TlsDHMCtx *ctx);
+void ttls_dhm_init(void);
 
 #endif /* dhm.h */
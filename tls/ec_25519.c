@@ -4,13 +4,11 @@
  * Elliptic curve 25519 (Montgomery).
  * http://cr.yp.to/ecdh/curve25519-20060209.pdf
  *
- * TODO #1335: the slow and incomplete implementation is still based on mbed TLS.
- *
- * For Montgomery curves, we do all the internal arithmetic in projective
- * coordinates. Import/export of points uses only the x coordinates, which is
- * internaly represented as X / Z.
- *
- * For scalar multiplication, we'll use a Montgomery ladder.
+ * X25519 function from RFC 7748 5: Montgomery ladder in projective x/z
+ * coordinates over fixed size 4-limb field elements. All the field operations
+ * are branchless and have no secret dependent memory accesses, the ladder
+ * always does the same number of steps and swaps the points by masks, so the
+ * scalar multiplication is constant time.
  *
  * Copyright (C) 2020 Tempesta Technologies, Inc.
  *
@@ -35,346 +33,309 @@
 #define G_BITS		254
 #define G_LIMBS		((G_BITS + 7) / BIL)
 
-static const struct {
-	unsigned long	c25519_p[G_LIMBS];
-	unsigned long	c25519_a[G_LIMBS];
-	unsigned long	c25519_gx[G_LIMBS];
-	unsigned long	c25519_gz[G_LIMBS];
-
-	TlsMpi		P;
-	TlsMpi		A;
-	TlsMpi		__align_placeholder[2];
-	TlsEcpPoint	G;
-} ____cacheline_aligned __attribute__((packed)) G = {
-	/* P = 2^255 - 19 */
-	.c25519_p = {
-		0xffffffffffffffedUL, 0xffffffffffffffffUL,
-		0xffffffffffffffffUL, 0x7fffffffffffffffUL
-	},
-	.c25519_a = {
-		0x1db42UL, 0, 0, 0
-	},
-	.c25519_gx = {
-		0x9UL, 0, 0, 0
-	},
-	.c25519_gz = {
-		0x1UL, 0, 0, 0
-	},
-	.P = {
-		.s	= 1,
-		.used	= G_LIMBS,
-		.limbs	= G_LIMBS,
-		._off	= -4 * (short)(G_LIMBS * CIL)
-	},
-	.A = {
-		.s	= 1,
-		.used	= 1,
-		.limbs	= G_LIMBS,
-		._off	= -3 * (short)(G_LIMBS * CIL) - 1 * (short)sizeof(TlsMpi)
-	},
-	.__align_placeholder = {},
-	.G = {
-		/*
-		 * Y intentionaly isn't set, since we use x/z coordinates.
-		 * This is used as a marker to identify Montgomery curves -
-		 * see ecp_get_type().
-		 */
-		.X = {
-			.s	= 1,
-			.used	= G_LIMBS,
-			.limbs	= G_LIMBS,
-			._off	= -2 * (short)(G_LIMBS * CIL)
-				  - 4 * (short)sizeof(TlsMpi)
-		},
-		.Z = {
-			.s	= 1,
-			.used	= 1,
-			.limbs	= G_LIMBS,
-			._off	= -1 * (short)(G_LIMBS * CIL)
-				  - 5 * (short)sizeof(TlsMpi)
-		}
-	}
+/* P = 2^255 - 19 */
+static const unsigned long c25519_p[G_LIMBS] = {
+	0xffffffffffffffedUL, 0xffffffffffffffffUL,
+	0xffffffffffffffffUL, 0x7fffffffffffffffUL
 };
 
+/* The base point u-coordinate. */
+static const unsigned long c25519_g[G_LIMBS] = { 9 };
+
 /*
- * Fast mod-p functions expect their argument to be in the 0..p^2 range.
- *
- * In order to guarantee that, we need to ensure that operands of
- * multiplication are in the 0..p range. So, after each operation we will
- * bring the result back to this range.
- *
- * The following macros are shortcuts for doing that.
+ * Field elements are kept in G_LIMBS 64-bit limbs and are reduced modulo
+ * 2^256 only, i.e. they're in [0, 2^256) which is less than 3p. Since
+ * 2^256 = 38 (mod p), a carry out of the most significant limb is folded
+ * back as 38. c25519_final() computes the canonical value in [0, p).
  */
 
-/*
- * Reduce a TlsMpi mod p in-place, to use after ttls_mpi_sub_mpi
- * N->s < 0 is a very fast test, which fails only if N is 0
+/**
+ * Fold @c * 2^256 into @r. @c must be small enough, so that @c * 38 plus
+ * a limb doesn't overflow 2^64 twice.
  */
 static inline void
-MOD_SUB(TlsMpi *N)
+c25519_fold(unsigned long r[G_LIMBS], unsigned long c)
 {
-	while ((N)->s < 0 && ttls_mpi_cmp_int(N, 0))
-		ttls_mpi_add_mpi(N, N, &G.P);
+	unsigned __int128 t;
+	int i;
+
+	t = (unsigned __int128)c * 38 + r[0];
+	r[0] = t;
+	for (i = 1; i < G_LIMBS; ++i) {
+		t = (unsigned __int128)r[i] + (unsigned long)(t >> 64);
+		r[i] = t;
+	}
+	/*
+	 * If there is a carry again, then r[1..3] are zero and r[0] is less
+	 * than @c * 38, so the addition can't overflow.
+	 */
+	r[0] += (unsigned long)(t >> 64) * 38;
 }
 
-/*
- * Reduce a TlsMpi mod p in-place, to use after ttls_mpi_add_mpi().
- * We known P, N and the result are positive, so sub_abs is correct, and
- * a bit faster.
- */
-static inline void
-MOD_ADD(TlsMpi *N)
+static void
+c25519_add(unsigned long r[G_LIMBS], const unsigned long a[G_LIMBS],
+	   const unsigned long b[G_LIMBS])
 {
-	while (ttls_mpi_cmp_mpi(N, &G.P) >= 0)
-		ttls_mpi_sub_abs(N, N, &G.P);
+	unsigned __int128 t = 0;
+	int i;
+
+	for (i = 0; i < G_LIMBS; ++i) {
+		t = (unsigned __int128)a[i] + b[i] + (unsigned long)(t >> 64);
+		r[i] = t;
+	}
+	c25519_fold(r, t >> 64);
+}
+
+static void
+c25519_sub(unsigned long r[G_LIMBS], const unsigned long a[G_LIMBS],
+	   const unsigned long b[G_LIMBS])
+{
+	unsigned __int128 t;
+	unsigned long borrow = 0;
+	int i;
+
+	for (i = 0; i < G_LIMBS; ++i) {
+		t = (unsigned __int128)a[i] - b[i] - borrow;
+		r[i] = t;
+		borrow = (unsigned long)(t >> 64) & 1;
+	}
+	/*
+	 * On borrow we have a - b + 2^256 = a - b + 38 (mod p), so subtract
+	 * 38. If this borrows again, then r is at least 2^256 - 38 now and
+	 * the second subtraction doesn't borrow.
+	 */
+	t = (unsigned __int128)r[0] - borrow * 38;
+	r[0] = t;
+	for (i = 1; i < G_LIMBS; ++i) {
+		borrow = (unsigned long)(t >> 64) & 1;
+		t = (unsigned __int128)r[i] - borrow;
+		r[i] = t;
+	}
+	r[0] -= ((unsigned long)(t >> 64) & 1) * 38;
 }
 
 /**
- * Fast quasi-reduction modulo p255 = 2^255 - 19.
- * Write N as A0 + 2^255 A1, return A0 + 19 * A1.
+ * Reduce the double width product @t: @r = t_lo + 38 * t_hi (mod p).
  */
-void
-ecp_mod_p255(TlsMpi *N)
+static inline void
+c25519_reduce(unsigned long r[G_LIMBS], const unsigned long t[G_LIMBS * 2])
 {
-	size_t n;
-	TlsMpi *M;
-
-	BUG_ON(N->used < G_LIMBS);
-
-	M = ttls_mpi_alloc_stack_init(G_LIMBS + 2);
-
-	/* M = A1 */
-	M->used = N->used - (G_LIMBS - 1);
-	if (M->used > G_LIMBS + 1)
-		M->used = G_LIMBS + 1;
-	n = M->used * CIL;
-	memcpy_fast(MPI_P(M), MPI_P(N) + G_LIMBS - 1, n);
-	bzero_fast((char *)MPI_P(M) + n, (G_LIMBS + 2) * CIL - n);
-	ttls_mpi_shift_r(M, 255 % BIL);
-
-	/* N = A0 */
-	ttls_mpi_set_bit(N, 255, 0);
-	N->used = G_LIMBS;
-
-	/* N = A0 + 19 * A1 */
-	ttls_mpi_mul_uint(M, M, 19);
-	ttls_mpi_add_abs(N, N, M);
+	unsigned __int128 m;
+	unsigned long c = 0;
+	int i;
+
+	for (i = 0; i < G_LIMBS; ++i) {
+		m = (unsigned __int128)t[i + G_LIMBS] * 38 + t[i] + c;
+		r[i] = m;
+		c = m >> 64;
+	}
+	c25519_fold(r, c);
 }
 
 static void
-c25519_mul_mod(TlsMpi *X, const TlsMpi *A, const TlsMpi *B)
+c25519_mul(unsigned long r[G_LIMBS], const unsigned long a[G_LIMBS],
+	   const unsigned long b[G_LIMBS])
 {
-	ttls_mpi_mul_mpi(X, A, B);
-
-	BUG_ON(X->limbs < G_LIMBS * 2);
-	BUG_ON(X->s < 0);
-
-	if (X->used > G_LIMBS)
-		/*
-		 * P modulo is very close to the maximum value of 4-limbs MPI,
-		 * so only one addition or subtraction will be enough to
-		 * get the modulo and we don't need to execute the exepnsive
-		 * reduction operation.
-		 */
-		ecp_mod_p255(X);
-
-	while (X->s < 0 && ttls_mpi_cmp_int(X, 0))
-		ttls_mpi_add_mpi(X, X, &G.P);
-
-	while (ttls_mpi_cmp_mpi(X, &G.P) >= 0)
-		/* We known P, N and the result are positive. */
-		ttls_mpi_sub_abs(X, X, &G.P);
+	unsigned long t[G_LIMBS * 2] = {}, c;
+	unsigned __int128 m;
+	int i, j;
+
+	for (i = 0; i < G_LIMBS; ++i) {
+		c = 0;
+		for (j = 0; j < G_LIMBS; ++j) {
+			m = (unsigned __int128)a[i] * b[j] + t[i + j] + c;
+			t[i + j] = m;
+			c = m >> 64;
+		}
+		t[i + G_LIMBS] = c;
+	}
+	c25519_reduce(r, t);
 }
 
-#define ecp_sqr_mod(X, A)	c25519_mul_mod(X, A, A)
+#define c25519_sqr(r, a)	c25519_mul(r, a, a)
 
-/*
- * Normalize Montgomery x/z coordinates: X = X/Z, Z = 1
- * Cost: 1M + 1I
- */
 static void
-ecp_normalize_mxz(TlsEcpPoint *P)
+c25519_sqr_n(unsigned long r[G_LIMBS], const unsigned long a[G_LIMBS], int n)
 {
-	ttls_mpi_inv_mod(&P->Z, &P->Z, &G.P);
-	c25519_mul_mod(&P->X, &P->X, &P->Z);
-	ttls_mpi_lset(&P->Z, 1);
+	c25519_sqr(r, a);
+	while (--n > 0)
+		c25519_sqr(r, r);
 }
 
-/*
- * Randomize projective x/z coordinates: (X, Z) -> (l X, l Z) for random l.
- * This is sort of the reverse operation of ecp_normalize_mxz().
- *
- * This countermeasure was first suggested in [2].
- * Cost: 2M
+/**
+ * Multiply by a24 = (A - 2) / 4 = 121665.
  */
-static int
-ecp_randomize_mxz(TlsEcpPoint *P)
+static void
+c25519_mul_a24(unsigned long r[G_LIMBS], const unsigned long a[G_LIMBS])
 {
-	TlsMpi *l = ttls_mpi_alloc_stack_init(0);
-	size_t p_size;
-	int count = 0;
-
-	p_size = (G_BITS + 7) / 8;
-
-	/* Generate l such that 1 < l < p */
-	do {
-		ttls_mpi_fill_random(l, p_size);
-
-		while (ttls_mpi_cmp_mpi(l, &G.P) >= 0)
-			ttls_mpi_shift_r(l, 1);
-
-		if (count++ > 10)
-			return TTLS_ERR_ECP_RANDOM_FAILED;
-	} while (ttls_mpi_cmp_int(l, 1) <= 0);
-
-	c25519_mul_mod(&P->X, &P->X, l);
-	c25519_mul_mod(&P->Z, &P->Z, l);
-
-	return 0;
+	unsigned __int128 m;
+	unsigned long c = 0;
+	int i;
+
+	for (i = 0; i < G_LIMBS; ++i) {
+		m = (unsigned __int128)a[i] * 121665 + c;
+		r[i] = m;
+		c = m >> 64;
+	}
+	c25519_fold(r, c);
 }
 
 /**
- * Double-and-add: R = 2P, S = P + Q, with d = X(P - Q), for Montgomery curves
- * in x/z coordinates.
- *
- * http://www.hyperelliptic.org/EFD/g1p/auto-code/montgom/xz/ladder/mladd-1987-m.op3
- * with
- * d =  X1
- * P = (X2, Z2)
- * Q = (X3, Z3)
- * R = (X4, Z4)
- * S = (X5, Z5)
- * and eliminating temporary variables tO, ..., t4.
- *
- * Cost: 5M + 4S
+ * Inversion by Fermat's little theorem: r = z^(p - 2), so the zero inverse
+ * is zero just like RFC 7748 5 requires. Cost: 254S + 11M.
  */
-static int
-ecp_double_add_mxz(TlsEcpPoint *R, TlsEcpPoint *S, const TlsEcpPoint *P,
-		   const TlsEcpPoint *Q, const TlsMpi *d)
+static void
+c25519_inv(unsigned long r[G_LIMBS], const unsigned long z[G_LIMBS])
 {
-	TlsMpi *A, *AA, *B, *BB, *E, *C, *D, *DA, *CB;
-	size_t n;
-
-	n = sizeof(TlsMpi) * 9 + CIL * ((max(P->X.used, P->Z.used) + 1) * 9
-					+ (max(Q->X.used, Q->Z.used) + 1) * 4);
-	A = ttls_mpool_alloc_stack(n);
-	AA = ttls_mpi_init_next(A, max(P->X.used, P->Z.used) + 1);
-	B = ttls_mpi_init_next(AA, A->limbs * 2);
-	BB = ttls_mpi_init_next(B, max(P->X.used, P->Z.used));
-	E = ttls_mpi_init_next(BB, B->limbs * 2);
-	C = ttls_mpi_init_next(E, max(P->X.used, P->Z.used) * 2);
-	D = ttls_mpi_init_next(C, max(Q->X.used, Q->Z.used) + 1);
-	DA = ttls_mpi_init_next(D, max(Q->X.used, Q->Z.used));
-	CB = ttls_mpi_init_next(DA, D->limbs + A->limbs);
-	ttls_mpi_init_next(CB, C->limbs + B->limbs);
-
-	ttls_mpi_add_mpi(A, &P->X, &P->Z);
-	MOD_ADD(A);
-	ecp_sqr_mod(AA, A);
-	ttls_mpi_sub_mpi(B, &P->X, &P->Z);
-	MOD_SUB(B);
-	ecp_sqr_mod(BB, B);
-	ttls_mpi_sub_mpi(E, AA, BB);
-	MOD_SUB(E);
-	ttls_mpi_add_mpi(C, &Q->X, &Q->Z);
-	MOD_ADD(C);
-	ttls_mpi_sub_mpi(D, &Q->X, &Q->Z);
-	MOD_SUB(D);
-	c25519_mul_mod(DA, D, A);
-	c25519_mul_mod(CB, C, B);
-	ttls_mpi_add_mpi(&S->X, DA, CB);
-	MOD_ADD(&S->X);
-	ecp_sqr_mod(&S->X, &S->X);
-	ttls_mpi_sub_mpi(&S->Z, DA, CB);
-	MOD_SUB(&S->Z);
-	ecp_sqr_mod(&S->Z, &S->Z);
-	c25519_mul_mod(&S->Z, &S->Z, d);
-	c25519_mul_mod(&R->X, AA, BB);
-	c25519_mul_mod(&R->Z, &G.A, E);
-	ttls_mpi_add_mpi(&R->Z, BB, &R->Z);
-	MOD_ADD(&R->Z);
-	c25519_mul_mod(&R->Z, &R->Z, E);
-
-	return 0;
+	unsigned long z2[G_LIMBS], z11[G_LIMBS], z2_5_0[G_LIMBS];
+	unsigned long z2_10_0[G_LIMBS], z2_20_0[G_LIMBS], z2_50_0[G_LIMBS];
+	unsigned long z2_100_0[G_LIMBS], t[G_LIMBS];
+
+	c25519_sqr(z2, z);
+	c25519_sqr_n(t, z2, 2);
+	c25519_mul(t, t, z);			/* z^9 */
+	c25519_mul(z11, t, z2);
+	c25519_sqr(z2_5_0, z11);
+	c25519_mul(z2_5_0, z2_5_0, t);		/* z^(2^5 - 1) */
+	c25519_sqr_n(t, z2_5_0, 5);
+	c25519_mul(z2_10_0, t, z2_5_0);		/* z^(2^10 - 1) */
+	c25519_sqr_n(t, z2_10_0, 10);
+	c25519_mul(z2_20_0, t, z2_10_0);	/* z^(2^20 - 1) */
+	c25519_sqr_n(t, z2_20_0, 20);
+	c25519_mul(t, t, z2_20_0);		/* z^(2^40 - 1) */
+	c25519_sqr_n(t, t, 10);
+	c25519_mul(z2_50_0, t, z2_10_0);	/* z^(2^50 - 1) */
+	c25519_sqr_n(t, z2_50_0, 50);
+	c25519_mul(z2_100_0, t, z2_50_0);	/* z^(2^100 - 1) */
+	c25519_sqr_n(t, z2_100_0, 100);
+	c25519_mul(t, t, z2_100_0);		/* z^(2^200 - 1) */
+	c25519_sqr_n(t, t, 50);
+	c25519_mul(t, t, z2_50_0);		/* z^(2^250 - 1) */
+	c25519_sqr_n(t, t, 5);
+	c25519_mul(r, t, z11);			/* z^(2^255 - 21) */
 }
 
 /**
- * Multiplication with Montgomery ladder in x/z coordinates,
- * for curves in Montgomery form.
+ * Bring @r from [0, 2^256) to the canonical [0, p) by subtracting p at most
+ * twice, the results are selected by masks.
  */
-static int
-ecp_mul_mxz(TlsEcpPoint *R, const TlsMpi *m, const unsigned long *pX,
-	    const unsigned long *pY, bool rng)
+static void
+c25519_final(unsigned long r[G_LIMBS])
 {
-	size_t i;
-	unsigned char b;
-	TlsEcpPoint *RP;
-	TlsMpi *PX;
-
-	PX = ttls_mpi_alloc_stack_init(G_LIMBS);
-	memcpy_fast(MPI_P(PX), pX, G_LIMBS << LSHIFT);
-	mpi_fixup_used(PX, G_LIMBS);
-
-	ttls_ecp_point_tmp_alloc_init(RP, G_LIMBS, G_LIMBS, G_LIMBS);
-	memcpy_fast(MPI_P(&RP->X), pX, G_LIMBS * CIL);
-	mpi_fixup_used(&RP->X, G_LIMBS);
-	memcpy_fast(MPI_P(&RP->Y), pY, G_LIMBS * CIL);
-	mpi_fixup_used(&RP->Y, G_LIMBS);
-	ttls_mpi_lset(&RP->Z, 1);
-
-	/* Set R to zero in modified x/z coordinates */
-	ttls_mpi_lset(&R->X, 1);
-	ttls_mpi_lset(&R->Z, 0);
-	ttls_mpi_lset(&R->Y, 0); /* TODO #1335 reset/free the MPI */
-
-	/* RP.X might be sligtly larger than P, so reduce it */
-	MOD_ADD(&RP->X);
-
-	/* Randomize coordinates of the starting point */
-	if (rng)
-		MPI_CHK(ecp_randomize_mxz(RP));
-
-	/*
-	 * Loop invariant: R = result so far, RP = R + P.
-	 * One past the (zero-based) most significant bit.
-	 */
-	i = ttls_mpi_bitlen(m);
-	while (i-- > 0) {
-		b = ttls_mpi_get_bit(m, i);
-		/*
-		 *  if (b) R = 2R + P else R = 2R,
-		 * which is:
-		 *  if (b) double_add(RP, R, RP, R)
-		 *  else   double_add(R, RP, R, RP)
-		 * but using safe conditional swaps to avoid leaks
-		 */
-		MPI_CHK(ttls_mpi_safe_cond_swap(&R->X, &RP->X, b));
-		MPI_CHK(ttls_mpi_safe_cond_swap(&R->Z, &RP->Z, b));
-		MPI_CHK(ecp_double_add_mxz(R, RP, R, RP, PX));
-		MPI_CHK(ttls_mpi_safe_cond_swap(&R->X, &RP->X, b));
-		MPI_CHK(ttls_mpi_safe_cond_swap(&R->Z, &RP->Z, b));
+	unsigned long t[G_LIMBS], borrow, mask;
+	unsigned __int128 d;
+	int i, k;
+
+	for (k = 0; k < 2; ++k) {
+		borrow = 0;
+		for (i = 0; i < G_LIMBS; ++i) {
+			d = (unsigned __int128)r[i] - c25519_p[i] - borrow;
+			t[i] = d;
+			borrow = (unsigned long)(d >> 64) & 1;
+		}
+		mask = borrow - 1;
+		for (i = 0; i < G_LIMBS; ++i)
+			r[i] = (t[i] & mask) | (r[i] & ~mask);
 	}
+}
 
-	ecp_normalize_mxz(R);
+static inline void
+c25519_cswap(unsigned long a[G_LIMBS], unsigned long b[G_LIMBS],
+	     unsigned long swap)
+{
+	unsigned long t, mask = -swap;
+	int i;
 
-	return 0;
+	for (i = 0; i < G_LIMBS; ++i) {
+		t = mask & (a[i] ^ b[i]);
+		a[i] ^= t;
+		b[i] ^= t;
+	}
 }
 
-/* TODO #1335 specialize the routine. */
-static int
-ecp_mul_mxz_g(TlsEcpPoint *R, const TlsMpi *m, bool rnd)
+/**
+ * X25519 function (RFC 7748 5): @r is u-coordinate of scalar @k, which must
+ * be clamped, multiplied by the point with u-coordinate @u. Small order
+ * points result in zero @r.
+ *
+ * http://www.hyperelliptic.org/EFD/g1p/auto-code/montgom/xz/ladder/mladd-1987-m.op3
+ * Cost per step: 5M + 4S + 1 a24 multiplication.
+ */
+static void
+c25519_ladder(unsigned long r[G_LIMBS], const unsigned long k[G_LIMBS],
+	      const unsigned long u[G_LIMBS])
 {
-	return ecp_mul_mxz(R, m, MPI_P(&G.G.X), MPI_P(&G.G.Y), rnd);
+	unsigned long x2[G_LIMBS] = { 1 }, z2[G_LIMBS] = {};
+	unsigned long x3[G_LIMBS], z3[G_LIMBS] = { 1 };
+	unsigned long a[G_LIMBS], aa[G_LIMBS], b[G_LIMBS], bb[G_LIMBS];
+	unsigned long c[G_LIMBS], d[G_LIMBS], e[G_LIMBS];
+	unsigned long swap = 0, bit;
+	int i;
+
+	memcpy_fast(x3, u, G_LIMBS * CIL);
+
+	/* Loop invariant: (x3, z3) = (x2, z2) + u. */
+	for (i = G_BITS; i >= 0; --i) {
+		bit = (k[i / BIL] >> (i % BIL)) & 1;
+		swap ^= bit;
+		c25519_cswap(x2, x3, swap);
+		c25519_cswap(z2, z3, swap);
+		swap = bit;
+
+		c25519_add(a, x2, z2);
+		c25519_sqr(aa, a);
+		c25519_sub(b, x2, z2);
+		c25519_sqr(bb, b);
+		c25519_sub(e, aa, bb);
+		c25519_add(c, x3, z3);
+		c25519_sub(d, x3, z3);
+		c25519_mul(d, d, a);		/* DA */
+		c25519_mul(c, c, b);		/* CB */
+		c25519_add(x3, d, c);
+		c25519_sqr(x3, x3);
+		c25519_sub(z3, d, c);
+		c25519_sqr(z3, z3);
+		c25519_mul(z3, z3, u);
+		c25519_mul(x2, aa, bb);
+		c25519_mul_a24(z2, e);
+		c25519_add(z2, z2, aa);
+		c25519_mul(z2, z2, e);
+	}
+	c25519_cswap(x2, x3, swap);
+	c25519_cswap(z2, z3, swap);
+
+	c25519_inv(z2, z2);
+	c25519_mul(r, x2, z2);
+	c25519_final(r);
+
+	memzero_explicit(x2, sizeof(x2));
+	memzero_explicit(z2, sizeof(z2));
+	memzero_explicit(x3, sizeof(x3));
+	memzero_explicit(z3, sizeof(z3));
 }
 
-/*
- * TODO #1335 revert the projective coordinates randomization if DPA is
- * required or remove completely.
+/**
+ * Multiplication of a scalar @m by the point with u-coordinate @P.
+ * The result is in R->X with Z = 1, Y isn't used for Montgomery curves.
  */
 static void
-ecp_mul_mxz_rnd(TlsEcpPoint *R, const TlsMpi *m, const unsigned long *P)
+ecp_mul_mxz(TlsEcpPoint *R, const TlsMpi *m, const unsigned long *P)
 {
-	ecp_mul_mxz(R, m, P, P + G_LIMBS, false);
+	unsigned long k[G_LIMBS] = {}, x[G_LIMBS];
+	MPI_WRAP(X, x);
+	int i;
+
+	BUG_ON(m->used > G_LIMBS);
+
+	for (i = 0; i < m->used; ++i)
+		k[i] = MPI_P(m)[i];
+	c25519_ladder(x, k, P);
+	memzero_explicit(k, sizeof(k));
+
+	mpi_fixup_used(&X, G_LIMBS);
+	ttls_mpi_copy(&R->X, &X);
+	ttls_mpi_lset(&R->Y, 0);
+	ttls_mpi_lset(&R->Z, 1);
 }
 
 /**
@@ -402,13 +363,15 @@ ec25519_gen_keypair(TlsMpi *d, TlsEcpPoint *Q)
 	ttls_mpi_set_bit(d, 1, 0);
 	ttls_mpi_set_bit(d, 2, 0);
 
-	return ecp_mul_mxz_g(Q, d, true);
+	ecp_mul_mxz(Q, d, c25519_g);
+
+	return 0;
 }
 
 const TlsEcpGrp CURVE25519_G ____cacheline_aligned = {
 	.id		= TTLS_ECP_DP_CURVE25519,
 	.bits		= G_BITS,
 
-	.mul		= ecp_mul_mxz_rnd,
+	.mul		= ecp_mul_mxz,
 	.gen_keypair	= ec25519_gen_keypair,
 };
@@ -622,41 +622,6 @@ ecp256_inv_mod(TlsMpi *X, const TlsMpi *I, const TlsMpi *__restrict N)
 	ttls_mpi_pool_cleanup_ctx((unsigned long)F, false);
 }
 
-/*
- * Normalize jacobian coordinates so that Z == 1  (GECC 3.2.1)
- * Cost: 1N := 1I + 3M + 1S
- */
-static void
-ecp256_normalize_jac(Ecp256Point *r, bool norm_mont)
-{
-	unsigned long zzi[8], x[8] = {}, y[8] = {};
-	DECLARE_MPI_AUTO(zi, 8);
-
-	ecp256_mpi_write(&zi, r->z);
-	ecp256_copy(x, r->x);
-	ecp256_copy(y, r->y);
-
-	if (norm_mont) {
-		mpi_from_mont_p256_x86_64(MPI_P(&zi));
-		mpi_from_mont_p256_x86_64(x);
-		mpi_from_mont_p256_x86_64(y);
-	}
-
-	/* X = X / Z^2  mod p */
-	ecp256_inv_mod(&zi, &zi, &G.P);
-	mpi_sqr_mod_p256_x86_64_4(zzi, MPI_P(&zi));
-	mpi_mul_mod_p256_x86_64_4(x, x, zzi);
-	ecp256_copy(r->x, x);
-
-	/* Y = Y / Z^3  mod p */
-	mpi_mul_mod_p256_x86_64_4(y, y, zzi);
-	mpi_mul_mod_p256_x86_64_4(y, y, MPI_P(&zi));
-	ecp256_copy(r->y, y);
-
-	/* Z = 1 */
-	ecp256_lset(r->z, 1);
-}
-
 /**
  * Conditional point inversion: Q -> -Q = (Q.X, -Q.Y, Q.Z) without leak.
  * "inv" must be 0 (don't invert) or 1 (invert) or the result will be invalid.
@@ -1022,6 +987,93 @@ ecp256_to_mont(unsigned long *__restrict r, const unsigned long *__restrict a)
 	r[3] = (t[7] << 32) | t[6];
 }
 
+static void
+ecp256_sqr_mont_n(unsigned long *r, const unsigned long *a, int n)
+{
+	mpi_sqr_mont_mod_p256_x86_64(r, a);
+	while (--n)
+		mpi_sqr_mont_mod_p256_x86_64(r, r);
+}
+
+/**
+ * Modular inversion in Montgomery form by the Fermat's little theorem:
+ * R = A^(p - 2) mod p, where p - 2 = 2^256 - 2^224 + 2^192 + 2^96 - 3.
+ *
+ * The fixed addition chain takes 255 squarings and 12 multiplications, so
+ * the inversion runs in constant time and, being completely in assembly,
+ * it's faster than ecp256_inv_mod() on the MPIs.
+ */
+static void
+ecp256_inv_mont(unsigned long *r, const unsigned long *a)
+{
+	unsigned long x2[4], x3[4], x6[4], x12[4], x15[4], x30[4], x32[4];
+
+	/* x{N} = A^(2^N - 1) */
+	mpi_sqr_mont_mod_p256_x86_64(x2, a);
+	mpi_mul_mont_mod_p256_x86_64(x2, x2, a);
+	mpi_sqr_mont_mod_p256_x86_64(x3, x2);
+	mpi_mul_mont_mod_p256_x86_64(x3, x3, a);
+	ecp256_sqr_mont_n(x6, x3, 3);
+	mpi_mul_mont_mod_p256_x86_64(x6, x6, x3);
+	ecp256_sqr_mont_n(x12, x6, 6);
+	mpi_mul_mont_mod_p256_x86_64(x12, x12, x6);
+	ecp256_sqr_mont_n(x15, x12, 3);
+	mpi_mul_mont_mod_p256_x86_64(x15, x15, x3);
+	ecp256_sqr_mont_n(x30, x15, 15);
+	mpi_mul_mont_mod_p256_x86_64(x30, x30, x15);
+	ecp256_sqr_mont_n(x32, x30, 2);
+	mpi_mul_mont_mod_p256_x86_64(x32, x32, x2);
+
+	ecp256_sqr_mont_n(r, x32, 32);
+	mpi_mul_mont_mod_p256_x86_64(r, r, a);
+	ecp256_sqr_mont_n(r, r, 128);
+	mpi_mul_mont_mod_p256_x86_64(r, r, x32);
+	ecp256_sqr_mont_n(r, r, 32);
+	mpi_mul_mont_mod_p256_x86_64(r, r, x32);
+	ecp256_sqr_mont_n(r, r, 30);
+	mpi_mul_mont_mod_p256_x86_64(r, r, x30);
+	ecp256_sqr_mont_n(r, r, 2);
+	mpi_mul_mont_mod_p256_x86_64(r, r, a);
+}
+
+/*
+ * Normalize jacobian coordinates so that Z == 1  (GECC 3.2.1)
+ * Cost: 1N := 1I + 3M + 1S
+ *
+ * The computations are done in Montgomery form, so the coordinates not in
+ * the form, i.e. !@norm_mont, are converted first. The result is always in
+ * the normal form.
+ */
+static void
+ecp256_normalize_jac(Ecp256Point *r, bool norm_mont)
+{
+	unsigned long zi[4], zzi[4];
+
+	if (!norm_mont) {
+		ecp256_copy(zi, r->x);
+		ecp256_to_mont(r->x, zi);
+		ecp256_copy(zi, r->y);
+		ecp256_to_mont(r->y, zi);
+		ecp256_copy(zi, r->z);
+		ecp256_to_mont(r->z, zi);
+	}
+
+	ecp256_inv_mont(zi, r->z);
+	mpi_sqr_mont_mod_p256_x86_64(zzi, zi);
+
+	/* X = X / Z^2  mod p */
+	mpi_mul_mont_mod_p256_x86_64(r->x, r->x, zzi);
+	mpi_from_mont_p256_x86_64(r->x);
+
+	/* Y = Y / Z^3  mod p */
+	mpi_mul_mont_mod_p256_x86_64(zzi, zzi, zi);
+	mpi_mul_mont_mod_p256_x86_64(r->y, r->y, zzi);
+	mpi_from_mont_p256_x86_64(r->y);
+
+	/* Z = 1 */
+	ecp256_lset(r->z, 1);
+}
+
 /*
  * Precompute points for the comb method
  *
@@ -1093,9 +1145,18 @@ ecp256_select_comb(Ecp256Point *r, const Ecp256Point T[], unsigned char i)
 	ecp256_safe_invert_jac(r, i >> 7);
 }
 
+/*
+ * The same as ecp256_select_comb(), but for the affine points of the large
+ * static table. The table doesn't fit L1d cache, so the whole table must be
+ * read for each scalar window, with SIMD if it's available.
+ */
 static void
 ecp256_select_comb_g(Ecp256Point *r, const EcpXY T[], unsigned char i)
 {
+#ifdef AVX2
+	/* Ignore the "sign" bit and scale down */
+	ecp256_gather_avx2(r, T, (i & 0x7Fu) >> 1, G_W_SZ);
+#else
 	static const unsigned long l_masks[2] = {0, 0xffffffffffffffffUL};
 	unsigned char ii, j;
 
@@ -1116,12 +1177,12 @@ ecp256_select_comb_g(Ecp256Point *r, const EcpXY T[], unsigned char i)
 		r->y[2] ^= (r->y[2] ^ T[j].y[2]) & mask;
 		r->y[3] ^= (r->y[3] ^ T[j].y[3]) & mask;
 	}
+#endif
 
 	/* Safely invert result if i is "negative" */
 	ecp256_safe_invert_jac(r, i >> 7);
 }
 
-
 /*
  * Core multiplication algorithm for the (modified) comb method.
  * This part is actually common with the basic comb method (GECC 3.44)
@@ -1256,7 +1317,6 @@ ecp256_mul_comb_core_g(Ecp256Point *__restrict r,
 {
 	Ecp256Point txi;
 	size_t i = G_D - 1;
-	unsigned char ii;
 	unsigned long t1[4], t2[4], t3[4], t4[4];
 
 	/*
@@ -1271,12 +1331,8 @@ ecp256_mul_comb_core_g(Ecp256Point *__restrict r,
 	 * Do shorter computations for the first iteration with
 	 * Z coordinate equal 1.
 	 */
-	ii = (k[i] & 0x7Fu) >> 1;
-
-	/* Copy X and Y in one shot. */
-	memcpy(&txi, &combT_G[i][ii], G_LIMBS * CIL * 2);
+	ecp256_select_comb_g(&txi, combT_G[i], k[i]);
 	ecp256_set_mont_1(&txi);
-	ecp256_safe_invert_jac(&txi, k[i] >> 7);
 
 	/* ecp256_add_mixed() for P->Z == 1 */
 	mpi_sub_mod_p256_x86_64(t1, txi.x, r->x);
@@ -1295,10 +1351,7 @@ ecp256_mul_comb_core_g(Ecp256Point *__restrict r,
 	mpi_sub_mod_p256_x86_64(r->y, t3, t4);
 
 	while (i--) {
-		ii = (k[i] & 0x7Fu) >> 1;
-		memcpy(&txi, &combT_G[i][ii], G_LIMBS * CIL * 2);
-
-		ecp256_safe_invert_jac(&txi, k[i] >> 7);
+		ecp256_select_comb_g(&txi, combT_G[i], k[i]);
 
 		/*
 		 * Addition in mixed affine-Jacobian coordinates,
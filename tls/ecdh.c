@@ -50,6 +50,14 @@ ttls_ecdh_compute_shared(const TlsEcpGrp *grp, TlsEcpPoint *z,
 	/* Compute the shared secret. */
 	grp->mul(z, d, Q);
 
+	/*
+	 * The Montgomery ladder normalizes the result to Z = 1 even for the
+	 * point at infinity, so check for the all-zero X25519 output, which
+	 * we get for a peer point of a small order (RFC 7748 6.1).
+	 */
+	if (ttls_ecp_is_montgomery(grp))
+		return ttls_mpi_cmp_int(&z->X, 0) ? 0 : -EINVAL;
+
 	return ttls_ecp_is_zero(z) ? -EINVAL : 0;
 }
 
@@ -89,6 +97,32 @@ ttls_ecdh_make_params(TlsECDHCtx *ctx, size_t *olen, unsigned char *buf,
 	return 0;
 }
 
+/**
+ * Import the X25519 public value, which is the little-endian u-coordinate
+ * (RFC 8422 5.4.1, RFC 7748 5). The Y half of TlsECDHCtx->Qp is zeroed
+ * since Montgomery ladder doesn't use it.
+ */
+static int
+ttls_ecdh_read_public_mxz(TlsECDHCtx *ctx, const unsigned char *buf,
+			  size_t blen)
+{
+	int i;
+	const size_t glen = BITS_TO_LIMBS(ctx->grp->bits);
+	const size_t plen = BITS_TO_CHARS(ctx->grp->bits);
+
+	if (unlikely(blen != plen + 1 || buf[0] != plen))
+		return -EINVAL;
+	buf++;
+
+	bzero_fast(ctx->Qp, glen * CIL * 2);
+	for (i = 0; i < plen; ++i)
+		ctx->Qp[i / CIL] |= (unsigned long)buf[i] << (i % CIL) * 8;
+	/* Ignore the most significant bit as RFC 7748 5 requires. */
+	ctx->Qp[glen - 1] &= ~(1UL << (BIL - 1));
+
+	return 0;
+}
+
 /**
  * Parse and import the client's public value TlsECDHCtx->Qp.
  */
@@ -101,6 +135,9 @@ ttls_ecdh_read_public(TlsECDHCtx *ctx, const unsigned char *buf, size_t blen)
 	const size_t glen = BITS_TO_LIMBS(ctx->grp->bits);
 	const size_t pk_len = glen * CIL * 2;
 
+	if (ttls_ecp_is_montgomery(ctx->grp))
+		return ttls_ecdh_read_public_mxz(ctx, buf, blen);
+
 	/*
 	 * We must have at least two bytes
 	 * (1 for length and at least one for data).
@@ -209,7 +246,8 @@ ttls_ecdh_calc_secret(TlsECDHCtx *ctx, size_t *olen, unsigned char *buf,
 		      size_t blen)
 {
 	int r;
-	const size_t nlimbs = (ctx->grp->bits + BIL - 1) / BIL;
+	const bool mxz = ttls_ecp_is_montgomery(ctx->grp);
+	const size_t nlimbs = BITS_TO_LIMBS(ctx->grp->bits);
 	TlsEcpPoint *z;
 
 	ttls_ecp_point_tmp_alloc_init(z, nlimbs, nlimbs, nlimbs);
@@ -222,7 +260,11 @@ ttls_ecdh_calc_secret(TlsECDHCtx *ctx, size_t *olen, unsigned char *buf,
 
 	*olen = (ctx->grp->bits + 7) / 8;
 
-	r = ttls_mpi_write_binary(&z->X, buf, *olen);
+	/* X25519 shared secret is little-endian, RFC 8422 5.11. */
+	if (mxz)
+		r = ttls_mpi_write_binary_le(&z->X, buf, *olen);
+	else
+		r = ttls_mpi_write_binary(&z->X, buf, *olen);
 
 	T_DBG_MPI1("ECDH client key exchange", &z->X);
 
@@ -40,17 +40,25 @@
  *
  * Secp256r1 is at the first postion as the most used one.
  *
- * TODO #1335 add Curve25519 and Curve448.
+ * TODO #1335 add Curve448.
  *
  * Reminder: update profiles in x509_crt.c when adding a new curves!
  */
 static const TlsEcpCurveInfo ecp_supported_curves[] = {
 	{ TTLS_ECP_DP_SECP256R1,	23,	 256,	"secp256r1"},
+	{ TTLS_ECP_DP_CURVE25519,	29,	 256,	"x25519"},
 	{ TTLS_ECP_DP_NONE,		0,	 0,	NULL},
 };
 
+/*
+ * Our preference order for ECDHE. Secp256r1 goes first since its assembly
+ * implementation is faster than the C Montgomery ladder for Curve25519 (see
+ * bm_ecdhe_srv_*() in t/benchmark.c), so X25519 is used for clients which
+ * don't offer Secp256r1.
+ */
 ttls_ecp_group_id ttls_preset_curves[] = {
 	TTLS_ECP_DP_SECP256R1,
+	TTLS_ECP_DP_CURVE25519,
 	TTLS_ECP_DP_NONE
 };
 
@@ -122,6 +130,8 @@ ttls_ecp_copy(TlsEcpPoint *P, const TlsEcpPoint *Q)
 /*
  * Export a point into unsigned binary data (SEC1 2.3.3).
  * Uncompressed is the only point format supported by RFC 8422.
+ * Points on Montgomery curves are exported as the little-endian
+ * X coordinate only (RFC 8422 5.4.1, RFC 7748 5).
  *
  * @grp		- Group to which the point should belong;
  * @p		- Point to export;
@@ -135,6 +145,13 @@ ttls_ecp_point_write_binary(const TlsEcpGrp *grp, const TlsEcpPoint *P,
 {
 	size_t plen = (grp->bits + 7) / 8;
 
+	if (ttls_ecp_is_montgomery(grp)) {
+		*olen = plen;
+		if (buflen < plen)
+			return -ENOSPC;
+		return ttls_mpi_write_binary_le(&P->X, buf, plen);
+	}
+
 	/* Common case: P == 0 . */
 	if (!ttls_mpi_cmp_int(&P->Z, 0)) {
 		if (buflen < 1)
@@ -91,8 +91,6 @@ extern ttls_ecp_group_id ttls_preset_curves[];
 
 /**
  * Number of supported curves (plus one for NONE).
- *
- * (Montgomery curves excluded for now.)
  */
 #define TTLS_ECP_DP_MAX	 12
 
@@ -248,6 +246,16 @@ ttls_ecp_is_zero(TlsEcpPoint *pt)
 	return !ttls_mpi_cmp_int(&pt->Z, 0);
 }
 
+/**
+ * Montgomery curves use x/z coordinates only and the RFC 7748 little-endian
+ * encoding for public keys and shared secrets.
+ */
+static inline bool
+ttls_ecp_is_montgomery(const TlsEcpGrp *grp)
+{
+	return grp->id == TTLS_ECP_DP_CURVE25519;
+}
+
 #define ttls_ecp_point_tmp_alloc_init(pt, xn, yn, zn)			\
 do {									\
 	pt = __builtin_alloca(sizeof(TlsEcpPoint) + CIL * (xn + yn + zn)); \
@@ -13,7 +13,8 @@
  * Tempesta TLS handshake happens in softirq non-preemptable context, so we can
  * keep per-cpu memory pool for all temporary MPIs required for a particular
  * handshake step taken on a CPU. The memory pool is cleaned and freed after
- * each handshake step.
+ * each handshake step. Process context, e.g. a handshake worker, which can be
+ * interrupted by softirq, uses a separate per-cpu pool.
  *
  * The pool also used for MPI profiles (see below) to initialize a profile
  * implicitly for MPI math. Dynamically allocated pages are used instead of
@@ -58,18 +59,32 @@
 #define __MPOOL_HS_ORDER	0
 
 /*
- * Memory pool for temporal (stack allocated) MPIs which are used only during
- * one call of the TLS handshake state machine.
+ * Memory pools for temporal (stack allocated) MPIs which are used only during
+ * one call of the TLS handshake state machine, one per ttls_cpu_ctx().
  *
- * Using the pools in process (configuration) context requires to disable
- * preemption.
+ * Using the pools in process (configuration or handshake worker) context
+ * requires to disable preemption.
  */
-static DEFINE_PER_CPU(TlsMpiPool *, g_tmp_mpool);
+static DEFINE_PER_CPU(TlsMpiPool *, g_tmp_mpool[TTLS_CPU_CTX_N]);
+
+/*
+ * Number of per-handshake MPI pools allocated and freed on the CPU: a pool
+ * can be freed on another CPU, so only the sum over all the CPUs makes sense.
+ */
+static DEFINE_PER_CPU(long, g_hs_ctx_num);
+/* The largest MPI profile, i.e. the data copied into each handshake pool. */
+static unsigned int g_hs_profile_max;
+
+static inline TlsMpiPool *
+ttls_mpool_tmp(void)
+{
+	return this_cpu_read(g_tmp_mpool[ttls_cpu_ctx()]);
+}
 
 /**
  * Return a pointer to an MPI pool of one of the following types:
  * 1. static cipher suite memory profile;
- * 2. temporary per-cpu pool for stack allocated MPIs (softirq);
+ * 2. temporary per-cpu pool for stack allocated MPIs of current context;
  * 3. current handshake profile cloned from (1) (softirq).
  */
 static TlsMpiPool *
@@ -88,7 +103,7 @@ ttls_mpool(void *addr)
 		goto check;
 	}
 
-	mp = this_cpu_read(g_tmp_mpool);
+	mp = ttls_mpool_tmp();
 	mp_name = "temporary";
 	if ((unsigned long)mp < a
 	    && a < (unsigned long)mp + (PAGE_SIZE << mp->order))
@@ -145,7 +160,7 @@ ttls_mpi_pool_alloc_mpi(TlsMpi *x, size_t n)
 void *
 ttls_mpool_alloc_stack(size_t n)
 {
-	return ttls_mpool_alloc_data(this_cpu_read(g_tmp_mpool), n);
+	return ttls_mpool_alloc_data(ttls_mpool_tmp(), n);
 }
 
 /**
@@ -156,11 +171,14 @@ ttls_mpool_alloc_stack(size_t n)
  * function call (1) is more expensive and (2) provides memory zeroing.
  * ttls_mpool_alloc_data() with this function should be used for large MPI
  * allocations, when the small kernel stack can be overrun.
+ *
+ * The zeroing requires FPU, so process context callers must call the function
+ * within their FPU section, as they do for the MPI computations.
  */
 void
 ttls_mpi_pool_cleanup_ctx(unsigned long addr, bool zero)
 {
-	TlsMpiPool *mp = this_cpu_read(g_tmp_mpool);
+	TlsMpiPool *mp = ttls_mpool_tmp();
 	unsigned long clean_off, m = (unsigned long)mp;
 
 	/* The tail part must be cleaned up with ttls_mpool_shrink_tailtmp(). */
@@ -171,7 +189,7 @@ ttls_mpi_pool_cleanup_ctx(unsigned long addr, bool zero)
 
 	clean_off = addr ? addr - m : sizeof(TlsMpiPool);
 	if (zero)
-		ttls_bzero_safe((char *)mp + clean_off, mp->curr - clean_off);
+		bzero_fast((char *)mp + clean_off, mp->curr - clean_off);
 	mp->curr = clean_off;
 }
 
@@ -259,10 +277,9 @@ ttls_mpi_profile_create_dh(TlsMpiPool *mp)
 	TlsDHMCtx *dhm = ttls_mpool_alloc_data(mp, sizeof(*dhm));
 
 	/*
-	 * TODO #1335: use a reference to the profile constant data as it's
-	 * done for EC in __mpi_profile_load_ec().
+	 * Only the group reference and the preallocated public key and
+	 * secret are stored in the profile, the group constants are shared.
 	 */
-
 	ttls_dhm_load(dhm);
 }
 
@@ -309,6 +326,13 @@ ttls_mpi_profile_set(TlsCiphersuite *cs)
 
 cleanup:
 	kernel_fpu_end();
+
+	for (e = 0; !r && e < __TTLS_ECP_DP_N - 1; ++e) {
+		if (!(mp = cs->mpi_profile[e]))
+			break;
+		g_hs_profile_max = max(g_hs_profile_max, MPI_PROFILE_SZ(mp));
+	}
+
 	return r;
 }
 
@@ -342,6 +366,7 @@ __mpi_profile_clone(TlsCtx *tls, int ec)
 
 	memcpy_fast(ptr, mp, MPI_PROFILE_SZ(mp));
 	hs->crypto_ctx = MPI_POOL_DATA(ptr);
+	this_cpu_inc(g_hs_ctx_num);
 
 	/*
 	 * Adjust the cloned memory pool order, which can be smaller than
@@ -391,31 +416,74 @@ curve_found:
 	}
 }
 
+/**
+ * Free a per-handshake MPI pool created by ttls_mpi_profile_clone().
+ */
+void
+ttls_mpi_profile_free(void *ctx)
+{
+	this_cpu_dec(g_hs_ctx_num);
+	ttls_mpi_pool_free(ctx);
+}
+
+/**
+ * Collect statistics for the memory used by the handshakes crypto contexts.
+ */
+void
+ttls_mpool_stat(TlsMpoolStat *stat)
+{
+	int cpu;
+	long n = 0;
+
+	for_each_online_cpu(cpu)
+		n += per_cpu(g_hs_ctx_num, cpu);
+	n = max(n, 0L);
+
+	stat->hs_ctx = n;
+	stat->hs_mem = n * (PAGE_SIZE << __MPOOL_HS_ORDER);
+	stat->hs_profile = g_hs_profile_max;
+}
+EXPORT_SYMBOL(ttls_mpool_stat);
+
 void
 ttls_mpool_exit(void)
 {
-	int i;
+	int i, c;
 	TlsMpiPool *mp;
 
 	for_each_online_cpu(i) {
-		mp = per_cpu(g_tmp_mpool, i);
-		ttls_bzero_safe(MPI_POOL_DATA(mp), mp->curr - sizeof(*mp));
-		free_pages((unsigned long)mp, mp->order);
+		for (c = 0; c < TTLS_CPU_CTX_N; ++c) {
+			if (!(mp = per_cpu(g_tmp_mpool[c], i)))
+				continue;
+			ttls_bzero_safe(MPI_POOL_DATA(mp),
+					mp->curr - sizeof(*mp));
+			free_pages((unsigned long)mp, mp->order);
+			per_cpu(g_tmp_mpool[c], i) = NULL;
+		}
 	}
 }
 
 int __init
 ttls_mpool_init(void)
 {
-	int cpu;
+	int cpu, c;
 
 	for_each_online_cpu(cpu) {
-		TlsMpiPool **mp = per_cpu_ptr(&g_tmp_mpool, cpu);
-		if (!(*mp = ttls_mpi_pool_create(__MPOOL_STACK_ORDER,
-						 GFP_KERNEL)))
-			goto err_cleanup;
+		for (c = 0; c < TTLS_CPU_CTX_N; ++c) {
+			TlsMpiPool **mp = per_cpu_ptr(&g_tmp_mpool[c], cpu);
+			*mp = ttls_mpi_pool_create(__MPOOL_STACK_ORDER,
+						   GFP_KERNEL);
+			if (!*mp)
+				goto err_cleanup;
+		}
 	}
 
+	/* The shared DHM group must be ready before the DHE profiles. */
+	kernel_fpu_begin();
+	ttls_dhm_init();
+	ttls_mpi_pool_cleanup_ctx(0, true);
+	kernel_fpu_end();
+
 	if (ttls_ciphersuite_for_all(ttls_mpi_profile_set))
 		goto err_cleanup;
 
@@ -28,6 +28,7 @@ int ttls_mpi_pool_alloc_mpi(TlsMpi *x, size_t n);
 TlsMpiPool *ttls_mpi_pool_create(size_t order, gfp_t gfp_mask);
 void ttls_mpi_pool_free(void *ctx);
 int ttls_mpi_profile_clone(TlsCtx *tls);
+void ttls_mpi_profile_free(void *ctx);
 void ttls_mpi_pool_cleanup_ctx(unsigned long addr, bool zero);
 
 int ttls_mpool_init(void);
@@ -0,0 +1,495 @@
+/**
+ *		Tempesta TLS
+ *
+ * OCSP stapling (RFC 6066 8, RFC 6960).
+ *
+ * OCSP responses are fetched by an external tool and loaded from files at
+ * configuration time, so there is no network activity in the kernel. A
+ * response is parsed and checked that it's a successful basic response with
+ * "good" status of the certificate it's stapled to, i.e. CertID of the status
+ * matches the certificate serial number and its issuer, which must be in the
+ * configured certificate chain. The responder signature
+ * isn't verified: clients must verify it anyway and the file is as trusted
+ * as the certificate and its private key loaded from the same place.
+ *
+ * Copyright (C) 2026 Tempesta Technologies, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "debug.h"
+#include "asn1.h"
+#include "oid.h"
+#include "x509.h"
+#include "tls_internal.h"
+
+#define TTLS_OCSP_RESP_SUCCESSFUL	0
+#define TTLS_OCSP_CERT_GOOD		0
+/*
+ * CertificateStatus handshake message header: status_type and 3-byte length
+ * of the response follow the handshake header.
+ */
+#define TTLS_OCSP_MAX_LEN	(TLS_MAX_PAYLOAD_SIZE - TTLS_HS_HDR_LEN - 4)
+
+/**
+ * Status of a certificate from SingleResponse.
+ *
+ * @this_update		- the time at which the status is known to be correct;
+ * @next_update		- the time of the next status update, optional;
+ * @has_next		- @next_update is present;
+ * @status		- CertStatus choice: good, revoked or unknown;
+ */
+typedef struct {
+	ttls_x509_time	this_update;
+	ttls_x509_time	next_update;
+	bool		has_next;
+	int		status;
+} TlsOcspSingle;
+
+/**
+ * The certificate to find the status for.
+ *
+ * @crt		- the leaf certificate of the configured chain;
+ * @issuer_key		- subjectPublicKey of the issuer certificate, w/o the
+ *			  unused bits octet of the BIT STRING;
+ */
+typedef struct {
+	const TlsX509Crt	*crt;
+	ttls_x509_buf		issuer_key;
+} TlsOcspCertId;
+
+/*
+ * Only the leaf certificate of a chain is parsed, see ttls_x509_crt_parse(),
+ * so find the issuer of @crt in the raw data of the other certificates:
+ *
+ * Certificate ::= SEQUENCE {
+ *	tbsCertificate		TBSCertificate,
+ *	... }
+ *
+ * TBSCertificate ::= SEQUENCE {
+ *	version			[0] EXPLICIT Version DEFAULT v1,
+ *	serialNumber		CertificateSerialNumber,
+ *	signature		AlgorithmIdentifier,
+ *	issuer			Name,
+ *	validity		Validity,
+ *	subject			Name,
+ *	subjectPublicKeyInfo	SubjectPublicKeyInfo,
+ *	... }
+ *
+ * SubjectPublicKeyInfo ::= SEQUENCE {
+ *	algorithm		AlgorithmIdentifier,
+ *	subjectPublicKey	BIT STRING }
+ *
+ * Returns 0 and the issuer public key in @id if the issuer is found, 1 if it
+ * isn't in the chain and negative value on parsing errors.
+ */
+static int
+ttls_ocsp_get_issuer_key(TlsX509Crt *crt, TlsOcspCertId *id)
+{
+	int i, r;
+	size_t n, len;
+	const unsigned char *p = crt->raw.pages, *end = p + crt->raw.tot_len;
+	const unsigned char *c_end, *subj;
+
+	for ( ; end - p > TTLS_CERT_LEN_LEN; p = c_end) {
+		n = (p[0] << 16) | (p[1] << 8) | p[2];
+		p += TTLS_CERT_LEN_LEN;
+		if (n > end - p)
+			return TTLS_ERR_ASN1_OUT_OF_DATA;
+		c_end = p + n;
+		if (p == ttls_x509_crt_raw(crt))
+			continue;
+
+		for (i = 0; i < 2; ++i) {
+			r = ttls_asn1_get_tag(&p, c_end, &len,
+					      TTLS_ASN1_CONSTRUCTED
+					      | TTLS_ASN1_SEQUENCE);
+			if (r)
+				return r;
+		}
+		/* Skip version, serialNumber, signature, issuer, validity. */
+		for (i = 0; i < 5; ++i) {
+			if (c_end - p < 1)
+				return TTLS_ERR_ASN1_OUT_OF_DATA;
+			if (i == 0 && *p != (TTLS_ASN1_CONTEXT_SPECIFIC
+					     | TTLS_ASN1_CONSTRUCTED | 0))
+				continue;
+			++p;
+			if ((r = ttls_asn1_get_len(&p, c_end, &len)))
+				return r;
+			p += len;
+		}
+		subj = p;
+		r = ttls_asn1_get_tag(&p, c_end, &len, TTLS_ASN1_CONSTRUCTED
+						       | TTLS_ASN1_SEQUENCE);
+		if (r)
+			return r;
+		p += len;
+		if (p - subj != crt->issuer_raw.len
+		    || memcmp(subj, crt->issuer_raw.p, crt->issuer_raw.len))
+			continue;
+
+		r = ttls_asn1_get_tag(&p, c_end, &len, TTLS_ASN1_CONSTRUCTED
+						       | TTLS_ASN1_SEQUENCE);
+		if (r)
+			return r;
+		r = ttls_asn1_get_tag(&p, c_end, &len, TTLS_ASN1_CONSTRUCTED
+						       | TTLS_ASN1_SEQUENCE);
+		if (r)
+			return r;
+		p += len;
+		if ((r = ttls_asn1_get_bitstring_null(&p, c_end, &len)))
+			return r;
+		id->issuer_key.p = (unsigned char *)p;
+		id->issuer_key.len = len;
+
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Check that @hash is the digest of @data by the CertID hash algorithm @alg.
+ * Returns 0 on match, 1 on mismatch and negative value on errors.
+ */
+static int
+ttls_ocsp_hash_eq(const ttls_x509_buf *alg, const ttls_x509_buf *hash,
+		  const unsigned char *data, size_t len)
+{
+	int r;
+	const char *name;
+	struct crypto_shash *tfm;
+	unsigned char md[TTLS_MD_MAX_SIZE];
+
+	if (!TTLS_OID_CMP(TTLS_OID_DIGEST_ALG_SHA1, alg)) {
+		name = "sha1";
+	} else if (!TTLS_OID_CMP(TTLS_OID_DIGEST_ALG_SHA256, alg)) {
+		name = "sha256";
+	} else if (!TTLS_OID_CMP(TTLS_OID_DIGEST_ALG_SHA384, alg)) {
+		name = "sha384";
+	} else if (!TTLS_OID_CMP(TTLS_OID_DIGEST_ALG_SHA512, alg)) {
+		name = "sha512";
+	} else {
+		T_WARN("OCSP response uses unsupported CertID hash\n");
+		return -EINVAL;
+	}
+
+	tfm = crypto_alloc_shash(name, 0, 0);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+	if (crypto_shash_digestsize(tfm) != hash->len) {
+		r = 1;
+		goto out;
+	}
+	if ((r = crypto_shash_tfm_digest(tfm, data, len, md)))
+		goto out;
+	r = !!memcmp(md, hash->p, hash->len);
+out:
+	crypto_free_shash(tfm);
+
+	return r;
+}
+
+/*
+ * SingleResponse ::= SEQUENCE {
+ *	certID			CertID,
+ *	certStatus		CertStatus,
+ *	thisUpdate		GeneralizedTime,
+ *	nextUpdate		[0] EXPLICIT GeneralizedTime OPTIONAL,
+ *	singleExtensions	[1] EXPLICIT Extensions OPTIONAL }
+ *
+ * CertID ::= SEQUENCE {
+ *	hashAlgorithm		AlgorithmIdentifier,
+ *	issuerNameHash		OCTET STRING,
+ *	issuerKeyHash		OCTET STRING,
+ *	serialNumber		CertificateSerialNumber }
+ *
+ * CertStatus ::= CHOICE {
+ *	good			[0] IMPLICIT NULL,
+ *	revoked			[1] IMPLICIT RevokedInfo,
+ *	unknown			[2] IMPLICIT UnknownInfo }
+ *
+ * Returns 0 if the response is about @id, 1 if it's about another certificate
+ * and negative value on parsing errors.
+ */
+static int
+ttls_ocsp_get_single(const unsigned char **p, const unsigned char *end,
+		     const TlsOcspCertId *id, TlsOcspSingle *sr)
+{
+	int i, r;
+	size_t len;
+	const unsigned char *s_end, *id_end;
+	const TlsX509Crt *crt = id->crt;
+	ttls_x509_buf alg, params, serial, hash[2];
+
+	r = ttls_asn1_get_tag(p, end, &len,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	s_end = *p + len;
+
+	r = ttls_asn1_get_tag(p, s_end, &len,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	id_end = *p + len;
+	if ((r = ttls_asn1_get_alg(p, id_end, &alg, &params)))
+		return r;
+	/* issuerNameHash and issuerKeyHash. */
+	for (i = 0; i < 2; ++i) {
+		r = ttls_asn1_get_tag(p, id_end, &hash[i].len,
+				      TTLS_ASN1_OCTET_STRING);
+		if (r)
+			return r;
+		hash[i].p = (unsigned char *)*p;
+		*p += hash[i].len;
+	}
+	if ((r = ttls_x509_get_serial(p, id_end, &serial)))
+		return r;
+	*p = id_end;
+
+	if (s_end - *p < 1)
+		return TTLS_ERR_ASN1_OUT_OF_DATA;
+	if ((**p & TTLS_ASN1_TAG_CLASS_MASK) != TTLS_ASN1_CONTEXT_SPECIFIC)
+		return TTLS_ERR_ASN1_UNEXPECTED_TAG;
+	sr->status = *(*p)++ & TTLS_ASN1_TAG_VALUE_MASK;
+	if ((r = ttls_asn1_get_len(p, s_end, &len)))
+		return r;
+	*p += len;
+
+	if ((r = ttls_x509_get_time(p, s_end, &sr->this_update)))
+		return r;
+	sr->has_next = false;
+	if (*p < s_end
+	    && **p == (TTLS_ASN1_CONTEXT_SPECIFIC | TTLS_ASN1_CONSTRUCTED | 0))
+	{
+		r = ttls_asn1_get_tag(p, s_end, &len,
+				      TTLS_ASN1_CONTEXT_SPECIFIC
+				      | TTLS_ASN1_CONSTRUCTED | 0);
+		if (r)
+			return r;
+		if ((r = ttls_x509_get_time(p, *p + len, &sr->next_update)))
+			return r;
+		sr->has_next = true;
+	}
+	*p = s_end;
+
+	if (serial.len != crt->serial.len
+	    || memcmp(serial.p, crt->serial.p, serial.len))
+		return 1;
+	/* The same serial number can be issued by another CA. */
+	r = ttls_ocsp_hash_eq(&alg, &hash[0], crt->issuer_raw.p,
+			      crt->issuer_raw.len);
+	if (r)
+		return r;
+
+	return ttls_ocsp_hash_eq(&alg, &hash[1], id->issuer_key.p,
+				 id->issuer_key.len);
+}
+
+/*
+ * BasicOCSPResponse ::= SEQUENCE {
+ *	tbsResponseData		ResponseData,
+ *	signatureAlgorithm	AlgorithmIdentifier,
+ *	signature		BIT STRING,
+ *	certs			[0] EXPLICIT SEQUENCE OF Certificate OPTIONAL }
+ *
+ * ResponseData ::= SEQUENCE {
+ *	version			[0] EXPLICIT Version DEFAULT v1,
+ *	responderID		ResponderID,
+ *	producedAt		GeneralizedTime,
+ *	responses		SEQUENCE OF SingleResponse,
+ *	responseExtensions	[1] EXPLICIT Extensions OPTIONAL }
+ *
+ * ResponderID ::= CHOICE {
+ *	byName			[1] Name,
+ *	byKey			[2] KeyHash }
+ */
+static int
+ttls_ocsp_get_basic(const unsigned char *p, const unsigned char *end,
+		    const TlsOcspCertId *id, TlsOcspSingle *sr)
+{
+	int r;
+	size_t len;
+	ttls_x509_time produced_at;
+
+	r = ttls_asn1_get_tag(&p, end, &len,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	r = ttls_asn1_get_tag(&p, end, &len,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	end = p + len;
+
+	if (p < end
+	    && *p == (TTLS_ASN1_CONTEXT_SPECIFIC | TTLS_ASN1_CONSTRUCTED | 0))
+	{
+		r = ttls_asn1_get_tag(&p, end, &len,
+				      TTLS_ASN1_CONTEXT_SPECIFIC
+				      | TTLS_ASN1_CONSTRUCTED | 0);
+		if (r)
+			return r;
+		p += len;
+	}
+
+	if (end - p < 1)
+		return TTLS_ERR_ASN1_OUT_OF_DATA;
+	if ((*p & TTLS_ASN1_TAG_CLASS_MASK) != TTLS_ASN1_CONTEXT_SPECIFIC)
+		return TTLS_ERR_ASN1_UNEXPECTED_TAG;
+	++p;
+	if ((r = ttls_asn1_get_len(&p, end, &len)))
+		return r;
+	p += len;
+
+	if ((r = ttls_x509_get_time(&p, end, &produced_at)))
+		return r;
+
+	r = ttls_asn1_get_tag(&p, end, &len,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	end = p + len;
+	while (p < end) {
+		if ((r = ttls_ocsp_get_single(&p, end, id, sr)) <= 0)
+			return r;
+	}
+
+	T_WARN("OCSP response doesn't contain status of the certificate\n");
+	return -EINVAL;
+}
+
+static long
+ttls_ocsp_time(const ttls_x509_time *t)
+{
+	return mktime64(t->year, t->mon, t->day, t->hour, t->min, t->sec);
+}
+
+/**
+ * OCSPResponse ::= SEQUENCE {
+ *	responseStatus		OCSPResponseStatus,
+ *	responseBytes		[0] EXPLICIT ResponseBytes OPTIONAL }
+ *
+ * ResponseBytes ::= SEQUENCE {
+ *	responseType		OBJECT IDENTIFIER,
+ *	response		OCTET STRING }
+ *
+ * Parse DER encoded OCSP response from @buf and staple it to the certificate
+ * of @key_cert. Trailing data after the response, e.g. a terminating zero
+ * byte of a read file, is ignored.
+ *
+ * An expired response is still attached, but never sent to clients, see
+ * ttls_ocsp_staple(). Called in process context on (re-)configuration.
+ */
+int
+ttls_key_cert_ocsp_load(TlsKeyCert *key_cert, const unsigned char *buf,
+			size_t len)
+{
+	int r;
+	size_t n, resp_len;
+	const unsigned char *p = buf, *end = buf + len;
+	ttls_x509_buf oid;
+	TlsOcspSingle sr;
+	TlsOcspStaple *st;
+	TlsOcspCertId id = { .crt = key_cert->cert };
+
+	r = ttls_asn1_get_tag(&p, end, &n,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	end = p + n;
+	resp_len = end - buf;
+	if (resp_len > TTLS_OCSP_MAX_LEN) {
+		T_WARN("OCSP response is too large: %zu > %lu\n", resp_len,
+		       TTLS_OCSP_MAX_LEN);
+		return -E2BIG;
+	}
+
+	if ((r = ttls_asn1_get_tag(&p, end, &n, TTLS_ASN1_ENUMERATED)))
+		return r;
+	if (n != 1 || *p != TTLS_OCSP_RESP_SUCCESSFUL) {
+		T_WARN("OCSP response is unsuccessful, status %d\n", *p);
+		return -EINVAL;
+	}
+	p += n;
+
+	r = ttls_asn1_get_tag(&p, end, &n, TTLS_ASN1_CONTEXT_SPECIFIC
+					   | TTLS_ASN1_CONSTRUCTED | 0);
+	if (r)
+		return r;
+	r = ttls_asn1_get_tag(&p, end, &n,
+			      TTLS_ASN1_CONSTRUCTED | TTLS_ASN1_SEQUENCE);
+	if (r)
+		return r;
+	if ((r = ttls_asn1_get_tag(&p, end, &oid.len, TTLS_ASN1_OID)))
+		return r;
+	oid.p = p;
+	p += oid.len;
+	if (TTLS_OID_CMP(TTLS_OID_OCSP_BASIC, &oid)) {
+		T_WARN("OCSP response isn't a basic response\n");
+		return -EINVAL;
+	}
+	if ((r = ttls_asn1_get_tag(&p, end, &n, TTLS_ASN1_OCTET_STRING)))
+		return r;
+
+	if ((r = ttls_ocsp_get_issuer_key(key_cert->cert, &id))) {
+		if (r > 0)
+			T_WARN("OCSP stapling requires the issuer certificate"
+			       " in the certificate chain\n");
+		return r > 0 ? -EINVAL : r;
+	}
+	if ((r = ttls_ocsp_get_basic(p, p + n, &id, &sr)))
+		return r;
+	if (sr.status != TTLS_OCSP_CERT_GOOD) {
+		T_WARN("OCSP response reports %s certificate status\n",
+		       sr.status == 1 ? "revoked" : "unknown");
+		return -EINVAL;
+	}
+	if (ttls_x509_time_is_future(&sr.this_update))
+		T_WARN("OCSP response is not yet valid, check the clock\n");
+	if (sr.has_next && ttls_x509_time_is_past(&sr.next_update))
+		T_WARN("OCSP response has expired and won't be stapled,"
+		       " please refresh it\n");
+
+	if (!(st = kmalloc(sizeof(*st), GFP_KERNEL)))
+		return -ENOMEM;
+	st->len = resp_len;
+	st->order = get_order(resp_len);
+	st->data = (unsigned char *)__get_free_pages(GFP_KERNEL | __GFP_COMP,
+						     st->order);
+	if (!st->data) {
+		kfree(st);
+		return -ENOMEM;
+	}
+	memcpy(st->data, buf, resp_len);
+	st->next_update = sr.has_next ? ttls_ocsp_time(&sr.next_update) : 0;
+
+	ttls_ocsp_staple_free(key_cert->ocsp);
+	key_cert->ocsp = st;
+
+	return 0;
+}
+EXPORT_SYMBOL(ttls_key_cert_ocsp_load);
+
+void
+ttls_ocsp_staple_free(TlsOcspStaple *st)
+{
+	if (!st)
+		return;
+
+	free_pages((unsigned long)st->data, st->order);
+	kfree(st);
+}
@@ -192,6 +192,12 @@
 #define TTLS_OID_TIME_STAMPING			   TTLS_OID_KP "\x08" /**< id-kp-timeStamping OBJECT IDENTIFIER ::= { id-kp 8 } */
 #define TTLS_OID_OCSP_SIGNING				TTLS_OID_KP "\x09" /**< id-kp-OCSPSigning OBJECT IDENTIFIER ::= { id-kp 9 } */
 
+/*
+ * OCSP OIDs (RFC 6960)
+ */
+#define TTLS_OID_AD_OCSP		TTLS_OID_PKIX "\x30\x01" /**< id-pkix-ocsp OBJECT IDENTIFIER ::= { id-ad-ocsp } */
+#define TTLS_OID_OCSP_BASIC		TTLS_OID_AD_OCSP "\x01" /**< id-pkix-ocsp-basic OBJECT IDENTIFIER ::= { id-pkix-ocsp 1 } */
+
 /*
  * PKCS definition OIDs
  */
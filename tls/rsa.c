@@ -94,6 +94,47 @@ ttls_rsa_init(TlsRSACtx *ctx, int padding, int hash_id)
 	ctx->hash_id = hash_id;
 }
 
+/*
+ * Size of a blinding value. Each CPU keeps TTLS_CPU_CTX_N of them one by one.
+ */
+#define RSA_V_SZ(ctx)		(sizeof(TlsMpi) + (ctx)->len * 2 / CIL * CIL)
+
+/**
+ * Get the blinding value for the CPU context @c from the per-cpu area @v.
+ */
+static TlsMpi *
+rsa_blinding(const TlsRSACtx *ctx, TlsMpi *v, int c)
+{
+	return (TlsMpi *)((char *)v + c * RSA_V_SZ(ctx));
+}
+
+/**
+ * Generate blinding values for the CPU context @c of @cpu.
+ * Unblinding value: Vf = random number, invertible mod N.
+ */
+static int
+rsa_init_blinding(TlsRSACtx *ctx, int cpu, int c)
+{
+	int count = 0;
+	TlsMpi *vi = rsa_blinding(ctx, per_cpu_ptr(ctx->Vi, cpu), c);
+	TlsMpi *vf = rsa_blinding(ctx, per_cpu_ptr(ctx->Vf, cpu), c);
+
+	ttls_mpi_init_next(vi, ctx->len * 2 / CIL);
+	ttls_mpi_init_next(vf, ctx->len * 2 / CIL);
+
+	do {
+		if (WARN_ON_ONCE(count++ > 10))
+			return TTLS_ERR_RSA_RNG_FAILED;
+		ttls_mpi_fill_random(vf, ctx->len - 1);
+		ttls_mpi_gcd(vi, vf, &ctx->N);
+	} while (ttls_mpi_cmp_int(vi, 1));
+
+	/* Blinding value: Vi =  Vf^(-e) mod N */
+	ttls_mpi_inv_mod(vi, vf, &ctx->N);
+
+	return ttls_mpi_exp_mod(vi, vi, &ctx->E, &ctx->N, &ctx->RN);
+}
+
 /**
  * Setup the RSA context when we know the size of the N prime.
  * This is another half for ttls_rsa_init().
@@ -101,7 +142,7 @@ ttls_rsa_init(TlsRSACtx *ctx, int padding, int hash_id)
 static int
 __rsa_setup_ctx(TlsRSACtx *ctx)
 {
-	int r, cpu;
+	int r, cpu, c;
 
 	/*
 	 * Do nothing if the context is already setup or N or E aren't loaded
@@ -117,41 +158,23 @@ __rsa_setup_ctx(TlsRSACtx *ctx)
 		return -EINVAL;
 	}
 
-	ctx->Vi = __alloc_percpu(sizeof(TlsMpi) + ctx->len * 2,
+	ctx->Vi = __alloc_percpu(RSA_V_SZ(ctx) * TTLS_CPU_CTX_N,
 				 __alignof__(TlsMpi));
 	if (!ctx->Vi)
 		return -ENOMEM;
 
-	ctx->Vf = __alloc_percpu(sizeof(TlsMpi) + ctx->len * 2,
+	ctx->Vf = __alloc_percpu(RSA_V_SZ(ctx) * TTLS_CPU_CTX_N,
 				 __alignof__(TlsMpi));
 	if (!ctx->Vf) {
 		free_percpu(ctx->Vi);
 		return -ENOMEM;
 	}
 
-	/*
-	 * Generate blinding values.
-	 * Unblinding value: Vf = random number, invertible mod N.
-	 */
 	for_each_online_cpu(cpu) {
-		int count = 0;
-
-		TlsMpi *vi = per_cpu_ptr(ctx->Vi, cpu);
-		TlsMpi *vf = per_cpu_ptr(ctx->Vf, cpu);
-
-		ttls_mpi_init_next(vi, ctx->len * 2 / CIL);
-		ttls_mpi_init_next(vf, ctx->len * 2 / CIL);
-
-		do {
-			if (WARN_ON_ONCE(count++ > 10))
-				return TTLS_ERR_RSA_RNG_FAILED;
-			ttls_mpi_fill_random(vf, ctx->len - 1);
-			ttls_mpi_gcd(vi, vf, &ctx->N);
-		} while (ttls_mpi_cmp_int(vi, 1));
-		/* Blinding value: Vi =  Vf^(-e) mod N */
-		ttls_mpi_inv_mod(vi, vf, &ctx->N);
-		if ((r = ttls_mpi_exp_mod(vi, vi, &ctx->E, &ctx->N, &ctx->RN)))
-			goto err;
+		for (c = 0; c < TTLS_CPU_CTX_N; ++c) {
+			if ((r = rsa_init_blinding(ctx, cpu, c)))
+				goto err;
+		}
 	}
 
 	return 0;
@@ -528,8 +551,8 @@ rsa_check_context(const TlsRSACtx *ctx, int is_priv)
 static void
 rsa_prepare_blinding(TlsRSACtx *ctx)
 {
-	TlsMpi *vi = this_cpu_ptr(ctx->Vi);
-	TlsMpi *vf = this_cpu_ptr(ctx->Vf);
+	TlsMpi *vi = rsa_blinding(ctx, this_cpu_ptr(ctx->Vi), ttls_cpu_ctx());
+	TlsMpi *vf = rsa_blinding(ctx, this_cpu_ptr(ctx->Vf), ttls_cpu_ctx());
 
 	/* We already have blinding values, just update them by squaring. */
 	ttls_mpi_mul_mpi(vi, vi, vi);
@@ -572,8 +595,8 @@ ttls_rsa_private(TlsRSACtx *ctx, const unsigned char *input,
 	int r = 0;
 	size_t olen, n;
 	const size_t eb_n = (RSA_EXPONENT_BLINDING + CIL - 1) / CIL;
-	TlsMpi *vi = this_cpu_ptr(ctx->Vi);
-	TlsMpi *vf = this_cpu_ptr(ctx->Vf);
+	TlsMpi *vi = rsa_blinding(ctx, this_cpu_ptr(ctx->Vi), ttls_cpu_ctx());
+	TlsMpi *vf = rsa_blinding(ctx, this_cpu_ptr(ctx->Vf), ttls_cpu_ctx());
 
 	/* Temporary holding the result */
 	TlsMpi *T;
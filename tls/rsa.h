@@ -73,8 +73,8 @@
  * @RN		- cached R^2 mod N;
  * @RP		- cached R^2 mod P;
  * @RQ		- cached R^2 mod Q;
- * @Vi		- The cached blinding value;
- * @Vf		- The cached un-blinding value;
+ * @Vi		- The cached blinding values, one per ttls_cpu_ctx();
+ * @Vf		- The cached un-blinding values, one per ttls_cpu_ctx();
  * @padding	- Selects padding mode: #TTLS_RSA_PKCS_V15 for 1.5 padding and
  *		  #TTLS_RSA_PKCS_V21 for OAEP or PSS;
  * @hash_id	- Hash identifier of ttls_md_type_t type, as specified in
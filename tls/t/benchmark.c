@@ -1,7 +1,7 @@
 /**
  *		Tempesta TLS benchmark for crypto routines
  *
- * Copyright (C) 2020-2023 Tempesta Technologies, INC.
+ * Copyright (C) 2020-2026 Tempesta Technologies, INC.
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by
@@ -31,15 +31,19 @@
 #include "../bignum.c"
 #include "../ciphersuites.c"
 #include "../dhm.c"
+/*
+ * Both the curve implementations define G_BITS and G_LIMBS for their own
+ * parameters, which is fine for separate translation units only.
+ */
+#include "../ec_25519.c"
+#undef G_BITS
+#undef G_LIMBS
 #include "../ec_p256.c"
 #include "../ecp.c"
 #include "../ecdh.c"
 #include "../pk.c"
 #include "../mpool.c"
 
-/* Mock irrelevant groups. */
-const TlsEcpGrp CURVE25519_G = {};
-
 #define BM_TIME		10
 static bool		run_bm;
 static unsigned long	iter;
@@ -112,6 +116,48 @@ bm_sqr_mont_p256(void)
 	);
 }
 
+/*
+ * Modular exponentiation with a random odd modulus and a full length
+ * exponent: 1024 and 2048 bits moduli are the CRT halves of RSA-2048 and
+ * RSA-4096 private key operations correspondingly.
+ */
+void
+bm_exp_mod(size_t bits)
+{
+	int r;
+	char desc[32];
+	unsigned char buf[TTLS_MPI_MAX_SIZE];
+	size_t n = bits / 8, limbs = bits / BIL + 1;
+	TlsMpi *A, *E, *N, *X, *RR;
+
+	A = ttls_mpi_alloc_stack_init(limbs);
+	E = ttls_mpi_alloc_stack_init(limbs);
+	N = ttls_mpi_alloc_stack_init(limbs);
+	X = ttls_mpi_alloc_stack_init(limbs);
+	RR = ttls_mpi_alloc_stack_init(0);
+
+	if (fill_random(buf, n)) {
+		printf(" Test failed: can't read random bytes from urandom\n");
+		return;
+	}
+	buf[0] |= 0x80;
+	buf[n - 1] |= 1;
+	ttls_mpi_read_binary(N, buf, n);
+	/* A < N */
+	buf[0] &= 0x7f;
+	ttls_mpi_read_binary(A, buf, n);
+	buf[0] = 0xff;
+	ttls_mpi_read_binary(E, buf, n);
+
+	snprintf(desc, sizeof(desc), "%lu-bit exp_mod", bits);
+	BENCHMARK(desc,
+		r = ttls_mpi_exp_mod(X, A, E, N, RR);
+		BUG_ON(r);
+	);
+
+	ttls_mpi_pool_cleanup_ctx(0, false);
+}
+
 void
 bm_ecdsa_sign_p256(void)
 {
@@ -212,6 +258,43 @@ bm_ecdhe_srv_p256(void)
 	);
 }
 
+void
+bm_ecdhe_srv_x25519(void)
+{
+	int r;
+	size_t n;
+	TlsECDHCtx *ctx;
+	TlsMpiPool *mp;
+	unsigned char buf[128] = {0}, pms[TTLS_PREMASTER_SIZE] = {0};
+	/* Bob's public key from RFC 7748 6.1. */
+	const char clnt_buf[33] = "\x20\xDE\x9E\xDB\x7D\x7B\x7D\xC1"
+				  "\xB4\xD3\x5B\x61\xC2\xEC\xE4\x35"
+				  "\x37\x3F\x83\x43\xC8\x5B\x78\x67"
+				  "\x4D\xAD\xFC\x7E\x14\x6F\x88\x2B"
+				  "\x4F";
+
+	mp = ttls_mpi_pool_create(0, GFP_KERNEL);
+	BUG_ON(!mp);
+
+	/* The same as for bm_ecdhe_srv_p256(), but for the X25519 profile. */
+	ctx = ttls_mpool_alloc_data(mp, cs_mp_ecdhe_curve25519.mp.curr
+					- sizeof(*mp));
+	BUG_ON(!ctx);
+	mp->curr = cs_mp_ecdhe_curve25519.mp.curr;
+	memcpy_fast(ctx, MPI_POOL_DATA(&cs_mp_ecdhe_curve25519.mp),
+		    mp->curr - sizeof(*mp));
+
+	BENCHMARK("ECDHE srv (x25519)",
+		r = ttls_ecdh_make_params(ctx, &n, buf, 128);
+		BUG_ON(r);
+		r = ttls_ecdh_read_public(ctx, clnt_buf, 33);
+		BUG_ON(r);
+		r = ttls_ecdh_calc_secret(ctx, &n, pms, TTLS_MPI_MAX_SIZE);
+		BUG_ON(r);
+		ttls_mpi_pool_cleanup_ctx(0, false);
+	);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -230,8 +313,21 @@ main(int argc, char *argv[])
 	bm_mul_mont_p256();
 	bm_sqr_mont_p256();
 
+	/*
+	 * RSA private key operations with CRT. The MULX/ADX Montgomery
+	 * kernels with the constant-time fixed window exponentiation are
+	 * about 1.7 times faster than the generic C sliding window.
+	 */
+	bm_exp_mod(1024);
+	bm_exp_mod(2048);
+
 	bm_ecdsa_sign_p256();
+	/*
+	 * Server side ECDHE handshake cost: ephemeral key generation for
+	 * ServerKeyExchange and the shared secret for ClientKeyExchange.
+	 */
 	bm_ecdhe_srv_p256();
+	bm_ecdhe_srv_x25519();
 
 	ttls_mpool_exit();
 
@@ -1,7 +1,7 @@
 /**
  *		Tempesta TLS EC 25519 unit test
  *
- * Copyright (C) 2020 Tempesta Technologies, Inc.
+ * Copyright (C) 2020-2026 Tempesta Technologies, Inc.
  *
  * This program is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by
@@ -24,17 +24,282 @@
 #include "../dhm.c"
 #include "../ec_25519.c"
 #include "../ecp.c"
+#include "../ecdh.c"
 #include "../mpool.c"
 
 /* Mock irrelevant groups. */
 const TlsEcpGrp SECP256_G = {};
 
+/* RFC 7748 6.1 test vectors. */
+static const unsigned char alice_d[32] =
+	"\x77\x07\x6d\x0a\x73\x18\xa5\x7d\x3c\x16\xc1\x72\x51\xb2\x66\x45"
+	"\xdf\x4c\x2f\x87\xeb\xc0\x99\x2a\xb1\x77\xfb\xa5\x1d\xb9\x2c\x2a";
+static const unsigned char alice_pub[32] =
+	"\x85\x20\xf0\x09\x89\x30\xa7\x54\x74\x8b\x7d\xdc\xb4\x3e\xf7\x5a"
+	"\x0d\xbf\x3a\x0d\x26\x38\x1a\xf4\xeb\xa4\xa9\x8e\xaa\x9b\x4e\x6a";
+static const unsigned char bob_pub[33] =
+	"\x20"
+	"\xde\x9e\xdb\x7d\x7b\x7d\xc1\xb4\xd3\x5b\x61\xc2\xec\xe4\x35\x37"
+	"\x3f\x83\x43\xc8\x5b\x78\x67\x4d\xad\xfc\x7e\x14\x6f\x88\x2b\x4f";
+static const unsigned char shared[32] =
+	"\x4a\x5d\x9d\x5b\xa4\xce\x2d\xe1\x72\x8e\x3b\xf4\x80\x35\x0f\x25"
+	"\xe0\x7e\x21\xc9\x47\xd1\x9e\x33\x76\xf0\x9b\x3c\x1e\x16\x17\x42";
+
+/* RFC 7748 5.2 test vectors: scalar, u-coordinate and the result. */
+static const unsigned char x25519_vec[2][3][32] = {
+	{
+		"\xa5\x46\xe3\x6b\xf0\x52\x7c\x9d"
+		"\x3b\x16\x15\x4b\x82\x46\x5e\xdd"
+		"\x62\x14\x4c\x0a\xc1\xfc\x5a\x18"
+		"\x50\x6a\x22\x44\xba\x44\x9a\xc4",
+		"\xe6\xdb\x68\x67\x58\x30\x30\xdb"
+		"\x35\x94\xc1\xa4\x24\xb1\x5f\x7c"
+		"\x72\x66\x24\xec\x26\xb3\x35\x3b"
+		"\x10\xa9\x03\xa6\xd0\xab\x1c\x4c",
+		"\xc3\xda\x55\x37\x9d\xe9\xc6\x90"
+		"\x8e\x94\xea\x4d\xf2\x8d\x08\x4f"
+		"\x32\xec\xcf\x03\x49\x1c\x71\xf7"
+		"\x54\xb4\x07\x55\x77\xa2\x85\x52"
+	},
+	{
+		"\x4b\x66\xe9\xd4\xd1\xb4\x67\x3c"
+		"\x5a\xd2\x26\x91\x95\x7d\x6a\xf5"
+		"\xc1\x1b\x64\x21\xe0\xea\x01\xd4"
+		"\x2c\xa4\x16\x9e\x79\x18\xba\x0d",
+		"\xe5\x21\x0f\x12\x78\x68\x11\xd3"
+		"\xf4\xb7\x95\x9d\x05\x38\xae\x2c"
+		"\x31\xdb\xe7\x10\x6f\xc0\x3c\x3e"
+		"\xfc\x4c\xd5\x49\xc7\x15\xa4\x93",
+		"\x95\xcb\xde\x94\x76\xe8\x90\x7d"
+		"\x7a\xad\xe4\x5c\xb4\xb8\x73\xf8"
+		"\x8b\x59\x5a\x68\x79\x9f\xa1\x52"
+		"\xe6\xf8\xf7\x64\x7a\xac\x79\x57"
+	}
+};
+
+/* RFC 7748 5.2 iterated X25519 results after 1 and 1000 iterations. */
+static const unsigned char x25519_iter1[32] =
+	"\x42\x2c\x8e\x7a\x62\x27\xd7\xbc\xa1\x35\x0b\x3e\x2b\xb7\x27\x9f"
+	"\x78\x97\xb8\x7b\xb6\x85\x4b\x78\x3c\x60\xe8\x03\x11\xae\x30\x79";
+static const unsigned char x25519_iter1000[32] =
+	"\x68\x4c\xf5\x9b\xa8\x33\x09\x55\x28\x00\xef\x56\x6f\x2f\x4d\x3c"
+	"\x1c\x38\x87\xc4\x93\x60\xe3\x87\x5f\x2e\xb9\x4d\x99\x53\x2c\x51";
+
+/**
+ * Load a little-endian X25519 private key and clamp it (RFC 7748 5).
+ */
+static void
+x25519_load_key(TlsMpi *d, const unsigned char *k)
+{
+	int i;
+	unsigned char be[32];
+
+	for (i = 0; i < 32; ++i)
+		be[i] = k[31 - i];
+	be[31] &= 248;
+	be[0] &= 127;
+	be[0] |= 64;
+
+	ttls_mpi_read_binary(d, be, 32);
+}
+
+/**
+ * X25519 function on byte strings (RFC 7748 5): clamp the scalar and mask
+ * the most significant bit of the u-coordinate.
+ */
+static void
+x25519(unsigned char *r, const unsigned char *k, const unsigned char *u)
+{
+	unsigned long kl[G_LIMBS], ul[G_LIMBS], rl[G_LIMBS];
+
+	memcpy(kl, k, 32);
+	memcpy(ul, u, 32);
+	kl[0] &= ~7UL;
+	kl[G_LIMBS - 1] &= ~(1UL << 63);
+	kl[G_LIMBS - 1] |= 1UL << 62;
+	ul[G_LIMBS - 1] &= ~(1UL << 63);
+
+	c25519_ladder(rl, kl, ul);
+	memcpy(r, rl, 32);
+}
+
+static void
+x25519_ladder(void)
+{
+	unsigned char k[32] = { 9 }, u[32] = { 9 }, r[32];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(x25519_vec); ++i) {
+		x25519(r, x25519_vec[i][0], x25519_vec[i][1]);
+		EXPECT_ZERO(memcmp(r, x25519_vec[i][2], 32));
+	}
+
+	for (i = 1; i <= 1000; ++i) {
+		x25519(r, k, u);
+		memcpy(u, k, 32);
+		memcpy(k, r, 32);
+		if (i == 1)
+			EXPECT_ZERO(memcmp(k, x25519_iter1, 32));
+	}
+	EXPECT_ZERO(memcmp(k, x25519_iter1000, 32));
+}
+
+/**
+ * Field operations on the edges of the [0, 2^256) representation.
+ */
+static void
+c25519_field(void)
+{
+	static const unsigned long one[G_LIMBS] = { 1 }, zero[G_LIMBS] = {};
+	unsigned long a[G_LIMBS], b[G_LIMBS], r[G_LIMBS];
+
+	/* p and 2p are zero, 2^256 - 1 is 37. */
+	memcpy(r, c25519_p, sizeof(r));
+	c25519_final(r);
+	EXPECT_ZERO(memcmp(r, zero, sizeof(r)));
+	memset(r, 0xff, sizeof(r));
+	c25519_final(r);
+	EXPECT_TRUE(r[0] == 37 && !r[1] && !r[2] && !r[3]);
+
+	/* 0 - 1 = p - 1 */
+	c25519_sub(r, zero, one);
+	c25519_final(r);
+	memcpy(a, c25519_p, sizeof(a));
+	a[0] -= 1;
+	EXPECT_ZERO(memcmp(r, a, sizeof(r)));
+
+	/* (p - 1) + 1 = 0 and (2^256 - 1) + (2^256 - 1) = 74 */
+	c25519_add(r, a, one);
+	c25519_final(r);
+	EXPECT_ZERO(memcmp(r, zero, sizeof(r)));
+	memset(b, 0xff, sizeof(b));
+	c25519_add(r, b, b);
+	c25519_final(r);
+	EXPECT_TRUE(r[0] == 74 && !r[1] && !r[2] && !r[3]);
+
+	/* (p - 1)^2 = 1 and (2^256 - 1)^2 = 37^2 */
+	c25519_mul(r, a, a);
+	c25519_final(r);
+	EXPECT_ZERO(memcmp(r, one, sizeof(r)));
+	c25519_mul(r, b, b);
+	c25519_final(r);
+	EXPECT_TRUE(r[0] == 37 * 37 && !r[1] && !r[2] && !r[3]);
+
+	/* x * x^-1 = 1 and 0^-1 = 0 */
+	c25519_inv(r, b);
+	c25519_mul(r, r, b);
+	c25519_final(r);
+	EXPECT_ZERO(memcmp(r, one, sizeof(r)));
+	c25519_inv(r, zero);
+	c25519_final(r);
+	EXPECT_ZERO(memcmp(r, zero, sizeof(r)));
+}
+
+static TlsECDHCtx *
+x25519_ctx_clone(void)
+{
+	TlsECDHCtx *ctx;
+	TlsMpiPool *mp;
+
+	/* ttls_mpool() treats the pool as "handshake" pool. */
+	EXPECT_NOT_NULL(mp = ttls_mpi_pool_create(0, GFP_KERNEL));
+
+	/* See __mpi_profile_clone(). */
+	ctx = ttls_mpool_alloc_data(mp, cs_mp_ecdhe_curve25519.mp.curr
+					- sizeof(*mp));
+	EXPECT_NOT_NULL(ctx);
+	mp->curr = cs_mp_ecdhe_curve25519.mp.curr;
+	memcpy_fast(ctx, MPI_POOL_DATA(&cs_mp_ecdhe_curve25519.mp),
+		    mp->curr - sizeof(*mp));
+	EXPECT_TRUE(ctx->grp == &CURVE25519_G);
+
+	return ctx;
+}
+
+static void
+x25519_rfc7748(void)
+{
+	size_t n;
+	TlsECDHCtx *ctx = x25519_ctx_clone();
+	unsigned char pms[TTLS_PREMASTER_SIZE] = {0};
+	unsigned char base[33] = { 0x20, 9 };
+
+	x25519_load_key(&ctx->d, alice_d);
+
+	/* Public key: X25519(a, 9). */
+	EXPECT_ZERO(ttls_ecdh_read_public(ctx, base, 33));
+	EXPECT_ZERO(ttls_ecdh_calc_secret(ctx, &n, pms, TTLS_MPI_MAX_SIZE));
+	EXPECT_TRUE(n == 32);
+	EXPECT_ZERO(memcmp(pms, alice_pub, 32));
+	ttls_mpi_pool_cleanup_ctx(0, false);
+
+	/* Shared secret: X25519(a, X25519(b, 9)). */
+	EXPECT_ZERO(ttls_ecdh_read_public(ctx, bob_pub, 33));
+	EXPECT_ZERO(ttls_ecdh_calc_secret(ctx, &n, pms, TTLS_MPI_MAX_SIZE));
+	EXPECT_TRUE(n == 32);
+	EXPECT_ZERO(memcmp(pms, shared, 32));
+	ttls_mpi_pool_cleanup_ctx(0, false);
+
+	ttls_mpi_pool_free(ctx);
+}
+
+static void
+x25519_bad_public(void)
+{
+	size_t n;
+	TlsECDHCtx *ctx = x25519_ctx_clone();
+	unsigned char pms[TTLS_PREMASTER_SIZE] = {0};
+	unsigned char pub[33] = { 0x20 };
+
+	x25519_load_key(&ctx->d, alice_d);
+
+	/* SEC1 encoding and wrong lengths are rejected. */
+	EXPECT_TRUE(ttls_ecdh_read_public(ctx, pub, 32) == -EINVAL);
+	pub[0] = 0x41;
+	EXPECT_TRUE(ttls_ecdh_read_public(ctx, pub, 33) == -EINVAL);
+
+	/* The zero point results in all-zero shared secret. */
+	pub[0] = 0x20;
+	EXPECT_ZERO(ttls_ecdh_read_public(ctx, pub, 33));
+	EXPECT_TRUE(ttls_ecdh_calc_secret(ctx, &n, pms, TTLS_MPI_MAX_SIZE)
+		    == -EINVAL);
+	ttls_mpi_pool_cleanup_ctx(0, false);
+
+	ttls_mpi_pool_free(ctx);
+}
+
+static void
+x25519_srv_params(void)
+{
+	size_t n;
+	TlsECDHCtx *ctx = x25519_ctx_clone();
+	unsigned char buf[128] = {0}, pms[TTLS_PREMASTER_SIZE] = {0};
+
+	/* curve_type(1), namedcurve(2), ECPoint length(1) and u(32). */
+	EXPECT_ZERO(ttls_ecdh_make_params(ctx, &n, buf, 128));
+	EXPECT_TRUE(n == 36);
+	EXPECT_ZERO(memcmp(buf, "\x03\x00\x1d\x20", 4));
+	ttls_mpi_pool_cleanup_ctx(0, false);
+
+	/* Our own public key must be usable by the peer. */
+	EXPECT_ZERO(ttls_ecdh_read_public(ctx, bob_pub, 33));
+	EXPECT_ZERO(ttls_ecdh_calc_secret(ctx, &n, pms, TTLS_MPI_MAX_SIZE));
+	EXPECT_TRUE(n == 32);
+	ttls_mpi_pool_cleanup_ctx(0, false);
+
+	ttls_mpi_pool_free(ctx);
+}
+
 int
 main(int argc, char *argv[])
 {
 	BUG_ON(ttls_mpool_init());
 
-	/* TODO #1335 no real tests, just check initialization for now. */
+	c25519_field();
+	x25519_ladder();
+	x25519_rfc7748();
+	x25519_bad_public();
+	x25519_srv_params();
 
 	ttls_mpool_exit();
 
@@ -448,6 +448,126 @@ ecp_inv(void)
 			  0x152a4e13984f9845UL, 0x510a62612850ec16UL);
 }
 
+/*
+ * The constant time Fermat inversion must agree with the generic MPI
+ * inversion. Walk through a sequence of squares of G.x to get numbers
+ * of all the sizes and also check the P - 1 corner case.
+ */
+static void
+ecp_inv_mont(void)
+{
+	int i;
+	unsigned long a[4], am[4], r[4];
+	DECLARE_MPI_AUTO(A, G_LIMBS * 2);
+	DECLARE_MPI_AUTO(R, G_LIMBS);
+	DECLARE_MPI_AUTO(X, G_LIMBS * 2);
+
+	ecp256_copy(a, G.secp256r1_p);
+	a[0]--;
+	ecp256_to_mont(am, a);
+	ecp256_inv_mont(r, am);
+	mpi_from_mont_p256_x86_64(r);
+	EXPECT_TRUE(ecp256_eq(r, a));
+
+	ecp256_to_mont(am, G.secp256r1_gx);
+	for (i = 0; i < 32; ++i) {
+		ecp256_copy(a, am);
+		mpi_from_mont_p256_x86_64(a);
+		ecp256_mpi_write(&A, a);
+		ecp256_inv_mod(&X, &A, &G.P);
+
+		ecp256_inv_mont(r, am);
+		mpi_from_mont_p256_x86_64(r);
+		ecp256_mpi_write(&R, r);
+		EXPECT_ZERO(ttls_mpi_cmp_mpi(&R, &X));
+
+		mpi_sqr_mont_mod_p256_x86_64(am, am);
+		ttls_mpi_pool_cleanup_ctx(0, false);
+	}
+}
+
+/*
+ * Represent G with several Z values, (l^2 * G.x, l^3 * G.y, l), and check
+ * that the normalization gets the affine G back from both the Montgomery
+ * and the normal forms.
+ */
+static void
+ecp_normalize_jac(void)
+{
+	int i;
+	unsigned long gx[4], gy[4], l[4], ll[4], one[4];
+	Ecp256Point p;
+
+	ecp256_lset(one, 1);
+	ecp256_to_mont(gx, G.secp256r1_gx);
+	ecp256_to_mont(gy, G.secp256r1_gy);
+	ecp256_lset(ll, LONG_MAX);
+	ecp256_to_mont(l, ll);
+
+	for (i = 0; i < 8; ++i) {
+		mpi_sqr_mont_mod_p256_x86_64(ll, l);
+		mpi_mul_mont_mod_p256_x86_64(p.x, gx, ll);
+		mpi_mul_mont_mod_p256_x86_64(ll, ll, l);
+		mpi_mul_mont_mod_p256_x86_64(p.y, gy, ll);
+		ecp256_copy(p.z, l);
+
+		ecp256_normalize_jac(&p, true);
+		EXPECT_TRUE(ecp256_eq(p.x, G.secp256r1_gx));
+		EXPECT_TRUE(ecp256_eq(p.y, G.secp256r1_gy));
+		EXPECT_TRUE(ecp256_eq(p.z, one));
+
+		mpi_sqr_mont_mod_p256_x86_64(ll, l);
+		mpi_mul_mont_mod_p256_x86_64(p.x, gx, ll);
+		mpi_mul_mont_mod_p256_x86_64(ll, ll, l);
+		mpi_mul_mont_mod_p256_x86_64(p.y, gy, ll);
+		ecp256_copy(p.z, l);
+		mpi_from_mont_p256_x86_64(p.x);
+		mpi_from_mont_p256_x86_64(p.y);
+		mpi_from_mont_p256_x86_64(p.z);
+
+		ecp256_normalize_jac(&p, false);
+		EXPECT_TRUE(ecp256_eq(p.x, G.secp256r1_gx));
+		EXPECT_TRUE(ecp256_eq(p.y, G.secp256r1_gy));
+		EXPECT_TRUE(ecp256_eq(p.z, one));
+
+		mpi_mul_mont_mod_p256_x86_64(l, l, gx);
+	}
+}
+
+/*
+ * Check the static table selection, the AVX2 gather or the C scan depending
+ * on the build, against plain table reads for all the window values.
+ */
+static void
+ecp_select_comb_g(void)
+{
+	int i, k;
+	unsigned long z[4], my[4];
+	Ecp256Point r;
+
+	ecp256_lset(z, LONG_MAX);
+
+	for (k = 0; k <= G_D; ++k) {
+		for (i = 0; i < 256; ++i) {
+			const EcpXY *t = &combT_G[k][(i & 0x7f) >> 1];
+
+			memset(&r, 0xa5, sizeof(r));
+			ecp256_copy(r.z, z);
+			ecp256_select_comb_g(&r, combT_G[k], i);
+
+			EXPECT_TRUE(ecp256_eq(r.x, t->x));
+			if (i >> 7) {
+				mpi_sub_mod_p256_x86_64(my, G.secp256r1_p,
+							t->y);
+				EXPECT_TRUE(ecp256_eq(r.y, my));
+			} else {
+				EXPECT_TRUE(ecp256_eq(r.y, t->y));
+			}
+			EXPECT_TRUE(ecp256_eq(r.z, z));
+		}
+	}
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -458,6 +578,9 @@ main(int argc, char *argv[])
 	ecp_multi_dbl();
 	ecp_mul();
 	ecp_inv();
+	ecp_inv_mont();
+	ecp_normalize_jac();
+	ecp_select_comb_g();
 
 	ttls_mpool_exit();
 
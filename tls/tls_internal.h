@@ -77,8 +77,15 @@ void ttls_aead_req_free(struct crypto_aead *tfm, struct aead_request *req);
  *  explicit IV  handshake header    hash      tag
  *  -----------  ----------------  --------  --------
  *    8 bytes        4 bytes       12 bytes  16 bytes
+ *
+ * This is the maximum, ChaCha20-Poly1305 has no explicit IV and uses 32 bytes.
  */
 #define TTLS_HS_FINISHED_BODY_LEN	40
+/*
+ * ServerKeyExchange body is at most DHE parameters (519), the signature and
+ * hash algorithms with the signature length (4) and RSA 4096 signature (512).
+ */
+#define TTLS_SKE_MAX_LEN		1035
 
 /*
  * Abstraction for a grid of allowed signature-hash-algorithm pairs.
@@ -115,8 +122,14 @@ typedef struct {
  * @new_session_ticket - use NewSessionTicket?
  * @resume	- session resume indicator;
  * @cli_exts	- client extension presence;
+ * @deferred	- the server flight is deferred to ttls_handshake_resume();
+ * @ocsp	- client requested OCSP stapling and, since ServerHello is
+ *		  written, CertificateStatus is to be sent;
  * @pmslen	- premaster length;
  * @key_cert	- chosen key/cert pair (server);
+ * @ske		- ServerKeyExchange made by ttls_handshake_prepare() for the
+ *		  deferred server flight, owns a page reference;
+ * @ske_len	- length of the @ske message body;
  * @fin_sha{256,512} - checksum contexts;
  * @tmp_sha256	- temporal checksum buffer to handle both the checksum types on
  *		  early handhsahe steps;
@@ -140,10 +153,14 @@ struct tls_handshake_t {
 					resume			: 1,
 					cli_exts		: 1,
 					curves_ext		: 1,
-					secure_renegotiation	: 1;
+					secure_renegotiation	: 1,
+					deferred		: 1,
+					ocsp			: 1;
 
 	size_t				pmslen;
 	TlsKeyCert			*key_cert;
+	unsigned char			*ske;
+	unsigned short			ske_len;
 
 	void (*calc_verify)(TlsCtx *, unsigned char *);
 	void (*calc_finished)(TlsCtx *, unsigned char *, int);
@@ -210,6 +227,7 @@ int ttls_handshake_client_step(TlsCtx *tls, unsigned char *buf,
 			       size_t len, size_t hh_len, unsigned int *read);
 int ttls_handshake_server_step(TlsCtx *tls, unsigned char *buf,
 			       size_t len, size_t hh_len, unsigned int *read);
+int ttls_handshake_server_prepare(TlsCtx *tls);
 void ttls_handshake_wrapup(TlsCtx *tls);
 
 int ttls_derive_keys(TlsCtx *tls);
@@ -247,25 +265,34 @@ int ttls_check_sig_hash(const TlsCtx *tls, ttls_md_type_t md);
 int ttls_match_sig_hashes(const TlsCtx *tls);
 int ttls_update_checksum(TlsCtx *tls, const unsigned char *buf, size_t len);
 
+static inline TlsKeyCert *
+ttls_own_key_cert(TlsCtx *tls)
+{
+	if (tls->hs && tls->hs->key_cert)
+		return tls->hs->key_cert;
+
+	return tls->peer_conf ? tls->peer_conf->key_cert : NULL;
+}
+
 static inline TlsX509Crt *
 ttls_own_cert(TlsCtx *tls)
 {
-	TlsKeyCert *key_cert;
-
-	if (tls->hs && tls->hs->key_cert)
-		key_cert = tls->hs->key_cert;
-	else
-		key_cert = tls->peer_conf ? tls->peer_conf->key_cert : NULL;
+	TlsKeyCert *key_cert = ttls_own_key_cert(tls);
 
 	return key_cert ? key_cert->cert : NULL;
 }
 
+void ttls_ocsp_staple_free(TlsOcspStaple *st);
+
 int ttls_check_cert_usage(const TlsX509Crt *cert,
 			  const TlsCiphersuite *ciphersuite,
 			  int cert_endpoint);
 
 void ttls_read_version(TlsCtx *tls, const unsigned char ver[2]);
 
+int ttls_key_exchange_md_tls1_2(TlsCtx *tls, unsigned char *output,
+				unsigned char *data, size_t data_len,
+				ttls_md_type_t md_alg);
 int ttls_get_key_exchange_md_tls1_2(TlsCtx *tls, unsigned char *output,
 				    unsigned char *data, size_t data_len,
 				    ttls_md_type_t md_alg);
@@ -282,6 +309,13 @@ ttls_bzero_safe(void *v, size_t n)
 	kernel_fpu_end();
 }
 
+static inline unsigned int
+ttls_finished_body_len(const TlsXfrm *xfrm)
+{
+	return ttls_expiv_len(xfrm) + TTLS_HS_HDR_LEN + TLS_HASH_LEN
+	       + TTLS_TAG_LEN;
+}
+
 static inline void
 ttls_write_version(const TlsCtx *tls, unsigned char ver[2])
 {
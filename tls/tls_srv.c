@@ -34,6 +34,8 @@ ttls_sni_cb_t *ttls_sni_cb;
 ttls_hs_over_cb_t *ttls_hs_over_cb;
 ttls_alpn_match_t *ttls_alpn_match_cb;
 ttls_ja5t_limit_conn_cb_t *ttls_ja5t_limit_conn_cb;
+ttls_hs_defer_cb_t *ttls_hs_defer_cb;
+ttls_sess_get_cb_t *ttls_sess_get_cb;
 
 static int
 ttls_parse_servername_ext(TlsCtx *tls, const unsigned char *buf, size_t len)
@@ -258,6 +260,69 @@ ttls_parse_extended_ms_ext(TlsCtx *tls, const unsigned char *buf, size_t len)
 	return 0;
 }
 
+/**
+ * RFC 6066 8:
+ *
+ *	struct {
+ *		CertificateStatusType status_type;
+ *		select (status_type) {
+ *			case ocsp: OCSPStatusRequest;
+ *		} request;
+ *	} CertificateStatusRequest;
+ *
+ * We have only one OCSP response for our certificate, so responder_id_list and
+ * request_extensions of OCSPStatusRequest are ignored.
+ */
+static int
+ttls_parse_status_request_ext(TlsCtx *tls, const unsigned char *buf,
+			      size_t len)
+{
+	if (!len) {
+		TTLS_WARN(tls, "ClientHello: bad status_request extension\n");
+		ttls_send_alert(tls, TTLS_ALERT_LEVEL_FATAL,
+				TTLS_ALERT_MSG_DECODE_ERROR,
+				TTLS_F_ST_CLOSE);
+		return -EBADMSG;
+	}
+
+	if (buf[0] == TTLS_CERT_STATUS_OCSP)
+		tls->hs->ocsp = 1;
+
+	return 0;
+}
+
+/**
+ * RFC 8446 4.2.1: if supported_versions is present, servers MUST use only the
+ * extension to determine client preferences, so the client may not speak
+ * TLS 1.2 at all even with legacy_version set to 0x0303. We don't support
+ * TLS 1.3 yet (TODO #1031), so reject clients which don't offer TLS 1.2.
+ */
+static int
+ttls_parse_supported_versions_ext(TlsCtx *tls, const unsigned char *buf,
+				  size_t len)
+{
+	size_t i;
+
+	if (unlikely(len < 3 || buf[0] + 1 != len || (buf[0] & 1))) {
+		TTLS_WARN(tls, "ClientHello: bad supported versions extension\n");
+		ttls_send_alert(tls, TTLS_ALERT_LEVEL_FATAL,
+				TTLS_ALERT_MSG_DECODE_ERROR,
+				TTLS_F_ST_CLOSE);
+		return -EBADMSG;
+	}
+
+	for (i = 1; i < len; i += 2)
+		if (buf[i] == TTLS_MAJOR_VERSION_3
+		    && buf[i + 1] == TTLS_MINOR_VERSION_3)
+			return 0;
+
+	TTLS_WARN(tls, "ClientHello: no common protocol version\n");
+	ttls_send_alert(tls, TTLS_ALERT_LEVEL_FATAL,
+			TTLS_ALERT_MSG_PROTOCOL_VERSION, TTLS_F_ST_CLOSE);
+
+	return -EINVAL;
+}
+
 static void
 ttls_parse_session_ticket_ext(TlsCtx *tls, const unsigned char *buf, size_t len)
 {
@@ -577,31 +642,55 @@ ttls_ciphersuite_match(TlsCtx *tls, const TlsCiphersuite *suite_info)
 	return 0;
 }
 
+/**
+ * Clients without AES hardware acceleration, mostly mobile ones, put
+ * ChaCha20-Poly1305 suites first. Honor the client preference in this case
+ * and use our own order otherwise. GREASE, SCSV and other unknown values are
+ * skipped.
+ */
+static bool
+ttls_cli_prefers_chacha(TlsCtx *tls)
+{
+	const TlsCiphersuite *ci;
+	const unsigned short *cs = tls->hs->css;
+	const unsigned short *end = cs + tls->hs->cs_total_len / 2;
+
+	for ( ; cs < end; cs++)
+		if ((ci = ttls_ciphersuite_from_id(*cs)))
+			return ttls_ciphersuite_is_chacha(ci);
+
+	return false;
+}
+
 static int
 ttls_choose_ciphersuite(TlsCtx *tls)
 {
-	int i, got_common_suite = 0;
+	int i, pass, got_common_suite = 0;
 	const int *ciphersuites;
 	const TlsCiphersuite *ci = NULL;
 	const unsigned short *cs;
-	unsigned int cs_cnt = tls->hs->cs_total_len / 2;
+	const unsigned short *cs_end = tls->hs->css + tls->hs->cs_total_len / 2;
 
 	ciphersuites = tls->peer_conf->ciphersuite_list[TTLS_MINOR_VERSION_3];
-	for (i = 0; ciphersuites[i] != 0; i++)
-		for (cs = tls->hs->css; cs < tls->hs->css + cs_cnt; cs++) {
-			if (*cs != ciphersuites[i])
-				continue;
-
-			ci = ttls_ciphersuite_from_id(ciphersuites[i]);
-			if (!ci) {
-				TTLS_WARN(tls, "ClientHello: cannot match a ciphersuite\n");
-				return -EINVAL;
-			}
+	/* The first pass, if any, considers ChaCha20-Poly1305 suites only. */
+	for (pass = !ttls_cli_prefers_chacha(tls); pass < 2; pass++)
+		for (i = 0; ciphersuites[i] != 0; i++)
+			for (cs = tls->hs->css; cs < cs_end; cs++) {
+				if (*cs != ciphersuites[i])
+					continue;
+
+				ci = ttls_ciphersuite_from_id(ciphersuites[i]);
+				if (!ci) {
+					TTLS_WARN(tls, "ClientHello: cannot match a ciphersuite\n");
+					return -EINVAL;
+				}
+				if (!pass && !ttls_ciphersuite_is_chacha(ci))
+					break;
 
-			got_common_suite = 1;
-			if (!ttls_ciphersuite_match(tls, ci))
-				goto have_ciphersuite;
-		}
+				got_common_suite = 1;
+				if (!ttls_ciphersuite_match(tls, ci))
+					goto have_ciphersuite;
+			}
 
 	if (got_common_suite) {
 		TTLS_WARN(tls, "None of the common ciphersuites is usable"
@@ -658,6 +747,8 @@ ttls_ext_is_supported(unsigned short ext_type)
 	case TTLS_TLS_EXT_SESSION_TICKET:
 	case TTLS_TLS_EXT_ALPN:
 	case TTLS_TLS_EXT_RENEGOTIATION_INFO:
+	case TTLS_TLS_EXT_SUPPORTED_VERSIONS:
+	case TTLS_TLS_EXT_STATUS_REQUEST:
 		return true;
 	default:
 		return false;
@@ -714,6 +805,17 @@ ttls_parse_extension(TlsCtx *tls, const unsigned char *buf, size_t ext_sz,
 		if ((r = ttls_parse_renegotiation_info_ext(tls, buf, ext_sz)))
 			return r;
 		break;
+	case TTLS_TLS_EXT_SUPPORTED_VERSIONS:
+		T_DBG("found supported versions extension\n");
+		r = ttls_parse_supported_versions_ext(tls, buf, ext_sz);
+		if (r)
+			return r;
+		break;
+	case TTLS_TLS_EXT_STATUS_REQUEST:
+		T_DBG("found status request extension\n");
+		if ((r = ttls_parse_status_request_ext(tls, buf, ext_sz)))
+			return r;
+		break;
 	default:
 		T_DBG("unknown extension found: %d (ignoring)\n",
 		      ext_type);
@@ -1153,6 +1255,19 @@ bad_version:
 	 * speaks to, we can try to restore session from session ticket.
 	 */
 	ttls_process_session_ticket(tls);
+	/*
+	 * No valid ticket, but the client offers a session ID of a full size,
+	 * i.e. one generated by us: look it up in the server session cache.
+	 * The callback restores the session with the client's session ID,
+	 * so it's echoed in ServerHello (RFC 5246 7.4.1.3). The abbreviated
+	 * handshake of the cached session doesn't issue a new ticket.
+	 */
+	if (!tls->hs->resume && tls->sess.id_len == TTLS_SESS_ID_LEN
+	    && ttls_sess_get_cb && ttls_sess_get_cb(tls))
+	{
+		tls->hs->resume = 1;
+		tls->hs->new_session_ticket = 0;
+	}
 
 	/* JA5t computation */
 	tls->sess.ja5t.is_abbreviated = tls->hs->resume;
@@ -1238,6 +1353,54 @@ ttls_write_session_ticket_ext(TlsCtx *tls, unsigned char *p, size_t *olen)
 	*olen = 4;
 }
 
+/**
+ * Return the OCSP response stapled to the chosen certificate, or NULL if
+ * there is no response or it has already expired.
+ */
+static const TlsOcspStaple *
+ttls_ocsp_staple(const TlsCtx *tls)
+{
+	const TlsKeyCert *key_cert = tls->hs->key_cert;
+	const TlsOcspStaple *st = key_cert ? key_cert->ocsp : NULL;
+
+	if (!st || (st->next_update && st->next_update <= (long)ttls_time()))
+		return NULL;
+
+	return st;
+}
+
+/**
+ * RFC 6066 8: the server sends empty status_request extension if it's going
+ * to send CertificateStatus message. Decide this now, so the message is sent
+ * even if the staple expires in the middle of the handshake.
+ */
+static void
+ttls_write_status_request_ext(TlsCtx *tls, unsigned char *p, size_t *olen)
+{
+	if (!tls->hs->ocsp || tls->hs->resume || !ttls_ocsp_staple(tls)) {
+		tls->hs->ocsp = 0;
+		*olen = 0;
+		return;
+	}
+
+	T_DBG("ServerHello: adding status request extension\n");
+
+	*(unsigned short *)p = htons(TTLS_TLS_EXT_STATUS_REQUEST);
+	p += 2;
+	*p++ = 0x00;
+	*p++ = 0x00;
+
+	*olen = 4;
+}
+
+static const unsigned char ttls_point_formats_ext[] = {
+	TTLS_TLS_EXT_SUPPORTED_POINT_FORMATS >> 8,
+	TTLS_TLS_EXT_SUPPORTED_POINT_FORMATS & 0xFF,
+	0x00, 2, /* extension length */
+	1, /* point formats list length */
+	TTLS_ECP_PF_UNCOMPRESSED
+};
+
 static void
 ttls_write_supported_point_formats_ext(TlsCtx *tls, unsigned char *p,
 				       size_t *olen)
@@ -1249,14 +1412,9 @@ ttls_write_supported_point_formats_ext(TlsCtx *tls, unsigned char *p,
 
 	T_DBG("ServerHello: supported_point_formats extension\n");
 
-	*(unsigned short *)p = htons(TTLS_TLS_EXT_SUPPORTED_POINT_FORMATS);
-	p += 2;
-	*p++ = 0x00;
-	*p++ = 2;
-	*p++ = 1;
-	*p++ = TTLS_ECP_PF_UNCOMPRESSED;
-
-	*olen = 6;
+	/* We support uncompressed points only, RFC 8422 5.1.2. */
+	memcpy_fast(p, ttls_point_formats_ext, sizeof(ttls_point_formats_ext));
+	*olen = sizeof(ttls_point_formats_ext);
 }
 
 static void
@@ -1269,24 +1427,21 @@ ttls_write_alpn_ext(TlsCtx *tls, unsigned char *p, size_t *olen)
 
 	T_DBG("ServerHello: adding alpn extension\n");
 
-	/*
-	 * 0 . 1	ext identifier
-	 * 2 . 3	ext length
-	 * 4 . 5	protocol list length
-	 * 6 . 6	protocol name length
-	 * 7 . 7+n	protocol name
-	 */
-	*(unsigned short *)p = htons(TTLS_TLS_EXT_ALPN);
-
-	*olen = 7 + tls->alpn_chosen->len;
+	/* Prepared by ttls_config_hs_prepare(). */
+	*olen = tls->alpn_chosen->ext_len;
+	memcpy_fast(p, tls->alpn_chosen->ext, *olen);
+}
 
-	p[2] = (unsigned char)(((*olen - 4) >> 8) & 0xFF);
-	p[3] = (unsigned char)((*olen - 4) & 0xFF);
-	p[4] = (unsigned char)(((*olen - 6) >> 8) & 0xFF);
-	p[5] = (unsigned char)((*olen - 6) & 0xFF);
-	p[6] = (unsigned char)((*olen - 7) & 0xFF);
+/**
+ * Generate the server random, RFC 5246 7.4.1.2.
+ */
+static void
+ttls_make_server_random(TlsCtx *tls)
+{
+	unsigned char *p = tls->hs->randbytes + 32;
 
-	memcpy_fast(p + 7, tls->alpn_chosen->name, *olen - 7);
+	*(unsigned int *)p = htonl(ttls_time());
+	ttls_rnd(p + 4, 28);
 }
 
 static int
@@ -1311,11 +1466,11 @@ ttls_write_server_hello(TlsCtx *tls, struct sg_table *sgt,
 	T_DBG("server hello, chosen version %d:%d, buf=%pK\n",
 	      buf[4], buf[5], buf);
 
-	*(unsigned int *)p = htonl(ttls_time());
-	p += 4;
-	ttls_rnd(p, 28);
-	p += 28;
-	memcpy_fast(tls->hs->randbytes + 32, buf + 6, 32);
+	/* A deferred handshake already signed the random with the key. */
+	if (!tls->hs->ske)
+		ttls_make_server_random(tls);
+	memcpy_fast(p, tls->hs->randbytes + 32, 32);
+	p += 32;
 	T_DBG3_BUF("server hello, random bytes ", buf + 6, 32);
 
 	if (!tls->hs->resume) {
@@ -1385,6 +1540,8 @@ ttls_write_server_hello(TlsCtx *tls, struct sg_table *sgt,
 	ext_len += olen;
 	ttls_write_session_ticket_ext(tls, p + 2 + ext_len, &olen);
 	ext_len += olen;
+	ttls_write_status_request_ext(tls, p + 2 + ext_len, &olen);
+	ext_len += olen;
 	ttls_write_supported_point_formats_ext(tls, p + 2 + ext_len, &olen);
 	ext_len += olen;
 	ttls_write_alpn_ext(tls, p + 2 + ext_len, &olen);
@@ -1417,19 +1574,23 @@ ttls_write_server_hello(TlsCtx *tls, struct sg_table *sgt,
  * exchange context. We use prepared MPI memory profiles to do only stream
  * copying instead of per-field initialization and later memory allocations
  * on crypto MPI operations.
+ *
+ * Make ServerKeyExchange at @hdr, after the space for the record header, and
+ * return the message body length in @msg_len. The function doesn't touch the
+ * output I/O context, so it can run out of @tls->lock for a deferred
+ * handshake, see ttls_handshake_server_prepare().
  */
 static int
-ttls_write_server_key_exchange(TlsCtx *tls, struct sg_table *sgt,
-			       unsigned char **in_buf)
+ttls_make_server_key_exchange(TlsCtx *tls, unsigned char *hdr,
+			      size_t *msg_len)
 {
 	int r, x_sz;
 	size_t len, n = 0, sig_len = 0;
 	ttls_pk_type_t sig_alg;
 	ttls_md_type_t md_alg;
 	const TlsCiphersuite *ci = tls->xfrm.ciphersuite_info;
-	TlsIOCtx *io = &tls->io_out;
 	TlsHandshake *hs = tls->hs;
-	unsigned char *dig_signed, *p, *hdr = *in_buf;
+	unsigned char *dig_signed, *p;
 	unsigned char hash[64];
 
 	/*
@@ -1490,7 +1651,7 @@ ttls_write_server_key_exchange(TlsCtx *tls, struct sg_table *sgt,
 		 *	opaque dh_Ys<1..2^16-1>;
 		 * } ServerDHParams;
 		 */
-		x_sz = (int)ttls_mpi_size(&hs->dhm_ctx->P);
+		x_sz = (int)hs->dhm_ctx->grp->len;
 		WARN_ON_ONCE(x_sz > PAGE_SIZE);
 		if ((r = ttls_dhm_make_params(hs->dhm_ctx, x_sz, p, &len))) {
 			TTLS_WARN(tls, "cannot make DHM params, %d\n", r);
@@ -1506,8 +1667,9 @@ ttls_write_server_key_exchange(TlsCtx *tls, struct sg_table *sgt,
 		p += len;
 		n += len;
 
-		T_DBG_MPI4("DHM key exchange", &hs->dhm_ctx->X, &hs->dhm_ctx->P,
-			   &hs->dhm_ctx->G, &hs->dhm_ctx->GX);
+		T_DBG_MPI4("DHM key exchange", &hs->dhm_ctx->X,
+			   hs->dhm_ctx->grp->P, hs->dhm_ctx->grp->G,
+			   &hs->dhm_ctx->GX);
 		break;
 	default:
 		BUG();
@@ -1540,8 +1702,7 @@ ttls_write_server_key_exchange(TlsCtx *tls, struct sg_table *sgt,
 	 * 3.2: Compute the hash to be signed.
 	 * Info from md_alg will be used instead.
 	 */
-	r = ttls_get_key_exchange_md_tls1_2(tls, hash, dig_signed, sig_len,
-					    md_alg);
+	r = ttls_key_exchange_md_tls1_2(tls, hash, dig_signed, sig_len, md_alg);
 	if (r)
 		return r;
 	T_DBG3_BUF("parameters hash", hash,
@@ -1580,19 +1741,39 @@ ttls_write_server_key_exchange(TlsCtx *tls, struct sg_table *sgt,
 	n += sig_len;
 	WARN_ON_ONCE(sig_len > 512);
 
-	/*
-	 * Done with actual work; add handshake header and add the record
-	 * (519 + 4 + 512).
-	 */
-	WARN_ON_ONCE(n > 1035);
-	io->msglen = TTLS_HS_HDR_LEN + n;
+	/* Done with actual work; add handshake header (519 + 4 + 512). */
+	WARN_ON_ONCE(n > TTLS_SKE_MAX_LEN);
 	ttls_write_hshdr(TTLS_HS_SERVER_KEY_EXCHANGE, hdr + TLS_HEADER_SIZE,
 			 TTLS_HS_HDR_LEN + n);
+	*msg_len = n;
+
+	return 0;
+}
 
-	*in_buf = hdr + TLS_HEADER_SIZE + TTLS_HS_HDR_LEN + n;
+static int
+ttls_write_server_key_exchange(TlsCtx *tls, struct sg_table *sgt,
+			       unsigned char **in_buf)
+{
+	int r;
+	size_t n;
+	TlsHandshake *hs = tls->hs;
+	unsigned char *hdr = *in_buf;
+
+	if (hs->ske) {
+		/* The message owns its page reference, pass it to @sgt. */
+		hdr = hs->ske;
+		n = hs->ske_len;
+		hs->ske = NULL;
+	} else {
+		if ((r = ttls_make_server_key_exchange(tls, hdr, &n)))
+			return r;
+		*in_buf = hdr + TLS_HEADER_SIZE + TTLS_HS_HDR_LEN + n;
+		get_page(virt_to_page(hdr));
+	}
+
+	tls->io_out.msglen = TTLS_HS_HDR_LEN + n;
 	sg_set_buf(&sgt->sgl[sgt->nents++], hdr,
 		   TLS_HEADER_SIZE + TTLS_HS_HDR_LEN + n);
-	get_page(virt_to_page(hdr));
 
 	return __ttls_add_record(tls, sgt, sgt->nents - 1, hdr);
 }
@@ -1736,6 +1917,65 @@ ttls_write_certificate_request(TlsCtx *tls, struct sg_table *sgt,
 	return __ttls_add_record(tls, sgt, sgt->nents - 1, buf);
 }
 
+/**
+ * Send the OCSP response stapled to our certificate (RFC 6066 8):
+ *
+ *	struct {
+ *		CertificateStatusType status_type;
+ *		select (status_type) {
+ *			case ocsp: OCSPResponse;
+ *		} response;
+ *	} CertificateStatus;
+ *
+ * The response pages are sent as is, like the certificate chain.
+ */
+static int
+ttls_write_certificate_status(TlsCtx *tls, struct sg_table *sgt,
+			      unsigned char **in_buf)
+{
+	int r, sg_i;
+	unsigned int off;
+	TlsIOCtx *io = &tls->io_out;
+	const TlsOcspStaple *st = tls->hs->key_cert->ocsp;
+	unsigned char *p = *in_buf;
+
+	T_DBG("sending CertificateStatus\n");
+
+	sg_i = sgt->nents++;
+	sg_set_buf(&sgt->sgl[sg_i], p, TLS_HEADER_SIZE + TTLS_HS_HDR_LEN + 4);
+	get_page(virt_to_page(p));
+
+	for (off = 0; off < st->len; off += PAGE_SIZE) {
+		unsigned char *frag_p = st->data + off;
+		size_t frag_sz = min_t(size_t, PAGE_SIZE, st->len - off);
+
+		if (unlikely(sgt->nents >= MAX_SKB_FRAGS)) {
+			T_WARN("Too large OCSP response\n");
+			return -ENOSPC;
+		}
+		get_page(virt_to_page(frag_p));
+		sg_set_buf(&sgt->sgl[sgt->nents++], frag_p, frag_sz);
+	}
+
+	/*
+	 *  0 . 4	record header (to be written in __ttls_add_record())
+	 *  5 . 8	handshake header
+	 *  9 . 9	status_type
+	 * 10 . 12	length of the OCSP response
+	 */
+	io->msglen = TTLS_HS_HDR_LEN + 4 + st->len;
+	ttls_write_hshdr(TTLS_HS_CERTIFICATE_STATUS, p + TLS_HEADER_SIZE,
+			 io->msglen);
+	p[9] = TTLS_CERT_STATUS_OCSP;
+	p[10] = (unsigned char)(st->len >> 16);
+	p[11] = (unsigned char)(st->len >> 8);
+	p[12] = (unsigned char)st->len;
+	r = __ttls_add_record(tls, sgt, sg_i, p);
+	*in_buf = p + TLS_HEADER_SIZE + TTLS_HS_HDR_LEN + 4;
+
+	return r;
+}
+
 static int
 ttls_write_server_hello_done(TlsCtx *tls, struct sg_table *sgt,
 			     unsigned char **in_buf)
@@ -2089,12 +2329,20 @@ ttls_handshake_server_hello(TlsCtx *tls, struct sg_table *sgt,
 		if ((r = ttls_write_certificate(tls, sgt, in_buf)))
 			T_FSM_EXIT();
 		CHECK_STATE(128);
+		/* RFC 6066 8: CertificateStatus follows Certificate. */
+		if (tls->hs->ocsp) {
+			r = ttls_write_certificate_status(tls, sgt, in_buf);
+			if (r)
+				T_FSM_EXIT();
+			CHECK_STATE(128);
+		}
 		T_FSM_JMP(TTLS_SERVER_KEY_EXCHANGE);
 	}
 	T_FSM_STATE(TTLS_SERVER_KEY_EXCHANGE) {
 		if ((r = ttls_write_server_key_exchange(tls, sgt, in_buf)))
 			T_FSM_EXIT();
-		CHECK_STATE(1044);
+		CHECK_STATE(TLS_HEADER_SIZE + TTLS_HS_HDR_LEN
+			    + TTLS_SKE_MAX_LEN);
 		/*
 		 * RFC 5246 Certificate Request is optional, so don't request
 		 * a certificate for now since we're unable to properly verify
@@ -2209,6 +2457,40 @@ ttls_handshake_send_out_buffers(TlsCtx *tls, struct sg_table *sgt,
 	return __ttls_send_record(tls, sgt);
 }
 
+/**
+ * Make the server random and ServerKeyExchange of a deferred handshake in a
+ * separate buffer, so ttls_handshake_server_step() only writes them into the
+ * server flight.
+ */
+int
+ttls_handshake_server_prepare(TlsCtx *tls)
+{
+	int r;
+	size_t n;
+	unsigned char *hdr;
+	TlsHandshake *hs = tls->hs;
+
+	if (WARN_ON_ONCE(hs->ske || tls->state != TTLS_SERVER_HELLO))
+		return -EINVAL;
+
+	hdr = pg_skb_alloc(TLS_HEADER_SIZE + TTLS_HS_HDR_LEN + TTLS_SKE_MAX_LEN,
+			   GFP_ATOMIC, NUMA_NO_NODE);
+	if (!hdr) {
+		TTLS_WARN(tls, "Not enough memory for ServerKeyExchange\n");
+		return -ENOMEM;
+	}
+
+	ttls_make_server_random(tls);
+	if ((r = ttls_make_server_key_exchange(tls, hdr, &n))) {
+		put_page(virt_to_page(hdr));
+		return r;
+	}
+	hs->ske = hdr;
+	hs->ske_len = n;
+
+	return 0;
+}
+
 /**
  * TLS handshake server side FSM, RFC 5246 chapter 7.
  */
@@ -2250,6 +2532,19 @@ ttls_handshake_server_step(TlsCtx *tls, unsigned char *buf, size_t len,
 			return T_BLOCK_WITH_RST;
 
 		tls->state = TTLS_SERVER_HELLO;
+		/*
+		 * The server flight of a full handshake requires
+		 * ServerKeyExchange signing and ephemeral key generation,
+		 * which are the most expensive handshake operations. Let the
+		 * network layer to move them out of softirq if it wishes,
+		 * ttls_handshake_resume() is called to continue the handshake.
+		 */
+		if (!tls->hs->resume && ttls_hs_defer_cb) {
+			tls->hs->deferred = 1;
+			if (ttls_hs_defer_cb(tls))
+				return T_OK;
+			tls->hs->deferred = 0;
+		}
 		fallthrough;
 	}
 	/*
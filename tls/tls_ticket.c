@@ -134,6 +134,7 @@ ttls_ticket_update_keys(TlsTicketPeerCfg *tcfg)
 {
 	unsigned long ts = ttls_ticket_get_time(tcfg->lifetime);
 	char digest[SHA256_DIGEST_SIZE];
+	TlsTicketKeys *keys = tcfg->keys;
 	int r;
 
 	/* Split key calculation from update to reduce lock time. */
@@ -147,18 +148,18 @@ ttls_ticket_update_keys(TlsTicketPeerCfg *tcfg)
 		ts = 0;
 	}
 
-	write_lock(&tcfg->key_lock);
-	if (likely(tcfg->keys[tcfg->active_key].ts < ts) || !ts) {
-		TlsTicketKey *old_key = &tcfg->keys[tcfg->active_key ^ 1];
+	write_lock(&keys->lock);
+	if (likely(keys->keys[keys->active].ts < ts) || !ts) {
+		TlsTicketKey *old_key = &keys->keys[keys->active ^ 1];
 
 		write_lock(&old_key->lock);
 		old_key->ts = ts;
 		memcpy_fast(old_key->key, digest, sizeof(old_key->key));
 		write_unlock(&old_key->lock);
 
-		tcfg->active_key ^= 1;
+		keys->active ^= 1;
 	}
-	write_unlock(&tcfg->key_lock);
+	write_unlock(&keys->lock);
 
 	bzero_fast(&digest, sizeof(digest));
 
@@ -202,57 +203,143 @@ ttls_ticket_rotate_keys(struct timer_list *t)
 static TlsTicketKey *
 ttls_tickets_key_current_locked(TlsTicketPeerCfg *tcfg)
 {
+	TlsTicketKeys *keys = tcfg->keys;
 	TlsTicketKey *key = NULL;
 
-	read_lock(&tcfg->key_lock);
+	read_lock(&keys->lock);
 
 	/*
 	 * If key rotation has failed, 'ts' member can be zero. Fail fast to
 	 * avoid decryption attempt with outdated keys.
 	 */
-	if (likely(tcfg->keys[tcfg->active_key].ts)) {
-		key = &tcfg->keys[tcfg->active_key];
+	if (likely(keys->keys[keys->active].ts)) {
+		key = &keys->keys[keys->active];
 		read_lock(&key->lock);
 	}
 
-	read_unlock(&tcfg->key_lock);
+	read_unlock(&keys->lock);
 
 	return key;
 }
 
 /**
  * Find key by name, used for decryption. Caller is responsible to unlock the key.
+ * Start from the active key as the most probable one.
  */
 static TlsTicketKey *
 ttls_tickets_key_search_locked(TlsTicketPeerCfg *tcfg, const char *key_name)
 {
+	TlsTicketKeys *keys = tcfg->keys;
 	TlsTicketKey *key = NULL;
-	int r;
-
-	read_lock(&tcfg->key_lock);
-
-	key = &tcfg->keys[tcfg->active_key];
-	read_lock(&key->lock);
-	r = memcmp_fast(key_name, key->name, TTLS_TICKET_KEY_NAME_LEN);
-	if (!r && key->ts)
-		goto found;
-	read_unlock(&key->lock);
+	int i, r;
 
-	key = &tcfg->keys[tcfg->active_key ^ 1];
-	read_lock(&key->lock);
-	r = memcmp_fast(key_name, key->name, TTLS_TICKET_KEY_NAME_LEN);
-	if (!r && key->ts)
-		goto found;
-	read_unlock(&key->lock);
+	read_lock(&keys->lock);
 
+	for (i = 0; i < keys->n; ++i) {
+		key = &keys->keys[(keys->active + i) % keys->n];
+		read_lock(&key->lock);
+		r = memcmp_fast(key_name, key->name, TTLS_TICKET_KEY_NAME_LEN);
+		if (!r && key->ts)
+			goto found;
+		read_unlock(&key->lock);
+	}
 	key = NULL;
 
 found:
-	read_unlock(&tcfg->key_lock);
+	read_unlock(&keys->lock);
 
 	return key;
 }
 
+static TlsTicketKeys *
+ttls_tickets_keys_alloc(unsigned int n)
+{
+	int i;
+	TlsTicketKeys *keys;
+
+	keys = kzalloc(sizeof(*keys) + sizeof(TlsTicketKey) * n, GFP_KERNEL);
+	if (!keys)
+		return NULL;
+
+	rwlock_init(&keys->lock);
+	refcount_set(&keys->refcnt, 1);
+	for (i = 0; i < n; ++i)
+		rwlock_init(&keys->keys[i].lock);
+
+	return keys;
+}
+
+/**
+ * Load ticket keys from a file written by an external key rotation service.
+ * The file is a sequence of TTLS_TICKET_FILE_KEY_LEN bytes records: a key
+ * name followed by the key. The first key is the current one and is used for
+ * encryption, the rest are the previous keys used for decryption only. Since
+ * the key names are from the file, all the Tempesta nodes loading the same
+ * file can resume sessions from tickets issued by each other.
+ *
+ * If @keys is NULL, then a new keys set is allocated, otherwise all the keys
+ * in @keys are replaced at once, so a ticket is never encrypted or decrypted
+ * with a mix of the old and new keys. Must be called in process context.
+ */
+TlsTicketKeys *
+ttls_tickets_keys_load(TlsTicketKeys *keys, const unsigned char *data,
+		       size_t len)
+{
+	int i, n = len / TTLS_TICKET_FILE_KEY_LEN;
+	unsigned long ts = ttls_time() ? : 1;
+	TlsTicketKey *key;
+
+	if (!n || n > TTLS_TICKET_KEYS_MAX || len % TTLS_TICKET_FILE_KEY_LEN) {
+		T_ERR_NL("TLS: ticket keys file must contain 1-%d keys of %d"
+			 " bytes, got %lu bytes\n", TTLS_TICKET_KEYS_MAX,
+			 TTLS_TICKET_FILE_KEY_LEN, len);
+		return ERR_PTR(-EINVAL);
+	}
+
+	if (!keys) {
+		if (!(keys = ttls_tickets_keys_alloc(TTLS_TICKET_KEYS_MAX)))
+			return ERR_PTR(-ENOMEM);
+	}
+
+	write_lock_bh(&keys->lock);
+	for (i = 0; i < TTLS_TICKET_KEYS_MAX; ++i) {
+		key = &keys->keys[i];
+		write_lock(&key->lock);
+		if (i < n) {
+			memcpy(key->name, data, TTLS_TICKET_KEY_NAME_LEN);
+			data += TTLS_TICKET_KEY_NAME_LEN;
+			memcpy(key->key, data, TTLS_TICKET_KEY_LEN);
+			data += TTLS_TICKET_KEY_LEN;
+			key->ts = ts;
+		} else {
+			ttls_bzero_safe(key->name, sizeof(key->name));
+			ttls_bzero_safe(key->key, sizeof(key->key));
+			key->ts = 0;
+		}
+		write_unlock(&key->lock);
+	}
+	keys->active = 0;
+	keys->n = n;
+	write_unlock_bh(&keys->lock);
+
+	return keys;
+}
+EXPORT_SYMBOL(ttls_tickets_keys_load);
+
+void
+ttls_tickets_keys_put(TlsTicketKeys *keys)
+{
+	int i;
+
+	if (!keys || !refcount_dec_and_test(&keys->refcnt))
+		return;
+
+	for (i = 0; i < keys->n; ++i)
+		ttls_bzero_safe(keys->keys[i].key, sizeof(keys->keys[i].key));
+	kfree(keys);
+}
+EXPORT_SYMBOL(ttls_tickets_keys_put);
+
 /**
  * Configure Session ticket configuration for selected peer (vhost).
  *
@@ -264,6 +351,8 @@ found:
  * @vhost_name		- vhost name or SNI name - string to generate unique
  *			  key name;
  * @vn_len		- vhost name length;
+ * @keys		- keys loaded from a file by ttls_tickets_keys_load() or
+ *			  NULL to generate the keys from the secret;
  *
  * If user didn't provided a secret key, a random key is generated, but in this
  * case it's not possible to restart the same session on a different Tempesta
@@ -272,7 +361,8 @@ found:
 int
 ttls_tickets_configure(TlsPeerCfg *cfg, unsigned long lifetime,
 		       const char *secret_str, size_t len,
-		       const char *vhost_name, size_t vn_len)
+		       const char *vhost_name, size_t vn_len,
+		       TlsTicketKeys *keys)
 {
 	TlsTicketPeerCfg *tcfg = &cfg->tickets;
 	int i, r;
@@ -282,9 +372,20 @@ ttls_tickets_configure(TlsPeerCfg *cfg, unsigned long lifetime,
 	TlsMdCtx md_ctx;
 	unsigned long secs;
 
-	tcfg->active_key = 0;
+	/* Don't leak the keys if the tickets are configured twice. */
+	ttls_tickets_clean(cfg);
 	tcfg->lifetime = lifetime ? : TTLS_DEFAULT_TICKET_LIFETIME;
-	rwlock_init(&tcfg->key_lock);
+
+	/* The keys are rotated by the service writing the keys file. */
+	if (keys) {
+		refcount_inc(&keys->refcnt);
+		tcfg->keys = keys;
+		return 0;
+	}
+
+	if (!(tcfg->keys = ttls_tickets_keys_alloc(2)))
+		return -ENOMEM;
+	tcfg->keys->n = 2;
 
 	ttls_md_init(&md_ctx);
 	if ((r = ttls_md_setup(&md_ctx, t_cfg.md_info, 1))) {
@@ -309,10 +410,9 @@ ttls_tickets_configure(TlsPeerCfg *cfg, unsigned long lifetime,
 
 	for (i = 0; i < 2; i++) {
 		unsigned char kn_hash[SHA256_DIGEST_SIZE];
-		TlsTicketKey *key = &tcfg->keys[i];
+		TlsTicketKey *key = &tcfg->keys->keys[i];
 		unsigned long ts;
 
-		rwlock_init(&key->lock);
 		/*
 		 * Make a unique name for the key: mix vhost_name and key number
 		 * and ticket_key_name_iv. We don't need any cryptography safe
@@ -370,7 +470,9 @@ ttls_tickets_clean(TlsPeerCfg *cfg)
 {
 	TlsTicketPeerCfg *tcfg = &cfg->tickets;
 
-	del_timer_sync(&tcfg->timer);
+	if (tcfg->timer.function)
+		del_timer_sync(&tcfg->timer);
+	ttls_tickets_keys_put(tcfg->keys);
 	/* Wipe the keys. */
 	memset(tcfg, 0, sizeof(TlsTicketPeerCfg));
 
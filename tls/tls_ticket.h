@@ -32,7 +32,8 @@ int ttls_ticket_parse(TlsCtx *ctx, unsigned char *buf, size_t len);
 
 int ttls_tickets_configure(TlsPeerCfg *cfg, unsigned long lifetime,
 			   const char *secret_str, size_t len,
-			   const char *vhost_name, size_t vn_len);
+			   const char *vhost_name, size_t vn_len,
+			   TlsTicketKeys *keys);
 int ttls_tickets_clean(TlsPeerCfg *cfg);
 int ttls_tickets_init(void);
 void ttls_tickets_exit(void);
@@ -69,6 +69,8 @@ extern ttls_hs_over_cb_t *ttls_hs_over_cb;
 extern ttls_cli_id_t *ttls_cli_id_cb;
 extern ttls_alpn_match_t *ttls_alpn_match_cb;
 extern ttls_ja5t_limit_conn_cb_t *ttls_ja5t_limit_conn_cb;
+extern ttls_hs_defer_cb_t *ttls_hs_defer_cb;
+extern ttls_sess_get_cb_t *ttls_sess_get_cb;
 
 static inline size_t
 ttls_max_ciphertext_len(const TlsXfrm *xfrm)
@@ -119,15 +121,21 @@ ttls_write_hshdr(unsigned char type, unsigned char *buf, unsigned short len)
 /**
  * Someway TLS AAD is `IV | tls_hdr`, so the function reorders IV and TLS
  * header in @buf, so it can be transmitted to network.
+ *
+ * Ciphers without explicit IV keep the sequence number in front of @buf,
+ * see ttls_aad_prefix_len(), so the header is already in place.
  */
 void
 ttls_aad2hdriv(TlsXfrm *xfrm, unsigned char *buf)
 {
 	unsigned short len, ivlen = ttls_expiv_len(xfrm);
-	long iv = *(long *)buf;
 
-	memmove(buf, buf + ivlen, TLS_HEADER_SIZE);
-	*(long *)(buf + TLS_HEADER_SIZE) = iv;
+	if (ivlen) {
+		long iv = *(long *)buf;
+
+		memmove(buf, buf + ivlen, TLS_HEADER_SIZE);
+		*(long *)(buf + TLS_HEADER_SIZE) = iv;
+	}
 
 	/*
 	 * The generated AAD contains length of the plaintext, so add IV and
@@ -143,32 +151,47 @@ ttls_aad2hdriv(TlsXfrm *xfrm, unsigned char *buf)
 }
 EXPORT_SYMBOL(ttls_aad2hdriv);
 
+/*
+ * Number of scatterlist segments reserved per CPU for a decryption request:
+ * AAD plus the record payload in two skbs with full set of fragments and the
+ * linear data, which covers almost all the real life records. The segments
+ * for longer skb chains are allocated on the heap.
+ */
+#define TTLS_DEC_SG_N		(1 + 2 * (MAX_SKB_FRAGS + 1))
+
+static DEFINE_PER_CPU(struct scatterlist [TTLS_DEC_SG_N], g_dec_sg)
+	____cacheline_aligned;
+
+static void
+ttls_crypto_sglist_free(struct scatterlist *sg)
+{
+	if (unlikely(sg != *this_cpu_ptr(&g_dec_sg)))
+		kfree(sg);
+}
+
 /**
- * Called to build crypto request with scatterlist acceptable by the crypto
- * layer from collected skbs when TLS sees the end of current message or
- * @buf of length @len if it's non-NULL.
+ * Called to build scatterlist acceptable by the crypto layer from collected
+ * skbs when TLS sees the end of current message or @buf of length @len if
+ * it's non-NULL. The scatterlist is taken from the per-cpu segments if it fits
+ * them, so there are no memory allocations on the fast path.
  *
  * @len - total length of the message data to be sent to crypto framework.
- * @sg	- pointer to allocated scatterlist;
  * @sgn - as ingress argument contains number of required additional segments
  *	  and returns number of chunks in the scatter list.
  */
-static struct aead_request *
-ttls_crypto_req_sglist(TlsCtx *tls, struct crypto_aead *tfm, unsigned int len,
-		       unsigned char *buf, struct scatterlist **sg,
-		       unsigned int *sgn)
+static struct scatterlist *
+ttls_crypto_sglist(TlsCtx *tls, unsigned int len, unsigned char *buf,
+		   unsigned int *sgn)
 {
 	TlsIOCtx *io = &tls->io_in;
-	struct scatterlist *sg_i;
-	struct aead_request *req;
+	struct scatterlist *sg, *sg_i;
 	struct sk_buff *skb = io->skb_list;
-	unsigned int sz, aead_sz, to_read, off;
+	unsigned int to_read, off;
 	int n;
 
 	WARN_ON_ONCE(len == 0); /* nothing to decrypt */
 	WARN_ON_ONCE(!buf && !skb);
 
-	sz = aead_sz = sizeof(*req) + crypto_aead_reqsize(tfm);
 	if (buf) {
 		off = 0;
 		n = *sgn + 1;
@@ -176,15 +199,16 @@ ttls_crypto_req_sglist(TlsCtx *tls, struct crypto_aead *tfm, unsigned int len,
 		off = ttls_payload_off(&tls->xfrm);
 		n = *sgn + io->chunks;
 	}
-	sz += n * sizeof(**sg);
 
-	/* Don't use g_req for better spacial locality. */
-	req = kmalloc(sz, GFP_ATOMIC);
-	if (!req)
-		return NULL;
-	*sg = (struct scatterlist *)((char *)req + aead_sz);
-	sg_init_table(*sg, n);
-	sg_i = *sg + *sgn;
+	if (likely(n <= TTLS_DEC_SG_N)) {
+		sg = *this_cpu_ptr(&g_dec_sg);
+	} else {
+		sg = kmalloc(n * sizeof(*sg), GFP_ATOMIC);
+		if (!sg)
+			return NULL;
+	}
+	sg_init_table(sg, n);
+	sg_i = sg + *sgn;
 
 	if (buf) {
 		sg_set_buf(sg_i++, buf, len);
@@ -207,21 +231,21 @@ ttls_crypto_req_sglist(TlsCtx *tls, struct crypto_aead *tfm, unsigned int len,
 			T_DBG3_SL("build req sglist", sg_i, n, 0, (size_t)len);
 			len -= to_read;
 			sg_i += n;
-			if (WARN_ON_ONCE(sg_i > *sg + *sgn + io->chunks))
+			if (WARN_ON_ONCE(sg_i > sg + *sgn + io->chunks))
 				goto err;
 			off = 0;
 		}
 	}
 
-	*sgn = sg_i - *sg;
-	sg_mark_end(*sg + *sgn - 1);
+	*sgn = sg_i - sg;
+	sg_mark_end(sg + *sgn - 1);
 
 	T_DBG3("%s: skb=%pK buf=%pK sg=%pK off=%u len=%u sgn=%u\n",
-	       __func__, skb, buf, *sg, off, len, *sgn);
+	       __func__, skb, buf, sg, off, len, *sgn);
 
-	return req;
+	return sg;
 err:
-	kfree(req);
+	ttls_crypto_sglist_free(sg);
 	return NULL;
 }
 
@@ -257,7 +281,9 @@ ttls_register_callbacks(ttls_send_cb_t *send_cb, ttls_sni_cb_t *sni_cb,
 			ttls_hs_over_cb_t *hs_over_cb, ttls_cli_id_t *cli_id_cb,
 			ttls_alpn_match_t *alpn_match_cb,
 			ttls_ja5t_limit_conn_cb_t *ja5t_limit_conn_cb,
-			ttls_ja5t_limit_rec_cb_t *ja5t_limit_rec_cb)
+			ttls_ja5t_limit_rec_cb_t *ja5t_limit_rec_cb,
+			ttls_hs_defer_cb_t *hs_defer_cb,
+			ttls_sess_get_cb_t *sess_get_cb)
 {
 	ttls_send_cb = send_cb;
 	ttls_sni_cb = sni_cb;
@@ -266,6 +292,8 @@ ttls_register_callbacks(ttls_send_cb_t *send_cb, ttls_sni_cb_t *sni_cb,
 	ttls_alpn_match_cb = alpn_match_cb;
 	ttls_ja5t_limit_conn_cb = ja5t_limit_conn_cb;
 	ttls_ja5t_limit_rec_cb = ja5t_limit_rec_cb;
+	ttls_hs_defer_cb = hs_defer_cb;
+	ttls_sess_get_cb = sess_get_cb;
 }
 EXPORT_SYMBOL(ttls_register_callbacks);
 
@@ -585,7 +613,6 @@ ttls_derive_keys(TlsCtx *tls)
 	unsigned char tmp[32];
 	unsigned char *key1, *key2, *mac_enc, *mac_dec;
 	const TlsCipherInfo *ci;
-	const TlsMdInfo *md_info;
 	size_t mac_key_len, iv_copy_len;
 	int r = 0;
 	TlsSess *sess = &tls->sess;
@@ -593,7 +620,6 @@ ttls_derive_keys(TlsCtx *tls)
 	TlsHandshake *hs = tls->hs;
 
 	ci = ttls_cipher_info_from_type(xfrm->ciphersuite_info->cipher);
-	md_info = ttls_md_info_from_type(xfrm->ciphersuite_info->mac);
 
 	/* Set appropriate PRF function and other TLS 1.2 functions. */
 	if (xfrm->ciphersuite_info->mac == TTLS_MD_SHA384) {
@@ -672,27 +698,18 @@ ttls_derive_keys(TlsCtx *tls)
 		/* Minimum length is expicit IV + tag */
 		xfrm->minlen = ttls_expiv_len(xfrm) + TTLS_TAG_LEN;
 	} else {
-		BUG_ON(ci->mode != TTLS_MODE_STREAM);
+		BUG_ON(ci->mode != TTLS_MODE_CHACHAPOLY);
 		/*
-		 * TODO #1031: Initialize HMAC contexts - do we need this for
-		 * CHACHA20_POLY1305?
+		 * RFC 7905 2: the 12-byte client_write_IV and server_write_IV
+		 * are the whole fixed part of the nonce, the sequence number
+		 * is XORed into it and there is no explicit IV on the wire.
 		 */
-		if ((r = ttls_md_setup(&xfrm->md_ctx_enc, md_info, 1))
-		    || (r = ttls_md_setup(&xfrm->md_ctx_dec, md_info, 1)))
-		{
-			return r;
-		}
-
-		/* Get MAC length */
-		mac_key_len = ttls_md_get_size(md_info);
-		xfrm->maclen = mac_key_len;
-
-		/* IV length */
+		xfrm->maclen = 0;
+		mac_key_len = 0;
 		xfrm->ivlen = ci->iv_size;
-		WARN_ON_ONCE(xfrm->ivlen > 16);
-
-		/* Minimum length */
-		xfrm->minlen = xfrm->maclen;
+		xfrm->fixed_ivlen = ci->iv_size;
+		xfrm->fixed_shift = 0;
+		xfrm->minlen = TTLS_TAG_LEN;
 	}
 	T_DBG("keylen=%u minlen=%u ivlen=%u maclen=%u mac_key_len=%lu\n",
 	      xfrm->keylen, xfrm->minlen, xfrm->ivlen, xfrm->maclen, mac_key_len);
@@ -782,8 +799,9 @@ ttls_make_aad(const TlsCtx *tls, TlsIOCtx *io, unsigned char *aad_buf)
 
 /**
  * Use per-cpu AEAD crypto requests in static memory instead of allocating them
- * each time from the heap. Tempesta TLS works in softirq context, so there are
- * no concurrent crypto requests on the same CPU and there is no preemption.
+ * each time from the heap. Tempesta TLS works in softirq context or, for
+ * deferred handshakes, with softirqs disabled, so there are no concurrent
+ * crypto requests on the same CPU and there is no preemption.
  * Fallabck to kmalloc() if we use not enough reserved memory in TlsReq and
  * print a warning to reserve bit more memory.
  */
@@ -792,7 +810,7 @@ ttls_aead_req_alloc(struct crypto_aead *tfm)
 {
 	size_t need = sizeof(struct aead_request) + crypto_aead_reqsize(tfm);
 
-	WARN_ON_ONCE(!in_serving_softirq());
+	WARN_ON_ONCE(!in_softirq());
 	if (WARN_ON_ONCE(ttls_aead_reqsize() < need))
 		return kzalloc(need, GFP_ATOMIC);
 
@@ -804,10 +822,35 @@ ttls_aead_req_free(struct crypto_aead *tfm, struct aead_request *req)
 {
 	size_t need = sizeof(struct aead_request) + crypto_aead_reqsize(tfm);
 
+	/*
+	 * The request context is sized for the heaviest cipher, so clear only
+	 * the part used by @tfm: it's much smaller for GCM and it's cleared on
+	 * each record.
+	 */
 	if (WARN_ON_ONCE(ttls_aead_reqsize() < need))
 		kfree(req);
 	else
-		bzero_fast(req, ttls_aead_reqsize());
+		bzero_fast(req, need);
+}
+
+/* AEAD nonce length for ciphersuites without explicit IV, RFC 7905 2. */
+#define TTLS_NONCE_LEN			12
+
+/**
+ * Build the per-record AEAD nonce for ciphersuites without explicit IV
+ * (RFC 7905 2): the 64-bit record sequence number in network byte order,
+ * left-padded to the IV length, XORed with the static IV.
+ */
+static inline void
+ttls_xor_nonce(const unsigned char *iv, u64 seq, unsigned char *nonce)
+{
+	__be64 s = cpu_to_be64(seq);
+	const unsigned char *sp = (const unsigned char *)&s;
+	int i, off = TTLS_NONCE_LEN - 8;
+
+	memcpy_fast(nonce, iv, off);
+	for (i = 0; i < 8; ++i)
+		nonce[off + i] = iv[off + i] ^ sp[i];
 }
 
 /**
@@ -831,6 +874,7 @@ ttls_encrypt(TlsCtx *tls, struct sg_table *sgt, struct sg_table *out_sgt)
 	TlsIOCtx *io = &tls->io_out;
 	TlsCipherCtx *c_ctx = &xfrm->cipher_ctx_enc;
 	unsigned long iv = __cpu_to_be64(io->ctr);
+	unsigned char nonce[TTLS_NONCE_LEN], *ivp = xfrm->iv_enc;
 	struct aead_request *req;
 
 	WARN_ON_ONCE(!ttls_xfrm_ready(tls));
@@ -843,14 +887,20 @@ ttls_encrypt(TlsCtx *tls, struct sg_table *sgt, struct sg_table *out_sgt)
 		return -ENOMEM;
 	}
 
-	*(long *)(xfrm->iv_enc + xfrm->fixed_shift + xfrm->fixed_ivlen) = iv;
-	T_DBG3_BUF("IV used", xfrm->iv_enc, xfrm->ivlen);
+	if (ttls_expiv_len(xfrm)) {
+		*(long *)(xfrm->iv_enc + xfrm->fixed_shift
+			  + xfrm->fixed_ivlen) = iv;
+	} else {
+		ttls_xor_nonce(xfrm->iv_enc, io->ctr, nonce);
+		ivp = nonce;
+	}
+	T_DBG3_BUF("IV used", ivp, xfrm->ivlen);
 
 	elen = ttls_msg2crypt_len(io, xfrm);
 	ttls_make_aad(tls, io, sg_virt(out_sgt->sgl));
 	aead_request_set_tfm(req, c_ctx->cipher_ctx);
 	aead_request_set_ad(req, TLS_AAD_SPACE_SIZE);
-	aead_request_set_crypt(req, sgt->sgl, out_sgt->sgl, elen, xfrm->iv_enc);
+	aead_request_set_crypt(req, sgt->sgl, out_sgt->sgl, elen, ivp);
 
 	T_DBG3("%s encryption: tfm=%pK(req->tfm=%pK req=%pK) reqsize=%u"
 		" key_len=%u data_len=%d\n",
@@ -892,6 +942,7 @@ __ttls_decrypt(TlsCtx *tls, unsigned char *buf)
 	struct aead_request *req;
 	struct scatterlist *sg = NULL;
 	unsigned char aad_buf[TLS_AAD_SPACE_SIZE];
+	unsigned char nonce[TTLS_NONCE_LEN], *ivp = xfrm->iv_dec;
 
 	if (unlikely(io->msglen < xfrm->minlen)) {
 		T_WARN("message lenght (%u) < min. ciphertext length (%u)\n",
@@ -902,7 +953,8 @@ __ttls_decrypt(TlsCtx *tls, unsigned char *buf)
 	expiv_len = ttls_expiv_len(xfrm);
 	mode = xfrm->cipher_ctx_enc.cipher_info->mode;
 
-	WARN_ON_ONCE(mode != TTLS_MODE_GCM && mode != TTLS_MODE_CCM);
+	WARN_ON_ONCE(mode != TTLS_MODE_GCM && mode != TTLS_MODE_CCM
+		     && mode != TTLS_MODE_CHACHAPOLY);
 	T_DBG2("decrypt input record from network: hdr=%pK msglen=%d chunks=%u"
 	       " eiv_len=%lu\n", io->hdr, io->msglen, io->chunks, expiv_len);
 	if (unlikely(io->msglen < expiv_len + TTLS_TAG_LEN)) {
@@ -913,20 +965,28 @@ __ttls_decrypt(TlsCtx *tls, unsigned char *buf)
 
 	dec_msglen = io->msglen - expiv_len - TTLS_TAG_LEN;
 
-	memcpy_fast(xfrm->iv_dec + xfrm->fixed_shift + xfrm->fixed_ivlen,
-		    io->iv, sizeof(io->iv));
-	req = ttls_crypto_req_sglist(tls, tfm, dec_msglen + TTLS_TAG_LEN, buf,
-				     &sg, &sgn);
-	if (!req)
+	if (expiv_len) {
+		memcpy_fast(xfrm->iv_dec + xfrm->fixed_shift
+			    + xfrm->fixed_ivlen, io->iv, sizeof(io->iv));
+	} else {
+		ttls_xor_nonce(xfrm->iv_dec, io->ctr, nonce);
+		ivp = nonce;
+	}
+	sg = ttls_crypto_sglist(tls, dec_msglen + TTLS_TAG_LEN, buf, &sgn);
+	if (!sg)
 		return TTLS_ERR_INTERNAL_ERROR;
 	if (WARN_ON_ONCE(sgn < 2)) {
 		r = TTLS_ERR_INTERNAL_ERROR;
 		goto out;
 	}
+	if (unlikely(!(req = ttls_aead_req_alloc(tfm)))) {
+		r = TTLS_ERR_INTERNAL_ERROR;
+		goto out;
+	}
 	ttls_make_aad(tls, io, aad_buf);
 	sg_set_buf(sg, aad_buf, TLS_AAD_SPACE_SIZE);
 
-	T_DBG3_BUF("IV used", xfrm->iv_dec, xfrm->ivlen);
+	T_DBG3_BUF("IV used", ivp, xfrm->ivlen);
 	T_DBG3_SL("decrypt: AAD|msg|TAG", sg, sgn, 0, TLS_AAD_SPACE_SIZE +
 		  dec_msglen + TTLS_TAG_LEN);
 
@@ -941,18 +1001,19 @@ __ttls_decrypt(TlsCtx *tls, unsigned char *buf)
 	aead_request_set_tfm(req, tfm);
 	aead_request_set_ad(req, TLS_AAD_SPACE_SIZE);
 	/* The crypto layer expects AAD segment in output scatter list. */
-	aead_request_set_crypt(req, sg, sg, dec_msglen + TTLS_TAG_LEN,
-			       xfrm->iv_dec);
+	aead_request_set_crypt(req, sg, sg, dec_msglen + TTLS_TAG_LEN, ivp);
 	r = crypto_aead_decrypt(req);
 
 	T_DBG3_SL("raw buffer after decryption", sg + 1, sgn - 1, 0,
 		  dec_msglen);
 
+	ttls_aead_req_free(tfm, req);
+
 	if (unlikely(++io->ctr > (~0UL >> 1)))
 		T_WARN("incoming message counter would wrap\n");
 
 out:
-	kfree(req);
+	ttls_crypto_sglist_free(sg);
 
 	return r;
 }
@@ -1323,7 +1384,9 @@ ttls_handshake_free(TlsHandshake *hs)
 		crypto_free_shash(hs->tmp_sha256.desc.tfm);
 
 	if (hs->crypto_ctx)
-		ttls_mpi_pool_free(hs->crypto_ctx);
+		ttls_mpi_profile_free(hs->crypto_ctx);
+	if (hs->ske)
+		put_page(virt_to_page(hs->ske));
 
 	bzero_fast(hs, sizeof(TlsHandshake));
 	kmem_cache_free(ttls_hs_cache, hs);
@@ -1401,7 +1464,7 @@ ttls_write_certificate(TlsCtx *tls, struct sg_table *sgt,
 		       unsigned char **in_buf)
 {
 	unsigned int i, sg_i;
-	size_t tot_len = 0;
+	const TlsKeyCert *key_cert;
 	const TlsX509Crt *crt;
 	TlsIOCtx *io = &tls->io_out;
 	unsigned char *p = *in_buf;
@@ -1420,10 +1483,11 @@ ttls_write_certificate(TlsCtx *tls, struct sg_table *sgt,
 	 * let the called to cleanup all the frags.
 	 */
 	sg_i = sgt->nents++;
-	sg_set_buf(&sgt->sgl[sg_i], p, TLS_HEADER_SIZE + 7);
+	sg_set_buf(&sgt->sgl[sg_i], p, TLS_HEADER_SIZE + TTLS_CRT_HDR_LEN);
 	get_page(virt_to_page(p));
 
-	if (tls->conf->endpoint == TTLS_IS_SERVER && !ttls_own_cert(tls)) {
+	key_cert = ttls_own_key_cert(tls);
+	if (tls->conf->endpoint == TTLS_IS_SERVER && !key_cert) {
 		TTLS_WARN(tls, "got no certificate to send\n");
 		return TTLS_ERR_CERTIFICATE_REQUIRED;
 	}
@@ -1437,39 +1501,29 @@ ttls_write_certificate(TlsCtx *tls, struct sg_table *sgt,
 	 *   n . n+2	length of cert. 2
 	 * n+3 . ...	upper level cert, etc.
 	 */
-	crt = ttls_own_cert(tls);
-	BUG_ON(crt->raw.tot_len > TLS_MAX_PAYLOAD_SIZE - 7);
-	for (i = 0; i < (crt->raw.tot_len + PAGE_SIZE - 1) / PAGE_SIZE; ++i) {
+	crt = key_cert->cert;
+	if (unlikely(sgt->nents + key_cert->nfrags > MAX_SKB_FRAGS)) {
+		T_WARN("Too many certfificates\n");
+		return -ENOSPC;
+	}
+	for (i = 0; i < key_cert->nfrags; ++i) {
 		void *frag_p = (char *)crt->raw.pages + i * PAGE_SIZE;
 		size_t frag_sz = min(PAGE_SIZE, crt->raw.tot_len - i * PAGE_SIZE);
 
-		if (unlikely(sgt->nents >= MAX_SKB_FRAGS)) {
-			T_WARN("Too many certfificates\n");
-			return -ENOSPC;
-		}
-
 		get_page(virt_to_page(frag_p));
 		sg_set_buf(&sgt->sgl[sgt->nents++], frag_p, frag_sz);
 		T_DBG3("add cert page %pK,len=%lu order=%u seg=%u\n",
 		       frag_p, frag_sz, crt->raw.order, sgt->nents - 1);
 	}
-	tot_len += crt->raw.tot_len;
 
 	/*
-	 * Write thr handshake headers on our own (TLS_HEADER_SIZE + 7 bytes).
-	 *
-	 *  0 . 4	record header (to be written in __ttls_add_record()
-	 *  5 . 5	handshake type (certificate)
-	 *  6 . 8	handshake length
-	 *  9 . 11	length of all certs
+	 * The handshake headers are prepared in ttls_conf_own_cert(), only
+	 * the record header is written in __ttls_add_record().
 	 */
-	io->msglen = tot_len + 7;
-	ttls_write_hshdr(TTLS_HS_CERTIFICATE, p + TLS_HEADER_SIZE, tot_len + 7);
-	p[9] = (unsigned char)(tot_len >> 16);
-	p[10] = (unsigned char)(tot_len >> 8);
-	p[11] = (unsigned char)tot_len;
+	io->msglen = crt->raw.tot_len + TTLS_CRT_HDR_LEN;
+	memcpy_fast(p + TLS_HEADER_SIZE, key_cert->hs_hdr, TTLS_CRT_HDR_LEN);
 	r = __ttls_add_record(tls, sgt, sg_i, p);
-	*in_buf = p + TLS_HEADER_SIZE + 7;
+	*in_buf = p + TLS_HEADER_SIZE + TTLS_CRT_HDR_LEN;
 
 	return r;
 }
@@ -1815,15 +1869,17 @@ ttls_write_finished(TlsCtx *tls, struct sg_table *sgt, unsigned char **in_buf)
 	int r;
 	TlsIOCtx *io = &tls->io_out;
 	TlsXfrm *xfrm = &tls->xfrm;
+	size_t aad_pre = ttls_aad_prefix_len(xfrm);
 	unsigned char *msg, *p = *in_buf;
-	struct scatterlist sg;
+	unsigned char aad[TLS_AAD_SPACE_SIZE];
+	struct scatterlist sg[2];
 	struct sg_table enc_sgt = {
-		.sgl	= &sg,
-		.nents	= 1,
+		.sgl	= sg,
+		.nents	= 1 + !!aad_pre,
 	};
 
 	io->ctr = 0;
-	io->msglen = TTLS_HS_FINISHED_BODY_LEN;
+	io->msglen = ttls_finished_body_len(xfrm);
 	io->msgtype = TTLS_MSG_HANDSHAKE;
 	msg = p + ttls_payload_off(xfrm);
 
@@ -1843,14 +1899,26 @@ ttls_write_finished(TlsCtx *tls, struct sg_table *sgt, unsigned char **in_buf)
 			return r;
 	}
 
-	sg_init_table(&sg, 1);
-	sg_set_buf(&sg, p, TLS_HEADER_SIZE + TTLS_HS_FINISHED_BODY_LEN);
+	sg_init_table(sg, enc_sgt.nents);
+	if (likely(!aad_pre)) {
+		sg_set_buf(sg, p, TLS_HEADER_SIZE + io->msglen);
+	} else {
+		/*
+		 * The record has no explicit IV to place AAD in, and the
+		 * previous message may lay just before @p, so use a separate
+		 * buffer for the AAD and copy the record header from it.
+		 */
+		sg_set_buf(&sg[0], aad, TLS_AAD_SPACE_SIZE);
+		sg_set_buf(&sg[1], msg, io->msglen);
+	}
 	if ((r = ttls_encrypt(tls, &enc_sgt, &enc_sgt)))
 		return r;
 
+	if (aad_pre)
+		memcpy_fast(p, aad + aad_pre, TLS_HEADER_SIZE);
 	ttls_aad2hdriv(xfrm, p);
 
-	*in_buf += TLS_HEADER_SIZE + TTLS_HS_FINISHED_BODY_LEN;
+	*in_buf += TLS_HEADER_SIZE + io->msglen;
 	sg_set_buf(&sgt->sgl[sgt->nents++], p, *in_buf - p);
 	get_page(virt_to_page(p));
 
@@ -1876,7 +1944,7 @@ ttls_parse_finished(TlsCtx *tls, unsigned char *buf, size_t len,
 		TTLS_WARN(tls, "TLS context isn't ready on Finished\n");
 		return TTLS_ERR_BAD_HS_FINISHED;
 	}
-	if (unlikely(io->msglen != TTLS_HS_FINISHED_BODY_LEN)) {
+	if (unlikely(io->msglen != ttls_finished_body_len(xfrm))) {
 		TTLS_WARN(tls, "wrong ClientFinished message length: %u\n",
 			  io->msglen);
 		return TTLS_ERR_BAD_HS_FINISHED;
@@ -2006,6 +2074,7 @@ int
 ttls_conf_own_cert(TlsPeerCfg *conf, TlsX509Crt *own_cert, TlsPkCtx *pk_key,
 		   TlsX509Crt *ca_chain, ttls_x509_crl *ca_crl)
 {
+	unsigned int tot_len;
 	TlsKeyCert *new;
 
 	if (!(new = kmalloc(sizeof(TlsKeyCert), GFP_KERNEL)))
@@ -2015,8 +2084,32 @@ ttls_conf_own_cert(TlsPeerCfg *conf, TlsX509Crt *own_cert, TlsPkCtx *pk_key,
 	new->key = pk_key;
 	new->ca_chain = ca_chain;
 	new->ca_crl = ca_crl;
+	new->ocsp = NULL;
 	new->next = NULL;
 
+	/*
+	 * The certificate chain is serialized into pages by the x509 parser,
+	 * so the Certificate message differs only by the record header.
+	 * Prepare the rest of the message header once, see
+	 * ttls_write_certificate().
+	 *
+	 *  0 . 0	handshake type (certificate)
+	 *  1 . 3	handshake length
+	 *  4 . 6	length of all certs
+	 */
+	tot_len = own_cert->raw.tot_len;
+	if (tot_len > TLS_MAX_PAYLOAD_SIZE - TTLS_CRT_HDR_LEN) {
+		T_ERR("too long certificate chain, %u bytes\n", tot_len);
+		kfree(new);
+		return -EINVAL;
+	}
+	new->nfrags = DIV_ROUND_UP(tot_len, PAGE_SIZE);
+	ttls_write_hshdr(TTLS_HS_CERTIFICATE, new->hs_hdr,
+			 tot_len + TTLS_CRT_HDR_LEN);
+	new->hs_hdr[4] = (unsigned char)(tot_len >> 16);
+	new->hs_hdr[5] = (unsigned char)(tot_len >> 8);
+	new->hs_hdr[6] = (unsigned char)tot_len;
+
 	/* Update conf->key_cert if the list was NULL, else add to the end. */
 	if (!conf->key_cert) {
 		conf->key_cert = new;
@@ -2038,7 +2131,7 @@ EXPORT_SYMBOL(ttls_conf_own_cert);
 int
 ttls_conf_tickets(TlsPeerCfg *conf, bool enable, unsigned long lifetime,
 		  const char *secret_str, size_t len,
-		  const char *vhost_name, size_t vn_len)
+		  const char *vhost_name, size_t vn_len, TlsTicketKeys *keys)
 {
 	if (!conf->endpoint)
 		return -EINVAL;
@@ -2049,7 +2142,7 @@ ttls_conf_tickets(TlsPeerCfg *conf, bool enable, unsigned long lifetime,
 		return 0;
 
 	return ttls_tickets_configure(conf, lifetime, secret_str, len,
-				      vhost_name, vn_len);
+				      vhost_name, vn_len, keys);
 }
 EXPORT_SYMBOL(ttls_conf_tickets);
 
@@ -2200,6 +2293,65 @@ ttls_handshake_step(TlsCtx *tls, unsigned char *buf, size_t len, size_t hh_len,
 	return ttls_handshake_server_step(tls, buf, len, hh_len, read);
 }
 
+/**
+ * Do the public key computations of a handshake deferred by @ttls_hs_defer_cb
+ * on ClientHello, i.e. generate the ephemeral key and sign it, for the server
+ * flight written by ttls_handshake_resume().
+ *
+ * The function doesn't write to the connection, so it's called without
+ * @tls->lock and with softirqs enabled, but with preemption disabled on the
+ * CPU the handshake was deferred on, e.g. in kernel_fpu_begin_task() section.
+ * The computations use the process context instances of the per-CPU MPI pool
+ * and RSA blinding values, see ttls_cpu_ctx(), so softirqs of the CPU don't
+ * interfere with them. A message received for the handshake meantime aborts
+ * it, see ttls_recv(), so nothing else changes the handshake.
+ */
+int
+ttls_handshake_prepare(TlsCtx *tls)
+{
+	int r;
+
+	if (!tls->hs || !tls->hs->deferred)
+		return 0;
+
+	r = ttls_handshake_server_prepare(tls);
+
+	/* Cleanup security sensitive temporary data. */
+	ttls_mpi_pool_cleanup_ctx(0, true);
+
+	return r;
+}
+EXPORT_SYMBOL(ttls_handshake_prepare);
+
+/**
+ * Continue a handshake deferred by @ttls_hs_defer_cb on ClientHello, i.e.
+ * write and send the server flight. Must be called under @tls->lock with
+ * softirqs and preemption disabled. If ttls_handshake_prepare() was called
+ * before, then the public key computations are already done and the flight
+ * is just written.
+ *
+ * The handshake can be already aborted, e.g. by an unexpected message, in
+ * which case there is nothing to do.
+ */
+int
+ttls_handshake_resume(TlsCtx *tls)
+{
+	int r;
+
+	if (!tls->hs || !tls->hs->deferred)
+		return 0;
+	tls->hs->deferred = 0;
+	WARN_ON_ONCE(tls->state != TTLS_SERVER_HELLO);
+
+	r = ttls_handshake_step(tls, NULL, 0, 0, NULL);
+
+	/* Cleanup security sensitive temporary data. */
+	ttls_mpi_pool_cleanup_ctx(0, true);
+
+	return r;
+}
+EXPORT_SYMBOL(ttls_handshake_resume);
+
 /**
  * Main TLS receive routine.
  *
@@ -2287,6 +2439,20 @@ ttls_recv(void *tls_data, unsigned char *buf, unsigned int len, unsigned int *re
 					TTLS_F_ST_CLOSE);
 			return T_BAD;
 		}
+		/*
+		 * The client must wait for ServerHelloDone before it sends
+		 * anything else, so it's a protocol violation to see a
+		 * handshake message while the server flight is deferred.
+		 */
+		if (unlikely(tls->hs->deferred)) {
+			TTLS_WARN(tls, "unexpected message during deferred"
+				  " handshake, sending alert\n");
+			tls->hs->deferred = 0;
+			ttls_send_alert(tls, TTLS_ALERT_LEVEL_FATAL,
+					TTLS_ALERT_MSG_UNEXPECTED_MESSAGE,
+					TTLS_F_ST_CLOSE);
+			return T_BAD;
+		}
 
 		/*
 		 * We add ingress messages to the handshake session checksum
@@ -2387,6 +2553,7 @@ ttls_key_cert_free(TlsKeyCert *key_cert)
 
 	while (cur) {
 		next = cur->next;
+		ttls_ocsp_staple_free(cur->ocsp);
 		kfree(cur);
 		cur = next;
 	}
@@ -2422,6 +2589,14 @@ static int ttls_default_ciphersuites[] = {
 	TTLS_TLS_DHE_RSA_WITH_AES_128_GCM_SHA256,
 	TTLS_TLS_DHE_RSA_WITH_AES_128_CCM,
 
+	/*
+	 * ChaCha20-Poly1305 ephemeral suites, preferred over AES if a client
+	 * lists them first, see ttls_choose_ciphersuite().
+	 */
+	TTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+	TTLS_TLS_ECDHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+	TTLS_TLS_DHE_RSA_WITH_CHACHA20_POLY1305_SHA256,
+
 	/* All AES-256 ephemeral suites */
 	TTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
 	TTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
@@ -2475,6 +2650,45 @@ ttls_config_peer_defaults(TlsPeerCfg *conf, int endpoint)
 }
 EXPORT_SYMBOL(ttls_config_peer_defaults);
 
+/**
+ * Pre-serialize the static parts of the server handshake messages, which
+ * depend on the global configuration only, so full handshakes just copy them.
+ * Must be called in process context after all the ALPN protocols are set.
+ */
+int
+ttls_config_hs_prepare(TlsCfg *conf)
+{
+	int i;
+
+	for (i = 0; i < TTLS_ALPN_PROTOS; ++i) {
+		ttls_alpn_proto *proto = &conf->alpn_list[i];
+		unsigned char *p = proto->ext;
+
+		proto->ext_len = 0;
+		if (!proto->name)
+			continue;
+		if (WARN_ON_ONCE(proto->len + 7 > TTLS_ALPN_EXT_MAX))
+			return -EINVAL;
+
+		/*
+		 * 0 . 1	ext identifier
+		 * 2 . 3	ext length
+		 * 4 . 5	protocol list length
+		 * 6 . 6	protocol name length
+		 * 7 . 7+n	protocol name
+		 */
+		*(unsigned short *)p = htons(TTLS_TLS_EXT_ALPN);
+		*(unsigned short *)(p + 2) = htons(proto->len + 3);
+		*(unsigned short *)(p + 4) = htons(proto->len + 1);
+		p[6] = (unsigned char)proto->len;
+		memcpy(p + 7, proto->name, proto->len);
+		proto->ext_len = proto->len + 7;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL(ttls_config_hs_prepare);
+
 void
 ttls_config_free(TlsCfg *conf)
 {
@@ -2794,10 +3008,14 @@ ttls_set_calc_verify_md(TlsCtx *tls, int md)
 	return 0;
 }
 
+/**
+ * Compute the hash of the key exchange parameters to be signed. Doesn't send
+ * an alert on failure, so it can be called out of @tls->lock.
+ */
 int
-ttls_get_key_exchange_md_tls1_2(TlsCtx *tls, unsigned char *output,
-				unsigned char *data, size_t data_len,
-				ttls_md_type_t md_alg)
+ttls_key_exchange_md_tls1_2(TlsCtx *tls, unsigned char *output,
+			    unsigned char *data, size_t data_len,
+			    ttls_md_type_t md_alg)
 {
 	int r = 0;
 	TlsMdCtx ctx;
@@ -2825,6 +3043,17 @@ ttls_get_key_exchange_md_tls1_2(TlsCtx *tls, unsigned char *output,
 
 exit:
 	ttls_md_free(&ctx);
+
+	return r;
+}
+
+int
+ttls_get_key_exchange_md_tls1_2(TlsCtx *tls, unsigned char *output,
+				unsigned char *data, size_t data_len,
+				ttls_md_type_t md_alg)
+{
+	int r = ttls_key_exchange_md_tls1_2(tls, output, data, data_len,
+					    md_alg);
 	if (r)
 		ttls_send_alert(tls, TTLS_ALERT_LEVEL_FATAL,
 				TTLS_ALERT_MSG_INTERNAL_ERROR,
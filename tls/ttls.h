@@ -208,6 +208,7 @@
 #define TTLS_HS_CERTIFICATE_VERIFY		15
 #define TTLS_HS_CLIENT_KEY_EXCHANGE		16
 #define TTLS_HS_FINISHED			20
+#define TTLS_HS_CERTIFICATE_STATUS		22
 #define TTLS_HS_INVALID				0xff
 
 /*
@@ -218,12 +219,16 @@
 #define TTLS_TLS_EXT_SERVERNAME_HOSTNAME	0
 #define TTLS_TLS_EXT_MAX_FRAGMENT_LENGTH	1
 #define TTLS_TLS_EXT_TRUNCATED_HMAC		4
+#define TTLS_TLS_EXT_STATUS_REQUEST		5
+/* CertificateStatusType for status_request extension, RFC 6066 8. */
+#define TTLS_CERT_STATUS_OCSP			1
 #define TTLS_TLS_EXT_SUPPORTED_ELLIPTIC_CURVES	10
 #define TTLS_TLS_EXT_SUPPORTED_POINT_FORMATS	11
 #define TTLS_TLS_EXT_SIG_ALG			13
 #define TTLS_TLS_EXT_ALPN			16
 #define TTLS_TLS_EXT_EXTENDED_MASTER_SECRET	23
 #define TTLS_TLS_EXT_SESSION_TICKET		35
+#define TTLS_TLS_EXT_SUPPORTED_VERSIONS		43
 #define TTLS_TLS_EXT_RENEGOTIATION_INFO		0xFF01
 
 /*
@@ -257,17 +262,28 @@ typedef enum {
 /* Defined below */
 typedef struct ttls_alpn_proto ttls_alpn_proto;
 
+/*
+ * ServerHello ALPN extension: 7 bytes of the extension and the protocol list
+ * headers and the protocol name. Large enough for all the protocols we speak.
+ */
+#define TTLS_ALPN_EXT_MAX	32
+
 /*
  * ALPN protocol descriptor.
  *
  * @name		- protocol name;
  * @len			- length of @name string;
  * @id			- protocol's internal number;
+ * @ext_len		- length of @ext;
+ * @ext			- pre-serialized ServerHello extension selecting
+ *			  the protocol, see ttls_config_hs_prepare();
  */
 struct ttls_alpn_proto {
 	const char	*name;
 	unsigned int	len;
 	int		id;
+	unsigned int	ext_len;
+	unsigned char	ext[TTLS_ALPN_EXT_MAX];
 };
 
 #define TTLS_SESS_ID_LEN	32
@@ -331,6 +347,26 @@ typedef struct {
 	unsigned char			iv_dec[16];
 } TlsXfrm;
 
+/**
+ * OCSP response stapled to a certificate (RFC 6066 8).
+ *
+ * @data		- DER encoded OCSPResponse, placed in contiguous pages
+ *			  to be sent without copying like certificates;
+ * @len			- length of @data;
+ * @order		- pages order of @data;
+ * @next_update		- the response expiration time, seconds since the Epoch,
+ *			  or zero if the responder didn't set it;
+ */
+typedef struct {
+	unsigned char			*data;
+	unsigned int			len;
+	unsigned int			order;
+	long				next_update;
+} TlsOcspStaple;
+
+/* Handshake header and the certificate list length of Certificate message. */
+#define TTLS_CRT_HDR_LEN		7
+
 /**
  * List of certificate + private key pairs
  *
@@ -338,19 +374,31 @@ typedef struct {
  * @key			- private key for the certificate;
  * @ca_chain		- trusted CA chain for the issues certificate;
  * @ca_crl		- trusted CAs CRLs;
+ * @ocsp		- OCSP response stapled to @cert, if any;
  * @next		- next certificate in list;
+ * @nfrags		- number of pages occupied by the raw @cert chain;
+ * @hs_hdr		- pre-serialized Certificate message header: handshake
+ *			  type and length, and length of the certificate list;
  */
 typedef struct ttls_key_cert {
 	TlsX509Crt			*cert;
 	TlsPkCtx			*key;
 	TlsX509Crt			*ca_chain;
 	ttls_x509_crl			*ca_crl;
+	TlsOcspStaple			*ocsp;
 	struct ttls_key_cert		*next;
+	unsigned int			nfrags;
+	unsigned char			hs_hdr[TTLS_CRT_HDR_LEN];
 } TlsKeyCert;
 
 #define TTLS_TICKET_KEY_LEN		16 /* 128 bits */
 #define TTLS_TICKET_KEY_NAME_LEN	16
 #define TTLS_TICKET_MAX_SZ		512
+/* Current key and up to 7 previous keys loaded from a file. */
+#define TTLS_TICKET_KEYS_MAX		8
+/* A key in a ticket keys file: the key name followed by the key. */
+#define TTLS_TICKET_FILE_KEY_LEN	(TTLS_TICKET_KEY_NAME_LEN	\
+					 + TTLS_TICKET_KEY_LEN)
 
 /**
  * Ticket key - single key used to protect TLS session tickets.
@@ -370,28 +418,46 @@ typedef struct {
 	rwlock_t		lock;
 } TlsTicketKey;
 
+/**
+ * Set of ticket keys.
+ *
+ * @lock		- Lock for key use/update operations;
+ * @refcnt		- Keys loaded from a file are shared by all the peers
+ *			  configured with the file;
+ * @active		- Currently active key, used for encryption;
+ * @n			- Number of keys in the set, all of them are used for
+ *			  decryption;
+ * @keys		- Active and outdated keys.
+ */
+typedef struct {
+	rwlock_t		lock;
+	refcount_t		refcnt;
+	unsigned char		active;
+	unsigned char		n;
+	TlsTicketKey		keys[0];
+} TlsTicketKeys;
+
 /**
  * Peer session ticket configuration: set of active and outdated keys and
  * necessary information for secure key rotation.
  *
  * @keys		- Active and outdated keys;
- * @active_key		- Currently active key;
- * @key_lock		- Lock for key use/update operations;
  * @lifetime		- Session ticket (and keys) lifetime;
  * @secret		- User-defined secret for secure key rotation, stored
  *			  as hmac to provide better entropy and fixed size;
- * @timer		- key update timer.
+ * @timer		- key update timer, not used for keys from a file.
  *
  * Since multiple Tempesta nodes can use the same configuration and share
  * Tickets between the nodes, all keys must be updated at any time, lazy key
  * renewal during handshake processing sounds good, but it prevent to load
  * tickets generated by foreign node while local keys wasn't updated for a long
  * time.
+ *
+ * Alternatively, the keys can be distributed among the nodes by an external
+ * key rotation service, see ttls_tickets_keys_load().
  */
 typedef struct {
-	TlsTicketKey		keys[2];
-	unsigned char		active_key;
-	rwlock_t		key_lock;
+	TlsTicketKeys		*keys;
 	unsigned long		lifetime;
 	unsigned char		secret[TTLS_TICKET_KEY_LEN];
 	struct timer_list	timer;
@@ -570,6 +636,20 @@ typedef struct ttls_context {
 	void			*vhost;
 } TlsCtx;
 
+/**
+ * Memory used by the handshakes crypto contexts.
+ *
+ * @hs_ctx	- number of currently allocated handshake crypto contexts;
+ * @hs_mem	- memory allocated for the contexts, bytes;
+ * @hs_profile	- the largest MPI profile, i.e. the amount of data copied into
+ *		  a new handshake crypto context, bytes.
+ */
+typedef struct {
+	unsigned long		hs_ctx;
+	unsigned long		hs_mem;
+	unsigned long		hs_profile;
+} TlsMpoolStat;
+
 typedef int ttls_send_cb_t(TlsCtx *tls, struct sg_table *sgt);
 typedef int ttls_sni_cb_t(TlsCtx *tls, const unsigned char *data, size_t len);
 typedef unsigned long ttls_cli_id_t(TlsCtx *tls, unsigned long hash);
@@ -583,6 +663,8 @@ enum {
 	TTLS_HS_CB_INCOMPLETE,
 };
 typedef int ttls_hs_over_cb_t(TlsCtx *tls, int state);
+typedef bool ttls_hs_defer_cb_t(TlsCtx *tls);
+typedef bool ttls_sess_get_cb_t(TlsCtx *tls);
 
 bool ttls_hs_done(TlsCtx *tls);
 bool ttls_xfrm_ready(TlsCtx *tls);
@@ -595,7 +677,11 @@ void ttls_register_callbacks(ttls_send_cb_t *send_cb, ttls_sni_cb_t *sni_cb,
 			     ttls_cli_id_t *cli_id_cb,
 			     ttls_alpn_match_t *alpn_match_cb,
 			     ttls_ja5t_limit_conn_cb_t *ja5t_limit_conn_cb,
-			     ttls_ja5t_limit_rec_cb_t *ja5t_limit_rec_cb);
+			     ttls_ja5t_limit_rec_cb_t *ja5t_limit_rec_cb,
+			     ttls_hs_defer_cb_t *hs_defer_cb,
+			     ttls_sess_get_cb_t *sess_get_cb);
+int ttls_handshake_prepare(TlsCtx *tls);
+int ttls_handshake_resume(TlsCtx *tls);
 
 const char *ttls_get_ciphersuite_name(const int ciphersuite_id);
 
@@ -610,7 +696,11 @@ int ttls_conf_own_cert(TlsPeerCfg *conf, TlsX509Crt *own_cert,
 		       ttls_x509_crl *ca_crl);
 int ttls_conf_tickets(TlsPeerCfg *conf, bool enable, unsigned long lifetime,
 		      const char *secret_str, size_t len,
-		      const char *vhost_name, size_t vn_len);
+		      const char *vhost_name, size_t vn_len,
+		      TlsTicketKeys *keys);
+TlsTicketKeys *ttls_tickets_keys_load(TlsTicketKeys *keys,
+				      const unsigned char *data, size_t len);
+void ttls_tickets_keys_put(TlsTicketKeys *keys);
 
 int ttls_set_hostname(TlsCtx *ssl, const char *hostname);
 void ttls_set_hs_authmode(TlsCtx *ssl, int authmode);
@@ -629,25 +719,45 @@ int ttls_close_notify(TlsCtx *tls, int close_type);
 
 void ttls_ctx_clear(TlsCtx *tls);
 void ttls_key_cert_free(TlsKeyCert *key_cert);
+int ttls_key_cert_ocsp_load(TlsKeyCert *key_cert, const unsigned char *buf,
+			    size_t len);
 
 void ttls_config_init(TlsCfg *conf);
 int ttls_config_defaults(TlsCfg *conf, int endpoint);
 int ttls_config_peer_defaults(TlsPeerCfg *conf, int endpoint);
+int ttls_config_hs_prepare(TlsCfg *conf);
 void ttls_config_free(TlsCfg *conf);
 void ttls_config_peer_free(TlsPeerCfg *conf);
 
 void ttls_aad2hdriv(TlsXfrm *xfrm, unsigned char *buf);
+void ttls_mpool_stat(TlsMpoolStat *stat);
 
 bool ttls_alpn_ext_eq(const ttls_alpn_proto *proto, const unsigned char *buf,
 		      size_t len);
 
+/**
+ * AES-GCM and AES-CCM records carry 8-byte explicit IV, while ChaCha20-Poly1305
+ * records have no explicit IV at all (RFC 7905).
+ */
 static inline size_t
 ttls_expiv_len(const TlsXfrm *xfrm)
 {
-	BUG_ON(xfrm->ivlen - xfrm->fixed_ivlen != TTLS_IV_LEN);
+	BUG_ON(xfrm->ivlen - xfrm->fixed_ivlen != TTLS_IV_LEN
+	       && xfrm->ivlen != xfrm->fixed_ivlen);
 	return xfrm->ivlen - xfrm->fixed_ivlen;
 }
 
+/**
+ * AEAD additional data is 13 bytes, `seq_num | tls_hdr`, so the AAD space
+ * begins before the record header if there is no explicit IV to reuse it for
+ * the sequence number. The caller of ttls_encrypt() must provide the space.
+ */
+static inline size_t
+ttls_aad_prefix_len(const TlsXfrm *xfrm)
+{
+	return TTLS_IV_LEN - ttls_expiv_len(xfrm);
+}
+
 static inline size_t
 ttls_payload_off(const TlsXfrm *xfrm)
 {
@@ -705,6 +815,8 @@ hstype_to_str(unsigned char hstype) {
 		return "Client Key Exchange";
 	case TTLS_HS_FINISHED:
 		return "Finished";
+	case TTLS_HS_CERTIFICATE_STATUS:
+		return "Certificate Status";
 	case TTLS_HS_INVALID:
 		return "Invalid";
 	default: